@@ -0,0 +1,464 @@
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#endif
+#include "Scene.h"
+#include "Loader.h"
+#include "GLTFLoader.h"
+#include "Profiler.h"
+#include "TaskSystem.h"
+#include "SceneGenerator.h"
+#include "SimdBench.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+using namespace PathTracer;
+
+// Times loading and ProcessScene() of synthetic and given scenes without a window or GL context and writes the results
+// as JSON, so runs of different commits can be compared. Stages are the CPU sections of the profiler. The SIMD math
+// the BVH builds rely on is checked against the scalar code and timed as well
+struct BenchOptions
+{
+    std::string outputPath = "bench.json";
+    std::string dataDir = "bench_data";
+    std::vector<std::string> scenePaths;
+    int repetitions = 3;
+    int threads = 0;
+    float scale = 1.0f;
+    bool synthetic = true;
+    bool simd = true;
+};
+
+struct BenchScene
+{
+    std::string name;
+    std::string path;
+};
+
+struct SceneResult
+{
+    BenchScene scene;
+    int meshes = 0;
+    int instances = 0;
+    int triangles = 0;
+    int lights = 0;
+    int textures = 0;
+    int bvhNodes = 0;
+    double baseMemoryMB = 0.0;
+    double peakMemoryMB = 0.0;
+    std::map<std::string, std::vector<double>> timings;
+};
+
+// Stages in the order they run. Load Scene and Process Scene are the totals, the others are profiler sections
+static const char* stageNames[] = {
+    "Load Scene", "Load Meshes", "Load GLTF",
+    "Process Scene", "Build BLAS", "Build TLAS", "Flatten BVH", "Light Distribution", "Copy Scene Data", "Resize Textures"
+};
+
+// Resident memory of the process in MB. The peak can only be reset on Linux, elsewhere it covers the whole run
+#ifdef _WIN32
+double CurrentMemoryMB()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / (1024.0 * 1024.0);
+}
+
+double PeakMemoryMB()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+}
+
+void ResetPeakMemory()
+{
+}
+#else
+double ReadStatusMB(const char* key)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0.0;
+
+    char line[256];
+    double kb = 0.0;
+    size_t keyLength = strlen(key);
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, key, keyLength) == 0)
+        {
+            kb = atof(line + keyLength);
+            break;
+        }
+    }
+    fclose(file);
+    return kb / 1024.0;
+}
+
+double CurrentMemoryMB()
+{
+    return ReadStatusMB("VmRSS:");
+}
+
+double PeakMemoryMB()
+{
+    return ReadStatusMB("VmHWM:");
+}
+
+// Writing 5 to clear_refs resets VmHWM to the current resident size
+void ResetPeakMemory()
+{
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file)
+    {
+        fputs("5", file);
+        fclose(file);
+    }
+}
+#endif
+
+double ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+double Median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    int n = values.size();
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) * 0.5;
+}
+
+std::string JsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void PrintUsage(const char* exeName)
+{
+    printf("Usage: %s [-o results.json] [--reps n] [--threads n] [--scale f] [--data dir] [--no-synthetic] [scenes...]\n", exeName);
+    printf("  -o, --output <path>  JSON file for the results (default bench.json)\n");
+    printf("  --reps <n>           times every scene is loaded and processed, the JSON has min, median and max (default 3)\n");
+    printf("  --threads <n>        threads of the task system, 0 uses all cores (default)\n");
+    printf("  --scale <f>          multiplies the triangle and light counts of the synthetic scenes (default 1)\n");
+    printf("  --data <dir>         directory for the synthetic scenes (default bench_data)\n");
+    printf("  --no-synthetic       only time the scenes given on the command line\n");
+    printf("  --no-simd            skip the scalar against SIMD checks and timings\n");
+    printf("  scenes               .scene, .gltf or .glb files to time as well\n");
+}
+
+bool ParseArguments(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if ((arg == "-o" || arg == "--output") && hasValue)
+            options.outputPath = argv[++i];
+        else if (arg == "--reps" && hasValue)
+            options.repetitions = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--threads" && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--scale" && hasValue)
+            options.scale = (float)atof(argv[++i]);
+        else if (arg == "--data" && hasValue)
+            options.dataDir = argv[++i];
+        else if (arg == "--no-synthetic")
+            options.synthetic = false;
+        else if (arg == "--no-simd")
+            options.simd = false;
+        else if (arg[0] != '-')
+            options.scenePaths.push_back(arg);
+        else
+        {
+            PrintUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (!options.synthetic && !options.simd && options.scenePaths.empty())
+    {
+        printf("Nothing to time, give scenes or leave out --no-synthetic or --no-simd\n");
+        return false;
+    }
+    return true;
+}
+
+// Scaled counts never drop below 1
+int Scaled(int count, float scale)
+{
+    return std::max((int)(count * scale), 1);
+}
+
+bool GenerateScenes(const BenchOptions& options, std::vector<BenchScene>& scenes)
+{
+    const std::string& dir = options.dataDir;
+    float scale = options.scale;
+
+    printf("Generating synthetic scenes in %s\n", dir.c_str());
+    std::vector<BenchScene> generated = {
+        { "soup", GenerateTriangleSoup(dir + "/soup", Scaled(500000, scale)) },
+        { "meshes", GenerateManyMeshes(dir + "/meshes", 64, Scaled(8000, scale)) },
+        { "grid", GenerateInstancedGrid(dir + "/grid", Scaled(128, std::sqrt(scale)), 500) },
+        { "lights", GenerateManyLights(dir + "/lights", Scaled(4096, scale)) },
+        { "textures", GenerateTextured(dir + "/textures", 8, 512) },
+        { "gltf", GenerateGLTFSoup(dir + "/gltf", Scaled(500000, scale)) },
+    };
+
+    for (const BenchScene& scene : generated)
+    {
+        if (scene.path.empty())
+        {
+            printf("Unable to generate the %s scene\n", scene.name.c_str());
+            return false;
+        }
+        scenes.push_back(scene);
+    }
+    return true;
+}
+
+bool LoadBenchScene(const std::string& path, Scene* scene, RenderOptions& options)
+{
+    std::string ext = path.substr(path.find_last_of(".") + 1);
+    if (ext == "scene")
+        return LoadSceneFromFile(path, scene, options);
+    if (ext == "gltf" || ext == "glb")
+        return LoadGLTF(path, scene, options, Mat4(), ext == "glb");
+
+    printf("Unsupported scene %s\n", path.c_str());
+    return false;
+}
+
+// Loads and processes the scene options.repetitions times. The scene is deleted in between, so the peak memory is
+// the one of a single load
+bool RunScene(const BenchOptions& options, const BenchScene& benchScene, SceneResult& result)
+{
+    result.scene = benchScene;
+    result.baseMemoryMB = CurrentMemoryMB();
+    ResetPeakMemory();
+
+    Profiler& profiler = Profiler::Get();
+    for (int rep = 0; rep < options.repetitions; rep++)
+    {
+        // Drops sections of anything that ran before
+        profiler.EndFrame();
+
+        Scene* scene = new Scene();
+        RenderOptions renderOptions;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!LoadBenchScene(benchScene.path, scene, renderOptions))
+        {
+            printf("Unable to load %s\n", benchScene.path.c_str());
+            delete scene;
+            return false;
+        }
+        double loadMs = ElapsedMs(start);
+
+        renderOptions.cpuThreads = options.threads;
+        scene->renderOptions = renderOptions;
+
+        start = std::chrono::high_resolution_clock::now();
+        scene->ProcessScene();
+        double processMs = ElapsedMs(start);
+
+        result.timings["Load Scene"].push_back(loadMs);
+        result.timings["Process Scene"].push_back(processMs);
+        for (const Profiler::Section& section : profiler.GetSections())
+        {
+            if (!section.gpu && !section.counter && section.frameHit)
+                result.timings[section.name].push_back(section.frameTime);
+        }
+
+        if (rep == 0)
+        {
+            result.meshes = scene->meshes.size();
+            result.instances = scene->meshInstances.size();
+            result.triangles = scene->vertIndices.size();
+            result.lights = scene->lights.size();
+            result.textures = scene->textures.size();
+            result.bvhNodes = scene->bvhTranslator.nodes.size();
+        }
+
+        delete scene;
+    }
+    profiler.EndFrame();
+
+    result.peakMemoryMB = PeakMemoryMB();
+    return true;
+}
+
+void WriteTimings(FILE* file, const char* name, const std::vector<double>& times)
+{
+    fprintf(file, "%s: { \"min\": %.3f, \"median\": %.3f, \"max\": %.3f }", JsonString(name).c_str(),
+        *std::min_element(times.begin(), times.end()), Median(times), *std::max_element(times.begin(), times.end()));
+}
+
+bool WriteJson(const std::string& filename, const BenchOptions& options, const std::vector<SceneResult>& results,
+               const std::vector<SimdCase>& simdCases)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file)
+    {
+        printf("Couldn't open %s for writing\n", filename.c_str());
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"threads\": %d,\n", TaskSystem::Get().GetThreadCount());
+    fprintf(file, "  \"repetitions\": %d,\n", options.repetitions);
+    fprintf(file, "  \"scale\": %g,\n", options.scale);
+    fprintf(file, "  \"scenes\": [\n");
+    for (int i = 0; i < results.size(); i++)
+    {
+        const SceneResult& result = results[i];
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": %s,\n", JsonString(result.scene.name).c_str());
+        fprintf(file, "      \"path\": %s,\n", JsonString(result.scene.path).c_str());
+        fprintf(file, "      \"meshes\": %d,\n", result.meshes);
+        fprintf(file, "      \"instances\": %d,\n", result.instances);
+        fprintf(file, "      \"triangles\": %d,\n", result.triangles);
+        fprintf(file, "      \"lights\": %d,\n", result.lights);
+        fprintf(file, "      \"textures\": %d,\n", result.textures);
+        fprintf(file, "      \"bvhNodes\": %d,\n", result.bvhNodes);
+        fprintf(file, "      \"memoryMB\": { \"base\": %.1f, \"peak\": %.1f },\n", result.baseMemoryMB, result.peakMemoryMB);
+        fprintf(file, "      \"timingsMs\": {");
+
+        bool first = true;
+        for (const char* stage : stageNames)
+        {
+            auto it = result.timings.find(stage);
+            if (it == result.timings.end())
+                continue;
+
+            fprintf(file, "%s\n        ", first ? "" : ",");
+            WriteTimings(file, stage, it->second);
+            first = false;
+        }
+        fprintf(file, "\n      }\n");
+        fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"simd\": [\n");
+    for (int i = 0; i < simdCases.size(); i++)
+    {
+        const SimdCase& simdCase = simdCases[i];
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": %s,\n", JsonString(simdCase.name).c_str());
+        fprintf(file, "      \"count\": %d,\n", simdCase.count);
+        fprintf(file, "      \"mismatches\": %d,\n", simdCase.mismatches);
+        fprintf(file, "      \"timingsMs\": {\n        ");
+        WriteTimings(file, "scalar", simdCase.scalarMs);
+        fprintf(file, ",\n        ");
+        WriteTimings(file, "simd", simdCase.simdMs);
+        fprintf(file, "\n      }\n");
+        fprintf(file, "    }%s\n", i + 1 < simdCases.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
+
+void PrintSummary(const std::vector<SceneResult>& results, const std::vector<SimdCase>& simdCases)
+{
+    if (!results.empty())
+        printf("\n%-12s %-20s %12s\n", "scene", "stage", "median ms");
+    for (const SceneResult& result : results)
+    {
+        for (const char* stage : stageNames)
+        {
+            auto it = result.timings.find(stage);
+            if (it != result.timings.end())
+                printf("%-12s %-20s %12.2f\n", result.scene.name.c_str(), stage, Median(it->second));
+        }
+        printf("%-12s %-20s %9.1f MB\n", result.scene.name.c_str(), "peak memory", result.peakMemoryMB);
+    }
+
+    if (simdCases.empty())
+        return;
+
+    printf("\n%-20s %10s %12s %16s %14s\n", "simd case", "count", "mismatches", "scalar median ms", "simd median ms");
+    for (const SimdCase& simdCase : simdCases)
+    {
+        printf("%-20s %10d %12d %16.2f %14.2f\n", simdCase.name.c_str(), simdCase.count, simdCase.mismatches,
+            Median(simdCase.scalarMs), Median(simdCase.simdMs));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseArguments(argc, argv, options))
+        return 1;
+
+    Profiler::Get().SetEnabled(true);
+    TaskSystem::Get().SetThreadCount(options.threads);
+
+    std::vector<BenchScene> scenes;
+    if (options.synthetic && !GenerateScenes(options, scenes))
+        return 1;
+
+    for (const std::string& path : options.scenePaths)
+    {
+        size_t start = path.find_last_of("/\\") + 1;
+        scenes.push_back({ path.substr(start, path.find_last_of(".") - start), path });
+    }
+
+    std::vector<SimdCase> simdCases;
+    if (options.simd)
+    {
+        printf("Timing scalar against SIMD math\n");
+        simdCases = RunSimdCases(options.repetitions);
+    }
+
+    std::vector<SceneResult> results;
+    for (const BenchScene& scene : scenes)
+    {
+        printf("Timing %s (%s)\n", scene.name.c_str(), scene.path.c_str());
+        SceneResult result;
+        if (!RunScene(options, scene, result))
+            return 1;
+        results.push_back(result);
+    }
+
+    PrintSummary(results, simdCases);
+    if (!WriteJson(options.outputPath, options, results, simdCases))
+        return 1;
+
+    printf("Results written to %s\n", options.outputPath.c_str());
+
+    // The SIMD code has to give the same results as the scalar code, anything else fails the run
+    for (const SimdCase& simdCase : simdCases)
+    {
+        if (simdCase.mismatches > 0)
+        {
+            printf("%s differs from the scalar code in %d of %d results\n", simdCase.name.c_str(), simdCase.mismatches, simdCase.count);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,337 @@
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include "SceneGenerator.h"
+#include "Vec3.h"
+#include "stb_image_write.h"
+#include "tiny_gltf.h"
+
+namespace PathTracer
+{
+    namespace
+    {
+        // Triangles with random orientation scattered through the cube [-1, 1]. Their size shrinks with the count so
+        // the soup stays about as dense, which keeps BVH builds from degenerating into huge overlapping boxes
+        void RandomTriangles(int numTris, unsigned seed, std::vector<Vec3>& positions, std::vector<Vec3>& normals)
+        {
+            std::mt19937 rng(seed);
+            std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+            float size = 4.0f / std::cbrt((float)std::max(numTris, 1));
+
+            positions.resize(numTris * 3);
+            normals.resize(numTris);
+            for (int i = 0; i < numTris; i++)
+            {
+                Vec3 center(unit(rng), unit(rng), unit(rng));
+                for (int v = 0; v < 3; v++)
+                    positions[i * 3 + v] = center + Vec3(unit(rng), unit(rng), unit(rng)) * size;
+
+                Vec3 n = Vec3::Cross(positions[i * 3 + 1] - positions[i * 3], positions[i * 3 + 2] - positions[i * 3]);
+                normals[i] = Vec3::Length(n) > 0.0f ? Vec3::Normalize(n) : Vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+
+        // Mesh::LoadFromFile needs normals, every face gets its own
+        bool WriteObj(const std::string& filename, const std::vector<Vec3>& positions, const std::vector<Vec3>& normals)
+        {
+            FILE* file = fopen(filename.c_str(), "w");
+            if (!file)
+            {
+                printf("Couldn't open %s for writing\n", filename.c_str());
+                return false;
+            }
+
+            for (const Vec3& p : positions)
+                fprintf(file, "v %f %f %f\n", p.x, p.y, p.z);
+            for (const Vec3& n : normals)
+                fprintf(file, "vn %f %f %f\n", n.x, n.y, n.z);
+            for (int i = 0; i < normals.size(); i++)
+                fprintf(file, "f %d//%d %d//%d %d//%d\n", i * 3 + 1, i + 1, i * 3 + 2, i + 1, i * 3 + 3, i + 1);
+
+            fclose(file);
+            return true;
+        }
+
+        bool WriteSoupObj(const std::string& filename, int numTris, unsigned seed)
+        {
+            std::vector<Vec3> positions, normals;
+            RandomTriangles(numTris, seed, positions, normals);
+            return WriteObj(filename, positions, normals);
+        }
+
+        // Opens the .scene file and writes the parts every synthetic scene shares
+        FILE* BeginScene(const std::string& filename)
+        {
+            FILE* file = fopen(filename.c_str(), "w");
+            if (!file)
+            {
+                printf("Couldn't open %s for writing\n", filename.c_str());
+                return nullptr;
+            }
+
+            fprintf(file, "renderer\n{\n    resolution 512 512\n    maxdepth 4\n}\n\n");
+            fprintf(file, "camera\n{\n    position 0 0 6\n    lookat 0 0 0\n    fov 45\n}\n\n");
+            fprintf(file, "material white\n{\n    color 0.8 0.8 0.8\n}\n\n");
+            return file;
+        }
+
+        void WriteMesh(FILE* file, const std::string& meshFile, const char* material, const Vec3& position, float scale)
+        {
+            fprintf(file, "mesh\n{\n    file %s\n    material %s\n    position %f %f %f\n    scale %f %f %f\n}\n\n",
+                meshFile.c_str(), material, position.x, position.y, position.z, scale, scale, scale);
+        }
+    }
+
+    std::string GenerateTriangleSoup(const std::string& dir, int numTris)
+    {
+        std::filesystem::create_directories(dir);
+        if (!WriteSoupObj(dir + "/soup.obj", numTris, 1))
+            return "";
+
+        std::string sceneFile = dir + "/soup.scene";
+        FILE* file = BeginScene(sceneFile);
+        if (!file)
+            return "";
+        WriteMesh(file, "soup.obj", "white", Vec3(0.0f, 0.0f, 0.0f), 1.0f);
+        fclose(file);
+        return sceneFile;
+    }
+
+    // Separate files, so loading and BLAS builds have many independent meshes to work on
+    std::string GenerateManyMeshes(const std::string& dir, int numMeshes, int trisPerMesh)
+    {
+        std::filesystem::create_directories(dir);
+        std::string sceneFile = dir + "/meshes.scene";
+        FILE* file = BeginScene(sceneFile);
+        if (!file)
+            return "";
+
+        int side = (int)std::ceil(std::sqrt((float)numMeshes));
+        for (int i = 0; i < numMeshes; i++)
+        {
+            std::string meshFile = "part" + std::to_string(i) + ".obj";
+            if (!WriteSoupObj(dir + "/" + meshFile, trisPerMesh, 100 + i))
+            {
+                fclose(file);
+                return "";
+            }
+
+            Vec3 position((i % side) * 2.0f - side, (i / side) * 2.0f - side, 0.0f);
+            WriteMesh(file, meshFile, "white", position, 0.9f);
+        }
+
+        fclose(file);
+        return sceneFile;
+    }
+
+    // One mesh on a gridSize x gridSize grid, so most of the work is in the TLAS and the flattening of the instances
+    std::string GenerateInstancedGrid(const std::string& dir, int gridSize, int trisPerMesh)
+    {
+        std::filesystem::create_directories(dir);
+        if (!WriteSoupObj(dir + "/cell.obj", trisPerMesh, 2))
+            return "";
+
+        std::string sceneFile = dir + "/grid.scene";
+        FILE* file = BeginScene(sceneFile);
+        if (!file)
+            return "";
+
+        float spacing = 4.0f / gridSize;
+        for (int y = 0; y < gridSize; y++)
+        {
+            for (int x = 0; x < gridSize; x++)
+            {
+                Vec3 position((x + 0.5f) * spacing - 2.0f, (y + 0.5f) * spacing - 2.0f, 0.0f);
+                WriteMesh(file, "cell.obj", "white", position, spacing * 0.4f);
+            }
+        }
+
+        fclose(file);
+        return sceneFile;
+    }
+
+    // A floor under a grid of lights, two quads to every sphere, for the light distribution and the copy of the lights
+    std::string GenerateManyLights(const std::string& dir, int numLights)
+    {
+        std::filesystem::create_directories(dir);
+
+        std::vector<Vec3> positions = { Vec3(-4, 0, -4), Vec3(4, 0, -4), Vec3(4, 0, 4),
+                                        Vec3(-4, 0, -4), Vec3(4, 0, 4), Vec3(-4, 0, 4) };
+        std::vector<Vec3> normals = { Vec3(0, 1, 0), Vec3(0, 1, 0) };
+        if (!WriteObj(dir + "/floor.obj", positions, normals))
+            return "";
+
+        std::string sceneFile = dir + "/lights.scene";
+        FILE* file = BeginScene(sceneFile);
+        if (!file)
+            return "";
+        WriteMesh(file, "floor.obj", "white", Vec3(0.0f, -1.0f, 0.0f), 1.0f);
+
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<float> power(1.0f, 20.0f);
+        int side = (int)std::ceil(std::sqrt((float)numLights));
+        float spacing = 8.0f / side;
+        for (int i = 0; i < numLights; i++)
+        {
+            float x = (i % side + 0.5f) * spacing - 4.0f;
+            float z = (i / side + 0.5f) * spacing - 4.0f;
+            float e = power(rng);
+            if (i % 3 == 2)
+            {
+                fprintf(file, "light\n{\n    position %f 1 %f\n    radius %f\n    emission %f %f %f\n    type sphere\n}\n\n",
+                    x, z, spacing * 0.25f, e, e, e);
+            }
+            else
+            {
+                float h = spacing * 0.25f;
+                fprintf(file, "light\n{\n    position %f 1 %f\n    v1 %f 1 %f\n    v2 %f 1 %f\n    emission %f %f %f\n    type quad\n}\n\n",
+                    x - h, z - h, x + h, z - h, x - h, z + h, e, e, e);
+            }
+        }
+
+        fclose(file);
+        return sceneFile;
+    }
+
+    // Textures smaller than the texture array of the renderer, so ProcessScene resizes every one of them
+    std::string GenerateTextured(const std::string& dir, int numTextures, int textureSize)
+    {
+        std::filesystem::create_directories(dir);
+        if (!WriteSoupObj(dir + "/textured.obj", 1000, 4))
+            return "";
+
+        std::string sceneFile = dir + "/textured.scene";
+        FILE* file = BeginScene(sceneFile);
+        if (!file)
+            return "";
+
+        std::vector<unsigned char> pixels(textureSize * textureSize * 4);
+        for (int i = 0; i < numTextures; i++)
+        {
+            // Checkers with a per texture color
+            for (int y = 0; y < textureSize; y++)
+            {
+                for (int x = 0; x < textureSize; x++)
+                {
+                    unsigned char* pixel = &pixels[(y * textureSize + x) * 4];
+                    bool odd = ((x / 16) + (y / 16)) % 2 != 0;
+                    pixel[0] = odd ? 255 : (unsigned char)(i * 37);
+                    pixel[1] = odd ? 255 : (unsigned char)(i * 91);
+                    pixel[2] = odd ? 255 : (unsigned char)(i * 53);
+                    pixel[3] = 255;
+                }
+            }
+
+            std::string textureFile = "tex" + std::to_string(i) + ".png";
+            if (!stbi_write_png((dir + "/" + textureFile).c_str(), textureSize, textureSize, 4, pixels.data(), textureSize * 4))
+            {
+                printf("Couldn't write %s\n", textureFile.c_str());
+                fclose(file);
+                return "";
+            }
+
+            std::string material = "checker" + std::to_string(i);
+            fprintf(file, "material %s\n{\n    color 1 1 1\n    albedotexture %s\n}\n\n", material.c_str(), textureFile.c_str());
+            WriteMesh(file, "textured.obj", material.c_str(), Vec3(i * 2.5f, 0.0f, 0.0f), 1.0f);
+        }
+
+        fclose(file);
+        return sceneFile;
+    }
+
+    // The same kind of soup as a .gltf with the buffer embedded, so LoadGLTF parses JSON and decodes base64 like it
+    // does for most exported files
+    std::string GenerateGLTFSoup(const std::string& dir, int numTris)
+    {
+        std::filesystem::create_directories(dir);
+
+        std::vector<Vec3> positions, faceNormals;
+        RandomTriangles(numTris, 5, positions, faceNormals);
+        int numVertices = positions.size();
+
+        std::vector<float> vertexData(numVertices * 6);
+        std::vector<unsigned> indices(numVertices);
+        std::vector<double> minPosition(3, 1e30), maxPosition(3, -1e30);
+        for (int i = 0; i < numVertices; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                vertexData[i * 3 + c] = positions[i][c];
+                vertexData[(numVertices + i) * 3 + c] = faceNormals[i / 3][c];
+                minPosition[c] = std::min(minPosition[c], (double)positions[i][c]);
+                maxPosition[c] = std::max(maxPosition[c], (double)positions[i][c]);
+            }
+            indices[i] = i;
+        }
+
+        tinygltf::Model model;
+        tinygltf::Buffer buffer;
+        size_t vertexBytes = vertexData.size() * sizeof(float);
+        buffer.data.resize(vertexBytes + indices.size() * sizeof(unsigned));
+        memcpy(buffer.data.data(), vertexData.data(), vertexBytes);
+        memcpy(buffer.data.data() + vertexBytes, indices.data(), indices.size() * sizeof(unsigned));
+        model.buffers.push_back(buffer);
+
+        // Positions, normals and indices
+        size_t offsets[3] = { 0, vertexBytes / 2, vertexBytes };
+        size_t lengths[3] = { vertexBytes / 2, vertexBytes / 2, indices.size() * sizeof(unsigned) };
+        for (int i = 0; i < 3; i++)
+        {
+            tinygltf::BufferView view;
+            view.buffer = 0;
+            view.byteOffset = offsets[i];
+            view.byteLength = lengths[i];
+            view.target = i < 2 ? TINYGLTF_TARGET_ARRAY_BUFFER : TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+            model.bufferViews.push_back(view);
+
+            tinygltf::Accessor accessor;
+            accessor.bufferView = i;
+            accessor.count = numVertices;
+            accessor.componentType = i < 2 ? TINYGLTF_COMPONENT_TYPE_FLOAT : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+            accessor.type = i < 2 ? TINYGLTF_TYPE_VEC3 : TINYGLTF_TYPE_SCALAR;
+            if (i == 0)
+            {
+                accessor.minValues = minPosition;
+                accessor.maxValues = maxPosition;
+            }
+            model.accessors.push_back(accessor);
+        }
+
+        tinygltf::Primitive primitive;
+        primitive.attributes["POSITION"] = 0;
+        primitive.attributes["NORMAL"] = 1;
+        primitive.indices = 2;
+        primitive.material = 0;
+        primitive.mode = TINYGLTF_MODE_TRIANGLES;
+
+        tinygltf::Mesh mesh;
+        mesh.primitives.push_back(primitive);
+        model.meshes.push_back(mesh);
+        model.materials.push_back(tinygltf::Material());
+
+        tinygltf::Node node;
+        node.mesh = 0;
+        model.nodes.push_back(node);
+
+        tinygltf::Scene scene;
+        scene.nodes.push_back(0);
+        model.scenes.push_back(scene);
+        model.defaultScene = 0;
+        model.asset.version = "2.0";
+
+        std::string gltfFile = dir + "/soup.gltf";
+        tinygltf::TinyGLTF writer;
+        if (!writer.WriteGltfSceneToFile(&model, gltfFile, false, true, false, false))
+        {
+            printf("Couldn't write %s\n", gltfFile.c_str());
+            return "";
+        }
+        return gltfFile;
+    }
+}
@@ -0,0 +1,18 @@
+
+
+#pragma once
+
+#include <string>
+
+namespace PathTracer
+{
+    // Synthetic scenes for pathtracer_bench. Each generator writes its meshes, textures and a .scene (or .gltf) file into
+    // dir, which has to exist, and returns the path of the file to load. Geometry comes from a fixed seed, so the same
+    // arguments always give the same scene
+    std::string GenerateTriangleSoup(const std::string& dir, int numTris);
+    std::string GenerateManyMeshes(const std::string& dir, int numMeshes, int trisPerMesh);
+    std::string GenerateInstancedGrid(const std::string& dir, int gridSize, int trisPerMesh);
+    std::string GenerateManyLights(const std::string& dir, int numLights);
+    std::string GenerateTextured(const std::string& dir, int numTextures, int textureSize);
+    std::string GenerateGLTFSoup(const std::string& dir, int numTris);
+}
@@ -0,0 +1,355 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include "SimdBench.h"
+#include "bbox.h"
+#include "Mat4.h"
+#include "Vec3.h"
+#include "Vec3A.h"
+#include "Vec4.h"
+
+namespace PathTracer
+{
+    namespace
+    {
+        // Inputs of every case, large enough for the times to be well above the timer resolution
+        const int kVectorCount = 1 << 20;
+        const int kMatrixCount = 1 << 18;
+
+        // bbox as it was before its corners moved into SIMD registers
+        struct ScalarBox
+        {
+            ScalarBox()
+                : pmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max())
+                , pmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+            {
+            }
+
+            void grow(const Vec3& p)
+            {
+                pmin = Vec3::Min(pmin, p);
+                pmax = Vec3::Max(pmax, p);
+            }
+
+            void grow(const ScalarBox& b)
+            {
+                pmin = Vec3::Min(pmin, b.pmin);
+                pmax = Vec3::Max(pmax, b.pmax);
+            }
+
+            Vec3 pmin;
+            Vec3 pmax;
+        };
+
+        // Random values in [-100, 100], every fourth one is a special value instead
+        class RandomFloats
+        {
+        public:
+            RandomFloats(unsigned seed) : rng(seed), range(-100.0f, 100.0f) {}
+
+            float operator()()
+            {
+                static const float specials[] = {
+                    0.0f, -0.0f, NAN, -NAN, INFINITY, -INFINITY, 1e-40f, -1e-40f, std::numeric_limits<float>::max(), 1.0f
+                };
+                if (rng() % 4 == 0)
+                    return specials[rng() % (sizeof(specials) / sizeof(specials[0]))];
+                return range(rng);
+            }
+
+        private:
+            std::mt19937 rng;
+            std::uniform_real_distribution<float> range;
+        };
+
+        bool Same(float a, float b)
+        {
+            return (std::isnan(a) && std::isnan(b)) || memcmp(&a, &b, sizeof(float)) == 0;
+        }
+
+        bool Same(const Vec3& a, const Vec3A& b)
+        {
+            return Same(a.x, b.x) && Same(a.y, b.y) && Same(a.z, b.z);
+        }
+
+        bool Same(const ScalarBox& a, const RadeonRays::bbox& b)
+        {
+            return Same(a.pmin, b.pmin) && Same(a.pmax, b.pmax);
+        }
+
+        bool Same(const Mat4& a, const Mat4& b)
+        {
+            for (int i = 0; i < 4; i++)
+                for (int j = 0; j < 4; j++)
+                    if (!Same(a.data[i][j], b.data[i][j]))
+                        return false;
+            return true;
+        }
+
+        template <typename Func>
+        double TimeMs(Func func)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            func();
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Runs both versions repetitions times and compares what the first run of each produced
+        template <typename ScalarFunc, typename SimdFunc, typename CompareFunc>
+        SimdCase RunCase(const char* name, int count, int repetitions, ScalarFunc scalar, SimdFunc simd, CompareFunc compare)
+        {
+            SimdCase result;
+            result.name = name;
+            result.count = count;
+            for (int rep = 0; rep < repetitions; rep++)
+            {
+                result.scalarMs.push_back(TimeMs(scalar));
+                result.simdMs.push_back(TimeMs(simd));
+                if (rep == 0)
+                    result.mismatches = compare();
+            }
+            return result;
+        }
+
+        // Mat4::operator* without SIMD, summed in the same order
+        Mat4 ScalarProduct(const Mat4& a, const Mat4& b)
+        {
+            Mat4 out;
+            for (int i = 0; i < 4; i++)
+                for (int j = 0; j < 4; j++)
+                    out.data[i][j] = a.data[i][0] * b.data[0][j] + a.data[i][1] * b.data[1][j] + a.data[i][2] * b.data[2][j] + a.data[i][3] * b.data[3][j];
+            return out;
+        }
+
+        // The Arvo transform of Scene::createTLAS before transform_bounds()
+        ScalarBox ScalarTransformBounds(const ScalarBox& box, const Mat4& matrix)
+        {
+            Vec3 right       = Vec3(matrix.data[0][0], matrix.data[0][1], matrix.data[0][2]);
+            Vec3 up          = Vec3(matrix.data[1][0], matrix.data[1][1], matrix.data[1][2]);
+            Vec3 forward     = Vec3(matrix.data[2][0], matrix.data[2][1], matrix.data[2][2]);
+            Vec3 translation = Vec3(matrix.data[3][0], matrix.data[3][1], matrix.data[3][2]);
+
+            Vec3 xa = right * box.pmin.x;
+            Vec3 xb = right * box.pmax.x;
+            Vec3 ya = up * box.pmin.y;
+            Vec3 yb = up * box.pmax.y;
+            Vec3 za = forward * box.pmin.z;
+            Vec3 zb = forward * box.pmax.z;
+
+            ScalarBox out;
+            out.pmin = Vec3::Min(xa, xb) + Vec3::Min(ya, yb) + Vec3::Min(za, zb) + translation;
+            out.pmax = Vec3::Max(xa, xb) + Vec3::Max(ya, yb) + Vec3::Max(za, zb) + translation;
+            return out;
+        }
+    }
+
+    std::vector<SimdCase> RunSimdCases(int repetitions)
+    {
+        std::vector<SimdCase> cases;
+        RandomFloats random(7);
+        int n = kVectorCount;
+
+        // Vec3A ops, all six results of a pair side by side
+        {
+            std::vector<Vec3> a(n), b(n), scalarOut(n * 6);
+            std::vector<float> s(n);
+            std::vector<Vec3A> simdOut(n * 6);
+            for (int i = 0; i < n; i++)
+            {
+                a[i] = Vec3(random(), random(), random());
+                b[i] = Vec3(random(), random(), random());
+                s[i] = random();
+            }
+
+            cases.push_back(RunCase("Vec3A ops", n * 6, repetitions,
+                [&]()
+                {
+                    for (int i = 0; i < n; i++)
+                    {
+                        Vec3* out = &scalarOut[i * 6];
+                        out[0] = Vec3::Min(a[i], b[i]);
+                        out[1] = Vec3::Max(a[i], b[i]);
+                        out[2] = a[i] + b[i];
+                        out[3] = a[i] - b[i];
+                        out[4] = a[i] * b[i];
+                        out[5] = a[i] * s[i];
+                    }
+                },
+                [&]()
+                {
+                    for (int i = 0; i < n; i++)
+                    {
+                        Vec3A va(a[i]), vb(b[i]);
+                        Vec3A* out = &simdOut[i * 6];
+                        out[0] = Vec3A::Min(va, vb);
+                        out[1] = Vec3A::Max(va, vb);
+                        out[2] = va + vb;
+                        out[3] = va - vb;
+                        out[4] = va * vb;
+                        out[5] = va * s[i];
+                    }
+                },
+                [&]()
+                {
+                    int mismatches = 0;
+                    for (int i = 0; i < n * 6; i++)
+                        mismatches += !Same(scalarOut[i], simdOut[i]);
+                    return mismatches;
+                }));
+        }
+
+        // Boxes of the triangles feed transform_bounds and bboxunion as well
+        std::vector<ScalarBox> scalarTriBoxes(n);
+        std::vector<RadeonRays::bbox> simdTriBoxes(n);
+        {
+            std::vector<Vec4> vertices(n * 3);
+            for (Vec4& v : vertices)
+                v = Vec4(random(), random(), random(), random());
+
+            cases.push_back(RunCase("triangle_bounds", n, repetitions,
+                [&]()
+                {
+                    for (int i = 0; i < n; i++)
+                    {
+                        ScalarBox box;
+                        box.grow(Vec3(vertices[i * 3 + 0]));
+                        box.grow(Vec3(vertices[i * 3 + 1]));
+                        box.grow(Vec3(vertices[i * 3 + 2]));
+                        scalarTriBoxes[i] = box;
+                    }
+                },
+                [&]()
+                {
+                    RadeonRays::triangle_bounds(vertices.data(), n, simdTriBoxes.data());
+                },
+                [&]()
+                {
+                    int mismatches = 0;
+                    for (int i = 0; i < n; i++)
+                        mismatches += !Same(scalarTriBoxes[i], simdTriBoxes[i]);
+                    return mismatches;
+                }));
+        }
+
+        {
+            std::vector<Mat4> transforms(n);
+            for (Mat4& m : transforms)
+                for (int i = 0; i < 4; i++)
+                    for (int j = 0; j < 3; j++)
+                        m.data[i][j] = random();
+
+            std::vector<ScalarBox> scalarOut(n);
+            std::vector<RadeonRays::bbox> simdOut(n);
+            cases.push_back(RunCase("transform_bounds", n, repetitions,
+                [&]()
+                {
+                    for (int i = 0; i < n; i++)
+                        scalarOut[i] = ScalarTransformBounds(scalarTriBoxes[i], transforms[i]);
+                },
+                [&]()
+                {
+                    RadeonRays::transform_bounds(simdTriBoxes.data(), transforms.data(), n, simdOut.data());
+                },
+                [&]()
+                {
+                    int mismatches = 0;
+                    for (int i = 0; i < n; i++)
+                        mismatches += !Same(scalarOut[i], simdOut[i]);
+                    return mismatches;
+                }));
+        }
+
+        {
+            ScalarBox scalarUnion;
+            RadeonRays::bbox simdUnion;
+            cases.push_back(RunCase("bboxunion", n, repetitions,
+                [&]()
+                {
+                    scalarUnion = ScalarBox();
+                    for (int i = 0; i < n; i++)
+                        scalarUnion.grow(scalarTriBoxes[i]);
+                },
+                [&]()
+                {
+                    simdUnion = RadeonRays::bboxunion(simdTriBoxes.data(), n);
+                },
+                [&]()
+                {
+                    return Same(scalarUnion, simdUnion) ? 0 : 1;
+                }));
+        }
+
+        int m = kMatrixCount;
+        std::vector<Mat4> a(m), b(m);
+        for (int k = 0; k < m; k++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    a[k].data[i][j] = random();
+                    b[k].data[i][j] = random();
+                }
+            }
+        }
+
+        {
+            std::vector<Mat4> scalarOut(m), simdOut(m);
+            cases.push_back(RunCase("Mat4 product", m, repetitions,
+                [&]()
+                {
+                    for (int k = 0; k < m; k++)
+                        scalarOut[k] = ScalarProduct(a[k], b[k]);
+                },
+                [&]()
+                {
+                    for (int k = 0; k < m; k++)
+                        simdOut[k] = a[k] * b[k];
+                },
+                [&]()
+                {
+                    int mismatches = 0;
+                    for (int k = 0; k < m; k++)
+                        mismatches += !Same(scalarOut[k], simdOut[k]);
+                    return mismatches;
+                }));
+        }
+
+        // Inverse() has no SIMD path of its own, so it is timed together with the product that multiplies it back. The
+        // matrices are affine like the instance transforms Scene inverts
+        {
+            std::vector<Mat4> affine(m);
+            for (int k = 0; k < m; k++)
+            {
+                affine[k] = a[k];
+                affine[k].data[0][3] = affine[k].data[1][3] = affine[k].data[2][3] = 0.0f;
+                affine[k].data[3][3] = 1.0f;
+            }
+
+            std::vector<Mat4> scalarOut(m), simdOut(m);
+            cases.push_back(RunCase("Mat4 Inverse", m, repetitions,
+                [&]()
+                {
+                    for (int k = 0; k < m; k++)
+                        scalarOut[k] = ScalarProduct(affine[k], Mat4::Inverse(affine[k]));
+                },
+                [&]()
+                {
+                    for (int k = 0; k < m; k++)
+                        simdOut[k] = affine[k] * Mat4::Inverse(affine[k]);
+                },
+                [&]()
+                {
+                    int mismatches = 0;
+                    for (int k = 0; k < m; k++)
+                        mismatches += !Same(scalarOut[k], simdOut[k]);
+                    return mismatches;
+                }));
+        }
+
+        return cases;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace PathTracer
+{
+    // Scalar against SIMD cases for pathtracer_bench. Each runs the SIMD math of Vec3A, Mat4 or the RadeonRays bbox
+    // helpers and the scalar code it replaced on the same random inputs, mixed with ±0, NaN, ±inf, denormals and
+    // FLT_MAX. Results that differ in more than the payload of a NaN count as mismatches
+    struct SimdCase
+    {
+        std::string name;
+        int count = 0;
+        int mismatches = 0;
+        std::vector<double> scalarMs;
+        std::vector<double> simdMs;
+    };
+
+    // Times every case repetitions times, the results are compared after the first one
+    std::vector<SimdCase> RunSimdCases(int repetitions);
+}
@@ -1,5 +1,10 @@
 #include <time.h>
+#include <chrono>
+#include <functional>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
 
 #include "SDL2/SDL.h"
 #include "GL/gl3w.h"
@@ -15,6 +20,13 @@
 #include "GLTFLoader.h"
 #include "BlendLoader.h"
 #include "Renderer.h"
+#include "CpuRenderer.h"
+#include "Denoiser.h"
+#include "HeadlessContext.h"
+#include "Profiler.h"
+#include "FrameCapture.h"
+#include "ProgramCache.h"
+#include "TaskSystem.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -43,12 +55,15 @@ float mouseSensitivity = 0.01f;
 double lastTime = SDL_GetTicks();
 bool done = false;
 
+char profileCSVPath[256] = "profile.csv";
+
 std::string shadersDir = "../src/shaders/";
 std::string scenesDir = "../scenes/";
 std::string envMapsDir = "../scenes/HDR/";
 
 Scene* scene;
 Renderer* renderer;
+FrameCapture* frameCapture;
 RenderOptions renderOptions;
 LoopData loopData;
 
@@ -96,6 +111,10 @@ void GetEnvMaps()
 
 void LoadScene(std::string sceneName)
 {
+    // The renderer is only replaced once the new scene is loaded, its CPU tile must not read the old one meanwhile
+    if (renderer)
+        renderer->WaitForCPUTile();
+
     delete scene;
     scene = new Scene();
     std::string ext = sceneName.substr(sceneName.find_last_of(".") + 1);
@@ -129,6 +148,9 @@ void LoadScene(std::string sceneName)
         renderOptions.envMapIntensity = 1.5f;
     }
 
+    // Scene files may set the thread count, processing the scene already runs on it
+    TaskSystem::Get().SetThreadCount(renderOptions.cpuThreads);
+
     scene->renderOptions = renderOptions;
 }
 
@@ -195,6 +217,7 @@ void InitOpenGLLoader()
         return;
     }
 #endif
+    Program::InitParallelCompile();
 }
 
 void ImGuiSetup()
@@ -208,15 +231,12 @@ void ImGuiSetup()
     ImGui::StyleColorsDark();
 }
 
+// Queues the current image for writing. The readback and PNG encoding finish in the background
 void SaveFrame(const std::string filename)
 {
-    unsigned char* data = nullptr;
     int w, h;
-    renderer->GetOutputBuffer(&data, w, h);
-    stbi_flip_vertically_on_write(true);
-    stbi_write_png(filename.c_str(), w, h, 4, data, w * 4);
-    printf("Frame saved: %s\n", filename.c_str());
-    delete[] data;
+    GLuint outputTexture = renderer->GetOutputTexture(w, h);
+    frameCapture->Capture(outputTexture, w, h, filename);
 }
 
 void Render()
@@ -257,6 +277,57 @@ void Update(float secondsElapsed)
     renderer->Update(secondsElapsed);
 }
 
+void ProfilerPanel()
+{
+    Profiler& profiler = Profiler::Get();
+
+    bool enabled = profiler.IsEnabled();
+    if (ImGui::Checkbox("Enable Profiler", &enabled))
+        profiler.SetEnabled(enabled);
+
+    if (!enabled)
+        return;
+
+    ImGui::InputText("CSV File", profileCSVPath, sizeof(profileCSVPath));
+    if (!profiler.IsWritingCSV())
+    {
+        if (ImGui::Button("Start CSV"))
+            profiler.StartCSV(profileCSVPath);
+    }
+    else if (ImGui::Button("Stop CSV"))
+        profiler.StopCSV();
+
+    // Rolling statistics over the last Profiler::historySize frames, in ms for timings
+    const std::vector<Profiler::Section>& sections = profiler.GetSections();
+    ImGui::Columns(5, "ProfilerStats");
+    ImGui::Text("Section"); ImGui::NextColumn();
+    ImGui::Text("Last"); ImGui::NextColumn();
+    ImGui::Text("Avg"); ImGui::NextColumn();
+    ImGui::Text("Min"); ImGui::NextColumn();
+    ImGui::Text("Max"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (int i = 0; i < sections.size(); i++)
+    {
+        float last, average, minimum, maximum;
+        profiler.GetStats(sections[i], last, average, minimum, maximum);
+
+        ImGui::Text("%s %s", sections[i].counter ? "CNT" : sections[i].gpu ? "GPU" : "CPU", sections[i].name.c_str());
+        if (ImGui::IsItemHovered() && sections[i].historyCount > 0)
+        {
+            ImGui::BeginTooltip();
+            int offset = sections[i].historyCount < Profiler::historySize ? 0 : sections[i].historyIndex;
+            ImGui::PlotLines("", sections[i].history, sections[i].historyCount, offset, NULL, 0.0f, FLT_MAX, ImVec2(240, 60));
+            ImGui::EndTooltip();
+        }
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", last); ImGui::NextColumn();
+        ImGui::Text("%.3f", average); ImGui::NextColumn();
+        ImGui::Text("%.3f", minimum); ImGui::NextColumn();
+        ImGui::Text("%.3f", maximum); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
 void EditTransform(const float* view, const float* projection, float* matrix)
 {
     static ImGuizmo::OPERATION mCurrentGizmoOperation(ImGuizmo::TRANSLATE);
@@ -386,11 +457,13 @@ void MainLoop(void* arg)
 
         if (ImGui::Combo("EnvMaps", &envMapIndex, envMapsList.data(), envMapsList.size()))
         {
+            renderer->WaitForCPUTile();
             scene->AddEnvMap(envMapPaths[envMapIndex]);
         }
 
         bool optionsChanged = false;
         bool reloadShaders = false;
+        bool threadsChanged = false;
 
         optionsChanged |= ImGui::SliderFloat("Mouse Sensitivity", &mouseSensitivity, 0.001f, 1.0f);
 
@@ -400,7 +473,27 @@ void MainLoop(void* arg)
             optionsChanged |= ImGui::SliderInt("Max Depth", &renderOptions.maxDepth, 1, 10);
 
             reloadShaders |= ImGui::Checkbox("Enable Russian Roulette", &renderOptions.enableRR);
-            reloadShaders |= ImGui::SliderInt("Russian Roulette Depth", &renderOptions.RRDepth, 1, 10);
+            optionsChanged |= ImGui::SliderInt("Russian Roulette Depth", &renderOptions.RRDepth, 1, 10);
+            reloadShaders |= ImGui::Checkbox("Power-Proportional Light Sampling", &renderOptions.enableLightPowerSampling);
+            reloadShaders |= ImGui::Checkbox("Enable ReSTIR Direct Lighting", &renderOptions.enableReSTIR);
+            optionsChanged |= ImGui::SliderInt("ReSTIR Candidates", &renderOptions.restirCandidates, 1, 32);
+            optionsChanged |= ImGui::SliderInt("ReSTIR Spatial Samples", &renderOptions.restirSpatialSamples, 0, 8);
+            // Without more than one sample per pass the tile shader is compiled without its sample loop
+            bool multiSample = renderOptions.samplesPerPass > 1 || renderOptions.enableAdaptiveTiles;
+            ImGui::Checkbox("Adaptive Tile Scheduling", &renderOptions.enableAdaptiveTiles);
+            ImGui::Checkbox("Dynamic Preview Resolution", &renderOptions.enableDynamicPreview);
+            ImGui::SliderFloat("Target Frame Time (ms)", &renderOptions.targetFrameTime, 4.0f, 200.0f);
+            reloadShaders |= ImGui::Checkbox("Reproject While Moving", &renderOptions.enableReprojection);
+            optionsChanged |= ImGui::SliderInt("Samples Per Pass", &renderOptions.samplesPerPass, 1, 16);
+            reloadShaders |= multiSample != (renderOptions.samplesPerPass > 1 || renderOptions.enableAdaptiveTiles);
+            reloadShaders |= ImGui::Checkbox("Adaptive Sampling", &renderOptions.enableAdaptiveSampling);
+            optionsChanged |= ImGui::SliderFloat("Adaptive Error Threshold", &renderOptions.adaptiveThreshold, 0.001f, 0.1f, "%.3f");
+            optionsChanged |= ImGui::SliderInt("Adaptive Min Spp", &renderOptions.adaptiveMinSpp, 1, 256);
+            reloadShaders |= ImGui::Checkbox("Wavefront Path Tracing (GL 4.3)", &renderOptions.enableWavefront);
+            ImGui::Checkbox("Sort Secondary Rays (Wavefront)", &renderOptions.enableRaySorting);
+            reloadShaders |= ImGui::Checkbox("Short BVH Traversal Stack", &renderOptions.enableShortStack);
+            reloadShaders |= ImGui::Checkbox("CPU Path Tracing", &renderOptions.enableCPURenderer);
+            threadsChanged = ImGui::SliderInt("CPU Threads (0 = all cores)", &renderOptions.cpuThreads, 0, 64);
         }
 
         if (ImGui::CollapsingHeader("Environment"))
@@ -408,9 +501,9 @@ void MainLoop(void* arg)
             reloadShaders |= ImGui::Checkbox("Enable Environment Map", &renderOptions.enableEnvMap);
             optionsChanged |= ImGui::SliderFloat("Enviornment Map Intensity", &renderOptions.envMapIntensity, 0.1f, 10.0f);
             optionsChanged |= ImGui::SliderFloat("Enviornment Map Rotation", &renderOptions.envMapRot, 0.0f, 360.0f);
-            reloadShaders |= ImGui::Checkbox("Enable Background", &renderOptions.enableBackground);
+            optionsChanged |= ImGui::Checkbox("Enable Background", &renderOptions.enableBackground);
             optionsChanged |= ImGui::ColorEdit3("Background Color", (float*)&renderOptions.backgroundCol, 0);
-            reloadShaders |= ImGui::Checkbox("Transparent Background", &renderOptions.transparentBackground);
+            optionsChanged |= ImGui::Checkbox("Transparent Background", &renderOptions.transparentBackground);
         }
 
         if (ImGui::CollapsingHeader("Tonemapping"))
@@ -428,7 +521,7 @@ void MainLoop(void* arg)
         if (ImGui::CollapsingHeader("Denoiser"))
         {
 
-            ImGui::Checkbox("Enable Denoiser", &renderOptions.enableDenoiser);
+            reloadShaders |= ImGui::Checkbox("Enable Denoiser", &renderOptions.enableDenoiser);
             ImGui::SliderInt("Number of Frames to skip", &renderOptions.denoiserFrameCnt, 5, 50);
         }
 
@@ -541,11 +634,23 @@ void MainLoop(void* arg)
             }
 
             if (objectPropChanged)
+            {
+                renderer->WaitForCPUTile();
                 scene->RebuildInstances();
+            }
         }
 
+        if (ImGui::CollapsingHeader("Profiler"))
+            ProfilerPanel();
+
         scene->renderOptions = renderOptions;
 
+        if (threadsChanged)
+        {
+            renderer->WaitForCPUTile();
+            TaskSystem::Get().SetThreadCount(renderOptions.cpuThreads);
+        }
+
         if (optionsChanged)
             scene->dirty = true;
 
@@ -566,12 +671,16 @@ void MainLoop(void* arg)
     glDisable(GL_DEPTH_TEST);
     Render();
     SDL_GL_SwapWindow(loopData.window);
+    frameCapture->Update();
+    Profiler::Get().EndFrame();
 }
 
 void Quit()
 {
+    delete frameCapture;
     delete renderer;
     delete scene;
+    Profiler::Get().StopCSV();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
@@ -582,22 +691,476 @@ void Quit()
     SDL_Quit();
 }
 
+struct BatchOptions
+{
+    bool headless = false;
+    std::string scenePath;
+    std::string outputPath = "render.png";
+    iVec2 resolution = iVec2(0, 0);
+    int spp = -1;
+    int maxDepth = -1;
+    int snapshotInterval = 0;
+    std::string profilePath;
+    std::string shaderCacheDir = "./shadercache/";
+    bool cpu = false;
+    int threads = -1;
+    int rayBenchmark = 0;
+};
+
+void PrintUsage(const char* exeName)
+{
+    printf("Usage: %s [--headless] [-s scene] [-r width height] [--spp n] [--depth n] [-o output.png] [--snapshot n] [--profile timings.csv] [--shader-cache dir | --no-shader-cache] [--cpu [threads]] [--threads n] [--raybench rays]\n", exeName);
+    printf("  --headless              render without a window until spp is reached, then write the output and exit\n");
+    printf("  -s, --scene <path>      scene to load (.scene, .gltf, .glb, .blend)\n");
+    printf("  -r, --resolution <w h>  render resolution, overrides the scene\n");
+    printf("  --spp <n>               samples per pixel, overrides maxSpp of the scene\n");
+    printf("  --depth <n>             max path depth, overrides the scene\n");
+    printf("  -o, --output <path>     output image for headless mode (png)\n");
+    printf("  --snapshot <n>          in headless mode, also write the image every n samples as <output>_<samples>.png\n");
+    printf("  --profile <path>        enable the profiler from startup and write per frame timings to a CSV file\n");
+    printf("  --shader-cache <dir>    directory for linked shader programs, so known variants skip compilation (default ./shadercache)\n");
+    printf("  --no-shader-cache       always compile shaders from source\n");
+    printf("  --cpu [threads]         path trace tiles on the CPU, with all cores unless a thread count is given.\n");
+    printf("                          With --headless, renders without OpenGL\n");
+    printf("  --threads <n>           threads for loading, BVH builds and CPU rendering, 0 uses all cores (default)\n");
+    printf("  --raybench <rays>       time the batched ray queries of the scene with this many camera and occlusion rays, then exit\n");
+}
+
+bool ParseArguments(int argc, char** argv, BatchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--headless")
+            options.headless = true;
+        else if ((arg == "-s" || arg == "--scene") && hasValue)
+            options.scenePath = argv[++i];
+        else if ((arg == "-o" || arg == "--output") && hasValue)
+            options.outputPath = argv[++i];
+        else if ((arg == "-r" || arg == "--resolution") && i + 2 < argc)
+        {
+            options.resolution.x = atoi(argv[++i]);
+            options.resolution.y = atoi(argv[++i]);
+        }
+        else if (arg == "--spp" && hasValue)
+            options.spp = atoi(argv[++i]);
+        else if (arg == "--depth" && hasValue)
+            options.maxDepth = atoi(argv[++i]);
+        else if (arg == "--snapshot" && hasValue)
+            options.snapshotInterval = atoi(argv[++i]);
+        else if (arg == "--profile" && hasValue)
+            options.profilePath = argv[++i];
+        else if (arg == "--shader-cache" && hasValue)
+            options.shaderCacheDir = argv[++i];
+        else if (arg == "--no-shader-cache")
+            options.shaderCacheDir.clear();
+        else if (arg == "--cpu")
+        {
+            options.cpu = true;
+            if (hasValue && isdigit(argv[i + 1][0]))
+                options.threads = atoi(argv[++i]);
+        }
+        else if (arg == "--threads" && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--raybench" && hasValue)
+            options.rayBenchmark = atoi(argv[++i]);
+        else
+        {
+            PrintUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options.headless && (options.scenePath.empty() || options.spp <= 0))
+    {
+        printf("Headless mode needs a scene (--scene) and a sample count (--spp)\n");
+        return false;
+    }
+
+    if (options.rayBenchmark > 0 && options.scenePath.empty())
+    {
+        printf("The ray benchmark needs a scene (--scene)\n");
+        return false;
+    }
+
+    return true;
+}
+
+void ApplyBatchOptions(const BatchOptions& options)
+{
+    if (options.resolution.x > 0 && options.resolution.y > 0)
+    {
+        renderOptions.renderResolution = options.resolution;
+        renderOptions.windowResolution = options.resolution;
+    }
+    if (options.maxDepth > 0)
+        renderOptions.maxDepth = options.maxDepth;
+    if (options.cpu)
+        renderOptions.enableCPURenderer = true;
+    if (options.threads >= 0)
+    {
+        renderOptions.cpuThreads = options.threads;
+        TaskSystem::Get().SetThreadCount(options.threads);
+    }
+    if (options.spp > 0)
+        renderOptions.maxSpp = options.spp;
+
+    scene->renderOptions = renderOptions;
+}
+
+// Renders a single frame offscreen without SDL, ImGui or vsync: Update/Render run back to back until maxSpp
+int RenderHeadless(const BatchOptions& options)
+{
+    HeadlessContext context;
+    if (!context.Create(3, 3))
+        return 1;
+
+    if (gl3wInit() != 0)
+    {
+        fprintf(stderr, "Failed to initialize OpenGL loader!\n");
+        return 1;
+    }
+    Program::InitParallelCompile();
+
+    InitRenderer();
+    frameCapture = new FrameCapture();
+
+    // Snapshots are named after the output, e.g. render_64.png
+    std::string snapshotPath = options.outputPath;
+    size_t extension = snapshotPath.rfind(".png");
+    if (extension != std::string::npos)
+        snapshotPath.erase(extension);
+    int lastSnapshot = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    int lastProgress = -1;
+    while (renderer->GetProgress() < 100.0f)
+    {
+        renderer->Update(0.0f);
+        renderer->Render();
+        frameCapture->Update();
+        Profiler::Get().EndFrame();
+
+        // The output texture holds every sample before the one in progress
+        int samples = renderer->GetSampleCount() - 1;
+        if (options.snapshotInterval > 0 && samples - lastSnapshot >= options.snapshotInterval && samples < options.spp)
+        {
+            SaveFrame(snapshotPath + "_" + to_string(samples) + ".png");
+            lastSnapshot = samples;
+        }
+
+        int progress = (int)renderer->GetProgress();
+        if (progress / 10 != lastProgress / 10)
+        {
+            printf("Progress: %d%%\n", progress);
+            lastProgress = progress;
+        }
+    }
+    glFinish();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    printf("Rendered %d spp in %.2fs\n", options.spp, seconds.count());
+
+    SaveFrame(options.outputPath);
+
+    // Everything was finished by glFinish, so the last GPU timings can be collected
+    Profiler::Get().EndFrame();
+
+    // Waits for the snapshots and the output to be written
+    delete frameCapture;
+    frameCapture = nullptr;
+
+    delete renderer;
+    delete scene;
+    renderer = nullptr;
+    scene = nullptr;
+    Profiler::Get().StopCSV();
+    return 0;
+}
+
+// Renders with the CPU path tracer and no OpenGL context at all, for render nodes without a GPU. Every pass covers the
+// whole image, the sums are averaged, denoised if the scene enables the denoiser, tonemapped and written out directly
+int RenderHeadlessCPU(const BatchOptions& options)
+{
+    scene->ProcessScene();
+
+    // Without a GPU to fall back to, what the CPU path tracer lacks is left out
+    bool media = false;
+    for (const Material& material : scene->materials)
+        media |= (int)material.mediumType != MediumType::None;
+    if (renderOptions.enableReSTIR || renderOptions.enableAdaptiveSampling || media)
+        printf("The CPU path tracer has no ReSTIR, adaptive sampling or media, they are left out\n");
+
+    int width = renderOptions.renderResolution.x;
+    int height = renderOptions.renderResolution.y;
+    CpuRenderer cpuRenderer(scene);
+    cpuRenderer.Resize(width, height);
+    RenderParams params = GetRenderParams(scene, renderOptions.renderResolution);
+
+    std::vector<float> average(cpuRenderer.color.size());
+    std::vector<float> albedo(cpuRenderer.albedo.size());
+    std::vector<float> normal(cpuRenderer.normal.size());
+    std::vector<unsigned char> pixels((size_t)width * height * 4);
+
+    auto saveImage = [&](const std::string& filename, int samples)
+    {
+        float scale = 1.0f / samples;
+        for (size_t i = 0; i < average.size(); i++)
+            average[i] = cpuRenderer.color[i] * scale;
+
+        if (renderOptions.enableDenoiser)
+        {
+            CPUProfileScope profile("Denoise");
+            for (size_t i = 0; i < albedo.size(); i++)
+            {
+                albedo[i] = cpuRenderer.albedo[i] * scale;
+                normal[i] = cpuRenderer.normal[i] * scale;
+            }
+            Denoiser::FilterImage(average.data(), albedo.data(), normal.data(), width, height);
+        }
+
+        CpuRenderer::Tonemap(average.data(), width, height, 1.0f, renderOptions, pixels.data());
+        if (stbi_write_png(filename.c_str(), width, height, 4, pixels.data(), width * 4))
+            printf("Frame saved: %s\n", filename.c_str());
+        else
+            printf("Unable to write %s\n", filename.c_str());
+    };
+
+    // Snapshots are named after the output, e.g. render_64.png
+    std::string snapshotPath = options.outputPath;
+    size_t extension = snapshotPath.rfind(".png");
+    if (extension != std::string::npos)
+        snapshotPath.erase(extension);
+    int lastSnapshot = 0;
+
+    // Passes are seeded like the tiles of the renderer, with a frame number per sample starting at 1
+    auto start = std::chrono::steady_clock::now();
+    int samplesPerPass = std::max(renderOptions.samplesPerPass, 1);
+    int lastProgress = -1;
+    for (int samples = 0; samples < options.spp;)
+    {
+        int passSamples = std::min(samplesPerPass, options.spp - samples);
+        {
+            CPUProfileScope profile("CPU Path Trace");
+            cpuRenderer.RenderTile(0, 0, width, height, params, samples + 1, passSamples);
+        }
+        samples += passSamples;
+        Profiler::Get().EndFrame();
+
+        if (options.snapshotInterval > 0 && samples - lastSnapshot >= options.snapshotInterval && samples < options.spp)
+        {
+            saveImage(snapshotPath + "_" + to_string(samples) + ".png", samples);
+            lastSnapshot = samples;
+        }
+
+        int progress = samples * 100 / options.spp;
+        if (progress / 10 != lastProgress / 10)
+        {
+            printf("Progress: %d%%\n", progress);
+            lastProgress = progress;
+        }
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    printf("Rendered %d spp in %.2fs\n", options.spp, seconds.count());
+
+    saveImage(options.outputPath, options.spp);
+
+    delete scene;
+    scene = nullptr;
+    Profiler::Get().StopCSV();
+    return 0;
+}
+
+// Times Scene::IntersectBatch and OccludedBatch without OpenGL, in packets and one ray at a time. Camera rays through a
+// grid of pixels are coherent, rays in random directions from where they hit are like ambient occlusion or baking rays
+int RayBenchmark(const BatchOptions& options)
+{
+    scene->ProcessScene();
+
+    int count = options.rayBenchmark;
+    float aspect = (float)renderOptions.renderResolution.x / renderOptions.renderResolution.y;
+    int width = std::max(1, (int)sqrtf(count * aspect));
+    int height = (count + width - 1) / width;
+    float scale = tanf(scene->camera->fov * 0.5f);
+
+    std::vector<float> rayData(count * 7);
+    float* origin[3] = { &rayData[0], &rayData[count], &rayData[count * 2] };
+    float* direction[3] = { &rayData[count * 3], &rayData[count * 4], &rayData[count * 5] };
+    float* tMax = &rayData[count * 6];
+
+    for (int i = 0; i < count; i++)
+    {
+        float dx = ((i % width) + 0.5f) / width * 2.0f - 1.0f;
+        float dy = ((i / width) + 0.5f) / height * 2.0f - 1.0f;
+        Vec3 dir = Vec3::Normalize(scene->camera->right * (dx * scale) + scene->camera->up * (dy * scale / aspect) + scene->camera->forward);
+        for (int c = 0; c < 3; c++)
+        {
+            origin[c][i] = scene->camera->position[c];
+            direction[c][i] = dir[c];
+        }
+        tMax[i] = INFINITY;
+    }
+
+    RayBatch rays = { count, { origin[0], origin[1], origin[2] }, { direction[0], direction[1], direction[2] }, nullptr };
+
+    std::vector<float> t(count), u(count), v(count), packetT(count), packetU(count), packetV(count);
+    std::vector<int> instance(count), primitive(count), packetInstance(count), packetPrimitive(count);
+    bool* occluded = new bool[count];
+    bool* packetOccluded = new bool[count];
+    HitBatch hits = { t.data(), instance.data(), primitive.data(), u.data(), v.data() };
+    HitBatch packetHits = { packetT.data(), packetInstance.data(), packetPrimitive.data(), packetU.data(), packetV.data() };
+
+    // Runs a query and prints its throughput
+    auto measure = [&](const char* name, std::function<void()> query)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        query();
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        printf("  %-10s %8.2f Mrays/s\n", name, count / seconds * 1e-6);
+    };
+
+    // Differences between packets and single rays. Hit distances are computed the same way, so they have to match
+    // exactly. Only ties (rays through a shared edge) may report another triangle
+    auto compareHits = [&]()
+    {
+        int hitCount = 0, distances = 0, triangles = 0;
+        for (int i = 0; i < count; i++)
+        {
+            hitCount += instance[i] != -1;
+            distances += t[i] != packetT[i];
+            triangles += instance[i] != packetInstance[i] || primitive[i] != packetPrimitive[i];
+        }
+        printf("  %d hits, %d distances and %d triangles differ between packets and single rays\n", hitCount, distances, triangles);
+    };
+
+    auto compareOccluded = [&]()
+    {
+        int occludedCount = 0, differences = 0;
+        for (int i = 0; i < count; i++)
+        {
+            occludedCount += occluded[i];
+            differences += occluded[i] != packetOccluded[i];
+        }
+        printf("  %d occluded, %d differ between packets and single rays\n", occludedCount, differences);
+    };
+
+    printf("Camera rays (%d), closest hit\n", count);
+    measure("packets", [&]() { scene->IntersectBatch(rays, packetHits, true); });
+    measure("single", [&]() { scene->IntersectBatch(rays, hits, false); });
+    compareHits();
+
+    // Occlusion rays of the camera rays towards their hit points, ending just before them
+    for (int i = 0; i < count; i++)
+        tMax[i] = t[i] == INFINITY ? INFINITY : t[i] * 0.999f;
+    rays.tMax = tMax;
+
+    printf("Camera rays (%d), occlusion up to the hit\n", count);
+    measure("packets", [&]() { scene->OccludedBatch(rays, packetOccluded, true); });
+    measure("single", [&]() { scene->OccludedBatch(rays, occluded, false); });
+    compareOccluded();
+
+    // Random directions from the hit points, or from the camera for rays that missed, reaching a fifth of the scene
+    float radius = Vec3::Length(scene->sceneBounds.extents()) * 0.2f;
+    srand(1);
+    for (int i = 0; i < count; i++)
+    {
+        if (t[i] != INFINITY)
+        {
+            for (int c = 0; c < 3; c++)
+                origin[c][i] += direction[c][i] * t[i] * 0.999f;
+        }
+
+        Vec3 dir;
+        do
+            dir = Vec3((float)rand() / RAND_MAX * 2.0f - 1.0f, (float)rand() / RAND_MAX * 2.0f - 1.0f, (float)rand() / RAND_MAX * 2.0f - 1.0f);
+        while (Vec3::Length(dir) > 1.0f || Vec3::Length(dir) < 0.01f);
+        dir = Vec3::Normalize(dir);
+
+        for (int c = 0; c < 3; c++)
+            direction[c][i] = dir[c];
+        tMax[i] = radius;
+    }
+
+    printf("Random rays (%d), closest hit\n", count);
+    measure("packets", [&]() { scene->IntersectBatch(rays, packetHits, true); });
+    measure("single", [&]() { scene->IntersectBatch(rays, hits, false); });
+    compareHits();
+
+    printf("Random rays (%d), occlusion\n", count);
+    measure("packets", [&]() { scene->OccludedBatch(rays, packetOccluded, true); });
+    measure("single", [&]() { scene->OccludedBatch(rays, occluded, false); });
+    compareOccluded();
+
+    delete[] occluded;
+    delete[] packetOccluded;
+    delete scene;
+    scene = nullptr;
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     srand((unsigned int)time(0));
 
+    BatchOptions batchOptions;
+    if (!ParseArguments(argc, argv, batchOptions))
+        return 1;
+
+    // Enabled before anything is loaded so scene processing and shader compiles are captured too
+    if (!batchOptions.profilePath.empty())
+    {
+        Profiler::Get().SetEnabled(true);
+        Profiler::Get().StartCSV(batchOptions.profilePath);
+    }
+
+    ProgramCache::Get().SetDirectory(batchOptions.shaderCacheDir);
+
+    // Scenes are loaded before the batch options are applied to the render options, so loading gets the thread count here
+    if (batchOptions.threads >= 0)
+        TaskSystem::Get().SetThreadCount(batchOptions.threads);
+
+    if (batchOptions.rayBenchmark > 0)
+    {
+        LoadScene(batchOptions.scenePath);
+        ApplyBatchOptions(batchOptions);
+        return RayBenchmark(batchOptions);
+    }
+
+    if (batchOptions.headless)
+    {
+        GetEnvMaps();
+        LoadScene(batchOptions.scenePath);
+        ApplyBatchOptions(batchOptions);
+
+        // CPU renders need no GPU, so they do not create a context either
+        if (batchOptions.cpu)
+            return RenderHeadlessCPU(batchOptions);
+        return RenderHeadless(batchOptions);
+    }
+
     // step 1: read all scenes and environment maps
     GetSceneFiles();
     GetEnvMaps();
 
-    // step 2: load a default scene indexed by selectedSceneIndex
-    LoadScene(scenePaths[selectedSceneIndex]);
+    // step 2: load the scene given on the command line, or a default scene indexed by selectedSceneIndex
+    if (!batchOptions.scenePath.empty())
+    {
+        LoadScene(batchOptions.scenePath);
+        auto it = std::find(scenePaths.begin(), scenePaths.end(), batchOptions.scenePath);
+        if (it != scenePaths.end())
+            selectedSceneIndex = int(it - scenePaths.begin());
+    }
+    else
+        LoadScene(scenePaths[selectedSceneIndex]);
+    ApplyBatchOptions(batchOptions);
 
     // step 3: Initializations and setups
     SimpleDirectMediaSetup();
     ImGuiSetup();
     InitOpenGLLoader();
     InitRenderer();
+    frameCapture = new FrameCapture();
 
     // step 4: loop for imgui display
     while (!done)
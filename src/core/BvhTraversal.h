@@ -0,0 +1,280 @@
+
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "bvh_translator.h"
+#include "Mat4.h"
+#include "Vec3.h"
+#include "Vec3A.h"
+#include "Vec4.h"
+
+// Walking the flattened two level BVH (BvhTranslator::nodes) on the CPU, shared by CpuRenderer and the batched ray
+// queries of Scene. Node layout and traversal order follow closest_hit.glsl and anyhit.glsl
+namespace PathTracer
+{
+    struct Ray
+    {
+        Vec3 origin;
+        Vec3 direction;
+    };
+
+    // Columns of the matrix are data[0..3], like mat4(r1, r2, r3, r4) in the shaders
+    inline Vec3 TransformPoint(const Mat4& m, const Vec3& p)
+    {
+        return Vec3(m.data[0][0] * p.x + m.data[1][0] * p.y + m.data[2][0] * p.z + m.data[3][0],
+                    m.data[0][1] * p.x + m.data[1][1] * p.y + m.data[2][1] * p.z + m.data[3][1],
+                    m.data[0][2] * p.x + m.data[1][2] * p.y + m.data[2][2] * p.z + m.data[3][2]);
+    }
+
+    inline Vec3 TransformVector(const Mat4& m, const Vec3& v)
+    {
+        return Vec3(m.data[0][0] * v.x + m.data[1][0] * v.y + m.data[2][0] * v.z,
+                    m.data[0][1] * v.x + m.data[1][1] * v.y + m.data[2][1] * v.z,
+                    m.data[0][2] * v.x + m.data[1][2] * v.y + m.data[2][2] * v.z);
+    }
+
+    // transpose(inverse(mat3(transform))) * n, given the inverse of the transform
+    inline Vec3 TransformNormal(const Mat4& inv, const Vec3& n)
+    {
+        return Vec3(inv.data[0][0] * n.x + inv.data[0][1] * n.y + inv.data[0][2] * n.z,
+                    inv.data[1][0] * n.x + inv.data[1][1] * n.y + inv.data[1][2] * n.z,
+                    inv.data[2][0] * n.x + inv.data[2][1] * n.y + inv.data[2][2] * n.z);
+    }
+
+    // Ray with the reciprocal direction for box tests. With SSE, both children of a node are tested at once:
+    // the four corners (left min, right min, left max, right max) are transposed into one register per axis
+    struct BoxRay
+    {
+        BoxRay(const Ray& r)
+        {
+            origin = r.origin;
+            invDir = Vec3(1.0f / r.direction.x, 1.0f / r.direction.y, 1.0f / r.direction.z);
+#ifdef MATH_SIMD_SSE
+            for (int i = 0; i < 3; i++)
+            {
+                originSSE[i] = _mm_set1_ps(origin[i]);
+                invDirSSE[i] = _mm_set1_ps(invDir[i]);
+            }
+#endif
+        }
+
+        Vec3 origin;
+        Vec3 invDir;
+#ifdef MATH_SIMD_SSE
+        __m128 originSSE[3];
+        __m128 invDirSSE[3];
+#endif
+    };
+
+    // Child boxes a ray hits. order is the result of AABBIntersect() in the shaders (entry distance, exit distance
+    // from inside, -1 on a miss) and picks the child visited first. entry is where the ray enters the box, 0 from
+    // inside. Unlike the shaders, boxes entered at or beyond tMax (the closest hit so far) count as missed
+    struct ChildHits
+    {
+        float order[2];
+        float entry[2];
+    };
+
+    inline void BoxHit(float t0, float t1, float tMax, float& order, float& entry)
+    {
+        entry = std::max(t0, 0.0f);
+        order = (t1 >= t0 && entry < tMax) ? (t0 > 0.0f ? t0 : t1) : -1.0f;
+    }
+
+    inline void IntersectChildren(const RadeonRays::BvhTranslator::Node& left, const RadeonRays::BvhTranslator::Node& right,
+                                  const BoxRay& r, float tMax, ChildHits& hits)
+    {
+#ifdef MATH_SIMD_SSE
+        // Node is bboxmin, parent, bboxmax, pad, so the corners load as four floats each
+        __m128 row0 = _mm_loadu_ps(&left.bboxmin.x);
+        __m128 row1 = _mm_loadu_ps(&right.bboxmin.x);
+        __m128 row2 = _mm_loadu_ps(&left.bboxmax.x);
+        __m128 row3 = _mm_loadu_ps(&right.bboxmax.x);
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        __m128 axes[3] = { row0, row1, row2 };
+
+        __m128 t0 = _mm_set1_ps(-INFINITY);
+        __m128 t1 = _mm_set1_ps(INFINITY);
+        for (int i = 0; i < 3; i++)
+        {
+            // Lanes are (left min, right min, left max, right max), swapping the halves pairs min with max
+            __m128 t = _mm_mul_ps(_mm_sub_ps(axes[i], r.originSSE[i]), r.invDirSSE[i]);
+            __m128 swapped = _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2));
+            t0 = _mm_max_ps(t0, _mm_min_ps(t, swapped));
+            t1 = _mm_min_ps(t1, _mm_max_ps(t, swapped));
+        }
+
+        float near[4], far[4];
+        _mm_storeu_ps(near, t0);
+        _mm_storeu_ps(far, t1);
+        for (int i = 0; i < 2; i++)
+            BoxHit(near[i], far[i], tMax, hits.order[i], hits.entry[i]);
+#else
+        const RadeonRays::BvhTranslator::Node* children[2] = { &left, &right };
+        for (int c = 0; c < 2; c++)
+        {
+            float t0 = -INFINITY, t1 = INFINITY;
+            for (int i = 0; i < 3; i++)
+            {
+                float f = (children[c]->bboxmax[i] - r.origin[i]) * r.invDir[i];
+                float n = (children[c]->bboxmin[i] - r.origin[i]) * r.invDir[i];
+                t0 = std::max(t0, std::min(f, n));
+                t1 = std::min(t1, std::max(f, n));
+            }
+            BoxHit(t0, t1, tMax, hits.order[c], hits.entry[c]);
+        }
+#endif
+    }
+
+    // Ray/triangle test of closest_hit.glsl. u and v weight the second and third vertex
+    inline bool IntersectTriangle(const Ray& r, const Vec4& v0, const Vec4& v1, const Vec4& v2, float& t, float& u, float& v)
+    {
+        Vec3 e0 = Vec3(v1) - Vec3(v0);
+        Vec3 e1 = Vec3(v2) - Vec3(v0);
+        Vec3 pv = Vec3::Cross(r.direction, e1);
+        float det = Vec3::Dot(e0, pv);
+
+        Vec3 tv = r.origin - Vec3(v0);
+        Vec3 qv = Vec3::Cross(tv, e0);
+
+        u = Vec3::Dot(tv, pv) / det;
+        v = Vec3::Dot(r.direction, qv) / det;
+        t = Vec3::Dot(e1, qv) / det;
+
+        return u >= 0.0f && v >= 0.0f && t >= 0.0f && 1.0f - u - v >= 0.0f;
+    }
+
+    // Stack of deferred nodes. The BVH builder has no depth limit, so entries past the fixed part spill to the heap
+    // instead of overrunning it
+    template <typename T, int N>
+    class TraversalStack
+    {
+    public:
+        TraversalStack() : size(0) {}
+
+        void Push(const T& entry)
+        {
+            if (size < N)
+                fixed[size] = entry;
+            else
+                spill.push_back(entry);
+            size++;
+        }
+
+        T Pop()
+        {
+            size--;
+            if (size < N)
+                return fixed[size];
+            T entry = spill.back();
+            spill.pop_back();
+            return entry;
+        }
+
+    private:
+        T fixed[N];
+        std::vector<T> spill;
+        int size;
+    };
+
+    // Walks the two level BVH from the root of the TLAS. visitLeaf(first, count, instance, matID, rTrans) gets the tris
+    // of every BLAS leaf the ray reaches and the ray in the space of the instance, and returns true to stop. Nodes the
+    // ray enters beyond tMax are skipped, it may shrink while the BVH is walked
+    template <typename LeafFunc>
+    void TraverseBVH(const RadeonRays::BvhTranslator::Node* nodes, int root, const Mat4* inverseTransforms,
+                     const Ray& r, const float& tMax, LeafFunc visitLeaf)
+    {
+        // Deferred children with the distance the ray enters them. A -1 marker separates the BLAS entries
+        struct StackEntry
+        {
+            int index;
+            float entry;
+        };
+        TraversalStack<StackEntry, 128> stack;
+        stack.Push({ -1, 0.0f });
+
+        int index = root;
+        int instance = -1;
+        int matID = 0;
+        bool BLAS = false;
+
+        Ray rTrans = r;
+        BoxRay boxRay(rTrans);
+
+        while (index != -1)
+        {
+            const RadeonRays::BvhTranslator::Node& node = nodes[index];
+            int leftIndex = (int)node.LRLeaf.x;
+            int rightIndex = (int)node.LRLeaf.y;
+            int leaf = (int)node.LRLeaf.z;
+
+            if (leaf > 0) // Leaf node of BLAS
+            {
+                if (visitLeaf(leftIndex, rightIndex, instance, matID, rTrans))
+                    return;
+            }
+            else if (leaf < 0) // Leaf node of TLAS
+            {
+                instance = -leaf - 1;
+                const Mat4& inv = inverseTransforms[instance];
+                rTrans.origin = TransformPoint(inv, r.origin);
+                rTrans.direction = TransformVector(inv, r.direction);
+                boxRay = BoxRay(rTrans);
+
+                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
+                stack.Push({ -1, 0.0f });
+                index = leftIndex;
+                BLAS = true;
+                matID = rightIndex;
+                continue;
+            }
+            else
+            {
+                ChildHits hits;
+                IntersectChildren(nodes[leftIndex], nodes[rightIndex], boxRay, tMax, hits);
+
+                if (hits.order[0] > 0.0f && hits.order[1] > 0.0f)
+                {
+                    // Nearer child first, the other one is deferred
+                    int far = hits.order[0] > hits.order[1] ? 0 : 1;
+                    index = far == 0 ? rightIndex : leftIndex;
+                    stack.Push({ far == 0 ? leftIndex : rightIndex, hits.entry[far] });
+                    continue;
+                }
+                else if (hits.order[0] > 0.0f)
+                {
+                    index = leftIndex;
+                    continue;
+                }
+                else if (hits.order[1] > 0.0f)
+                {
+                    index = rightIndex;
+                    continue;
+                }
+            }
+
+            // Resume with the last deferred child the ray enters before the closest hit found since it was pushed.
+            // If we've traversed the entire BLAS then switch back to TLAS and resume where we left off
+            while (true)
+            {
+                StackEntry next = stack.Pop();
+                if (next.index == -1 && BLAS)
+                {
+                    BLAS = false;
+                    rTrans = r;
+                    boxRay = BoxRay(rTrans);
+                    continue;
+                }
+
+                if (next.index == -1 || next.entry < tMax)
+                {
+                    index = next.index;
+                    break;
+                }
+            }
+        }
+    }
+}
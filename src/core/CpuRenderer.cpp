@@ -0,0 +1,1568 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include "CpuRenderer.h"
+#include "BvhTraversal.h"
+#include "Scene.h"
+#include "TaskSystem.h"
+
+namespace PathTracer
+{
+    namespace
+    {
+        // Constants and structures of shaders/common/globals.glsl
+        const float INV_PI = 0.31830988618379067f;
+        const float TWO_PI = 6.28318530717958648f;
+        const float INV_TWO_PI = 0.15915494309189533f;
+        const float EPS = 0.0003f;
+        const float INF = 1000000.0f;
+
+        const int BLOCK_SIZE = 16;
+
+        struct MaterialParams
+        {
+            Vec3 baseColor;
+            float opacity;
+            int alphaMode;
+            float alphaCutoff;
+            Vec3 emission;
+            float anisotropic;
+            float metallic;
+            float roughness;
+            float subsurface;
+            float specularTint;
+            float sheen;
+            float sheenTint;
+            float clearcoat;
+            float clearcoatRoughness;
+            float specTrans;
+            float ior;
+            float ax;
+            float ay;
+        };
+
+        struct State
+        {
+            int depth;
+            float eta;
+            float hitDist;
+
+            Vec3 fhp;
+            Vec3 normal;
+            Vec3 ffnormal;
+            Vec3 tangent;
+            Vec3 bitangent;
+
+            bool isEmitter;
+
+            float texCoord[2];
+            int matID;
+            MaterialParams mat;
+        };
+
+        struct ScatterSampleRec
+        {
+            Vec3 L;
+            Vec3 f;
+            float pdf;
+        };
+
+        struct LightSampleRec
+        {
+            Vec3 normal;
+            Vec3 emission;
+            Vec3 direction;
+            float dist;
+            float pdf;
+        };
+
+        inline Vec3 Neg(const Vec3& a) { return Vec3(-a.x, -a.y, -a.z); }
+        inline Vec3 Div(const Vec3& a, float b) { return Vec3(a.x / b, a.y / b, a.z / b); }
+        inline Vec3 Mix(const Vec3& a, const Vec3& b, float t) { return a + (b - a) * t; }
+        inline float Mix(float a, float b, float t) { return a + (b - a) * t; }
+        inline float Luminance(const Vec3& c) { return 0.212671f * c.x + 0.715160f * c.y + 0.072169f * c.z; }
+        inline float Clamp01(float x) { return std::min(std::max(x, 0.0f), 1.0f); }
+
+        inline Vec3 Reflect(const Vec3& I, const Vec3& N)
+        {
+            return I - N * (2.0f * Vec3::Dot(N, I));
+        }
+
+        inline Vec3 Refract(const Vec3& I, const Vec3& N, float eta)
+        {
+            float NDotI = Vec3::Dot(N, I);
+            float k = 1.0f - eta * eta * (1.0f - NDotI * NDotI);
+            if (k < 0.0f)
+                return Vec3();
+            return I * eta - N * (eta * NDotI + sqrtf(k));
+        }
+
+        // pcg4d of globals.glsl, seeded the same way
+        struct Rng
+        {
+            Rng(int x, int y, int frame)
+            {
+                v[0] = (uint32_t)x;
+                v[1] = (uint32_t)y;
+                v[2] = (uint32_t)frame;
+                v[3] = (uint32_t)x + (uint32_t)y;
+            }
+
+            float Next()
+            {
+                for (int i = 0; i < 4; i++)
+                    v[i] = v[i] * 1664525u + 1013904223u;
+                v[0] += v[1] * v[3]; v[1] += v[2] * v[0]; v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+                for (int i = 0; i < 4; i++)
+                    v[i] ^= v[i] >> 16u;
+                v[0] += v[1] * v[3]; v[1] += v[2] * v[0]; v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+                return (float)v[0] / (float)0xffffffffu;
+            }
+
+            uint32_t v[4];
+        };
+
+        // Sampling functions of shaders/common/sampling.glsl
+        float GTR1(float NDotH, float a)
+        {
+            if (a >= 1.0f)
+                return INV_PI;
+            float a2 = a * a;
+            float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+            return (a2 - 1.0f) / (PI * logf(a2) * t);
+        }
+
+        Vec3 SampleGTR1(float rgh, float r1, float r2)
+        {
+            float a = std::max(0.001f, rgh);
+            float a2 = a * a;
+
+            float phi = r1 * TWO_PI;
+
+            float cosTheta = sqrtf((1.0f - powf(a2, 1.0f - r2)) / (1.0f - a2));
+            float sinTheta = Clamp01(sqrtf(1.0f - (cosTheta * cosTheta)));
+
+            return Vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+        }
+
+        Vec3 SampleGGXVNDF(const Vec3& V, float ax, float ay, float r1, float r2)
+        {
+            Vec3 Vh = Vec3::Normalize(Vec3(ax * V.x, ay * V.y, V.z));
+
+            float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+            Vec3 T1 = lensq > 0.0f ? Vec3(-Vh.y, Vh.x, 0.0f) * (1.0f / sqrtf(lensq)) : Vec3(1.0f, 0.0f, 0.0f);
+            Vec3 T2 = Vec3::Cross(Vh, T1);
+
+            float r = sqrtf(r1);
+            float phi = 2.0f * PI * r2;
+            float t1 = r * cosf(phi);
+            float t2 = r * sinf(phi);
+            float s = 0.5f * (1.0f + Vh.z);
+            t2 = (1.0f - s) * sqrtf(1.0f - t1 * t1) + s * t2;
+
+            Vec3 Nh = T1 * t1 + T2 * t2 + Vh * sqrtf(std::max(0.0f, 1.0f - t1 * t1 - t2 * t2));
+
+            return Vec3::Normalize(Vec3(ax * Nh.x, ay * Nh.y, std::max(0.0f, Nh.z)));
+        }
+
+        float GTR2Aniso(float NDotH, float HDotX, float HDotY, float ax, float ay)
+        {
+            float a = HDotX / ax;
+            float b = HDotY / ay;
+            float c = a * a + b * b + NDotH * NDotH;
+            return 1.0f / (PI * ax * ay * c * c);
+        }
+
+        float SmithG(float NDotV, float alphaG)
+        {
+            float a = alphaG * alphaG;
+            float b = NDotV * NDotV;
+            return (2.0f * NDotV) / (NDotV + sqrtf(a + b - a * b));
+        }
+
+        float SmithGAniso(float NDotV, float VDotX, float VDotY, float ax, float ay)
+        {
+            float a = VDotX * ax;
+            float b = VDotY * ay;
+            float c = NDotV;
+            return (2.0f * NDotV) / (NDotV + sqrtf(a * a + b * b + c * c));
+        }
+
+        float SchlickWeight(float u)
+        {
+            float m = Clamp01(1.0f - u);
+            float m2 = m * m;
+            return m2 * m2 * m;
+        }
+
+        float DielectricFresnel(float cosThetaI, float eta)
+        {
+            float sinThetaTSq = eta * eta * (1.0f - cosThetaI * cosThetaI);
+
+            // Total internal reflection
+            if (sinThetaTSq > 1.0f)
+                return 1.0f;
+
+            float cosThetaT = sqrtf(std::max(1.0f - sinThetaTSq, 0.0f));
+
+            float rs = (eta * cosThetaT - cosThetaI) / (eta * cosThetaT + cosThetaI);
+            float rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+
+            return 0.5f * (rs * rs + rp * rp);
+        }
+
+        Vec3 CosineSampleHemisphere(float r1, float r2)
+        {
+            Vec3 dir;
+            float r = sqrtf(r1);
+            float phi = TWO_PI * r2;
+            dir.x = r * cosf(phi);
+            dir.y = r * sinf(phi);
+            dir.z = sqrtf(std::max(0.0f, 1.0f - dir.x * dir.x - dir.y * dir.y));
+            return dir;
+        }
+
+        Vec3 UniformSampleHemisphere(float r1, float r2)
+        {
+            float r = sqrtf(std::max(0.0f, 1.0f - r1 * r1));
+            float phi = TWO_PI * r2;
+            return Vec3(r * cosf(phi), r * sinf(phi), r1);
+        }
+
+        float PowerHeuristic(float a, float b)
+        {
+            float t = a * a;
+            return t / (b * b + t);
+        }
+
+        void Onb(const Vec3& N, Vec3& T, Vec3& B)
+        {
+            Vec3 up = fabsf(N.z) < 0.9999999f ? Vec3(0.0f, 0.0f, 1.0f) : Vec3(1.0f, 0.0f, 0.0f);
+            T = Vec3::Normalize(Vec3::Cross(up, N));
+            B = Vec3::Cross(N, T);
+        }
+
+        inline Vec3 ToWorld(const Vec3& X, const Vec3& Y, const Vec3& Z, const Vec3& V)
+        {
+            return X * V.x + Y * V.y + Z * V.z;
+        }
+
+        inline Vec3 ToLocal(const Vec3& X, const Vec3& Y, const Vec3& Z, const Vec3& V)
+        {
+            return Vec3(Vec3::Dot(V, X), Vec3::Dot(V, Y), Vec3::Dot(V, Z));
+        }
+
+        // Intersection functions of shaders/common/intersection.glsl
+        float SphereIntersect(float rad, const Vec3& pos, const Ray& r)
+        {
+            Vec3 op = pos - r.origin;
+            float eps = 0.001f;
+            float b = Vec3::Dot(op, r.direction);
+            float det = b * b - Vec3::Dot(op, op) + rad * rad;
+            if (det < 0.0f)
+                return INF;
+
+            det = sqrtf(det);
+            float t1 = b - det;
+            if (t1 > eps)
+                return t1;
+
+            float t2 = b + det;
+            if (t2 > eps)
+                return t2;
+
+            return INF;
+        }
+
+        float RectIntersect(const Vec3& pos, const Vec3& u, const Vec3& v, const Vec3& n, float planeDist, const Ray& r)
+        {
+            float dt = Vec3::Dot(r.direction, n);
+            float t = (planeDist - Vec3::Dot(n, r.origin)) / dt;
+
+            if (t > EPS)
+            {
+                Vec3 p = r.origin + r.direction * t;
+                Vec3 vi = p - pos;
+                float a1 = Vec3::Dot(u, vi);
+                if (a1 >= 0.0f && a1 <= 1.0f)
+                {
+                    float a2 = Vec3::Dot(v, vi);
+                    if (a2 >= 0.0f && a2 <= 1.0f)
+                        return t;
+                }
+            }
+
+            return INF;
+        }
+
+        // Everything one tile needs: scene data and the uniforms of the path tracing shaders. Functions follow their GLSL
+        // counterparts
+        class PathTracerCPU
+        {
+        public:
+            PathTracerCPU(Scene* scene, const RenderParams& params, const RenderOptions& options, const Material* materials)
+                : rays(0)
+                , scene(scene)
+                , params(params)
+                , options(options)
+                , materials(materials)
+                , nodes(scene->bvhTranslator.nodes.data())
+                , inverseTransforms(scene->inverseTransforms.data())
+            {
+                numOfLights = (int)scene->lights.size();
+                enableEnvMap = options.enableEnvMap && scene->envMap != nullptr;
+            }
+
+            Vec4 PathTrace(Ray r, Rng& rng, Vec3& aovAlbedo, Vec3& aovNormal);
+            Ray CameraRay(float px, float py, Rng& rng);
+
+            long long rays;
+
+        private:
+            // Ray/triangle test against triangle tri of vertIndices
+            bool IntersectTriangle(const Ray& r, int tri, float& t, float& u, float& v)
+            {
+                const iVec3& vertIndices = scene->vertIndices[tri];
+                return PathTracer::IntersectTriangle(r, scene->vertexXYZU[vertIndices.x], scene->vertexXYZU[vertIndices.y],
+                                                     scene->vertexXYZU[vertIndices.z], t, u, v);
+            }
+
+            bool ClosestHit(const Ray& r, State& state, LightSampleRec& lightSample);
+            bool AnyHit(const Ray& r, float maxDist, Rng& rng);
+            void GetMaterial(State& state, const Ray& r);
+            Vec3 DirectLight(const Ray& r, const State& state, Rng& rng);
+            Vec3 DisneySample(const State& state, Vec3 V, const Vec3& N, Vec3& L, float& pdf, Rng& rng);
+            Vec3 DisneyEval(const State& state, Vec3 V, const Vec3& N, Vec3 L, float& pdf);
+            Vec4 SampleTexture(int id, float u, float v);
+            Vec3 SampleEnvMapTexture(float u, float v);
+            Vec4 EvalEnvMap(const Ray& r);
+            Vec4 SampleEnvMap(Vec3& color, Rng& rng);
+            void SampleOneLight(const Light& light, const Vec3& scatterPos, LightSampleRec& lightSample, Rng& rng);
+            float LightSelectPdf(int lightIndex);
+            int SampleLightIndex(Rng& rng);
+
+            Scene* scene;
+            const RenderParams& params;
+            const RenderOptions& options;
+            const Material* materials;
+            const RadeonRays::BvhTranslator::Node* nodes;
+            const Mat4* inverseTransforms;
+            int numOfLights;
+            bool enableEnvMap;
+        };
+
+        Ray PathTracerCPU::CameraRay(float px, float py, Rng& rng)
+        {
+            float r1 = 2.0f * rng.Next();
+            float r2 = 2.0f * rng.Next();
+
+            float jitterX = r1 < 1.0f ? sqrtf(r1) - 1.0f : 1.0f - sqrtf(2.0f - r1);
+            float jitterY = r2 < 1.0f ? sqrtf(r2) - 1.0f : 1.0f - sqrtf(2.0f - r2);
+
+            jitterX /= (params.resolution.x * 0.5f);
+            jitterY /= (params.resolution.y * 0.5f);
+            float dx = (px / params.resolution.x * 2.0f - 1.0f) + jitterX;
+            float dy = (py / params.resolution.y * 2.0f - 1.0f) + jitterY;
+
+            float scale = tanf(params.cameraFov * 0.5f);
+            dy *= params.resolution.y / params.resolution.x * scale;
+            dx *= scale;
+            Vec3 rayDir = Vec3::Normalize(params.cameraRight * dx + params.cameraUp * dy + params.cameraForward);
+
+            Vec3 focalPoint = rayDir * params.cameraFocalDist;
+            float camR1 = rng.Next() * TWO_PI;
+            float camR2 = rng.Next() * params.cameraAperture;
+            Vec3 randomAperturePos = (params.cameraRight * cosf(camR1) + params.cameraUp * sinf(camR1)) * sqrtf(camR2);
+            Vec3 finalRayDir = Vec3::Normalize(focalPoint - randomAperturePos);
+
+            Ray ray = { params.cameraPosition + randomAperturePos, finalRayDir };
+            return ray;
+        }
+
+        // Bilinear lookup with repeat wrapping, like sampling textureMapsArrayTexture
+        Vec4 PathTracerCPU::SampleTexture(int id, float u, float v)
+        {
+            int w = options.textureWidth;
+            int h = options.textureHeight;
+            const unsigned char* data = &scene->textureMapsArray[(size_t)id * w * h * 4];
+
+            float x = u * w - 0.5f;
+            float y = v * h - 0.5f;
+            float fx = floorf(x);
+            float fy = floorf(y);
+            float tx = x - fx;
+            float ty = y - fy;
+
+            int x0 = (int)fx % w, y0 = (int)fy % h;
+            x0 = x0 < 0 ? x0 + w : x0;
+            y0 = y0 < 0 ? y0 + h : y0;
+            int x1 = (x0 + 1) % w, y1 = (y0 + 1) % h;
+
+            const unsigned char* t00 = &data[(y0 * w + x0) * 4];
+            const unsigned char* t10 = &data[(y0 * w + x1) * 4];
+            const unsigned char* t01 = &data[(y1 * w + x0) * 4];
+            const unsigned char* t11 = &data[(y1 * w + x1) * 4];
+
+            float out[4];
+            for (int i = 0; i < 4; i++)
+                out[i] = Mix(Mix(t00[i], t10[i], tx), Mix(t01[i], t11[i], tx), ty) / 255.0f;
+            return Vec4(out[0], out[1], out[2], out[3]);
+        }
+
+        Vec3 PathTracerCPU::SampleEnvMapTexture(float u, float v)
+        {
+            const EnvironmentMap* envMap = scene->envMap;
+            int w = envMap->width;
+            int h = envMap->height;
+
+            float x = u * w - 0.5f;
+            float y = v * h - 0.5f;
+            float fx = floorf(x);
+            float fy = floorf(y);
+            float tx = x - fx;
+            float ty = y - fy;
+
+            int x0 = (int)fx % w, y0 = (int)fy % h;
+            x0 = x0 < 0 ? x0 + w : x0;
+            y0 = y0 < 0 ? y0 + h : y0;
+            int x1 = (x0 + 1) % w, y1 = (y0 + 1) % h;
+
+            const float* t00 = &envMap->img[(y0 * w + x0) * 3];
+            const float* t10 = &envMap->img[(y0 * w + x1) * 3];
+            const float* t01 = &envMap->img[(y1 * w + x0) * 3];
+            const float* t11 = &envMap->img[(y1 * w + x1) * 3];
+
+            float out[3];
+            for (int i = 0; i < 3; i++)
+                out[i] = Mix(Mix(t00[i], t10[i], tx), Mix(t01[i], t11[i], tx), ty);
+            return Vec3(out[0], out[1], out[2]);
+        }
+
+        Vec4 PathTracerCPU::EvalEnvMap(const Ray& r)
+        {
+            float theta = acosf(std::min(std::max(r.direction.y, -1.0f), 1.0f));
+            float u = (PI + atan2f(r.direction.z, r.direction.x)) * INV_TWO_PI + params.envMapRot;
+            float v = theta * INV_PI;
+
+            Vec3 color = SampleEnvMapTexture(u, v);
+            float pdf = Luminance(color) / params.envMapTotalSum;
+
+            return Vec4(color.x, color.y, color.z, (pdf * params.envMapRes.x * params.envMapRes.y) / (TWO_PI * PI * sinf(theta)));
+        }
+
+        Vec4 PathTracerCPU::SampleEnvMap(Vec3& color, Rng& rng)
+        {
+            const EnvironmentMap* envMap = scene->envMap;
+            float value = rng.Next() * params.envMapTotalSum;
+
+            // Binary search of the row in the last column of the CDF, then of the column in that row
+            int lower = 0;
+            int upper = envMap->height - 1;
+            while (lower < upper)
+            {
+                int mid = (lower + upper) >> 1;
+                if (value < envMap->cdf[mid * envMap->width + envMap->width - 1])
+                    upper = mid;
+                else
+                    lower = mid + 1;
+            }
+            int y = std::min(std::max(lower, 0), envMap->height - 1);
+
+            lower = 0;
+            upper = envMap->width - 1;
+            while (lower < upper)
+            {
+                int mid = (lower + upper) >> 1;
+                if (value < envMap->cdf[y * envMap->width + mid])
+                    upper = mid;
+                else
+                    lower = mid + 1;
+            }
+            int x = std::min(std::max(lower, 0), envMap->width - 1);
+
+            float u = (float)x / params.envMapRes.x;
+            float v = (float)y / params.envMapRes.y;
+
+            color = SampleEnvMapTexture(u, v);
+            float pdf = Luminance(color) / params.envMapTotalSum;
+
+            u -= params.envMapRot;
+            float phi = u * TWO_PI;
+            float theta = v * PI;
+
+            if (sinf(theta) == 0.0f)
+                pdf = 0.0f;
+
+            return Vec4(-sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi), (pdf * params.envMapRes.x * params.envMapRes.y) / (TWO_PI * PI * sinf(theta)));
+        }
+
+        float PathTracerCPU::LightSelectPdf(int lightIndex)
+        {
+            if (options.enableLightPowerSampling)
+                return scene->lightDistribution[lightIndex].z * (1.0f - params.envMapSelectPdf);
+            return 1.0f / (float)numOfLights;
+        }
+
+        int PathTracerCPU::SampleLightIndex(Rng& rng)
+        {
+            if (options.enableLightPowerSampling)
+            {
+                // Alias table lookup: pick a bin uniformly, then keep it or jump to its alias
+                float u = rng.Next() * (float)numOfLights;
+                int index = std::min((int)u, numOfLights - 1);
+                const Vec3& thresholdAlias = scene->lightDistribution[index];
+                return u - floorf(u) < thresholdAlias.x ? index : (int)thresholdAlias.y;
+            }
+            return std::min((int)(rng.Next() * (float)numOfLights), numOfLights - 1);
+        }
+
+        void PathTracerCPU::SampleOneLight(const Light& light, const Vec3& scatterPos, LightSampleRec& lightSample, Rng& rng)
+        {
+            int type = (int)light.type;
+
+            if (type == RectLight)
+            {
+                float r1 = rng.Next();
+                float r2 = rng.Next();
+
+                Vec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+                lightSample.direction = lightSurfacePos - scatterPos;
+                lightSample.dist = Vec3::Length(lightSample.direction);
+                float distSq = lightSample.dist * lightSample.dist;
+                lightSample.direction = Div(lightSample.direction, lightSample.dist);
+                lightSample.normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                lightSample.emission = light.emission;
+                lightSample.pdf = distSq / (light.area * fabsf(Vec3::Dot(lightSample.normal, lightSample.direction)));
+            }
+            else if (type == SphereLight)
+            {
+                float r1 = rng.Next();
+                float r2 = rng.Next();
+
+                Vec3 sphereCentertoSurface = scatterPos - light.position;
+                float distToSphereCenter = Vec3::Length(sphereCentertoSurface);
+
+                // TODO: Fix this. Currently assumes the light will be hit only from the outside
+                sphereCentertoSurface = Div(sphereCentertoSurface, distToSphereCenter);
+                Vec3 sampledDir = UniformSampleHemisphere(r1, r2);
+                Vec3 T, B;
+                Onb(sphereCentertoSurface, T, B);
+                sampledDir = T * sampledDir.x + B * sampledDir.y + sphereCentertoSurface * sampledDir.z;
+
+                Vec3 lightSurfacePos = light.position + sampledDir * light.radius;
+
+                lightSample.direction = lightSurfacePos - scatterPos;
+                lightSample.dist = Vec3::Length(lightSample.direction);
+                float distSq = lightSample.dist * lightSample.dist;
+
+                lightSample.direction = Div(lightSample.direction, lightSample.dist);
+                lightSample.normal = Vec3::Normalize(lightSurfacePos - light.position);
+                lightSample.emission = light.emission;
+                lightSample.pdf = distSq / (light.area * 0.5f * fabsf(Vec3::Dot(lightSample.normal, lightSample.direction)));
+            }
+            else
+            {
+                lightSample.direction = Vec3::Normalize(light.position);
+                lightSample.normal = Vec3::Normalize(scatterPos - light.position);
+                lightSample.emission = light.emission;
+                lightSample.dist = INF;
+                lightSample.pdf = 1.0f;
+            }
+        }
+
+        bool PathTracerCPU::ClosestHit(const Ray& r, State& state, LightSampleRec& lightSample)
+        {
+            rays++;
+            float t = INF;
+
+            // Intersect Emitters
+            for (int i = 0; i < numOfLights; i++)
+            {
+                const Light& light = scene->lights[i];
+
+                if ((int)light.type == RectLight)
+                {
+                    Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                    if (Vec3::Dot(normal, r.direction) > 0.0f) // Hide backfacing quad light
+                        continue;
+                    Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+                    Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+
+                    float d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+                    if (d < 0.0f)
+                        d = INF;
+                    if (d < t)
+                    {
+                        t = d;
+                        float cosTheta = Vec3::Dot(Neg(r.direction), normal);
+                        lightSample.pdf = (t * t) / (light.area * cosTheta);
+                        if (options.enableLightPowerSampling)
+                            lightSample.pdf *= LightSelectPdf(i);
+                        lightSample.emission = light.emission;
+                        state.isEmitter = true;
+                    }
+                }
+
+                if ((int)light.type == SphereLight)
+                {
+                    float d = SphereIntersect(light.radius, light.position, r);
+                    if (d < 0.0f)
+                        d = INF;
+                    if (d < t)
+                    {
+                        t = d;
+                        Vec3 hitPt = r.origin + r.direction * t;
+                        float cosTheta = Vec3::Dot(Neg(r.direction), Vec3::Normalize(hitPt - light.position));
+                        // TODO: Fix this. Currently assumes the light will be hit only from the outside
+                        lightSample.pdf = (t * t) / (light.area * cosTheta * 0.5f);
+                        if (options.enableLightPowerSampling)
+                            lightSample.pdf *= LightSelectPdf(i);
+                        lightSample.emission = light.emission;
+                        state.isEmitter = true;
+                    }
+                }
+            }
+
+            // Intersect BVH and tris
+            int hitTri = -1;
+            int hitInstance = -1;
+            float bary[3] = { 0.0f, 0.0f, 0.0f };
+
+            TraverseBVH(nodes, params.topBVHIndex, inverseTransforms, r, t, [&](int first, int count, int instance, int matID, const Ray& rTrans)
+            {
+                for (int i = 0; i < count; i++) // Loop through tris
+                {
+                    float tHit, u, v;
+                    if (IntersectTriangle(rTrans, first + i, tHit, u, v) && tHit < t)
+                    {
+                        t = tHit;
+                        hitTri = first + i;
+                        hitInstance = instance;
+                        state.matID = matID;
+                        bary[0] = 1.0f - u - v;
+                        bary[1] = u;
+                        bary[2] = v;
+                    }
+                }
+                return false;
+            });
+
+            // No intersections
+            if (t == INF)
+                return false;
+
+            state.hitDist = t;
+            state.fhp = r.origin + r.direction * t;
+
+            // Ray hit a triangle and not a light source
+            if (hitTri != -1)
+            {
+                state.isEmitter = false;
+
+                const iVec3& triID = scene->vertIndices[hitTri];
+                const Vec4& vert0 = scene->vertexXYZU[triID.x];
+                const Vec4& vert1 = scene->vertexXYZU[triID.y];
+                const Vec4& vert2 = scene->vertexXYZU[triID.z];
+                const Vec4& n0 = scene->normalXYZV[triID.x];
+                const Vec4& n1 = scene->normalXYZV[triID.y];
+                const Vec4& n2 = scene->normalXYZV[triID.z];
+
+                // Get texcoords from w coord of vertices and normals
+                float t0[2] = { vert0.w, n0.w };
+                float t1[2] = { vert1.w, n1.w };
+                float t2[2] = { vert2.w, n2.w };
+
+                // Interpolate texture coords and normals using barycentric coords
+                for (int i = 0; i < 2; i++)
+                    state.texCoord[i] = t0[i] * bary[0] + t1[i] * bary[1] + t2[i] * bary[2];
+                Vec3 normal = Vec3::Normalize(Vec3(n0) * bary[0] + Vec3(n1) * bary[1] + Vec3(n2) * bary[2]);
+
+                const Mat4& transform = scene->transforms[hitInstance];
+                state.normal = Vec3::Normalize(TransformNormal(inverseTransforms[hitInstance], normal));
+                state.ffnormal = Vec3::Dot(state.normal, r.direction) <= 0.0f ? state.normal : Neg(state.normal);
+
+                // Calculate tangent and bitangent
+                Vec3 deltaPos1 = Vec3(vert1) - Vec3(vert0);
+                Vec3 deltaPos2 = Vec3(vert2) - Vec3(vert0);
+
+                float deltaUV1[2] = { t1[0] - t0[0], t1[1] - t0[1] };
+                float deltaUV2[2] = { t2[0] - t0[0], t2[1] - t0[1] };
+
+                float invdet = 1.0f / (deltaUV1[0] * deltaUV2[1] - deltaUV1[1] * deltaUV2[0]);
+
+                state.tangent = (deltaPos1 * deltaUV2[1] - deltaPos2 * deltaUV1[1]) * invdet;
+                state.bitangent = (deltaPos2 * deltaUV1[0] - deltaPos1 * deltaUV2[0]) * invdet;
+
+                state.tangent = Vec3::Normalize(TransformVector(transform, state.tangent));
+                state.bitangent = Vec3::Normalize(TransformVector(transform, state.bitangent));
+            }
+
+            return true;
+        }
+
+        bool PathTracerCPU::AnyHit(const Ray& r, float maxDist, Rng& rng)
+        {
+            rays++;
+
+            // Intersect Emitters
+            for (int i = 0; i < numOfLights; i++)
+            {
+                const Light& light = scene->lights[i];
+
+                // Intersect rectangular area light
+                if ((int)light.type == RectLight)
+                {
+                    Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                    Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+                    Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+
+                    float d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+                    if (d > 0.0f && d < maxDist)
+                        return true;
+                }
+
+                // Intersect spherical area light
+                if ((int)light.type == SphereLight)
+                {
+                    float d = SphereIntersect(light.radius, light.position, r);
+                    if (d > 0.0f && d < maxDist)
+                        return true;
+                }
+            }
+
+            // Intersect BVH and tris
+            bool occluded = false;
+            TraverseBVH(nodes, params.topBVHIndex, inverseTransforms, r, maxDist, [&](int first, int count, int, int matID, const Ray& rTrans)
+            {
+                for (int i = 0; i < count; i++) // Loop through tris
+                {
+                    float tHit, u, v;
+                    if (!IntersectTriangle(rTrans, first + i, tHit, u, v) || tHit >= maxDist)
+                        continue;
+
+                    const Material& mat = materials[matID];
+                    if ((int)mat.alphaMode == AlphaMode::Opaque)
+                        return occluded = true;
+
+                    float opacity = mat.opacity;
+                    if (mat.baseColorTexId >= 0.0f)
+                    {
+                        const iVec3& vertIndices = scene->vertIndices[first + i];
+                        float w = 1.0f - u - v;
+                        float texCoord[2];
+                        texCoord[0] = scene->vertexXYZU[vertIndices.x].w * w + scene->vertexXYZU[vertIndices.y].w * u + scene->vertexXYZU[vertIndices.z].w * v;
+                        texCoord[1] = scene->normalXYZV[vertIndices.x].w * w + scene->normalXYZV[vertIndices.y].w * u + scene->normalXYZV[vertIndices.z].w * v;
+                        opacity *= SampleTexture((int)mat.baseColorTexId, texCoord[0], texCoord[1]).w;
+                    }
+
+                    // Ignore intersection and continue ray based on alpha test
+                    if (!(((int)mat.alphaMode == AlphaMode::Mask && opacity < mat.alphaCutoff) ||
+                          ((int)mat.alphaMode == AlphaMode::Blend && rng.Next() > opacity)))
+                        return occluded = true;
+                }
+                return false;
+            });
+
+            return occluded;
+        }
+
+        void PathTracerCPU::GetMaterial(State& state, const Ray& r)
+        {
+            const Material& src = materials[state.matID];
+            MaterialParams& mat = state.mat;
+
+            mat.baseColor = src.baseColor;
+            mat.anisotropic = src.anisotropic;
+            mat.emission = src.emission;
+            mat.metallic = src.metallic;
+            mat.roughness = std::max(src.roughness, 0.001f);
+            mat.subsurface = src.subsurface;
+            mat.specularTint = src.specularTint;
+            mat.sheen = src.sheen;
+            mat.sheenTint = src.sheenTint;
+            mat.clearcoat = src.clearcoat;
+            mat.clearcoatRoughness = Mix(0.1f, 0.001f, src.clearcoatGloss); // Remapping from gloss to roughness
+            mat.specTrans = src.specTrans;
+            mat.ior = src.ior;
+            mat.opacity = src.opacity;
+            mat.alphaMode = (int)src.alphaMode;
+            mat.alphaCutoff = src.alphaCutoff;
+
+            // Base Color Map
+            if (src.baseColorTexId >= 0.0f)
+            {
+                Vec4 col = SampleTexture((int)src.baseColorTexId, state.texCoord[0], state.texCoord[1]);
+                mat.baseColor = mat.baseColor * Vec3::Pow(Vec3(col), 2.2f);
+                mat.opacity *= col.w;
+            }
+
+            // Metallic Roughness Map
+            if (src.metallicRoughnessTexID >= 0.0f)
+            {
+                Vec4 matRgh = SampleTexture((int)src.metallicRoughnessTexID, state.texCoord[0], state.texCoord[1]);
+                mat.metallic = matRgh.z;
+                mat.roughness = std::max(matRgh.y * matRgh.y, 0.001f);
+            }
+
+            // Normal Map
+            if (src.normalmapTexID >= 0.0f)
+            {
+                Vec3 texNormal = Vec3(SampleTexture((int)src.normalmapTexID, state.texCoord[0], state.texCoord[1]));
+
+                if (options.openglNormalMap)
+                    texNormal.y = 1.0f - texNormal.y;
+                texNormal = Vec3::Normalize(texNormal * 2.0f - Vec3(1.0f, 1.0f, 1.0f));
+
+                Vec3 origNormal = state.normal;
+                state.normal = Vec3::Normalize(state.tangent * texNormal.x + state.bitangent * texNormal.y + state.normal * texNormal.z);
+                state.ffnormal = Vec3::Dot(origNormal, r.direction) <= 0.0f ? state.normal : Neg(state.normal);
+            }
+
+            // Emission Map
+            if (src.emissionmapTexID >= 0.0f)
+                mat.emission = Vec3::Pow(Vec3(SampleTexture((int)src.emissionmapTexID, state.texCoord[0], state.texCoord[1])), 2.2f);
+
+            float aspect = sqrtf(1.0f - mat.anisotropic * 0.9f);
+            mat.ax = std::max(0.001f, mat.roughness / aspect);
+            mat.ay = std::max(0.001f, mat.roughness * aspect);
+
+            state.eta = Vec3::Dot(r.direction, state.normal) < 0.0f ? (1.0f / mat.ior) : mat.ior;
+        }
+
+        // BSDF of shaders/common/disney.glsl
+        void TintColors(const MaterialParams& mat, float eta, float& F0, Vec3& Csheen, Vec3& Cspec0)
+        {
+            float lum = Luminance(mat.baseColor);
+            Vec3 ctint = lum > 0.0f ? Div(mat.baseColor, lum) : Vec3(1.0f, 1.0f, 1.0f);
+
+            F0 = (1.0f - eta) / (1.0f + eta);
+            F0 *= F0;
+
+            Cspec0 = Mix(Vec3(1.0f, 1.0f, 1.0f), ctint, mat.specularTint) * F0;
+            Csheen = Mix(Vec3(1.0f, 1.0f, 1.0f), ctint, mat.sheenTint);
+        }
+
+        Vec3 EvalDisneyDiffuse(const MaterialParams& mat, const Vec3& Csheen, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3();
+
+            float LDotH = Vec3::Dot(L, H);
+
+            float Rr = 2.0f * mat.roughness * LDotH * LDotH;
+
+            // Diffuse
+            float FL = SchlickWeight(L.z);
+            float FV = SchlickWeight(V.z);
+            float Fretro = Rr * (FL + FV + FL * FV * (Rr - 1.0f));
+            float Fd = (1.0f - 0.5f * FL) * (1.0f - 0.5f * FV);
+
+            float diffuse = Fd + Fretro;
+
+            // Fake subsurface
+            if (mat.subsurface > 0.0f)
+            {
+                float Fss90 = 0.5f * Rr;
+                float Fss = Mix(1.0f, Fss90, FL) * Mix(1.0f, Fss90, FV);
+                float ss = 1.25f * (Fss * (1.0f / (L.z + V.z) - 0.5f) + 0.5f);
+                diffuse = Mix(diffuse, ss, mat.subsurface);
+            }
+
+            // Sheen
+            Vec3 Fsheen;
+            if (mat.sheen > 0.0f)
+                Fsheen = Csheen * (SchlickWeight(LDotH) * mat.sheen);
+
+            pdf = L.z * INV_PI;
+            return mat.baseColor * (INV_PI * diffuse) + Fsheen;
+        }
+
+        Vec3 EvalMicrofacetReflection(const MaterialParams& mat, const Vec3& V, const Vec3& L, const Vec3& H, const Vec3& F, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3();
+
+            float D = GTR2Aniso(H.z, H.x, H.y, mat.ax, mat.ay);
+            float G1 = SmithGAniso(fabsf(V.z), V.x, V.y, mat.ax, mat.ay);
+            float G2 = G1 * SmithGAniso(fabsf(L.z), L.x, L.y, mat.ax, mat.ay);
+
+            pdf = G1 * D / (4.0f * V.z);
+            return F * (D * G2 / (4.0f * L.z * V.z));
+        }
+
+        Vec3 EvalMicrofacetRefraction(const MaterialParams& mat, float eta, const Vec3& V, const Vec3& L, const Vec3& H, const Vec3& F, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z >= 0.0f)
+                return Vec3();
+
+            float LDotH = Vec3::Dot(L, H);
+            float VDotH = Vec3::Dot(V, H);
+
+            float D = GTR2Aniso(H.z, H.x, H.y, mat.ax, mat.ay);
+            float G1 = SmithGAniso(fabsf(V.z), V.x, V.y, mat.ax, mat.ay);
+            float G2 = G1 * SmithGAniso(fabsf(L.z), L.x, L.y, mat.ax, mat.ay);
+            float denom = LDotH + VDotH * eta;
+            denom *= denom;
+            float eta2 = eta * eta;
+            float jacobian = fabsf(LDotH) / denom;
+
+            pdf = G1 * std::max(0.0f, VDotH) * D * jacobian / V.z;
+            return Vec3::Pow(mat.baseColor, 0.5f) * (Vec3(1.0f, 1.0f, 1.0f) - F) * (D * G2 * fabsf(VDotH) * jacobian * eta2 / fabsf(L.z * V.z));
+        }
+
+        Vec3 EvalClearcoat(const MaterialParams& mat, const Vec3& V, const Vec3& L, const Vec3& H, float& pdf)
+        {
+            pdf = 0.0f;
+            if (L.z <= 0.0f)
+                return Vec3();
+
+            float VDotH = Vec3::Dot(V, H);
+
+            float F = Mix(0.04f, 1.0f, SchlickWeight(VDotH));
+            float D = GTR1(H.z, mat.clearcoatRoughness);
+            float G = SmithG(L.z, 0.25f) * SmithG(V.z, 0.25f);
+            float jacobian = 1.0f / (4.0f * VDotH);
+
+            pdf = D * H.z * jacobian;
+            return Vec3(F, F, F) * (D * G);
+        }
+
+        // Lobe weights and sampling probabilities shared by DisneySample and DisneyEval
+        struct Lobes
+        {
+            Lobes(const MaterialParams& mat, float eta, const Vec3& V)
+            {
+                TintColors(mat, eta, F0, Csheen, Cspec0);
+
+                // Model weights
+                dielectricWt = (1.0f - mat.metallic) * (1.0f - mat.specTrans);
+                metalWt = mat.metallic;
+                glassWt = (1.0f - mat.metallic) * mat.specTrans;
+
+                // Lobe probabilities
+                float schlickWt = SchlickWeight(V.z);
+
+                diffPr = dielectricWt * Luminance(mat.baseColor);
+                dielectricPr = dielectricWt * Luminance(Mix(Cspec0, Vec3(1.0f, 1.0f, 1.0f), schlickWt));
+                metalPr = metalWt * Luminance(Mix(mat.baseColor, Vec3(1.0f, 1.0f, 1.0f), schlickWt));
+                glassPr = glassWt;
+                clearCtPr = 0.25f * mat.clearcoat;
+
+                // Normalize probabilities
+                float invTotalWt = 1.0f / (diffPr + dielectricPr + metalPr + glassPr + clearCtPr);
+                diffPr *= invTotalWt;
+                dielectricPr *= invTotalWt;
+                metalPr *= invTotalWt;
+                glassPr *= invTotalWt;
+                clearCtPr *= invTotalWt;
+            }
+
+            float F0;
+            Vec3 Csheen, Cspec0;
+            float dielectricWt, metalWt, glassWt;
+            float diffPr, dielectricPr, metalPr, glassPr, clearCtPr;
+        };
+
+        Vec3 PathTracerCPU::DisneySample(const State& state, Vec3 V, const Vec3& N, Vec3& L, float& pdf, Rng& rng)
+        {
+            pdf = 0.0f;
+
+            float r1 = rng.Next();
+            float r2 = rng.Next();
+
+            Vec3 T, B;
+            Onb(N, T, B);
+
+            // Transform to shading space to simplify operations (NDotL = L.z; NDotV = V.z; NDotH = H.z)
+            V = ToLocal(T, B, N, V);
+
+            Lobes lobes(state.mat, state.eta, V);
+
+            // CDF of the sampling probabilities
+            float cdf[5];
+            cdf[0] = lobes.diffPr;
+            cdf[1] = cdf[0] + lobes.dielectricPr;
+            cdf[2] = cdf[1] + lobes.metalPr;
+            cdf[3] = cdf[2] + lobes.glassPr;
+            cdf[4] = cdf[3] + lobes.clearCtPr;
+
+            // Sample a lobe based on its importance
+            float r3 = rng.Next();
+
+            if (r3 < cdf[0]) // Diffuse
+            {
+                L = CosineSampleHemisphere(r1, r2);
+            }
+            else if (r3 < cdf[2]) // Dielectric + Metallic reflection
+            {
+                Vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
+
+                if (H.z < 0.0f)
+                    H = Neg(H);
+
+                L = Vec3::Normalize(Reflect(Neg(V), H));
+            }
+            else if (r3 < cdf[3]) // Glass
+            {
+                Vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
+                float F = DielectricFresnel(fabsf(Vec3::Dot(V, H)), state.eta);
+
+                if (H.z < 0.0f)
+                    H = Neg(H);
+
+                // Rescale random number for reuse
+                r3 = (r3 - cdf[2]) / (cdf[3] - cdf[2]);
+
+                // Reflection
+                if (r3 < F)
+                    L = Vec3::Normalize(Reflect(Neg(V), H));
+                else // Transmission
+                    L = Vec3::Normalize(Refract(Neg(V), H, state.eta));
+            }
+            else // Clearcoat
+            {
+                Vec3 H = SampleGTR1(state.mat.clearcoatRoughness, r1, r2);
+
+                if (H.z < 0.0f)
+                    H = Neg(H);
+
+                L = Vec3::Normalize(Reflect(Neg(V), H));
+            }
+
+            L = ToWorld(T, B, N, L);
+            V = ToWorld(T, B, N, V);
+
+            return DisneyEval(state, V, N, L, pdf);
+        }
+
+        Vec3 PathTracerCPU::DisneyEval(const State& state, Vec3 V, const Vec3& N, Vec3 L, float& pdf)
+        {
+            pdf = 0.0f;
+            Vec3 f;
+
+            Vec3 T, B;
+            Onb(N, T, B);
+
+            // Transform to shading space to simplify operations (NDotL = L.z; NDotV = V.z; NDotH = H.z)
+            V = ToLocal(T, B, N, V);
+            L = ToLocal(T, B, N, L);
+
+            Vec3 H;
+            if (L.z > 0.0f)
+                H = Vec3::Normalize(L + V);
+            else
+                H = Vec3::Normalize(L + V * state.eta);
+
+            if (H.z < 0.0f)
+                H = Neg(H);
+
+            Lobes lobes(state.mat, state.eta, V);
+
+            bool reflect = L.z * V.z > 0.0f;
+
+            float tmpPdf = 0.0f;
+            float VDotH = fabsf(Vec3::Dot(V, H));
+
+            // Diffuse
+            if (lobes.diffPr > 0.0f && reflect)
+            {
+                f = f + EvalDisneyDiffuse(state.mat, lobes.Csheen, V, L, H, tmpPdf) * lobes.dielectricWt;
+                pdf += tmpPdf * lobes.diffPr;
+            }
+
+            // Dielectric Reflection
+            if (lobes.dielectricPr > 0.0f && reflect)
+            {
+                // Normalize for interpolating based on Cspec0
+                float F = (DielectricFresnel(VDotH, 1.0f / state.mat.ior) - lobes.F0) / (1.0f - lobes.F0);
+
+                f = f + EvalMicrofacetReflection(state.mat, V, L, H, Mix(lobes.Cspec0, Vec3(1.0f, 1.0f, 1.0f), F), tmpPdf) * lobes.dielectricWt;
+                pdf += tmpPdf * lobes.dielectricPr;
+            }
+
+            // Metallic Reflection
+            if (lobes.metalPr > 0.0f && reflect)
+            {
+                // Tinted to base color
+                Vec3 F = Mix(state.mat.baseColor, Vec3(1.0f, 1.0f, 1.0f), SchlickWeight(VDotH));
+
+                f = f + EvalMicrofacetReflection(state.mat, V, L, H, F, tmpPdf) * lobes.metalWt;
+                pdf += tmpPdf * lobes.metalPr;
+            }
+
+            // Glass/Specular BSDF
+            if (lobes.glassPr > 0.0f)
+            {
+                // Dielectric fresnel (achromatic)
+                float F = DielectricFresnel(VDotH, state.eta);
+
+                if (reflect)
+                {
+                    f = f + EvalMicrofacetReflection(state.mat, V, L, H, Vec3(F, F, F), tmpPdf) * lobes.glassWt;
+                    pdf += tmpPdf * lobes.glassPr * F;
+                }
+                else
+                {
+                    f = f + EvalMicrofacetRefraction(state.mat, state.eta, V, L, H, Vec3(F, F, F), tmpPdf) * lobes.glassWt;
+                    pdf += tmpPdf * lobes.glassPr * (1.0f - F);
+                }
+            }
+
+            // Clearcoat
+            if (lobes.clearCtPr > 0.0f && reflect)
+            {
+                f = f + EvalClearcoat(state.mat, V, L, H, tmpPdf) * (0.25f * state.mat.clearcoat);
+                pdf += tmpPdf * lobes.clearCtPr;
+            }
+
+            return f * fabsf(L.z);
+        }
+
+        Vec3 PathTracerCPU::DirectLight(const Ray& r, const State& state, Rng& rng)
+        {
+            Vec3 Ld;
+            Vec3 scatterPos = state.fhp + state.normal * EPS;
+
+            ScatterSampleRec scatterSample;
+
+            // Uniform selection samples the environment and one analytic light every time.
+            // With power sampling only one of them is sampled and the choice is folded into the light pdf
+            bool sampleEnvMap = true;
+            bool sampleLights = true;
+            if (options.enableLightPowerSampling)
+            {
+                sampleEnvMap = rng.Next() < params.envMapSelectPdf;
+                sampleLights = !sampleEnvMap;
+            }
+
+            // Environment Light
+            if (enableEnvMap && sampleEnvMap)
+            {
+                Vec3 Li;
+                Vec4 dirPdf = SampleEnvMap(Li, rng);
+                Vec3 lightDir = Vec3(dirPdf);
+                float lightPdf = dirPdf.w;
+                if (options.enableLightPowerSampling)
+                    lightPdf *= params.envMapSelectPdf;
+
+                Ray shadowRay = { scatterPos, lightDir };
+                bool inShadow = AnyHit(shadowRay, INF - EPS, rng);
+
+                if (!inShadow)
+                {
+                    scatterSample.f = DisneyEval(state, Neg(r.direction), state.ffnormal, lightDir, scatterSample.pdf);
+
+                    if (scatterSample.pdf > 0.0f)
+                    {
+                        float misWeight = PowerHeuristic(lightPdf, scatterSample.pdf);
+                        if (misWeight > 0.0f)
+                            Ld = Ld + Li * scatterSample.f * (misWeight * params.envMapIntensity / lightPdf);
+                    }
+                }
+            }
+
+            // Analytic Lights
+            if (numOfLights > 0 && sampleLights)
+            {
+                LightSampleRec lightSample;
+
+                //Pick a light to sample
+                int lightIndex = SampleLightIndex(rng);
+                float lightSelectPdf = LightSelectPdf(lightIndex);
+                const Light& light = scene->lights[lightIndex];
+
+                SampleOneLight(light, scatterPos, lightSample, rng);
+
+                // Selection probability is part of the light pdf so MIS matches the pdf ClosestHit reports for BSDF hits
+                Vec3 Li;
+                if (options.enableLightPowerSampling)
+                {
+                    Li = lightSample.emission;
+                    lightSample.pdf *= lightSelectPdf;
+                }
+                else
+                    Li = Div(lightSample.emission, lightSelectPdf);
+
+                if (Vec3::Dot(lightSample.direction, lightSample.normal) < 0.0f) // Required for quad lights with single sided emission
+                {
+                    Ray shadowRay = { scatterPos, lightSample.direction };
+                    bool inShadow = AnyHit(shadowRay, lightSample.dist - EPS, rng);
+
+                    if (!inShadow)
+                    {
+                        scatterSample.f = DisneyEval(state, Neg(r.direction), state.ffnormal, lightSample.direction, scatterSample.pdf);
+
+                        float misWeight = 1.0f;
+                        if (light.area > 0.0f) // No MIS for distant light
+                            misWeight = PowerHeuristic(lightSample.pdf, scatterSample.pdf);
+
+                        if (scatterSample.pdf > 0.0f)
+                            Ld = Ld + Li * scatterSample.f * (misWeight / lightSample.pdf);
+                    }
+                }
+            }
+
+            return Ld;
+        }
+
+        Vec4 PathTracerCPU::PathTrace(Ray r, Rng& rng, Vec3& aovAlbedo, Vec3& aovNormal)
+        {
+            Vec3 radiance;
+            Vec3 throughput(1.0f, 1.0f, 1.0f);
+            State state = {};
+            LightSampleRec lightSample = {};
+            ScatterSampleRec scatterSample = {};
+
+            float alpha = 1.0f;
+            bool primaryHit = true;
+
+            aovAlbedo = Vec3();
+            aovNormal = Vec3();
+
+            for (state.depth = 0;; state.depth++)
+            {
+                bool hit = ClosestHit(r, state, lightSample);
+
+                if (!hit)
+                {
+                    if (state.depth == 0 && (options.enableBackground || options.transparentBackground))
+                        alpha = 0.0f;
+
+                    if (enableEnvMap)
+                    {
+                        Vec4 envMapColPdf = EvalEnvMap(r);
+                        if (options.enableLightPowerSampling)
+                            envMapColPdf.w *= params.envMapSelectPdf;
+
+                        float misWeight = 1.0f;
+
+                        // Gather radiance from envmap and use scatterSample.pdf from previous bounce for MIS
+                        if (state.depth > 0)
+                            misWeight = PowerHeuristic(scatterSample.pdf, envMapColPdf.w);
+
+                        if (misWeight > 0.0f)
+                            radiance = radiance + Vec3(envMapColPdf) * throughput * (misWeight * params.envMapIntensity);
+                    }
+                    break;
+                }
+
+                GetMaterial(state, r);
+
+                // Gather radiance from emissive objects. Emission from meshes is not importance sampled
+                radiance = radiance + state.mat.emission * throughput;
+
+                // Gather radiance from light and use scatterSample.pdf from previous bounce for MIS
+                if (state.isEmitter)
+                {
+                    float misWeight = 1.0f;
+
+                    if (state.depth > 0)
+                        misWeight = PowerHeuristic(scatterSample.pdf, lightSample.pdf);
+
+                    radiance = radiance + lightSample.emission * throughput * misWeight;
+                    break;
+                }
+
+                // Stop tracing ray if maximum depth was reached
+                if (state.depth == options.maxDepth)
+                    break;
+
+                // Ignore intersection and continue ray based on alpha test
+                if ((state.mat.alphaMode == AlphaMode::Mask && state.mat.opacity < state.mat.alphaCutoff) ||
+                    (state.mat.alphaMode == AlphaMode::Blend && rng.Next() > state.mat.opacity))
+                {
+                    scatterSample.L = r.direction;
+                    state.depth--;
+                }
+                else
+                {
+                    if (primaryHit)
+                    {
+                        aovAlbedo = state.mat.baseColor;
+                        aovNormal = state.ffnormal;
+                    }
+
+                    // Next event estimation
+                    radiance = radiance + DirectLight(r, state, rng) * throughput;
+
+                    // Sample BSDF for color and outgoing direction
+                    scatterSample.f = DisneySample(state, Neg(r.direction), state.ffnormal, scatterSample.L, scatterSample.pdf, rng);
+                    if (scatterSample.pdf > 0.0f)
+                        throughput = throughput * Div(scatterSample.f, scatterSample.pdf);
+                    else
+                        break;
+                }
+
+                // Move ray origin to hit point and set direction for next bounce
+                r.direction = scatterSample.L;
+                r.origin = state.fhp + r.direction * EPS;
+
+                primaryHit = false;
+
+                // Russian roulette
+                if (options.enableRR && state.depth >= options.RRDepth)
+                {
+                    float q = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) + 0.001f, 0.95f);
+                    if (rng.Next() > q)
+                        break;
+                    throughput = Div(throughput, q);
+                }
+            }
+
+            // Background, lights and media seen directly have no surface. Their albedo is the clamped radiance
+            if (aovNormal.x == 0.0f && aovNormal.y == 0.0f && aovNormal.z == 0.0f)
+                aovAlbedo = Vec3::Clamp(radiance, Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 1.0f, 1.0f));
+
+            return Vec4(radiance.x, radiance.y, radiance.z, alpha);
+        }
+
+        // Tonemapping of shaders/tonemap.glsl. GLSL multiplies the row vector by mat3 columns, so the rows here are
+        // the columns written out in the shader
+        const float ACES_INPUT_MAT[3][3] =
+        {
+            { 0.59719f, 0.35458f, 0.04823f },
+            { 0.07600f, 0.90834f, 0.01566f },
+            { 0.02840f, 0.13383f, 0.83777f }
+        };
+
+        const float ACES_OUTPUT_MAT[3][3] =
+        {
+            { 1.60475f, -0.53108f, -0.07367f },
+            { -0.10208f, 1.10813f, -0.00605f },
+            { -0.00327f, -0.07276f, 1.07602f }
+        };
+
+        inline Vec3 MulRows(const float m[3][3], const Vec3& v)
+        {
+            return Vec3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                        m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                        m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+        }
+
+        inline float RRTAndODTFit(float v)
+        {
+            float a = v * (v + 0.0245786f) - 0.000090537f;
+            float b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
+            return a / b;
+        }
+
+        Vec3 ACESFitted(Vec3 color)
+        {
+            color = MulRows(ACES_INPUT_MAT, color);
+            color = Vec3(RRTAndODTFit(color.x), RRTAndODTFit(color.y), RRTAndODTFit(color.z));
+            color = MulRows(ACES_OUTPUT_MAT, color);
+            return Vec3(Clamp01(color.x), Clamp01(color.y), Clamp01(color.z));
+        }
+
+        inline float ACES(float c)
+        {
+            return Clamp01((c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f));
+        }
+
+        Vec3 TonemapColor(const Vec3& c, const RenderOptions& options)
+        {
+            if (!options.enableTonemap)
+                return c;
+            if (!options.enableAces)
+                return c * (1.0f / (1.0f + Luminance(c) / 1.5f));
+            if (options.simpleAcesFit)
+                return Vec3(ACES(c.x), ACES(c.y), ACES(c.z));
+            return ACESFitted(c);
+        }
+    }
+
+    CpuRenderer::CpuRenderer(Scene* scene)
+        : width(0)
+        , height(0)
+        , tileRays(0)
+        , tileSeconds(0.0)
+        , tileX(0)
+        , tileY(0)
+        , tileWidth(0)
+        , tileHeight(0)
+        , scene(scene)
+        , tileParams()
+    {
+    }
+
+    CpuRenderer::~CpuRenderer()
+    {
+        DropTile();
+    }
+
+    void CpuRenderer::Resize(int width, int height)
+    {
+        DropTile();
+
+        this->width = width;
+        this->height = height;
+        color.assign(width * height * 4, 0.0f);
+        albedo.assign(width * height * 4, 0.0f);
+        normal.assign(width * height * 4, 0.0f);
+    }
+
+    void CpuRenderer::Clear()
+    {
+        DropTile();
+
+        std::fill(color.begin(), color.end(), 0.0f);
+        std::fill(albedo.begin(), albedo.end(), 0.0f);
+        std::fill(normal.begin(), normal.end(), 0.0f);
+    }
+
+    void CpuRenderer::RenderTile(int x, int y, int w, int h, const RenderParams& params, int frameNum, int samples)
+    {
+        DropTile();
+        CopySceneState(x, y, w, h, params);
+        TraceTile(frameNum, samples);
+    }
+
+    void CpuRenderer::StartTile(int x, int y, int w, int h, const RenderParams& params, int frameNum, int samples)
+    {
+        DropTile();
+        CopySceneState(x, y, w, h, params);
+        job = TaskSystem::Get().Async([this, frameNum, samples]() { TraceTile(frameNum, samples); });
+    }
+
+    bool CpuRenderer::IsTileDone() const
+    {
+        return job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    void CpuRenderer::FinishTile()
+    {
+        if (job.valid())
+            job.get();
+    }
+
+    void CpuRenderer::WaitForTile() const
+    {
+        if (job.valid())
+            job.wait();
+    }
+
+    void CpuRenderer::DropTile()
+    {
+        if (!job.valid())
+            return;
+
+        job.wait();
+        job = std::future<void>();
+    }
+
+    void CpuRenderer::CopySceneState(int x, int y, int w, int h, const RenderParams& params)
+    {
+        tileX = x;
+        tileY = y;
+        tileWidth = w;
+        tileHeight = h;
+        tileParams = params;
+        tileOptions = scene->renderOptions;
+        tileMaterials = scene->materials;
+    }
+
+    void CpuRenderer::TraceTile(int frameNum, int samples)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        PathTracerCPU pathTracer(scene, tileParams, tileOptions, tileMaterials.data());
+        std::atomic<long long> rays(0);
+
+        int x = tileX;
+        int y = tileY;
+        int w = tileWidth;
+        int h = tileHeight;
+        int blocksX = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        int blocksY = (h + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        int numBlocks = blocksX * blocksY;
+
+        // Blocks only write their own pixels, so they need no synchronization. Each one traces with its own copy
+        // of the tracer state to keep the ray count local
+        auto renderBlock = [&](int block)
+        {
+            PathTracerCPU tracer = pathTracer;
+            tracer.rays = 0;
+
+            int x0 = x + (block % blocksX) * BLOCK_SIZE;
+            int y0 = y + (block / blocksX) * BLOCK_SIZE;
+            int x1 = std::min(x0 + BLOCK_SIZE, x + w);
+            int y1 = std::min(y0 + BLOCK_SIZE, y + h);
+
+            for (int py = y0; py < y1; py++)
+            {
+                for (int px = x0; px < x1; px++)
+                {
+                    float pixelColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                    Vec3 albedoSum, normalSum;
+
+                    // Decorrelated samples, seeded with their own frame number like the tile shader
+                    for (int i = 0; i < samples; i++)
+                    {
+                        Rng rng(px, py, frameNum + i);
+                        Ray ray = tracer.CameraRay(px + 0.5f, py + 0.5f, rng);
+
+                        Vec3 aovAlbedo, aovNormal;
+                        Vec4 sampleColor = tracer.PathTrace(ray, rng, aovAlbedo, aovNormal);
+                        for (int c = 0; c < 4; c++)
+                            pixelColor[c] += sampleColor[c];
+                        albedoSum = albedoSum + aovAlbedo;
+                        normalSum = normalSum + aovNormal;
+                    }
+
+                    int index = (py * width + px) * 4;
+                    for (int c = 0; c < 4; c++)
+                        color[index + c] += pixelColor[c];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        albedo[index + c] += albedoSum[c];
+                        normal[index + c] += normalSum[c];
+                    }
+                }
+            }
+
+            rays += tracer.rays;
+        };
+
+        // One block per task, blocks that finish early leave the others to be stolen
+        TaskSystem::Get().ParallelFor(0, numBlocks, 1, [&](int first, int last)
+        {
+            for (int block = first; block < last; block++)
+                renderBlock(block);
+        });
+
+        tileRays = rays;
+        tileSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void CpuRenderer::Tonemap(const float* color, int width, int height, float scale, const RenderOptions& options, unsigned char* pixels)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            // PNG rows start at the top
+            const float* src = &color[(size_t)(height - 1 - y) * width * 4];
+            unsigned char* dst = &pixels[(size_t)y * width * 4];
+
+            for (int x = 0; x < width; x++, src += 4, dst += 4)
+            {
+                Vec3 c = TonemapColor(Vec3(src[0] * scale, src[1] * scale, src[2] * scale), options);
+                c = Vec3(powf(std::max(c.x, 0.0f), 1.0f / 2.2f), powf(std::max(c.y, 0.0f), 1.0f / 2.2f), powf(std::max(c.z, 0.0f), 1.0f / 2.2f));
+
+                // No checkerboard behind transparent pixels, the alpha channel is written instead
+                float alpha = Clamp01(src[3] * scale);
+                float outAlpha = 1.0f;
+                if (options.transparentBackground)
+                    outAlpha = alpha;
+                else if (options.enableBackground)
+                    c = Mix(options.backgroundCol, c, alpha);
+
+                dst[0] = (unsigned char)(Clamp01(c.x) * 255.0f + 0.5f);
+                dst[1] = (unsigned char)(Clamp01(c.y) * 255.0f + 0.5f);
+                dst[2] = (unsigned char)(Clamp01(c.z) * 255.0f + 0.5f);
+                dst[3] = (unsigned char)(outAlpha * 255.0f + 0.5f);
+            }
+        }
+    }
+}
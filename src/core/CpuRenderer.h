@@ -0,0 +1,81 @@
+
+
+#pragma once
+
+#include <future>
+#include <vector>
+#include "Renderer.h"
+#include "Material.h"
+
+namespace PathTracer
+{
+    class Scene;
+
+    // Path tracer for machines without a usable GPU. It traces the same scene data the GPU gets (flattened BVH,
+    // vertices, materials, lights and environment map) with the Disney BSDF and next event estimation of
+    // pathtrace.glsl, ported to C++. Media are not supported. Color and the denoiser AOVs are summed per pixel like
+    // accumTexture, albedoTexture and normalTexture, so the renderer uploads them and tonemaps and denoises as usual.
+    // Tiles are split into blocks that run on the TaskSystem
+    class CpuRenderer
+    {
+    public:
+        CpuRenderer(Scene* scene);
+        ~CpuRenderer();
+
+        // Both drop the tile in flight
+        void Resize(int width, int height);
+        void Clear();
+
+        // Adds samples to every pixel of the rectangle. Returns once all of them are done
+        void RenderTile(int x, int y, int w, int h, const RenderParams& params, int frameNum, int samples);
+
+        // Same as RenderTile() in a job on the TaskSystem, so the render thread goes on meanwhile. Params, render
+        // options and materials are copied, geometry, instances, lights and the environment map are read in place and
+        // must not change before the tile is finished or waited for
+        void StartTile(int x, int y, int w, int h, const RenderParams& params, int frameNum, int samples);
+
+        // True from StartTile() until FinishTile()
+        bool IsBusy() const { return job.valid(); }
+        bool IsTileDone() const;
+
+        // Waits for the tile and rethrows what it threw. Its samples are in the sums afterwards
+        void FinishTile();
+
+        // Waits for the tile without finishing it, e.g. before the scene data it reads is changed
+        void WaitForTile() const;
+
+        // Tonemaps the sums like tonemap.glsl into 8 bit RGBA, top row first. scale is 1 / samples for the sums
+        static void Tonemap(const float* color, int width, int height, float scale, const RenderOptions& options, unsigned char* pixels);
+
+        // RGBA sums per pixel, bottom row first like the textures they are uploaded to
+        int width;
+        int height;
+        std::vector<float> color;
+        std::vector<float> albedo;
+        std::vector<float> normal;
+
+        // Rays traced by the last tile (closest hit and shadow rays) and the time it took
+        long long tileRays;
+        double tileSeconds;
+
+        // Rectangle of the last tile
+        int tileX;
+        int tileY;
+        int tileWidth;
+        int tileHeight;
+
+    private:
+        void DropTile();
+        void CopySceneState(int x, int y, int w, int h, const RenderParams& params);
+        void TraceTile(int frameNum, int samples);
+
+        Scene* scene;
+
+        // Copies of what the UI changes in place, read by the tile in flight
+        RenderParams tileParams;
+        RenderOptions tileOptions;
+        std::vector<Material> tileMaterials;
+
+        std::future<void> job;
+    };
+}
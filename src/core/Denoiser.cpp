@@ -0,0 +1,266 @@
+#include <cstring>
+#include "Denoiser.h"
+
+namespace PathTracer
+{
+    Denoiser::Denoiser()
+        : width(0)
+        , height(0)
+        , state(Idle)
+        , cancelled(false)
+        , requestSampleCount(0)
+        , resultSampleCount(0)
+        , packPBO(0)
+        , unpackPBO(0)
+        , readbackFence(0)
+        , filterDirty(true)
+        , hasJob(false)
+        , jobDone(false)
+        , quit(false)
+        , mappedInput(nullptr)
+        , mappedOutput(nullptr)
+    {
+        worker = std::thread(&Denoiser::WorkerLoop, this);
+    }
+
+    Denoiser::~Denoiser()
+    {
+        WaitForWorker();
+        DeleteBuffers();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        jobStarted.notify_one();
+        worker.join();
+    }
+
+    void Denoiser::Resize(int width, int height)
+    {
+        WaitForWorker();
+        DeleteBuffers();
+
+        this->width = width;
+        this->height = height;
+
+        size_t size = (size_t)width * height * 3;
+        inputBuffer.assign(size * 3, 0.0f);
+        outputBuffer.assign(size, 0.0f);
+        filterDirty = true;
+
+        glGenBuffers(1, &packPBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, packPBO);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size * 3 * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glGenBuffers(1, &unpackPBO);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackPBO);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size * sizeof(float), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void Denoiser::DeleteBuffers()
+    {
+        if (readbackFence)
+            glDeleteSync(readbackFence);
+        glDeleteBuffers(1, &packPBO);
+        glDeleteBuffers(1, &unpackPBO);
+
+        readbackFence = 0;
+        packPBO = unpackPBO = 0;
+        state = Idle;
+    }
+
+    bool Denoiser::Request(GLuint colorTexture, GLuint albedoTexture, GLuint normalTexture, int sampleCount)
+    {
+        if (state != Idle || packPBO == 0)
+            return false;
+
+        // The copies into the pack buffer are queued like any other command, the fence tells when they are done
+        GLuint textures[3] = { colorTexture, albedoTexture, normalTexture };
+        size_t imageSize = (size_t)width * height * 3 * sizeof(float);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, packPBO);
+        for (int i = 0; i < 3; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, (void*)(imageSize * i));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        state = Readback;
+        cancelled = false;
+        requestSampleCount = sampleCount;
+        return true;
+    }
+
+    void Denoiser::Cancel()
+    {
+        cancelled = true;
+    }
+
+    bool Denoiser::Update(GLuint outputTexture)
+    {
+        if (state == Readback)
+        {
+            GLenum result = glClientWaitSync(readbackFence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                return false;
+
+            glDeleteSync(readbackFence);
+            readbackFence = 0;
+
+            if (cancelled)
+            {
+                state = Idle;
+                return false;
+            }
+
+            // Both buffers stay mapped while the worker copies from/to them
+            size_t size = (size_t)width * height * 3 * sizeof(float);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, packPBO);
+            const float* input = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size * 3, GL_MAP_READ_BIT);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackPBO);
+            float* output = (float*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            if (!input || !output)
+            {
+                printf("Unable to map denoiser buffers\n");
+                jobDone = true;
+                state = Filtering;
+                cancelled = true;
+                return Update(0);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                mappedInput = input;
+                mappedOutput = output;
+                hasJob = true;
+                jobDone = false;
+            }
+            jobStarted.notify_one();
+
+            state = Filtering;
+            return false;
+        }
+
+        if (state == Filtering)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!jobDone)
+                    return false;
+            }
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, packPBO);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackPBO);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            state = Idle;
+
+            if (!cancelled)
+            {
+                // Sourced from the unpack buffer, so the upload does not wait for the copy either
+                glBindTexture(GL_TEXTURE_2D, outputTexture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, 0);
+                resultSampleCount = requestSampleCount;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            return !cancelled;
+        }
+
+        return false;
+    }
+
+    void Denoiser::WaitForWorker()
+    {
+        if (state != Filtering)
+            return;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobFinished.wait(lock, [this] { return jobDone; });
+        }
+
+        cancelled = true;
+        Update(0);
+    }
+
+    void Denoiser::FilterImage(float* color, const float* albedo, const float* normal, int width, int height)
+    {
+        oidn::DeviceRef device = oidn::newDevice();
+        device.commit();
+
+        // RGB of each RGBA pixel, the filter leaves the fourth float alone
+        size_t pixelStride = 4 * sizeof(float);
+        oidn::FilterRef filter = device.newFilter("RT");
+        filter.setImage("color", color, oidn::Format::Float3, width, height, 0, pixelStride, 0);
+        filter.setImage("albedo", (void*)albedo, oidn::Format::Float3, width, height, 0, pixelStride, 0);
+        filter.setImage("normal", (void*)normal, oidn::Format::Float3, width, height, 0, pixelStride, 0);
+        filter.setImage("output", color, oidn::Format::Float3, width, height, 0, pixelStride, 0);
+        filter.set("hdr", true);
+        filter.commit();
+        filter.execute();
+
+        const char* errorMessage;
+        if (device.getError(errorMessage) != oidn::Error::None)
+            printf("Error: %s\n", errorMessage);
+    }
+
+    void Denoiser::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            jobStarted.wait(lock, [this] { return hasJob || quit; });
+            if (quit)
+                break;
+
+            hasJob = false;
+            lock.unlock();
+
+            // The device is created on first use so startup does not pay for it
+            if (!device)
+            {
+                device = oidn::newDevice();
+                device.commit();
+                filter = device.newFilter("RT"); // generic ray tracing filter
+            }
+
+            if (filterDirty)
+            {
+                size_t imageSize = (size_t)width * height * 3;
+                filter.setImage("color", inputBuffer.data(), oidn::Format::Float3, width, height, 0, 0, 0);
+                filter.setImage("albedo", inputBuffer.data() + imageSize, oidn::Format::Float3, width, height, 0, 0, 0);
+                filter.setImage("normal", inputBuffer.data() + imageSize * 2, oidn::Format::Float3, width, height, 0, 0, 0);
+                filter.setImage("output", outputBuffer.data(), oidn::Format::Float3, width, height, 0, 0, 0);
+                filter.set("hdr", true);
+                filter.commit();
+                filterDirty = false;
+            }
+
+            memcpy(inputBuffer.data(), mappedInput, inputBuffer.size() * sizeof(float));
+            filter.execute();
+
+            const char* errorMessage;
+            if (device.getError(errorMessage) != oidn::Error::None)
+                printf("Error: %s\n", errorMessage);
+
+            memcpy(mappedOutput, outputBuffer.data(), outputBuffer.size() * sizeof(float));
+
+            lock.lock();
+            jobDone = true;
+            jobFinished.notify_one();
+        }
+    }
+}
@@ -0,0 +1,87 @@
+
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Config.h"
+#include "OpenImageDenoise/oidn.hpp"
+
+namespace PathTracer
+{
+    // Denoises frames with Intel Open Image Denoise without blocking the render thread.
+    // Frames are HDR radiance with first hit albedo and normal as auxiliary images, which lets the filter
+    // tell noise from texture and geometry detail at low sample counts.
+    // The device and filter live as long as the denoiser. A frame is read back into a pixel pack buffer
+    // guarded by a fence, filtered on a worker thread and uploaded again through a pixel unpack buffer,
+    // so the render thread only issues GL commands and polls for completion
+    class Denoiser
+    {
+    public:
+        Denoiser();
+        ~Denoiser();
+
+        // Reallocates buffers for a new resolution. Waits for a denoise in flight
+        void Resize(int width, int height);
+
+        // Starts reading back the color, albedo and normal textures (RGB, float) for denoising. Ignored while a denoise is in flight
+        bool Request(GLuint colorTexture, GLuint albedoTexture, GLuint normalTexture, int sampleCount);
+
+        // Drops the result of the denoise in flight, e.g. once the image it was made from is outdated
+        void Cancel();
+
+        // Advances the pipeline without blocking. Returns true once a new result was uploaded to outputTexture
+        bool Update(GLuint outputTexture);
+
+        bool IsBusy() const { return state != Idle; }
+        int GetSampleCount() const { return resultSampleCount; }
+
+        // Denoises an averaged RGBA image in place with its RGBA albedo and normal, without OpenGL or a worker.
+        // Alpha is kept. For batch renders on the CPU
+        static void FilterImage(float* color, const float* albedo, const float* normal, int width, int height);
+
+    private:
+        enum State
+        {
+            Idle,
+            Readback,
+            Filtering
+        };
+
+        void WorkerLoop();
+        void WaitForWorker();
+        void DeleteBuffers();
+
+        int width;
+        int height;
+        State state;
+        bool cancelled;
+        int requestSampleCount;
+        int resultSampleCount;
+
+        GLuint packPBO;
+        GLuint unpackPBO;
+        GLsync readbackFence;
+
+        // Owned by the worker while a job is running. The filter is bound to inputBuffer/outputBuffer
+        // and only recommitted after a resize. inputBuffer holds color, albedo and normal one after another
+        oidn::DeviceRef device;
+        oidn::FilterRef filter;
+        std::vector<float> inputBuffer;
+        std::vector<float> outputBuffer;
+        bool filterDirty;
+
+        // Job handoff between the render thread and the worker
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable jobStarted;
+        std::condition_variable jobFinished;
+        bool hasJob;
+        bool jobDone;
+        bool quit;
+        const float* mappedInput;
+        float* mappedOutput;
+    };
+}
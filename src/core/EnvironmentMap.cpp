@@ -18,15 +18,22 @@ namespace PathTracer
     {
         // Gather weights for CDF
         float* weights = new float[width * height];
+        double weightedSum = 0.0;
         for (int v = 0; v < height; v++)
         {
+            // Rows near the poles cover less solid angle
+            float sinTheta = sinf(PI * (v + 0.5f) / height);
             for (int u = 0; u < width; u++)
             {
                 int imgIdx = v * width * 3 + u * 3;
                 weights[u + v * width] = Luminance(img[imgIdx + 0], img[imgIdx + 1], img[imgIdx + 2]);
+                weightedSum += weights[u + v * width] * sinTheta;
             }
         }
 
+        // Each texel spans (2PI / width) * (PI / height) * sinTheta steradians of the 4PI sphere
+        avgLuminance = (float)(weightedSum * (2.0 * PI * PI / (width * height)) / (4.0 * PI));
+
         // Build CDF
         cdf = new float[width * height];
         cdf[0] = weights[0];
@@ -8,10 +8,12 @@
 
 namespace PathTracer
 {
+    float Luminance(float r, float g, float b);
+
     class EnvironmentMap
     {
     public:
-        EnvironmentMap() : width(0), height(0), img(nullptr), cdf(nullptr) {};
+        EnvironmentMap() : width(0), height(0), totalSum(0.0f), avgLuminance(0.0f), img(nullptr), cdf(nullptr) {};
         ~EnvironmentMap() { stbi_image_free(img); delete[] cdf; }
 
         bool LoadMap(const std::string& filename);
@@ -20,6 +22,7 @@ namespace PathTracer
         int width;
         int height;
         float totalSum;
+        float avgLuminance; // Solid angle weighted, used to estimate the power of the environment
         float* img;
         float* cdf;
     };
@@ -0,0 +1,158 @@
+#include <cstring>
+#include "FrameCapture.h"
+#include "stb_image_write.h"
+
+namespace PathTracer
+{
+    FrameCapture::FrameCapture()
+        : slots()
+        , nextSlot(0)
+        , writing(false)
+        , quit(false)
+    {
+        worker = std::thread(&FrameCapture::WorkerLoop, this);
+    }
+
+    FrameCapture::~FrameCapture()
+    {
+        Flush();
+
+        for (int i = 0; i < RING_SIZE; i++)
+            glDeleteBuffers(1, &slots[i].pbo);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        jobAdded.notify_one();
+        worker.join();
+    }
+
+    void FrameCapture::Capture(GLuint texture, int width, int height, const std::string& filename)
+    {
+        Slot& slot = slots[nextSlot];
+        nextSlot = (nextSlot + 1) % RING_SIZE;
+
+        // The ring is full. This capture was queued RING_SIZE captures ago, so it is the one most likely done
+        if (slot.fence)
+        {
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            Retire(slot);
+        }
+
+        size_t size = (size_t)width * height * 4;
+        if (slot.pbo == 0)
+            glGenBuffers(1, &slot.pbo);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        if (slot.size != size)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            slot.size = size;
+        }
+
+        // Queued like any other command, the fence tells when the pixels have arrived
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.width = width;
+        slot.height = height;
+        slot.filename = filename;
+    }
+
+    void FrameCapture::Update()
+    {
+        // Oldest first, so files are written in the order they were captured
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            Slot& slot = slots[(nextSlot + i) % RING_SIZE];
+            if (!slot.fence)
+                continue;
+
+            GLenum result = glClientWaitSync(slot.fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+
+            Retire(slot);
+        }
+    }
+
+    void FrameCapture::Flush()
+    {
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            Slot& slot = slots[(nextSlot + i) % RING_SIZE];
+            if (!slot.fence)
+                continue;
+
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            Retire(slot);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        jobsDone.wait(lock, [this] { return jobs.empty() && !writing; });
+    }
+
+    void FrameCapture::Retire(Slot& slot)
+    {
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        Job job;
+        job.width = slot.width;
+        job.height = slot.height;
+        job.filename = slot.filename;
+        job.pixels.resize(slot.size);
+
+        // Copied out row by row, bottom up, since GL images start at the bottom and PNGs at the top
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const unsigned char* data = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+        if (data)
+        {
+            size_t rowSize = (size_t)slot.width * 4;
+            for (int y = 0; y < slot.height; y++)
+                memcpy(&job.pixels[y * rowSize], data + (slot.height - 1 - y) * rowSize, rowSize);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (!data)
+        {
+            printf("Unable to read back frame for %s\n", slot.filename.c_str());
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAdded.notify_one();
+    }
+
+    void FrameCapture::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            jobAdded.wait(lock, [this] { return !jobs.empty() || quit; });
+            if (jobs.empty())
+                break;
+
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            writing = true;
+            lock.unlock();
+
+            if (stbi_write_png(job.filename.c_str(), job.width, job.height, 4, job.pixels.data(), job.width * 4))
+                printf("Frame saved: %s\n", job.filename.c_str());
+            else
+                printf("Unable to write %s\n", job.filename.c_str());
+
+            lock.lock();
+            writing = false;
+            jobsDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,69 @@
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Config.h"
+
+namespace PathTracer
+{
+    // Saves frames to disk without stalling the render loop. A frame is read back into one of a ring of
+    // pixel pack buffers guarded by a fence. Once the GPU is done with it the pixels are copied out and
+    // an output worker thread encodes the PNG while rendering continues
+    class FrameCapture
+    {
+    public:
+        FrameCapture();
+        ~FrameCapture();
+
+        // Queues a readback of texture (RGBA) to be written to filename. Only waits if every buffer of the ring is still in flight
+        void Capture(GLuint texture, int width, int height, const std::string& filename);
+
+        // Hands finished readbacks to the worker without blocking. Called once per frame
+        void Update();
+
+        // Waits until every capture is written to disk
+        void Flush();
+
+    private:
+        static const int RING_SIZE = 3;
+
+        struct Slot
+        {
+            GLuint pbo;
+            GLsync fence;
+            size_t size;
+            int width;
+            int height;
+            std::string filename;
+        };
+
+        struct Job
+        {
+            std::vector<unsigned char> pixels;
+            int width;
+            int height;
+            std::string filename;
+        };
+
+        void Retire(Slot& slot);
+        void WorkerLoop();
+
+        Slot slots[RING_SIZE];
+        int nextSlot;
+
+        // Encoding jobs handed to the worker
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable jobAdded;
+        std::condition_variable jobsDone;
+        std::deque<Job> jobs;
+        bool writing;
+        bool quit;
+    };
+}
@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstring>
+#include "HeadlessContext.h"
+
+#ifdef PATHTRACER_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace PathTracer
+{
+    HeadlessContext::HeadlessContext()
+        : display(nullptr)
+        , surface(nullptr)
+        , context(nullptr)
+    {
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        Destroy();
+    }
+
+#ifdef PATHTRACER_HEADLESS
+    bool HeadlessContext::Create(int majorVersion, int minorVersion)
+    {
+        // step 1: get a display. Mesa's surfaceless platform needs neither X11 nor a GPU
+        EGLDisplay dpy = EGL_NO_DISPLAY;
+        const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+        {
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = 
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if (getPlatformDisplay)
+                dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (dpy == EGL_NO_DISPLAY)
+            dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor))
+        {
+            printf("Failed to initialize EGL display\n");
+            return false;
+        }
+        display = dpy;
+
+        // step 2: pick a config. A 1x1 pbuffer is enough as rendering only goes to the renderer's FBOs
+        EGLint configAttribs[] = 
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+            EGL_NONE
+        };
+        EGLConfig config = nullptr;
+        EGLint numConfigs = 0;
+        eglChooseConfig(dpy, configAttribs, &config, 1, &numConfigs);
+
+        if (numConfigs > 0)
+        {
+            EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            EGLSurface pbuffer = eglCreatePbufferSurface(dpy, config, pbufferAttribs);
+            if (pbuffer != EGL_NO_SURFACE)
+                surface = pbuffer;
+        }
+
+        // step 3: create a core profile context, surfaceless if no pbuffer is available
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            printf("EGL does not support desktop OpenGL\n");
+            return false;
+        }
+
+        EGLint contextAttribs[] = 
+        {
+            EGL_CONTEXT_MAJOR_VERSION, majorVersion,
+            EGL_CONTEXT_MINOR_VERSION, minorVersion,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext ctx = eglCreateContext(dpy, numConfigs > 0 ? config : nullptr, EGL_NO_CONTEXT, contextAttribs);
+        if (ctx == EGL_NO_CONTEXT)
+        {
+            printf("Failed to create OpenGL %d.%d context\n", majorVersion, minorVersion);
+            return false;
+        }
+        context = ctx;
+
+        EGLSurface drawSurface = surface ? (EGLSurface)surface : EGL_NO_SURFACE;
+        if (!eglMakeCurrent(dpy, drawSurface, drawSurface, ctx))
+        {
+            printf("Failed to make the headless context current\n");
+            return false;
+        }
+
+        printf("EGL %d.%d headless context (%s)\n", major, minor, surface ? "pbuffer" : "surfaceless");
+        return true;
+    }
+
+    void HeadlessContext::Destroy()
+    {
+        if (display == nullptr)
+            return;
+
+        eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context)
+            eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+        if (surface)
+            eglDestroySurface((EGLDisplay)display, (EGLSurface)surface);
+        eglTerminate((EGLDisplay)display);
+
+        display = surface = context = nullptr;
+    }
+#else
+    bool HeadlessContext::Create(int, int)
+    {
+        printf("Headless rendering is not available. Rebuild with PATHTRACER_HEADLESS enabled\n");
+        return false;
+    }
+
+    void HeadlessContext::Destroy()
+    {
+    }
+#endif
+}
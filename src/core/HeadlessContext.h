@@ -0,0 +1,25 @@
+
+
+#pragma once
+
+namespace PathTracer
+{
+    // Offscreen OpenGL context for batch rendering without a window. Uses an EGL pbuffer
+    // (or a surfaceless context) so it also runs on Mesa's llvmpipe on machines without a GPU.
+    // Only available when built with PATHTRACER_HEADLESS, Create() fails otherwise
+    class HeadlessContext
+    {
+    public:
+        HeadlessContext();
+        ~HeadlessContext();
+
+        bool Create(int majorVersion, int minorVersion);
+        void Destroy();
+
+    private:
+        // EGLDisplay, EGLSurface and EGLContext, kept opaque so EGL headers are only needed by the implementation
+        void* display;
+        void* surface;
+        void* context;
+    };
+}
@@ -5,6 +5,7 @@
 #include <iostream>
 #include "tiny_obj_loader.h"
 #include "Mesh.h"
+#include "TaskSystem.h"
 
 namespace PathTracer
 {
@@ -88,17 +89,11 @@ namespace PathTracer
         const int numTris = vertexXYZU.size() / 3;
         std::vector<RadeonRays::bbox> bounds(numTris);
 
-#pragma omp parallel for
-        for (int i = 0; i < numTris; ++i)
+        // Chunks of tris are bounded on the workers, the BVHs of other meshes may be built at the same time
+        TaskSystem::Get().ParallelFor(0, numTris, 16384, [&](int first, int last)
         {
-            const Vec3 v1 = Vec3(vertexXYZU[i * 3 + 0]);
-            const Vec3 v2 = Vec3(vertexXYZU[i * 3 + 1]);
-            const Vec3 v3 = Vec3(vertexXYZU[i * 3 + 2]);
-
-            bounds[i].grow(v1);
-            bounds[i].grow(v2);
-            bounds[i].grow(v3);
-        }
+            RadeonRays::triangle_bounds(&vertexXYZU[first * 3], last - first, &bounds[first]);
+        });
 
         bvh->Build(&bounds[0], numTris);
     }
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include "Profiler.h"
+
+namespace PathTracer
+{
+    Profiler::Profiler()
+        : enabled(false)
+        , frameIndex(0)
+        , resolvingFrame(0)
+        , csvFile(nullptr)
+    {
+    }
+
+    Profiler& Profiler::Get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    void Profiler::SetEnabled(bool enable)
+    {
+        if (enabled == enable)
+            return;
+
+        enabled = enable;
+
+        // Timings of a partially recorded frame are dropped
+        for (int i = 0; i < sections.size(); i++)
+        {
+            sections[i].frameTime = 0.0;
+            sections[i].frameHit = false;
+        }
+
+        if (!enabled)
+        {
+            for (int i = 0; i < pendingTimers.size(); i++)
+            {
+                freeQueries.push_back(pendingTimers[i].startQuery);
+                freeQueries.push_back(pendingTimers[i].endQuery);
+            }
+            pendingTimers.clear();
+            StopCSV();
+        }
+
+        resolvingFrame = frameIndex;
+    }
+
+    int Profiler::FindSection(const char* name, bool gpu, bool counter)
+    {
+        std::string key = (counter ? "cnt:" : gpu ? "gpu:" : "cpu:") + std::string(name);
+        auto it = sectionIndices.find(key);
+        if (it != sectionIndices.end())
+            return it->second;
+
+        Section section;
+        section.name = name;
+        section.gpu = gpu;
+        section.counter = counter;
+        section.historyCount = 0;
+        section.historyIndex = 0;
+        section.frameTime = 0.0;
+        section.frameHit = false;
+
+        sections.push_back(section);
+        sectionIndices[key] = sections.size() - 1;
+        return sections.size() - 1;
+    }
+
+    void Profiler::AddCPUTime(const char* name, double ms)
+    {
+        if (!enabled)
+            return;
+
+        Section& section = sections[FindSection(name, false)];
+        section.frameTime += ms;
+        section.frameHit = true;
+    }
+
+    void Profiler::AddCount(const char* name, double value)
+    {
+        if (!enabled)
+            return;
+
+        Section& section = sections[FindSection(name, false, true)];
+        section.frameTime += value;
+        section.frameHit = true;
+    }
+
+    GLuint Profiler::AcquireQuery()
+    {
+        if (freeQueries.empty())
+        {
+            GLuint queries[16];
+            glGenQueries(16, queries);
+            freeQueries.insert(freeQueries.end(), queries, queries + 16);
+        }
+
+        GLuint query = freeQueries.back();
+        freeQueries.pop_back();
+        return query;
+    }
+
+    GLuint Profiler::BeginGPU(const char* name)
+    {
+        if (!enabled)
+            return 0;
+
+        // Timestamps instead of GL_TIME_ELAPSED, so scopes can nest and overlap with the tile timer
+        GPUTimer timer;
+        timer.startQuery = AcquireQuery();
+        timer.endQuery = AcquireQuery();
+        timer.section = FindSection(name, true);
+        timer.frame = frameIndex;
+        glQueryCounter(timer.startQuery, GL_TIMESTAMP);
+
+        pendingTimers.push_back(timer);
+        return timer.endQuery;
+    }
+
+    void Profiler::EndGPU(GLuint endQuery)
+    {
+        if (endQuery != 0)
+            glQueryCounter(endQuery, GL_TIMESTAMP);
+    }
+
+    void Profiler::ResolveGPUTimers()
+    {
+        // Timers complete in submission order, so stop at the first one that is not ready
+        while (!pendingTimers.empty())
+        {
+            GPUTimer& timer = pendingTimers.front();
+
+            GLint available = 0;
+            glGetQueryObjectiv(timer.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            // All timers of the previous frame were resolved
+            if (timer.frame != resolvingFrame)
+            {
+                FlushFrame(resolvingFrame, true);
+                resolvingFrame = timer.frame;
+            }
+
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(timer.startQuery, GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(timer.endQuery, GL_QUERY_RESULT, &end);
+
+            Section& section = sections[timer.section];
+            section.frameTime += (end - start) / 1000000.0;
+            section.frameHit = true;
+
+            freeQueries.push_back(timer.startQuery);
+            freeQueries.push_back(timer.endQuery);
+            pendingTimers.pop_front();
+        }
+
+        // Nothing left in flight for the frames up to the current one
+        if (pendingTimers.empty() && resolvingFrame <= frameIndex)
+        {
+            FlushFrame(resolvingFrame, true);
+            resolvingFrame = frameIndex + 1;
+        }
+    }
+
+    void Profiler::FlushFrame(int frame, bool gpu)
+    {
+        for (int i = 0; i < sections.size(); i++)
+        {
+            Section& section = sections[i];
+            if (section.gpu != gpu || !section.frameHit)
+                continue;
+
+            section.history[section.historyIndex] = (float)section.frameTime;
+            section.historyIndex = (section.historyIndex + 1) % historySize;
+            section.historyCount = std::min(section.historyCount + 1, historySize);
+
+            if (csvFile)
+                fprintf(csvFile, "%d,%s,%s,%.4f\n", frame, section.name.c_str(), section.counter ? "count" : gpu ? "gpu" : "cpu", section.frameTime);
+
+            section.frameTime = 0.0;
+            section.frameHit = false;
+        }
+    }
+
+    void Profiler::EndFrame()
+    {
+        if (!enabled)
+            return;
+
+        ResolveGPUTimers();
+        FlushFrame(frameIndex, false);
+        frameIndex++;
+    }
+
+    void Profiler::ReleaseQueries()
+    {
+        for (int i = 0; i < pendingTimers.size(); i++)
+        {
+            freeQueries.push_back(pendingTimers[i].startQuery);
+            freeQueries.push_back(pendingTimers[i].endQuery);
+        }
+        pendingTimers.clear();
+        resolvingFrame = frameIndex;
+
+        if (!freeQueries.empty())
+            glDeleteQueries(freeQueries.size(), freeQueries.data());
+        freeQueries.clear();
+    }
+
+    bool Profiler::StartCSV(const std::string& filename)
+    {
+        StopCSV();
+
+        csvFile = fopen(filename.c_str(), "w");
+        if (!csvFile)
+        {
+            printf("Couldn't open %s for writing\n", filename.c_str());
+            return false;
+        }
+
+        fprintf(csvFile, "frame,section,type,ms\n");
+        return true;
+    }
+
+    void Profiler::StopCSV()
+    {
+        if (csvFile)
+            fclose(csvFile);
+        csvFile = nullptr;
+    }
+
+    void Profiler::GetStats(const Section& section, float& last, float& average, float& minimum, float& maximum) const
+    {
+        last = average = minimum = maximum = 0.0f;
+        if (section.historyCount == 0)
+            return;
+
+        last = section.history[(section.historyIndex + historySize - 1) % historySize];
+        minimum = maximum = section.history[0];
+        for (int i = 0; i < section.historyCount; i++)
+        {
+            average += section.history[i];
+            minimum = std::min(minimum, section.history[i]);
+            maximum = std::max(maximum, section.history[i]);
+        }
+        average /= section.historyCount;
+    }
+}
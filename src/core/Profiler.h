@@ -0,0 +1,129 @@
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Config.h"
+
+namespace PathTracer
+{
+    // Collects CPU and GPU timings per named section and frame, keeps a rolling history of them and
+    // optionally writes every frame to a CSV file. GPU times come from timestamp queries that are read back
+    // once they are available, so measuring never stalls the pipeline. While disabled, scopes only check a flag
+    class Profiler
+    {
+    public:
+        static constexpr int historySize = 120;
+
+        struct Section
+        {
+            std::string name;
+            bool gpu;
+            bool counter;
+            float history[historySize];
+            int historyCount;
+            int historyIndex;
+            double frameTime;
+            bool frameHit;
+        };
+
+        static Profiler& Get();
+
+        void SetEnabled(bool enable);
+        bool IsEnabled() const { return enabled; }
+
+        // Called once per frame after all of its work was submitted
+        void EndFrame();
+
+        void AddCPUTime(const char* name, double ms);
+        // Counters (e.g. rays per second) are kept and written like CPU timings, in their own unit
+        void AddCount(const char* name, double value);
+        GLuint BeginGPU(const char* name);
+        void EndGPU(GLuint endQuery);
+
+        // Queries belong to the current GL context and have to be released before it goes away
+        void ReleaseQueries();
+
+        bool StartCSV(const std::string& filename);
+        void StopCSV();
+        bool IsWritingCSV() const { return csvFile != nullptr; }
+
+        const std::vector<Section>& GetSections() const { return sections; }
+        void GetStats(const Section& section, float& last, float& average, float& minimum, float& maximum) const;
+
+    private:
+        struct GPUTimer
+        {
+            GLuint startQuery;
+            GLuint endQuery;
+            int section;
+            int frame;
+        };
+
+        Profiler();
+
+        int FindSection(const char* name, bool gpu, bool counter = false);
+        void ResolveGPUTimers();
+        void FlushFrame(int frame, bool gpu);
+        GLuint AcquireQuery();
+
+        bool enabled;
+        int frameIndex;
+        int resolvingFrame;
+        std::vector<Section> sections;
+        std::unordered_map<std::string, int> sectionIndices;
+        std::deque<GPUTimer> pendingTimers;
+        std::vector<GLuint> freeQueries;
+        FILE* csvFile;
+    };
+
+    // Adds the wall time of the enclosing scope to a CPU section
+    class CPUProfileScope
+    {
+    public:
+        CPUProfileScope(const char* name)
+            : name(name)
+            , active(Profiler::Get().IsEnabled())
+        {
+            if (active)
+                start = std::chrono::high_resolution_clock::now();
+        }
+
+        ~CPUProfileScope()
+        {
+            if (active)
+            {
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                Profiler::Get().AddCPUTime(name, elapsed.count());
+            }
+        }
+
+    private:
+        const char* name;
+        bool active;
+        std::chrono::high_resolution_clock::time_point start;
+    };
+
+    // Adds the GPU time of the commands submitted in the enclosing scope to a GPU section
+    class GPUProfileScope
+    {
+    public:
+        GPUProfileScope(const char* name)
+            : endQuery(Profiler::Get().BeginGPU(name))
+        {
+        }
+
+        ~GPUProfileScope()
+        {
+            Profiler::Get().EndGPU(endQuery);
+        }
+
+    private:
+        GLuint endQuery;
+    };
+}
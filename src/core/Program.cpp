@@ -1,19 +1,104 @@
 
 
+#include <cstring>
 #include <stdexcept>
 #include "Program.h"
 
 namespace PathTracer
 {
-    Program::Program(const std::vector<Shader> shaders)
+    namespace
+    {
+        // From GL_KHR_parallel_shader_compile (GL_ARB_parallel_shader_compile has the same values), which
+        // glcorearb.h of gl3w predates
+        const GLenum COMPLETION_STATUS_KHR = 0x91B1;
+        typedef void (*PFNMAXSHADERCOMPILERTHREADSKHR)(GLuint count);
+
+        bool parallelCompileSupported = false;
+    }
+
+    void Program::InitParallelCompile()
+    {
+        parallelCompileSupported = false;
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; i++)
+        {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (name != nullptr && (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                parallelCompileSupported = true;
+        }
+
+        // Let the driver pick the number of compiler threads instead of its default, which may be none
+        PFNMAXSHADERCOMPILERTHREADSKHR maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSKHR)gl3wGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxShaderCompilerThreads == nullptr)
+            maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSKHR)gl3wGetProcAddress("glMaxShaderCompilerThreadsARB");
+        if (parallelCompileSupported && maxShaderCompilerThreads != nullptr)
+            maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+
+    Program::Program(const std::vector<Shader> shaders, bool deferCheck)
+        : pendingShaders(shaders)
     {
         object = glCreateProgram();
         for (unsigned i = 0; i < shaders.size(); i++)
             glAttachShader(object, shaders[i].getObject());
 
+        // Lets ProgramCache retrieve the linked binary
+        if (glProgramParameteri != nullptr)
+            glProgramParameteri(object, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
         glLinkProgram(object);
         for (unsigned i = 0; i < shaders.size(); i++)
             glDetachShader(object, shaders[i].getObject());
+
+        if (!deferCheck)
+            CheckStatus();
+    }
+
+    Program::Program(GLuint object)
+        : object(object)
+    {
+    }
+
+    Program::~Program()
+    {
+        for (unsigned i = 0; i < pendingShaders.size(); i++)
+            glDeleteShader(pendingShaders[i].getObject());
+        glDeleteProgram(object);
+    }
+
+    bool Program::IsReady()
+    {
+        if (pendingShaders.empty() || !parallelCompileSupported)
+            return true;
+
+        GLint done = GL_FALSE;
+        glGetProgramiv(object, COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    // Compile errors are reported before the link error they cause, since their log is the useful one.
+    // The shaders are released either way, a failed program only reports its link status afterwards
+    void Program::CheckStatus()
+    {
+        std::vector<Shader> shaders;
+        shaders.swap(pendingShaders);
+        for (unsigned i = 0; i < shaders.size(); i++)
+        {
+            try
+            {
+                shaders[i].CheckStatus();
+            }
+            catch (const std::runtime_error&)
+            {
+                // The failed shader deleted itself
+                for (unsigned j = i + 1; j < shaders.size(); j++)
+                    glDeleteShader(shaders[j].getObject());
+                throw;
+            }
+            glDeleteShader(shaders[i].getObject());
+        }
+
         GLint success = 0;
         glGetProgramiv(object, GL_LINK_STATUS, &success);
         if (success == GL_FALSE)
@@ -32,11 +117,6 @@ namespace PathTracer
         }
     }
 
-    Program::~Program()
-    {
-        glDeleteProgram(object);
-    }
-
     void Program::Use()
     {
         glUseProgram(object);
@@ -51,4 +131,16 @@ namespace PathTracer
     {
         return object;
     }
+
+    // Locations are looked up once per program and cached, so per-frame uniform updates do not query the driver
+    GLint Program::getUniformLocation(const std::string& name)
+    {
+        auto it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+
+        GLint location = glGetUniformLocation(object, name.c_str());
+        uniformLocations[name] = location;
+        return location;
+    }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
 #include "Shader.h"
 
 namespace PathTracer
@@ -11,12 +12,25 @@ namespace PathTracer
     {
     private:
         GLuint object;
+        std::unordered_map<std::string, GLint> uniformLocations;
+        std::vector<Shader> pendingShaders;
 
     public:
-        Program(const std::vector<Shader> shaders);
+        // With deferCheck neither the shaders nor the link are checked until CheckStatus(), so the driver can compile
+        // in the background (GL_KHR_parallel_shader_compile) while the caller keeps rendering
+        Program(const std::vector<Shader> shaders, bool deferCheck = false);
+        // Takes ownership of an already linked program, e.g. one loaded from a program binary
+        explicit Program(GLuint object);
         ~Program();
+        // Detects GL_KHR_parallel_shader_compile and lets the driver use all its compiler threads. Called once after
+        // the context is created, deferred checks do not poll for completion without it
+        static void InitParallelCompile();
+        // True once CheckStatus() would not block. Always true without parallel compilation
+        bool IsReady();
+        void CheckStatus();
         void Use();
         void StopUsing();
         GLuint getObject();
+        GLint getUniformLocation(const std::string& name);
     };
 }
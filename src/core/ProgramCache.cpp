@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include "ProgramCache.h"
+
+namespace PathTracer
+{
+    namespace
+    {
+        struct EntryHeader
+        {
+            char magic[4];
+            unsigned long long key;
+            GLenum format;
+            GLint length;
+        };
+
+        const char entryMagic[4] = { 'P', 'T', 'P', 'B' };
+
+        // FNV-1a, only used to name and check entries. Stops at the first null character like the
+        // compiler does, since Shader::load only terminates some of the sources with one
+        unsigned long long Hash(const char* data, unsigned long long hash)
+        {
+            for (; *data != '\0'; data++)
+            {
+                hash ^= (unsigned char)*data;
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    }
+
+    ProgramCache& ProgramCache::Get()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    ProgramCache::ProgramCache()
+        : supported(-1)
+    {
+    }
+
+    void ProgramCache::SetDirectory(const std::string& dir)
+    {
+        directory = dir;
+        if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+            directory += '/';
+    }
+
+    // Checked once a context exists, i.e. on the first load
+    bool ProgramCache::IsSupported()
+    {
+        if (supported == -1)
+        {
+            GLint numFormats = 0;
+            if (glGetProgramBinary != nullptr && glProgramBinary != nullptr)
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+            supported = numFormats > 0;
+
+            const char* strings[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+            for (int i = 0; i < 3; i++)
+                driver += std::string(strings[i] ? strings[i] : "") + "\n";
+
+            if (!supported)
+                printf("Program binaries are not supported by the driver, shaders are compiled every time\n");
+        }
+
+        return supported && !directory.empty();
+    }
+
+    std::string ProgramCache::EntryPath(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc, unsigned long long& key)
+    {
+        key = Hash(driver.c_str(), 14695981039346656037ull);
+        key = Hash(vertShaderSrc.src.c_str(), key);
+        key = Hash(fragShaderSrc.src.c_str(), key);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", key);
+        return directory + name;
+    }
+
+    Program* ProgramCache::Load(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc)
+    {
+        if (!IsSupported())
+            return nullptr;
+
+        unsigned long long key;
+        std::string path = EntryPath(vertShaderSrc, fragShaderSrc, key);
+
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return nullptr;
+
+        EntryHeader header;
+        std::vector<char> binary;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, entryMagic, 4) == 0 && header.key == key && header.length > 0;
+        if (valid)
+        {
+            binary.resize(header.length);
+            valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+        }
+        fclose(file);
+
+        if (!valid)
+            return nullptr;
+
+        // The driver can still refuse the binary (e.g. after an update), then the program is compiled from source again
+        GLuint object = glCreateProgram();
+        glProgramBinary(object, header.format, binary.data(), header.length);
+        GLint success = 0;
+        glGetProgramiv(object, GL_LINK_STATUS, &success);
+        if (success == GL_FALSE)
+        {
+            glDeleteProgram(object);
+            return nullptr;
+        }
+
+        printf("Loaded cached program for %s\n", fragShaderSrc.path.c_str());
+        return new Program(object);
+    }
+
+    void ProgramCache::Store(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc, Program* program)
+    {
+        if (!IsSupported())
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(program->getObject(), GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        EntryHeader header;
+        memcpy(header.magic, entryMagic, 4);
+        header.length = 0;
+        std::vector<char> binary(length);
+        glGetProgramBinary(program->getObject(), length, &header.length, &header.format, binary.data());
+        if (header.length <= 0)
+            return;
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        std::string path = EntryPath(vertShaderSrc, fragShaderSrc, header.key);
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            printf("Unable to write program cache entry %s\n", path.c_str());
+            return;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary.data(), 1, header.length, file);
+        fclose(file);
+    }
+}
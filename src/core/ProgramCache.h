@@ -0,0 +1,36 @@
+
+
+#pragma once
+
+#include <string>
+#include "Program.h"
+
+namespace PathTracer
+{
+    // Keeps linked programs on disk with glGetProgramBinary, so shader variants that were compiled before
+    // load without compiling. Entries are keyed by a hash of the complete source (defines included, since they are
+    // inserted into it) and the driver, which rejects binaries of other driver versions anyway. Caching is
+    // skipped when no directory is set or the driver has no binary formats
+    class ProgramCache
+    {
+    public:
+        static ProgramCache& Get();
+
+        // Empty disables the cache. The directory is created on first use
+        void SetDirectory(const std::string& dir);
+
+        // Returns nullptr if there is no usable binary for these sources
+        Program* Load(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc);
+        void Store(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc, Program* program);
+
+    private:
+        ProgramCache();
+
+        bool IsSupported();
+        std::string EntryPath(const Shader::ShaderSource& vertShaderSrc, const Shader::ShaderSource& fragShaderSrc, unsigned long long& key);
+
+        std::string directory;
+        std::string driver;
+        int supported;
+    };
+}
@@ -1,17 +1,39 @@
+#include <cstring>
+#include <stdexcept>
 #include "Config.h"
 #include "Renderer.h"
 #include "Scene.h"
-#include "OpenImageDenoise/oidn.hpp"
+#include "Profiler.h"
+#include "Denoiser.h"
+#include "CpuRenderer.h"
+#include "ProgramCache.h"
+#include "TaskSystem.h"
 
 namespace PathTracer
 {
-    Program* LoadShaders(const Shader::ShaderSource& vertShaderSrc, 
-                         const Shader::ShaderSource& fragShaderSrc)
+    // Defines have to follow the #version line
+    static void InsertDefines(Shader::ShaderSource& shaderSrc, const std::string& defines)
     {
-        std::vector<Shader> shaders;
-        shaders.push_back(Shader(vertShaderSrc, GL_VERTEX_SHADER));
-        shaders.push_back(Shader(fragShaderSrc, GL_FRAGMENT_SHADER));
-        return new Program(shaders);
+        size_t idx = shaderSrc.src.find("#version");
+        if (idx == std::string::npos)
+        {
+            shaderSrc.src.insert(0, defines);
+            return;
+        }
+
+        idx = shaderSrc.src.find("\n", idx);
+        if (idx == std::string::npos)
+            shaderSrc.src += "\n" + defines;
+        else
+            shaderSrc.src.insert(idx + 1, defines);
+    }
+
+    // Scene, camera and render options come from the uniform buffer at binding 0
+    static void BindRenderParams(Program* program)
+    {
+        GLuint blockIndex = glGetUniformBlockIndex(program->getObject(), "RenderParams");
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(program->getObject(), blockIndex, 0);
     }
 
     Renderer::Renderer(Scene* scene, const std::string& shadersDir)
@@ -27,23 +49,74 @@ namespace PathTracer
         , materialsTexture(0)
         , transformsTexture(0)
         , lightsTexture(0)
+        , lightDistTexture(0)
         , textureMapsArrayTexture(0)
         , envMapTexture(0)
         , envMapCDFTexture(0)
-        , pathTraceTextureLowRes(0)
-        , pathTraceTexture(0)
-        , accumTexture(0)
-        , tileOutputTexture()
-        , denoisedTexture(0)
-        , pathTraceFBO(0)
+        , renderParamsUBO(0)
+        , renderParams()
         , pathTraceFBOLowRes(0)
         , accumFBO(0)
         , outputFBO(0)
+        , restirInitialFBO(0)
+        , restirFBO()
+        , convergenceFBO(0)
+        , denoiserFBO(0)
+        , historyFBO()
         , shadersDir(shadersDir)
         , pathTraceShader(nullptr)
         , pathTraceShaderLowRes(nullptr)
         , outputShader(nullptr)
         , tonemapShader(nullptr)
+        , restirInitialShader(nullptr)
+        , restirSpatialShader(nullptr)
+        , convergenceShader(nullptr)
+        , denoiserShader(nullptr)
+        , reprojectShader(nullptr)
+        , wavefrontShaders()
+        , singleSample(true)
+        , pendingShaders()
+        , shadersPending(false)
+        , pathTraceTextureLowRes(0)
+        , accumTexture(0)
+        , tileOutputTexture()
+        , denoisedTexture(0)
+        , denoisedOutputTexture(0)
+        , restirInitialSampleTexture(0)
+        , restirInitialWeightTexture(0)
+        , restirGBufferTexture(0)
+        , restirSampleTexture()
+        , restirWeightTexture()
+        , momentTexture(0)
+        , convergenceTexture(0)
+        , convergedTiles(0)
+        , albedoTexture(0)
+        , normalTexture(0)
+        , denoiserInputTexture()
+        , historyTexture()
+        , historyPositionTexture()
+        , historyBuffer(0)
+        , historyLength(0)
+        , previewFrameCounter(1)
+        , historyParams()
+        , wavefrontBuffers()
+        , wavefrontCapacity(0)
+        , wavefrontStatsBuffer(0)
+        , wavefrontStatsQueries()
+        , wavefrontStatsBounces(0)
+        , wavefrontStatsPending(false)
+        , cpuRenderer(nullptr)
+        , tileTimerQuery(0)
+        , tileTimerPending(false)
+        , timedTileSamples(0)
+        , previewTimerQuery(0)
+        , previewTimerPending(false)
+        , timedPreviewPixels(0)
+        , previewPixelTime(0.0f)
+        , interactionScale(0.25f)
+        , refineStage(0)
+        , refinePreview(false)
+        , denoisedSampleCounter(0)
     {
         if (scene == nullptr)
         {
@@ -56,6 +129,7 @@ namespace PathTracer
             scene->ProcessScene();
 
         quad = new Quad();
+        denoiser = new Denoiser();
         pixelRatio = 0.25f;
 
         // step 2: load cpu data into gpu as glTextureBuffers and glTextures
@@ -66,6 +140,10 @@ namespace PathTracer
 
         // step 4: load actual shaders for rendering
         InitShaders();
+
+        // GPU timers for adaptive tile scheduling and dynamic preview resolution
+        glGenQueries(1, &tileTimerQuery);
+        glGenQueries(1, &previewTimerQuery);
     }
 
     Renderer::~Renderer()
@@ -80,43 +158,80 @@ namespace PathTracer
         glDeleteTextures(1, &materialsTexture);
         glDeleteTextures(1, &transformsTexture);
         glDeleteTextures(1, &lightsTexture);
+        glDeleteTextures(1, &lightDistTexture);
         glDeleteTextures(1, &textureMapsArrayTexture);
         glDeleteTextures(1, &envMapTexture);
         glDeleteTextures(1, &envMapCDFTexture);
-        glDeleteTextures(1, &pathTraceTexture);
         glDeleteTextures(1, &pathTraceTextureLowRes);
         glDeleteTextures(1, &accumTexture);
         glDeleteTextures(1, &tileOutputTexture[0]);
         glDeleteTextures(1, &tileOutputTexture[1]);
         glDeleteTextures(1, &denoisedTexture);
+        glDeleteTextures(1, &denoisedOutputTexture);
 
         // Delete buffers
         glDeleteBuffers(1, &BVHBuffer);
         glDeleteBuffers(1, &vertexIndicesBuffer);
         glDeleteBuffers(1, &verticesBuffer);
         glDeleteBuffers(1, &normalsBuffer);
+        glDeleteBuffers(1, &renderParamsUBO);
 
         // Delete FBOs
-        glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOLowRes);
         glDeleteFramebuffers(1, &accumFBO);
         glDeleteFramebuffers(1, &outputFBO);
 
+        // Delete ReSTIR reservoirs
+        DeleteReSTIRFBOs();
+
+        // Delete adaptive sampling buffers and tile queries
+        DeleteAdaptiveFBOs();
+
+        // Delete denoiser inputs
+        DeleteDenoiserFBOs();
+
+        // Delete reprojection history
+        DeleteReprojectionFBOs();
+
+        // Delete wavefront paths and queues
+        DeleteWavefrontBuffers();
+        if (wavefrontStatsBuffer != 0)
+        {
+            glDeleteBuffers(1, &wavefrontStatsBuffer);
+            glDeleteQueries(WAVEFRONT_STAT_BOUNCES + 1, wavefrontStatsQueries);
+        }
+
+        // Stop the CPU render threads
+        delete cpuRenderer;
+
+        // Delete queries
+        glDeleteQueries(1, &tileTimerQuery);
+        glDeleteQueries(1, &previewTimerQuery);
+        Profiler::Get().ReleaseQueries();
+
         // Delete shaders
         delete pathTraceShader;
         delete pathTraceShaderLowRes;
         delete outputShader;
         delete tonemapShader;
-
-        // Delete denoiser data
-        delete[] denoiserInputFramePtr;
-        delete[] frameOutputPtr;
-
+        delete restirInitialShader;
+        delete restirSpatialShader;
+        delete convergenceShader;
+        delete denoiserShader;
+        delete reprojectShader;
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+            delete wavefrontShaders[i];
+        pendingShaders.Delete();
+
+        // Delete denoiser, waits for a denoise in flight
+        delete denoiser;
     }
 
     // Refer to doc/InitGPUDataBuffers.md for explanation
     void Renderer::InitGPUDataBuffers()
     {
+        CPUProfileScope profile("Upload Scene");
+
         // step 1: GL_PACK_ALIGHMENT=1 means pixels are tightly packed with no padding
         // usually set as default for textures
         glPixelStorei(GL_PACK_ALIGNMENT, 1);
@@ -130,7 +245,7 @@ namespace PathTracer
                      &scene->bvhTranslator.nodes[0], GL_STATIC_DRAW);
         glGenTextures(1, &BVHTexture);
         glBindTexture(GL_TEXTURE_BUFFER, BVHTexture);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, BVHBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, BVHBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, 0);
         glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -202,6 +317,16 @@ namespace PathTracer
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
             glBindTexture(GL_TEXTURE_2D, 0);
+
+            // Create texture for the light power distribution (alias table)
+            glGenTextures(1, &lightDistTexture);
+            glBindTexture(GL_TEXTURE_2D, lightDistTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 
+                         scene->lightDistribution.size(), 
+                         1, 0, GL_RGB, GL_FLOAT, &scene->lightDistribution[0]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
         }
 
         // Create texture for scene textures
@@ -239,6 +364,12 @@ namespace PathTracer
             glBindTexture(GL_TEXTURE_2D, 0);
         }
 
+        // Create uniform buffer for parameters shared by all path tracing programs
+        glGenBuffers(1, &renderParamsUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, renderParamsUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(RenderParams), &renderParams, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
         // step 3: Bind textures to texture slots as they will not change slots during the lifespan of the renderer
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_BUFFER, BVHTexture);
@@ -260,36 +391,37 @@ namespace PathTracer
         glBindTexture(GL_TEXTURE_2D, envMapTexture);
         glActiveTexture(GL_TEXTURE10);
         glBindTexture(GL_TEXTURE_2D, envMapCDFTexture);
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D, lightDistTexture);
+
+        // Same for the uniform buffer, which stays on binding point 0
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, renderParamsUBO);
     }
 
     void Renderer::ResizeRenderer()
     {
         // Delete textures
-        glDeleteTextures(1, &pathTraceTexture);
         glDeleteTextures(1, &pathTraceTextureLowRes);
         glDeleteTextures(1, &accumTexture);
         glDeleteTextures(1, &tileOutputTexture[0]);
         glDeleteTextures(1, &tileOutputTexture[1]);
         glDeleteTextures(1, &denoisedTexture);
+        glDeleteTextures(1, &denoisedOutputTexture);
 
         // Delete FBOs
-        glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOLowRes);
         glDeleteFramebuffers(1, &accumFBO);
         glDeleteFramebuffers(1, &outputFBO);
 
-        // Delete denoiser data
-        delete[] denoiserInputFramePtr;
-        delete[] frameOutputPtr;
-
-        // Delete shaders
-        delete pathTraceShader;
-        delete pathTraceShaderLowRes;
-        delete outputShader;
-        delete tonemapShader;
+        // Delete ReSTIR reservoirs, adaptive sampling buffers, denoiser inputs and reprojection history. They are recreated at the new resolution below
+        DeleteReSTIRFBOs();
+        DeleteAdaptiveFBOs();
+        DeleteDenoiserFBOs();
+        DeleteReprojectionFBOs();
 
+        // Programs do not depend on the resolution (it is in the uniform buffer), so they are kept
         InitFBOs();
-        InitShaders();
+        UpdateFeatureFBOs();
     }
 
     void Renderer::InitFBOs()
@@ -313,18 +445,10 @@ namespace PathTracer
         tile.x = -1;
         tile.y = numTiles.y - 1;
 
-        // Create FBOs for path trace shader 
-        glGenFramebuffers(1, &pathTraceFBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
-
-        // Create Texture for FBO
-        glGenTextures(1, &pathTraceTexture);
-        glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tileWidth, tileHeight, 0, GL_RGBA, GL_FLOAT, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTexture, 0);
+        // Tile timings depend on the tile size, so the scheduler starts over
+        tilesPerFrame = 1;
+        tileTime = 0.0f;
+        samplesInPass = 1;
 
         // Create FBOs for low res preview shader 
         glGenFramebuffers(1, &pathTraceFBOLowRes);
@@ -333,8 +457,9 @@ namespace PathTracer
         // Create Texture for FBO
         glGenTextures(1, &pathTraceTextureLowRes);
         glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 
-                     windowResolution.x * pixelRatio, windowResolution.y * pixelRatio, 0, GL_RGBA, GL_FLOAT, 0);
+        // Allocated at window resolution since dynamic preview resolution and refinement can go up to full size.
+        // Previews are rendered into the bottom left corner at PreviewResolution()
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, windowResolution.x, windowResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -377,8 +502,7 @@ namespace PathTracer
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
 
         // For Denoiser
-        denoiserInputFramePtr = new Vec3[renderResolution.x * renderResolution.y];
-        frameOutputPtr = new Vec3[renderResolution.x * renderResolution.y];
+        denoiser->Resize(renderResolution.x, renderResolution.y);
 
         glGenTextures(1, &denoisedTexture);
         glBindTexture(GL_TEXTURE_2D, denoisedTexture);
@@ -387,6 +511,14 @@ namespace PathTracer
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glBindTexture(GL_TEXTURE_2D, 0);
 
+        // The denoised image is HDR and tonemapped into denoisedOutputTexture for display
+        glGenTextures(1, &denoisedOutputTexture);
+        glBindTexture(GL_TEXTURE_2D, denoisedOutputTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
         printf("Window Resolution : %d %d\n", windowResolution.x, windowResolution.y);
         printf("Render Resolution : %d %d\n", renderResolution.x, renderResolution.y);
         printf("Preview Resolution : %d %d\n", (int)((float)windowResolution.x * pixelRatio), 
@@ -394,363 +526,1415 @@ namespace PathTracer
         printf("Tile Size : %d %d\n", tileWidth, tileHeight);
     }
 
-    void Renderer::ReloadShaders()
+    void Renderer::InitReSTIRFBOs()
     {
-        // Delete shaders
-        delete pathTraceShader;
-        delete pathTraceShaderLowRes;
-        delete outputShader;
-        delete tonemapShader;
+        restirBuffer = 0;
 
-        InitShaders();
+        GLuint* reservoirTextures[7] = { &restirInitialSampleTexture, &restirInitialWeightTexture, &restirGBufferTexture,
+                                         &restirSampleTexture[0], &restirWeightTexture[0], 
+                                         &restirSampleTexture[1], &restirWeightTexture[1] };
+        GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+
+        // Create textures for reservoirs. They hold one reservoir per pixel and are only read with texelFetch
+        for (int i = 0; i < 7; i++)
+        {
+            glGenTextures(1, reservoirTextures[i]);
+            glBindTexture(GL_TEXTURE_2D, *reservoirTextures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // Create FBO for candidate generation and temporal reuse
+        glGenFramebuffers(1, &restirInitialFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, restirInitialFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, restirInitialSampleTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, restirInitialWeightTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, restirGBufferTexture, 0);
+        glDrawBuffers(3, drawBuffers);
+
+        // Create FBOs for spatial reuse
+        for (int i = 0; i < 2; i++)
+        {
+            glGenFramebuffers(1, &restirFBO[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, restirFBO[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, restirSampleTexture[i], 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, restirWeightTexture[i], 0);
+            glDrawBuffers(2, drawBuffers);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    void Renderer::InitShaders()
+    void Renderer::DeleteReSTIRFBOs()
     {
-        Shader::ShaderSource vertexShaderSrc = Shader::load(shadersDir + "common/vertex.glsl");
-        Shader::ShaderSource pathTraceShaderSrc = Shader::load(shadersDir + "tile.glsl");
-        Shader::ShaderSource pathTraceShaderLowResSrc = Shader::load(shadersDir + "preview.glsl");
-        Shader::ShaderSource outputShaderSrc = Shader::load(shadersDir + "output.glsl");
-        Shader::ShaderSource tonemapShaderSrc = Shader::load(shadersDir + "tonemap.glsl");
+        glDeleteTextures(1, &restirInitialSampleTexture);
+        glDeleteTextures(1, &restirInitialWeightTexture);
+        glDeleteTextures(1, &restirGBufferTexture);
+        glDeleteTextures(2, restirSampleTexture);
+        glDeleteTextures(2, restirWeightTexture);
+        glDeleteFramebuffers(1, &restirInitialFBO);
+        glDeleteFramebuffers(2, restirFBO);
+
+        restirInitialSampleTexture = restirInitialWeightTexture = restirGBufferTexture = 0;
+        restirSampleTexture[0] = restirSampleTexture[1] = 0;
+        restirWeightTexture[0] = restirWeightTexture[1] = 0;
+        restirInitialFBO = restirFBO[0] = restirFBO[1] = 0;
+    }
 
-        // Add preprocessor defines for conditional compilation
-        std::string pathtraceDefines = "";
-        std::string tonemapDefines = "";
+    void Renderer::InitAdaptiveFBOs()
+    {
+        // Luminance moments and sample count per pixel, written by the tile shader as a second target of accumFBO
+        glGenTextures(1, &momentTexture);
+        glBindTexture(GL_TEXTURE_2D, momentTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-        if (scene->renderOptions.enableEnvMap && scene->envMap != nullptr)
-            pathtraceDefines += "#define OPT_ENVMAP\n";
+        UpdateAccumDrawBuffers();
+        GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+        glClearBufferfv(GL_COLOR, 1, zero);
 
-        if (!scene->lights.empty())
-            pathtraceDefines += "#define OPT_LIGHTS\n";
+        // One flag per pixel, set once its estimated error is below the threshold
+        glGenTextures(1, &convergenceTexture);
+        glBindTexture(GL_TEXTURE_2D, convergenceTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, renderResolution.x, renderResolution.y, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
 
-        if (scene->renderOptions.enableRR)
-        {
-            pathtraceDefines += "#define OPT_RR\n";
-            pathtraceDefines += "#define OPT_RR_DEPTH " + std::to_string(scene->renderOptions.RRDepth) + "\n";
-        }
+        glGenFramebuffers(1, &convergenceFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, convergenceFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, convergenceTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        if (scene->renderOptions.openglNormalMap)
-            pathtraceDefines += "#define OPT_OPENGL_NORMALMAP\n";
+        glActiveTexture(GL_TEXTURE15);
+        glBindTexture(GL_TEXTURE_2D, convergenceTexture);
+        glActiveTexture(GL_TEXTURE0);
 
-        if (scene->renderOptions.enableBackground)
-        {
-            pathtraceDefines += "#define OPT_BACKGROUND\n";
-            tonemapDefines += "#define OPT_BACKGROUND\n";
-        }
+        // Samples passed queries tell when every pixel of a tile was discarded, so the tile can be skipped
+        tileQueries.resize(numTiles.x * numTiles.y);
+        glGenQueries(tileQueries.size(), tileQueries.data());
 
-        if (scene->renderOptions.transparentBackground)
-        {
-            pathtraceDefines += "#define OPT_TRANSPARENT_BACKGROUND\n";
-            tonemapDefines += "#define OPT_TRANSPARENT_BACKGROUND\n";
-        }
+        ResetConvergence();
+    }
 
-        for (int i = 0; i < scene->materials.size(); i++)
-        {
-            if ((int)scene->materials[i].alphaMode != AlphaMode::Opaque)
-            {
-                pathtraceDefines += "#define OPT_ALPHA_TEST\n";
-                break;
-            }
-        }
+    void Renderer::DeleteAdaptiveFBOs()
+    {
+        glDeleteTextures(1, &momentTexture);
+        glDeleteTextures(1, &convergenceTexture);
+        glDeleteFramebuffers(1, &convergenceFBO);
+        if (!tileQueries.empty())
+            glDeleteQueries(tileQueries.size(), tileQueries.data());
+
+        momentTexture = convergenceTexture = convergenceFBO = 0;
+        tileQueries.clear();
+        tileConverged.clear();
+        tileQueryPending.clear();
+        convergedTiles = 0;
+    }
 
-        for (int i = 0; i < scene->materials.size(); i++)
+    void Renderer::InitDenoiserFBOs()
+    {
+        // First hit albedo and normal sums, written by the tile shader as the third and fourth target of accumFBO
+        GLuint* aovTextures[2] = { &albedoTexture, &normalTexture };
+        for (int i = 0; i < 2; i++)
         {
-            if ((int)scene->materials[i].mediumType != MediumType::None)
-            {
-                pathtraceDefines += "#define OPT_MEDIUM\n";
-                break;
-            }
+            glGenTextures(1, aovTextures[i]);
+            glBindTexture(GL_TEXTURE_2D, *aovTextures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         }
 
-        if (pathtraceDefines.size() > 0)
+        UpdateAccumDrawBuffers();
+        GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+        glClearBufferfv(GL_COLOR, 2, zero);
+        glClearBufferfv(GL_COLOR, 3, zero);
+
+        // Averaged color, albedo and normal that are read back for the denoiser
+        GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glGenFramebuffers(1, &denoiserFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, denoiserFBO);
+        for (int i = 0; i < 3; i++)
         {
-            size_t idx = pathTraceShaderSrc.src.find("#version");
-            if (idx != -1)
-                idx = pathTraceShaderSrc.src.find("\n", idx);
-            else
-                idx = 0;
-            pathTraceShaderSrc.src.insert(idx + 1, pathtraceDefines);
-
-            idx = pathTraceShaderLowResSrc.src.find("#version");
-            if (idx != -1)
-                idx = pathTraceShaderLowResSrc.src.find("\n", idx);
-            else
-                idx = 0;
-            pathTraceShaderLowResSrc.src.insert(idx + 1, pathtraceDefines);
+            glGenTextures(1, &denoiserInputTexture[i]);
+            glBindTexture(GL_TEXTURE_2D, denoiserInputTexture[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, denoiserInputTexture[i], 0);
         }
+        glDrawBuffers(3, drawBuffers);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
-        if (tonemapDefines.size() > 0)
-        {
-            size_t idx = tonemapShaderSrc.src.find("#version");
-            if (idx != -1)
-                idx = tonemapShaderSrc.src.find("\n", idx);
-            else
-                idx = 0;
-            tonemapShaderSrc.src.insert(idx + 1, tonemapDefines);
-        }
+    void Renderer::DeleteDenoiserFBOs()
+    {
+        glDeleteTextures(1, &albedoTexture);
+        glDeleteTextures(1, &normalTexture);
+        glDeleteTextures(3, denoiserInputTexture);
+        glDeleteFramebuffers(1, &denoiserFBO);
 
-        pathTraceShader = LoadShaders(vertexShaderSrc, pathTraceShaderSrc);
-        pathTraceShaderLowRes = LoadShaders(vertexShaderSrc, pathTraceShaderLowResSrc);
-        outputShader = LoadShaders(vertexShaderSrc, outputShaderSrc);
-        tonemapShader = LoadShaders(vertexShaderSrc, tonemapShaderSrc);
+        albedoTexture = normalTexture = denoiserFBO = 0;
+        denoiserInputTexture[0] = denoiserInputTexture[1] = denoiserInputTexture[2] = 0;
+    }
 
-        // Setup shader uniforms
-        GLuint shaderObject;
-        pathTraceShader->Use();
-        shaderObject = pathTraceShader->getObject();
+    void Renderer::InitReprojectionFBOs()
+    {
+        historyBuffer = 0;
+        historyLength = 0;
 
-        if (scene->envMap)
+        // Color and first hit position of the history, twice since each frame reads the history of the last one
+        GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 2; i++)
         {
-            glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, 
-                                                                         (float)scene->envMap->height);
-            glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
+            GLuint* textures[2] = { &historyTexture[i], &historyPositionTexture[i] };
+            glGenFramebuffers(1, &historyFBO[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, historyFBO[i]);
+            for (int j = 0; j < 2; j++)
+            {
+                glGenTextures(1, textures[j]);
+                glBindTexture(GL_TEXTURE_2D, *textures[j]);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, renderResolution.x, renderResolution.y, 0, GL_RGBA, GL_FLOAT, 0);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[j], GL_TEXTURE_2D, *textures[j], 0);
+            }
+            glDrawBuffers(2, drawBuffers);
+            glClearBufferfv(GL_COLOR, 0, zero);
+            glClearBufferfv(GL_COLOR, 1, zero);
         }
-        
-        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
-        glUniform2f(glGetUniformLocation(shaderObject, "resolution"), float(renderResolution.x), float(renderResolution.y));
-        glUniform2f(glGetUniformLocation(shaderObject, "invNumTiles"), invNumTiles.x, invNumTiles.y);
-        glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), scene->lights.size());
-        glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
-        glUniform1i(glGetUniformLocation(shaderObject, "BVHTexture"), 1);
-        glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTexture"), 2);
-        glUniform1i(glGetUniformLocation(shaderObject, "verticesTexture"), 3);
-        glUniform1i(glGetUniformLocation(shaderObject, "normalsTexture"), 4);
-        glUniform1i(glGetUniformLocation(shaderObject, "materialsTexture"), 5);
-        glUniform1i(glGetUniformLocation(shaderObject, "transformsTexture"), 6);
-        glUniform1i(glGetUniformLocation(shaderObject, "lightsTexture"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTexture"), 8);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapTexture"), 9);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapCDFTexture"), 10);
-        pathTraceShader->StopUsing();
-        
-        pathTraceShaderLowRes->Use();
-        shaderObject = pathTraceShaderLowRes->getObject();
-
-        if (scene->envMap)
-        {
-            glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-            glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
-        }
-        glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndex);
-        glUniform2f(glGetUniformLocation(shaderObject, "resolution"), float(renderResolution.x), float(renderResolution.y));
-        glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), scene->lights.size());
-        glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
-        glUniform1i(glGetUniformLocation(shaderObject, "BVHTexture"), 1);
-        glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTexture"), 2);
-        glUniform1i(glGetUniformLocation(shaderObject, "verticesTexture"), 3);
-        glUniform1i(glGetUniformLocation(shaderObject, "normalsTexture"), 4);
-        glUniform1i(glGetUniformLocation(shaderObject, "materialsTexture"), 5);
-        glUniform1i(glGetUniformLocation(shaderObject, "transformsTexture"), 6);
-        glUniform1i(glGetUniformLocation(shaderObject, "lightsTexture"), 7);
-        glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTexture"), 8);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapTexture"), 9);
-        glUniform1i(glGetUniformLocation(shaderObject, "envMapCDFTexture"), 10);
-        pathTraceShaderLowRes->StopUsing();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    void Renderer::Render()
+    void Renderer::DeleteReprojectionFBOs()
     {
-        // If maxSpp was reached then stop rendering. 
-        // TODO: Tonemapping and denosing still need to be able to run on final image
-        if (!scene->dirty && scene->renderOptions.maxSpp != -1 && 
-            sampleCounter >= scene->renderOptions.maxSpp)
-            return;
-
-        glActiveTexture(GL_TEXTURE0);
+        glDeleteTextures(2, historyTexture);
+        glDeleteTextures(2, historyPositionTexture);
+        glDeleteFramebuffers(2, historyFBO);
+
+        historyTexture[0] = historyTexture[1] = 0;
+        historyPositionTexture[0] = historyPositionTexture[1] = 0;
+        historyFBO[0] = historyFBO[1] = 0;
+        historyLength = 0;
+    }
 
-        if (scene->dirty)
+    void Renderer::InitWavefrontBuffers(int capacity)
+    {
+        DeleteWavefrontBuffers();
+        wavefrontCapacity = capacity;
+
+        // std430 sizes of the buffers in wavefront.glsl: counters, indirect dispatch arguments and bounce statistics,
+        // paths, hit records, two shadow rays per path, the two ray queues, the hit queues of both material classes,
+        // the shadow queue, the sort keys of the queued rays and the key bins
+        GLsizeiptr vec4Size = sizeof(Vec4), uintSize = sizeof(GLuint);
+        GLsizeiptr sizes[10] = {
+            uintSize * (24 + 2 * WAVEFRONT_STAT_BOUNCES),
+            vec4Size * 6 * capacity,
+            vec4Size * 4 * capacity,
+            vec4Size * 3 * 2 * capacity,
+            uintSize * capacity,
+            uintSize * capacity,
+            uintSize * 2 * capacity,
+            uintSize * capacity,
+            uintSize * capacity,
+            uintSize * WAVEFRONT_KEYS
+        };
+
+        glGenBuffers(10, wavefrontBuffers);
+        for (int i = 0; i < 10; i++)
         {
-            // Renders a low res preview if camera/instances are modified
-            glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBOLowRes);
-            glViewport(0, 0, windowResolution.x * pixelRatio, windowResolution.y * pixelRatio);
-            quad->Draw(pathTraceShaderLowRes);
-
-            scene->instancesModified = false;
-            scene->dirty = false;
-            scene->envMapModified = false;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, wavefrontBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], nullptr, GL_DYNAMIC_COPY);
         }
-        else
-        {
-            // Renders to pathTraceTexture while using previously accumulated samples from accumTexture
-            // Rendering is done a tile per frame, so if a 500x500 image is rendered with a tileWidth and tileHeight of 250 then, all tiles (for a single sample) 
-            // get rendered after 4 frames
-            glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
-            glViewport(0, 0, tileWidth, tileHeight);
-            glBindTexture(GL_TEXTURE_2D, accumTexture);
-            quad->Draw(pathTraceShader);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-            // pathTraceTexture is copied to accumTexture and re-used as input for the first step.
-            glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
-            glViewport(tileWidth * tile.x, tileHeight * tile.y, tileWidth, tileHeight);
-            glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-            quad->Draw(outputShader);
-            
-            // Here we render to tileOutputTexture[currentBuffer] but display tileOutputTexture[1-currentBuffer] until all tiles are done rendering
-            // When all tiles are rendered, we flip the bound texture and start rendering to the other one
-            glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
-            glViewport(0, 0, renderResolution.x, renderResolution.y);
-            glBindTexture(GL_TEXTURE_2D, accumTexture);
-            quad->Draw(tonemapShader);
+        UpdateWavefrontCapacity();
+    }
+
+    // Hit queues of both material classes share a buffer, the kernels find the second one at pathCapacity
+    void Renderer::UpdateWavefrontCapacity()
+    {
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+        {
+            if (wavefrontShaders[i] == nullptr)
+                continue;
+            wavefrontShaders[i]->Use();
+            glUniform1i(wavefrontShaders[i]->getUniformLocation("pathCapacity"), wavefrontCapacity);
+            wavefrontShaders[i]->StopUsing();
         }
     }
 
-    void Renderer::Present()
+    void Renderer::DeleteWavefrontBuffers()
     {
-        glActiveTexture(GL_TEXTURE0);
+        if (wavefrontBuffers[0] != 0)
+            glDeleteBuffers(10, wavefrontBuffers);
 
-        // For the first sample or if the camera is moving, we do not have an image ready with all the tiles rendered, so we display a low res preview.
-        if (scene->dirty || sampleCounter == 1)
+        for (int i = 0; i < 10; i++)
+            wavefrontBuffers[i] = 0;
+        wavefrontCapacity = 0;
+    }
+
+    // Attaches the optional targets of the tile shader (moments, albedo, normal) to accumFBO.
+    // Locations are fixed, so targets of disabled features are left out with GL_NONE
+    void Renderer::UpdateAccumDrawBuffers()
+    {
+        GLenum drawBuffers[4] = { GL_COLOR_ATTACHMENT0, GL_NONE, GL_NONE, GL_NONE };
+        if (momentTexture != 0)
+            drawBuffers[1] = GL_COLOR_ATTACHMENT1;
+        if (albedoTexture != 0)
         {
-            glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
-            quad->Draw(tonemapShader);
+            drawBuffers[2] = GL_COLOR_ATTACHMENT2;
+            drawBuffers[3] = GL_COLOR_ATTACHMENT3;
         }
-        else
-        {
-            if (scene->renderOptions.enableDenoiser && denoised)
-                glBindTexture(GL_TEXTURE_2D, denoisedTexture);
-            else
-                glBindTexture(GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer]);
 
-            quad->Draw(outputShader);
-        }
+        glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, momentTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, normalTexture, 0);
+        glDrawBuffers(4, drawBuffers);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    float Renderer::GetProgress()
+    void Renderer::ResetConvergence()
     {
-        int maxSpp = scene->renderOptions.maxSpp;
-        return maxSpp <= 0 ? 0.0f : sampleCounter * 100.0f / maxSpp;
+        tileConverged.assign(tileQueries.size(), false);
+        tileQueryPending.assign(tileQueries.size(), false);
+        convergedTiles = 0;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, convergenceFBO);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
     }
 
-    void Renderer::GetOutputBuffer(unsigned char** data, int& w, int& h)
+    bool Renderer::IsTileConverged(int index)
     {
-        w = renderResolution.x;
-        h = renderResolution.y;
+        if (tileConverged[index])
+            return true;
 
-        *data = new unsigned char[w * h * 4];
+        if (!tileQueryPending[index])
+            return false;
 
-        glActiveTexture(GL_TEXTURE0);
+        // The query is from the previous pass over this tile, so it is normally done without stalling
+        GLint available = 0;
+        glGetQueryObjectiv(tileQueries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
 
-        if (scene->renderOptions.enableDenoiser && denoised)
-            glBindTexture(GL_TEXTURE_2D, denoisedTexture);
-        else
-            glBindTexture(GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer]);
+        GLuint samplesPassed = 0;
+        glGetQueryObjectuiv(tileQueries[index], GL_QUERY_RESULT, &samplesPassed);
+        tileQueryPending[index] = false;
 
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, *data);
+        // Every pixel of the tile was discarded. Converged pixels stop accumulating, so they stay converged
+        if (samplesPassed == 0)
+        {
+            tileConverged[index] = true;
+            convergedTiles++;
+        }
+
+        return tileConverged[index];
     }
 
-    int Renderer::GetSampleCount()
+    bool Renderer::IsConverged()
     {
-        return sampleCounter;
+        return convergenceShader != nullptr && convergedTiles == numTiles.x * numTiles.y;
     }
 
-    void Renderer::Update(float secondsElapsed)
+    // Starts compiling the shaders for the current options. The current programs are used until they are done,
+    // see Update(). A reload that is still compiling is superseded
+    void Renderer::ReloadShaders()
     {
-        // If maxSpp was reached then stop updates
-        // TODO: Tonemapping and denosing still need to be able to run on final image
-        if (!scene->dirty && scene->renderOptions.maxSpp != -1 && sampleCounter >= scene->renderOptions.maxSpp)
-            return;
+        pendingShaders.Delete();
+        CompileShaders(pendingShaders);
+        shadersPending = true;
+    }
 
-        // Update data for instances
-        if (scene->instancesModified)
-        {
-            // Update transforms
-            glBindTexture(GL_TEXTURE_2D, transformsTexture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Mat4) / sizeof(Vec4)) * scene->transforms.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->transforms[0]);
+    // Compiles the shaders for the current options and uses them right away
+    void Renderer::InitShaders()
+    {
+        ShaderSet shaders;
+        CompileShaders(shaders);
+        UseShaders(shaders);
+    }
 
-            // Update materials
-            glBindTexture(GL_TEXTURE_2D, materialsTexture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Material) / sizeof(Vec4)) * scene->materials.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->materials[0]);
+    void Renderer::CompileShaders(ShaderSet& shaders)
+    {
+        shaders.vertexShaderSrc = Shader::load(shadersDir + "common/vertex.glsl");
+        Shader::ShaderSource pathTraceShaderSrc = Shader::load(shadersDir + "tile.glsl");
+        Shader::ShaderSource pathTraceShaderLowResSrc = Shader::load(shadersDir + "preview.glsl");
+        Shader::ShaderSource outputShaderSrc = Shader::load(shadersDir + "output.glsl");
+        Shader::ShaderSource tonemapShaderSrc = Shader::load(shadersDir + "tonemap.glsl");
 
-            // Update top level BVH
-            int index = scene->bvhTranslator.topLevelIndex;
-            int offset = sizeof(RadeonRays::BvhTranslator::Node) * index;
-            int size = sizeof(RadeonRays::BvhTranslator::Node) * (scene->bvhTranslator.nodes.size() - index);
-            glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-            glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &scene->bvhTranslator.nodes[index]);
-        }
+        // Add preprocessor defines for conditional compilation
+        std::string pathtraceDefines = "";
+        std::string tonemapDefines = "";
+        std::string restirDefines = "";
+        std::string adaptiveDefines = "";
+        std::string denoiserDefines = "";
 
-        // Recreate texture for envmaps
-        if (scene->envMapModified)
+        // Reservoir resampling only applies to analytic lights and is not used by the preview
+        bool enableReSTIR = scene->renderOptions.enableReSTIR && !scene->lights.empty();
+        if (enableReSTIR)
         {
-            // Create texture for environment map
-            if (scene->envMap != nullptr)
-            {
-                glBindTexture(GL_TEXTURE_2D, envMapTexture);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
+            restirDefines += "#define OPT_RESTIR\n";
+        }
 
-                glBindTexture(GL_TEXTURE_2D, envMapCDFTexture);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->envMap->width, scene->envMap->height, 0, GL_RED, GL_FLOAT, scene->envMap->cdf);
+        // Adaptive sampling only applies to the tile shader and the tonemap of its output
+        bool enableAdaptiveSampling = scene->renderOptions.enableAdaptiveSampling;
+        if (enableAdaptiveSampling)
+            adaptiveDefines += "#define OPT_ADAPTIVE\n";
 
-                GLuint shaderObject;
-                pathTraceShader->Use();
-                shaderObject = pathTraceShader->getObject();
-                glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-                glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
-                pathTraceShader->StopUsing();
-
-                pathTraceShaderLowRes->Use();
-                shaderObject = pathTraceShaderLowRes->getObject();
-                glUniform2f(glGetUniformLocation(shaderObject, "envMapRes"), (float)scene->envMap->width, (float)scene->envMap->height);
-                glUniform1f(glGetUniformLocation(shaderObject, "envMapTotalSum"), scene->envMap->totalSum);
-                pathTraceShaderLowRes->StopUsing();
-            }
-        }
+        // The denoiser needs first hit albedo and normal from the tile shader
+        bool enableDenoiser = scene->renderOptions.enableDenoiser;
+        if (enableDenoiser)
+            denoiserDefines += "#define OPT_DENOISER\n";
 
-        // Denoise image if requested
-        if (scene->renderOptions.enableDenoiser && sampleCounter > 1)
-        {
-            if (!denoised || (frameCounter % (scene->renderOptions.denoiserFrameCnt * (numTiles.x * numTiles.y)) == 0))
-            {
-                // FIXME: Figure out a way to have transparency with denoiser
-                glBindTexture(GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer]);
-                glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, denoiserInputFramePtr);
+        if (scene->renderOptions.enableEnvMap && scene->envMap != nullptr)
+            pathtraceDefines += "#define OPT_ENVMAP\n";
 
-                // Create an Intel Open Image Denoise device
-                oidn::DeviceRef device = oidn::newDevice();
-                device.commit();
+        if (!scene->lights.empty())
+            pathtraceDefines += "#define OPT_LIGHTS\n";
 
-                // Create a denoising filter
-                oidn::FilterRef filter = device.newFilter("RT"); // generic ray tracing filter
-                filter.setImage("color", denoiserInputFramePtr, oidn::Format::Float3, renderResolution.x, renderResolution.y, 0, 0, 0);
-                filter.setImage("output", frameOutputPtr, oidn::Format::Float3, renderResolution.x, renderResolution.y, 0, 0, 0);
-                filter.set("hdr", false);
-                filter.commit();
+        // Russian roulette depth, candidate counts and the background are uniforms, only switches that change
+        // which code runs are defines
+        if (scene->renderOptions.enableRR)
+            pathtraceDefines += "#define OPT_RR\n";
 
-                // Filter the image
-                filter.execute();
+        if (scene->renderOptions.enableLightPowerSampling)
+            pathtraceDefines += "#define OPT_LIGHT_POWER_SAMPLING\n";
 
-                // Check for errors
-                const char* errorMessage;
-                if (device.getError(errorMessage) != oidn::Error::None)
-                    std::cout << "Error: " << errorMessage << std::endl;
+        if (scene->renderOptions.openglNormalMap)
+            pathtraceDefines += "#define OPT_OPENGL_NORMALMAP\n";
 
-                // Copy the denoised data to denoisedTexture
-                glBindTexture(GL_TEXTURE_2D, denoisedTexture);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, renderResolution.x, renderResolution.y, 0, GL_RGB, GL_FLOAT, frameOutputPtr);
+        // BVH traversal with an 8 entry stack and parent links, for GPUs where the 64 entry stack limits occupancy
+        if (scene->renderOptions.enableShortStack)
+            pathtraceDefines += "#define OPT_SHORT_STACK\n";
 
-                denoised = true;
+        shaders.materialDefines = MaterialDefines();
+        pathtraceDefines += shaders.materialDefines;
+
+        if (pathtraceDefines.size() > 0)
+        {
+            InsertDefines(pathTraceShaderSrc, pathtraceDefines);
+            InsertDefines(pathTraceShaderLowResSrc, pathtraceDefines);
+        }
+
+        if (tonemapDefines.size() > 0)
+            InsertDefines(tonemapShaderSrc, tonemapDefines);
+
+        if (enableReSTIR)
+        {
+            InsertDefines(pathTraceShaderSrc, restirDefines);
+
+            Shader::ShaderSource restirInitialShaderSrc = Shader::load(shadersDir + "restir_initial.glsl");
+            Shader::ShaderSource restirSpatialShaderSrc = Shader::load(shadersDir + "restir_spatial.glsl");
+
+            InsertDefines(restirInitialShaderSrc, pathtraceDefines + restirDefines);
+            InsertDefines(restirSpatialShaderSrc, pathtraceDefines + restirDefines);
+
+            shaders.restirInitialShader = CompileProgram(shaders, restirInitialShaderSrc);
+            shaders.restirSpatialShader = CompileProgram(shaders, restirSpatialShaderSrc);
+        }
+
+        // Passes of one sample get the tile shader without the sample loop. llvmpipe keeps the loop around PathTrace()
+        // even when it runs once, which made the default of one sample per pass about 20% slower. Reservoirs are
+        // resampled once per sample, so passes are one sample with ReSTIR as well
+        shaders.singleSample = enableReSTIR || (scene->renderOptions.samplesPerPass <= 1 && !scene->renderOptions.enableAdaptiveTiles);
+        if (shaders.singleSample)
+            InsertDefines(pathTraceShaderSrc, "#define OPT_SINGLE_SAMPLE\n");
+
+        if (enableAdaptiveSampling)
+        {
+            InsertDefines(pathTraceShaderSrc, adaptiveDefines);
+            InsertDefines(tonemapShaderSrc, adaptiveDefines);
+
+            Shader::ShaderSource convergenceShaderSrc = Shader::load(shadersDir + "convergence.glsl");
+            shaders.convergenceShader = CompileProgram(shaders, convergenceShaderSrc);
+        }
+
+        if (enableDenoiser)
+        {
+            InsertDefines(pathTraceShaderSrc, denoiserDefines);
+
+            Shader::ShaderSource denoiserShaderSrc = Shader::load(shadersDir + "denoiser.glsl");
+            if (enableAdaptiveSampling)
+                InsertDefines(denoiserShaderSrc, adaptiveDefines);
+            shaders.denoiserShader = CompileProgram(shaders, denoiserShaderSrc);
+        }
+
+        // Reprojection traces first hits like the preview and seeds its history from accumTexture (and moments)
+        if (scene->renderOptions.enableReprojection)
+        {
+            Shader::ShaderSource reprojectShaderSrc = Shader::load(shadersDir + "reproject.glsl");
+            InsertDefines(reprojectShaderSrc, pathtraceDefines + adaptiveDefines);
+            shaders.reprojectShader = CompileProgram(shaders, reprojectShaderSrc);
+        }
+
+        // The wavefront path tracer needs compute shaders (GL 4.3). Features that hook into the tile shader (ReSTIR,
+        // adaptive sampling and the denoiser) and media are only implemented there, so they keep using it. Tiles traced
+        // on the CPU need neither
+        bool enableWavefront = scene->renderOptions.enableWavefront && !scene->renderOptions.enableCPURenderer && gl3wIsSupported(4, 3) && !enableReSTIR &&
+            !enableAdaptiveSampling && !enableDenoiser && shaders.materialDefines.find("OPT_MEDIUM") == std::string::npos;
+        if (enableWavefront)
+        {
+            const char* kernelFiles[WAVEFRONT_KERNELS] = { "wavefront_generate.glsl", "wavefront_extend.glsl", "wavefront_shade.glsl",
+                "wavefront_shade.glsl", "wavefront_shadow.glsl", "wavefront_accumulate.glsl", "wavefront_dispatch.glsl", "wavefront_sort.glsl" };
+
+            for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+            {
+                // Opaque hits are shaded by a variant without the glass lobe. Without transmissive materials it is the only one
+                std::string kernelDefines = pathtraceDefines;
+                size_t specTrans = kernelDefines.find("#define OPT_SPECTRANS\n");
+                if (i == WAVEFRONT_SHADE_OPAQUE && specTrans != std::string::npos)
+                    kernelDefines.erase(specTrans, strlen("#define OPT_SPECTRANS\n"));
+                else if (i == WAVEFRONT_SHADE_TRANSMISSIVE && specTrans == std::string::npos)
+                    continue;
+
+                Shader::ShaderSource kernelSrc = Shader::load(shadersDir + kernelFiles[i]);
+                InsertDefines(kernelSrc, kernelDefines);
+                shaders.wavefrontShaders[i] = CompileComputeProgram(shaders, kernelSrc);
+            }
+        }
+
+        shaders.pathTraceShader = CompileProgram(shaders, pathTraceShaderSrc);
+        shaders.pathTraceShaderLowRes = CompileProgram(shaders, pathTraceShaderLowResSrc);
+        shaders.outputShader = CompileProgram(shaders, outputShaderSrc);
+        shaders.tonemapShader = CompileProgram(shaders, tonemapShaderSrc);
+    }
+
+    // Variants that were linked before come from the program binary cache, the rest is only submitted to the driver.
+    // Their status is checked by UseShaders()
+    Program* Renderer::CompileProgram(ShaderSet& shaders, const Shader::ShaderSource& fragShaderSrc)
+    {
+        CPUProfileScope profile("Shader Compile");
+
+        Program* program = ProgramCache::Get().Load(shaders.vertexShaderSrc, fragShaderSrc);
+        if (program != nullptr)
+            return program;
+
+        std::vector<Shader> shaderObjects;
+        shaderObjects.push_back(Shader(shaders.vertexShaderSrc, GL_VERTEX_SHADER, true));
+        shaderObjects.push_back(Shader(fragShaderSrc, GL_FRAGMENT_SHADER, true));
+        program = new Program(shaderObjects, true);
+
+        shaders.compiledPrograms.push_back(program);
+        shaders.compiledVertexShaderSrcs.push_back(shaders.vertexShaderSrc);
+        shaders.compiledShaderSrcs.push_back(fragShaderSrc);
+        return program;
+    }
+
+    // Same as CompileProgram() for a program with a single compute shader
+    Program* Renderer::CompileComputeProgram(ShaderSet& shaders, const Shader::ShaderSource& computeShaderSrc)
+    {
+        CPUProfileScope profile("Shader Compile");
+
+        Program* program = ProgramCache::Get().Load(Shader::ShaderSource(), computeShaderSrc);
+        if (program != nullptr)
+            return program;
+
+        std::vector<Shader> shaderObjects;
+        shaderObjects.push_back(Shader(computeShaderSrc, GL_COMPUTE_SHADER, true));
+        program = new Program(shaderObjects, true);
+
+        shaders.compiledPrograms.push_back(program);
+        shaders.compiledVertexShaderSrcs.push_back(Shader::ShaderSource());
+        shaders.compiledShaderSrcs.push_back(computeShaderSrc);
+        return program;
+    }
+
+    // Switches to a compiled set of programs. If one of them failed to compile, the set is dropped and
+    // the current programs are kept
+    bool Renderer::UseShaders(ShaderSet& shaders)
+    {
+        std::vector<Program*> programs = shaders.Programs();
+        try
+        {
+            for (int i = 0; i < programs.size(); i++)
+                programs[i]->CheckStatus();
+        }
+        catch (const std::runtime_error&)
+        {
+            shaders.Delete();
+
+            // Nothing to fall back to when the renderer is created
+            if (pathTraceShader == nullptr)
+                throw;
+            return false;
+        }
+
+        for (int i = 0; i < shaders.compiledPrograms.size(); i++)
+            ProgramCache::Get().Store(shaders.compiledVertexShaderSrcs[i], shaders.compiledShaderSrcs[i], shaders.compiledPrograms[i]);
+
+        // Delete shaders
+        delete pathTraceShader;
+        delete pathTraceShaderLowRes;
+        delete outputShader;
+        delete tonemapShader;
+        delete restirInitialShader;
+        delete restirSpatialShader;
+        delete convergenceShader;
+        delete denoiserShader;
+        delete reprojectShader;
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+            delete wavefrontShaders[i];
+
+        pathTraceShader = shaders.pathTraceShader;
+        pathTraceShaderLowRes = shaders.pathTraceShaderLowRes;
+        outputShader = shaders.outputShader;
+        tonemapShader = shaders.tonemapShader;
+        restirInitialShader = shaders.restirInitialShader;
+        restirSpatialShader = shaders.restirSpatialShader;
+        convergenceShader = shaders.convergenceShader;
+        denoiserShader = shaders.denoiserShader;
+        reprojectShader = shaders.reprojectShader;
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+            wavefrontShaders[i] = shaders.wavefrontShaders[i];
+        materialDefines = shaders.materialDefines;
+        singleSample = shaders.singleSample;
+        shaders = ShaderSet();
+
+        UpdateFeatureFBOs();
+
+        // Shaders or options changed, so the reprojection history is stale
+        historyLength = 0;
+
+        // Setup shader uniforms
+        InitPathTraceUniforms(pathTraceShader);
+        InitPathTraceUniforms(pathTraceShaderLowRes);
+
+        if (restirInitialShader != nullptr)
+        {
+            InitPathTraceUniforms(restirInitialShader);
+            InitPathTraceUniforms(restirSpatialShader);
+        }
+
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+        {
+            if (wavefrontShaders[i] != nullptr)
+                InitPathTraceUniforms(wavefrontShaders[i]);
+        }
+        UpdateWavefrontCapacity();
+
+        BindRenderParams(tonemapShader);
+
+        if (convergenceShader != nullptr)
+        {
+            tonemapShader->Use();
+            glUniform1i(tonemapShader->getUniformLocation("momentTexture"), 1);
+            tonemapShader->StopUsing();
+        }
+
+        if (denoiserShader != nullptr)
+        {
+            denoiserShader->Use();
+            glUniform1i(denoiserShader->getUniformLocation("accumTexture"), 0);
+            glUniform1i(denoiserShader->getUniformLocation("momentTexture"), 1);
+            glUniform1i(denoiserShader->getUniformLocation("albedoTexture"), 2);
+            glUniform1i(denoiserShader->getUniformLocation("normalTexture"), 3);
+            denoiserShader->StopUsing();
+        }
+
+        // Texture units of the ReSTIR reservoirs are free outside of tiles. Seeding reads moments where the preview goes
+        if (reprojectShader != nullptr)
+        {
+            InitPathTraceUniforms(reprojectShader);
+            reprojectShader->Use();
+            glUniform1i(reprojectShader->getUniformLocation("historyTexture"), 12);
+            glUniform1i(reprojectShader->getUniformLocation("historyPositionTexture"), 13);
+            glUniform1i(reprojectShader->getUniformLocation("previewTexture"), 14);
+            glUniform1i(reprojectShader->getUniformLocation("momentTexture"), 14);
+            glUniform1f(reprojectShader->getUniformLocation("maxHistoryLength"), (float)MAX_HISTORY_LENGTH);
+            reprojectShader->StopUsing();
+        }
+
+        return true;
+    }
+
+    // Feature buffers are only allocated while the current programs use them
+    void Renderer::UpdateFeatureFBOs()
+    {
+        if (restirInitialShader != nullptr)
+        {
+            if (restirInitialFBO == 0)
+                InitReSTIRFBOs();
+        }
+        else
+            DeleteReSTIRFBOs();
+
+        if (convergenceShader != nullptr)
+        {
+            if (momentTexture == 0)
+                InitAdaptiveFBOs();
+        }
+        else if (momentTexture != 0)
+        {
+            DeleteAdaptiveFBOs();
+            UpdateAccumDrawBuffers();
+        }
+
+        if (denoiserShader != nullptr)
+        {
+            if (albedoTexture == 0)
+                InitDenoiserFBOs();
+        }
+        else if (albedoTexture != 0)
+        {
+            DeleteDenoiserFBOs();
+            UpdateAccumDrawBuffers();
+        }
+
+        if (reprojectShader != nullptr)
+        {
+            if (historyFBO[0] == 0)
+                InitReprojectionFBOs();
+        }
+        else
+            DeleteReprojectionFBOs();
+
+        // Wavefront buffers are allocated by the first tile, once its path count is known
+        if (wavefrontShaders[WAVEFRONT_GENERATE] == nullptr)
+            DeleteWavefrontBuffers();
+
+        // The CPU path tracer has no ReSTIR, adaptive sampling or media, tiles stay on the GPU with them
+        const RenderOptions& options = scene->renderOptions;
+        bool enableCPURenderer = options.enableCPURenderer && restirInitialShader == nullptr && convergenceShader == nullptr &&
+            materialDefines.find("OPT_MEDIUM") == std::string::npos;
+        if (enableCPURenderer)
+        {
+            if (cpuRenderer == nullptr)
+                cpuRenderer = new CpuRenderer(scene);
+            cpuRenderer->Resize(renderResolution.x, renderResolution.y);
+        }
+        else
+        {
+            delete cpuRenderer;
+            cpuRenderer = nullptr;
+        }
+    }
+
+    Renderer::ShaderSet::ShaderSet()
+        : pathTraceShader(nullptr)
+        , pathTraceShaderLowRes(nullptr)
+        , outputShader(nullptr)
+        , tonemapShader(nullptr)
+        , restirInitialShader(nullptr)
+        , restirSpatialShader(nullptr)
+        , convergenceShader(nullptr)
+        , denoiserShader(nullptr)
+        , reprojectShader(nullptr)
+        , wavefrontShaders()
+        , singleSample(true)
+    {
+    }
+
+    std::vector<Program*> Renderer::ShaderSet::Programs()
+    {
+        Program* all[9] = { pathTraceShader, pathTraceShaderLowRes, outputShader, tonemapShader, restirInitialShader,
+                            restirSpatialShader, convergenceShader, denoiserShader, reprojectShader };
+
+        std::vector<Program*> programs;
+        for (int i = 0; i < 9; i++)
+        {
+            if (all[i] != nullptr)
+                programs.push_back(all[i]);
+        }
+        for (int i = 0; i < WAVEFRONT_KERNELS; i++)
+        {
+            if (wavefrontShaders[i] != nullptr)
+                programs.push_back(wavefrontShaders[i]);
+        }
+        return programs;
+    }
+
+    // True once every program can be checked without waiting for the driver
+    bool Renderer::ShaderSet::IsReady()
+    {
+        std::vector<Program*> programs = Programs();
+        for (int i = 0; i < programs.size(); i++)
+        {
+            if (!programs[i]->IsReady())
+                return false;
+        }
+        return true;
+    }
+
+    void Renderer::ShaderSet::Delete()
+    {
+        std::vector<Program*> programs = Programs();
+        for (int i = 0; i < programs.size(); i++)
+            delete programs[i];
+        *this = ShaderSet();
+    }
+
+
+    // Material features used by at least one material. Everything else is compiled out of the path tracing shaders
+    std::string Renderer::MaterialDefines()
+    {
+        bool alphaTest = false, medium = false, anisotropic = false, subsurface = false, sheen = false, clearcoat = false, specTrans = false;
+        bool baseColorMap = false, metallicRoughnessMap = false, normalMap = false, emissionMap = false;
+
+        for (int i = 0; i < scene->materials.size(); i++)
+        {
+            const Material& mat = scene->materials[i];
+            alphaTest |= (int)mat.alphaMode != AlphaMode::Opaque;
+            medium |= (int)mat.mediumType != MediumType::None;
+            anisotropic |= mat.anisotropic != 0.0f;
+            subsurface |= mat.subsurface != 0.0f;
+            sheen |= mat.sheen != 0.0f;
+            clearcoat |= mat.clearcoat != 0.0f;
+            specTrans |= mat.specTrans != 0.0f;
+            baseColorMap |= mat.baseColorTexId >= 0.0f;
+            metallicRoughnessMap |= mat.metallicRoughnessTexID >= 0.0f;
+            normalMap |= mat.normalmapTexID >= 0.0f;
+            emissionMap |= mat.emissionmapTexID >= 0.0f;
+        }
+
+        std::string defines = "";
+        if (alphaTest)
+            defines += "#define OPT_ALPHA_TEST\n";
+        if (medium)
+            defines += "#define OPT_MEDIUM\n";
+        if (anisotropic)
+            defines += "#define OPT_ANISOTROPIC\n";
+        if (subsurface)
+            defines += "#define OPT_SUBSURFACE\n";
+        if (sheen)
+            defines += "#define OPT_SHEEN\n";
+        if (clearcoat)
+            defines += "#define OPT_CLEARCOAT\n";
+        if (specTrans)
+            defines += "#define OPT_SPECTRANS\n";
+        if (baseColorMap)
+            defines += "#define OPT_BASECOLORMAP\n";
+        if (metallicRoughnessMap)
+            defines += "#define OPT_METALLICROUGHNESSMAP\n";
+        if (normalMap)
+            defines += "#define OPT_NORMALMAP\n";
+        if (emissionMap)
+            defines += "#define OPT_EMISSIONMAP\n";
+
+        return defines;
+    }
+
+    void Renderer::InitPathTraceUniforms(Program* shader)
+    {
+        // Samplers never change texture units and scene/camera parameters and options come from the shared uniform buffer
+        shader->Use();
+        BindRenderParams(shader);
+
+        glUniform1i(shader->getUniformLocation("accumTexture"), 0);
+        glUniform1i(shader->getUniformLocation("BVHTexture"), 1);
+        glUniform1i(shader->getUniformLocation("vertexIndicesTexture"), 2);
+        glUniform1i(shader->getUniformLocation("verticesTexture"), 3);
+        glUniform1i(shader->getUniformLocation("normalsTexture"), 4);
+        glUniform1i(shader->getUniformLocation("materialsTexture"), 5);
+        glUniform1i(shader->getUniformLocation("transformsTexture"), 6);
+        glUniform1i(shader->getUniformLocation("lightsTexture"), 7);
+        glUniform1i(shader->getUniformLocation("textureMapsArrayTexture"), 8);
+        glUniform1i(shader->getUniformLocation("envMapTexture"), 9);
+        glUniform1i(shader->getUniformLocation("envMapCDFTexture"), 10);
+        glUniform1i(shader->getUniformLocation("lightDistTexture"), 11);
+        glUniform1i(shader->getUniformLocation("restirSampleTexture"), 12);
+        glUniform1i(shader->getUniformLocation("restirWeightTexture"), 13);
+        glUniform1i(shader->getUniformLocation("restirGBufferTexture"), 14);
+        glUniform1i(shader->getUniformLocation("convergenceTexture"), 15);
+        shader->StopUsing();
+    }
+
+    void Renderer::ResampleLights()
+    {
+        restirBuffer = 1 - restirBuffer;
+
+        Program* restirShaders[2] = { restirInitialShader, restirSpatialShader };
+        for (int i = 0; i < 2; i++)
+        {
+            restirShaders[i]->Use();
+            glUniform1i(restirShaders[i]->getUniformLocation("sampleNum"), sampleCounter);
+            glUniform1i(restirShaders[i]->getUniformLocation("restirTemporal"), sampleCounter > 1);
+            restirShaders[i]->StopUsing();
+        }
+
+        glViewport(0, 0, renderResolution.x, renderResolution.y);
+
+        GPUProfileScope profile("ReSTIR");
+
+        // Generate candidates for every primary hit and reuse the reservoirs of the previous sample
+        glBindFramebuffer(GL_FRAMEBUFFER, restirInitialFBO);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, restirSampleTexture[1 - restirBuffer]);
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D, restirWeightTexture[1 - restirBuffer]);
+        quad->Draw(restirInitialShader);
+
+        // Reuse reservoirs of neighbouring pixels
+        glBindFramebuffer(GL_FRAMEBUFFER, restirFBO[restirBuffer]);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, restirInitialSampleTexture);
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D, restirInitialWeightTexture);
+        glActiveTexture(GL_TEXTURE14);
+        glBindTexture(GL_TEXTURE_2D, restirGBufferTexture);
+        quad->Draw(restirSpatialShader);
+
+        // All tiles of this sample shade their primary hits with the final reservoirs
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, restirSampleTexture[restirBuffer]);
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D, restirWeightTexture[restirBuffer]);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void Renderer::Render()
+    {
+        // If maxSpp samples are done or every pixel converged then stop rendering. sampleCounter is the sample in progress
+        // TODO: Tonemapping and denosing still need to be able to run on final image
+        if (!scene->dirty && ((scene->renderOptions.maxSpp != -1 && 
+            sampleCounter - 1 >= scene->renderOptions.maxSpp) || IsConverged()))
+            return;
+
+        glActiveTexture(GL_TEXTURE0);
+
+        if (scene->dirty || refinePreview)
+        {
+            // Renders a low res preview if camera/instances are modified, or a finer one while refining after they stopped
+            GPUProfileScope profile("Preview");
+            iVec2 previewResolution = PreviewResolution();
+
+            bool timePreview = scene->renderOptions.enableDynamicPreview && !previewTimerPending;
+            if (timePreview)
+                glBeginQuery(GL_TIME_ELAPSED, previewTimerQuery);
+
+            // Previews accumulated by reprojection need a different seed every frame
+            pathTraceShaderLowRes->Use();
+            glUniform1i(pathTraceShaderLowRes->getUniformLocation("frameNum"), reprojectShader != nullptr ? previewFrameCounter++ : 1);
+            pathTraceShaderLowRes->StopUsing();
+
+            glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBOLowRes);
+            glViewport(0, 0, previewResolution.x, previewResolution.y);
+            quad->Draw(pathTraceShaderLowRes);
+
+            if (timePreview)
+            {
+                glEndQuery(GL_TIME_ELAPSED);
+                previewTimerPending = true;
+                timedPreviewPixels = previewResolution.x * previewResolution.y;
+            }
+
+            if (reprojectShader != nullptr)
+                UpdateHistory(false);
+
+            scene->instancesModified = false;
+            scene->dirty = false;
+            scene->envMapModified = false;
+        }
+        else
+        {
+            // Rendering is done a tile per frame, so if a 500x500 image is rendered with a tileWidth and tileHeight of 250 then, all tiles (for a single sample) 
+            // get rendered after 4 frames. With adaptive tile scheduling, as many tiles are rendered as fit in the target frame time.
+            // CPU tiles take as long as they take, the GPU only uploads them
+            bool adaptiveTiles = scene->renderOptions.enableAdaptiveTiles && cpuRenderer == nullptr;
+            int tilesToRender = adaptiveTiles ? tilesPerFrame : 1;
+
+            // Only one timer query is in flight, it is read back in Update() once the GPU is done with it
+            bool timeTiles = adaptiveTiles && !tileTimerPending;
+            if (timeTiles)
+                glBeginQuery(GL_TIME_ELAPSED, tileTimerQuery);
+
+            int renderedTileSamples = 0;
+            for (int i = 0; i < tilesToRender; i++)
+            {
+                // Update() already moved to the first tile of this frame
+                if (i > 0)
+                {
+                    NextTile();
+                    if ((scene->renderOptions.maxSpp != -1 && sampleCounter - 1 >= scene->renderOptions.maxSpp) || IsConverged())
+                        break;
+                }
+
+                RenderTile();
+                renderedTileSamples += samplesInPass;
+            }
+
+            if (timeTiles)
+            {
+                glEndQuery(GL_TIME_ELAPSED);
+                tileTimerPending = true;
+                timedTileSamples = renderedTileSamples;
+            }
+        }
+    }
+
+    void Renderer::RenderTile()
+    {
+        if (cpuRenderer != nullptr)
+        {
+            RenderTileCPU();
+            return;
+        }
+
+        pathTraceShader->Use();
+        glUniform2f(pathTraceShader->getUniformLocation("tileOffset"), (float)tile.x * invNumTiles.x, (float)tile.y * invNumTiles.y);
+        glUniform1i(pathTraceShader->getUniformLocation("frameNum"), frameCounter);
+        glUniform1i(pathTraceShader->getUniformLocation("sampleNum"), sampleCounter);
+        glUniform1i(pathTraceShader->getUniformLocation("samplesPerPass"), samplesInPass);
+        pathTraceShader->StopUsing();
+
+        // With ReSTIR, light reservoirs for the whole image are resampled before the first tile of each sample
+        if (restirInitialShader != nullptr && tile.x == 0 && tile.y == numTiles.y - 1)
+            ResampleLights();
+
+        // Renders the tile straight into accumTexture, adding its samples to the ones accumulated so far
+        // With adaptive sampling, the moments in momentTexture are accumulated the same way
+        int tileIndex = tile.y * numTiles.x + tile.x;
+        if (convergenceShader != nullptr)
+            glBeginQuery(GL_SAMPLES_PASSED, tileQueries[tileIndex]);
+
+        {
+            GPUProfileScope profile("Path Trace");
+            if (wavefrontShaders[WAVEFRONT_GENERATE] != nullptr)
+                RenderTileWavefront();
+            else
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+                glViewport(tileWidth * tile.x, tileHeight * tile.y, tileWidth, tileHeight);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                quad->Draw(pathTraceShader);
+                glDisable(GL_BLEND);
+            }
+        }
+
+        if (convergenceShader != nullptr)
+        {
+            glEndQuery(GL_SAMPLES_PASSED);
+            tileQueryPending[tileIndex] = true;
+        }
+
+        // Tonemapping is done once all tiles of a sample are rendered
+        if (tile.x == numTiles.x - 1 && tile.y == 0)
+            FinishSample();
+    }
+
+    // Tonemaps the sample, then flags converged pixels and requests a denoise if they are enabled
+    // Here we render to tileOutputTexture[currentBuffer] but display tileOutputTexture[1-currentBuffer] until then
+    // NextTile() flips the buffers when the next sample is started
+    void Renderer::FinishSample()
+    {
+        tonemapShader->Use();
+        glUniform1f(tonemapShader->getUniformLocation("invSampleCounter"), 1.0f / (sampleCounter + samplesInPass - 1));
+        if (convergenceShader != nullptr)
+            glUniform1i(tonemapShader->getUniformLocation("pixelSampleCounts"), true);
+        tonemapShader->StopUsing();
+
+        GPUProfileScope profile("Tonemap");
+        glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
+        glViewport(0, 0, renderResolution.x, renderResolution.y);
+        if (convergenceShader != nullptr)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, momentTexture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        quad->Draw(tonemapShader);
+
+        if (convergenceShader != nullptr)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE0);
+
+            // The preview in Present() is still divided by invSampleCounter
+            tonemapShader->Use();
+            glUniform1i(tonemapShader->getUniformLocation("pixelSampleCounts"), false);
+            tonemapShader->StopUsing();
+
+            // Flag the pixels that converged, the next pass discards them
+            convergenceShader->Use();
+            glUniform1f(convergenceShader->getUniformLocation("adaptiveThreshold"), scene->renderOptions.adaptiveThreshold);
+            glUniform1i(convergenceShader->getUniformLocation("adaptiveMinSpp"), scene->renderOptions.adaptiveMinSpp);
+            convergenceShader->StopUsing();
+
+            GPUProfileScope profile("Convergence");
+            glBindFramebuffer(GL_FRAMEBUFFER, convergenceFBO);
+            glBindTexture(GL_TEXTURE_2D, momentTexture);
+            quad->Draw(convergenceShader);
+        }
+
+        if (denoiserShader != nullptr)
+            RequestDenoise();
+    }
+
+    // Tiles are traced on the CPU by a job on the TaskSystem while frames go on. Update() keeps the tile and sample
+    // counters of the tile in flight, the first Render() after it is done uploads the updated sums of its pixels and
+    // starts the next tile. accumTexture then holds the same data as with the tile shader, so tonemapping, denoising
+    // and presenting do not change
+    void Renderer::RenderTileCPU()
+    {
+        if (cpuRenderer->IsBusy())
+        {
+            if (!cpuRenderer->IsTileDone())
+                return;
+
+            cpuRenderer->FinishTile();
+            if (Profiler::Get().IsEnabled())
+                Profiler::Get().AddCount("CPU Mrays/s", cpuRenderer->tileRays / cpuRenderer->tileSeconds / 1000000.0);
+
+            {
+                CPUProfileScope profile("CPU Tile Upload");
+
+                // The sums are stored for the whole image, row length skips the pixels outside of the tile
+                int offset = (cpuRenderer->tileY * renderResolution.x + cpuRenderer->tileX) * 4;
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, renderResolution.x);
+                glBindTexture(GL_TEXTURE_2D, accumTexture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, cpuRenderer->tileX, cpuRenderer->tileY, cpuRenderer->tileWidth, cpuRenderer->tileHeight, GL_RGBA, GL_FLOAT, &cpuRenderer->color[offset]);
+                if (albedoTexture != 0)
+                {
+                    glBindTexture(GL_TEXTURE_2D, albedoTexture);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, cpuRenderer->tileX, cpuRenderer->tileY, cpuRenderer->tileWidth, cpuRenderer->tileHeight, GL_RGBA, GL_FLOAT, &cpuRenderer->albedo[offset]);
+                    glBindTexture(GL_TEXTURE_2D, normalTexture);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, cpuRenderer->tileX, cpuRenderer->tileY, cpuRenderer->tileWidth, cpuRenderer->tileHeight, GL_RGBA, GL_FLOAT, &cpuRenderer->normal[offset]);
+                }
+                glBindTexture(GL_TEXTURE_2D, 0);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            }
+
+            if (tile.x == numTiles.x - 1 && tile.y == 0)
+                FinishSample();
+
+            NextTile();
+            if (scene->renderOptions.maxSpp != -1 && sampleCounter - 1 >= scene->renderOptions.maxSpp)
+                return;
+        }
+
+        iVec2 tileOrigin(tileWidth * tile.x, tileHeight * tile.y);
+        iVec2 tileSize(std::min(tileWidth, renderResolution.x - tileOrigin.x), std::min(tileHeight, renderResolution.y - tileOrigin.y));
+        cpuRenderer->StartTile(tileOrigin.x, tileOrigin.y, tileSize.x, tileSize.y, renderParams, frameCounter, samplesInPass);
+    }
+
+    void Renderer::WaitForCPUTile()
+    {
+        if (cpuRenderer != nullptr)
+            cpuRenderer->WaitForTile();
+    }
+
+    // Traces the paths of a tile pass a bounce at a time. Every bounce extends the queued rays to their closest hit,
+    // shades the hits with the kernel of their material class and traces the shadow rays that queued. Queue lengths
+    // never leave the GPU, each stage is dispatched indirectly with the group counts wavefront_dispatch.glsl computes
+    void Renderer::RenderTileWavefront()
+    {
+        // Tiles at the right and top are clipped to the image, paths outside of it would be wasted
+        iVec2 tileOrigin(tileWidth * tile.x, tileHeight * tile.y);
+        iVec2 tileSize(std::min(tileWidth, renderResolution.x - tileOrigin.x), std::min(tileHeight, renderResolution.y - tileOrigin.y));
+        int tilePixels = tileSize.x * tileSize.y;
+        int numPaths = tilePixels * samplesInPass;
+        if (numPaths > wavefrontCapacity)
+            InitWavefrontBuffers(numPaths);
+
+        // Statistics of one tile are in flight at a time. Only the extend and dispatch kernels count them
+        bool collectStats = Profiler::Get().IsEnabled() && !wavefrontStatsPending;
+
+        int statsKernels[2] = { WAVEFRONT_EXTEND, WAVEFRONT_DISPATCH };
+        for (int i = 0; i < 2; i++)
+        {
+            Program* shader = wavefrontShaders[statsKernels[i]];
+            shader->Use();
+            glUniform1i(shader->getUniformLocation("collectStats"), collectStats);
+            shader->StopUsing();
+        }
+
+        Program* generateShader = wavefrontShaders[WAVEFRONT_GENERATE];
+        generateShader->Use();
+        glUniform2i(generateShader->getUniformLocation("tileOrigin"), tileOrigin.x, tileOrigin.y);
+        glUniform2i(generateShader->getUniformLocation("tileSize"), tileSize.x, tileSize.y);
+        glUniform1i(generateShader->getUniformLocation("numPaths"), numPaths);
+        glUniform1i(generateShader->getUniformLocation("frameNum"), frameCounter);
+        generateShader->StopUsing();
+
+        Program* accumulateShader = wavefrontShaders[WAVEFRONT_ACCUMULATE];
+        accumulateShader->Use();
+        glUniform2i(accumulateShader->getUniformLocation("tileSize"), tileSize.x, tileSize.y);
+        glUniform1i(accumulateShader->getUniformLocation("numSamples"), samplesInPass);
+        accumulateShader->StopUsing();
+
+        for (int i = 0; i < 10; i++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, wavefrontBuffers[i]);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, wavefrontBuffers[0]);
+
+        // Byte offsets of the indirect dispatch arguments and the bounce statistics in the counter buffer
+        const GLintptr extendArgs = 32;
+        const GLintptr shadeArgs[2] = { 48, 64 };
+        const GLintptr shadowArgs = 80;
+        const GLintptr bounceStats = 96;
+        const GLsizeiptr bounceStatsSize = sizeof(GLuint) * 2 * WAVEFRONT_STAT_BOUNCES;
+        const GLbitfield barriers = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+
+        if (collectStats)
+        {
+            if (wavefrontStatsBuffer == 0)
+            {
+                glGenBuffers(1, &wavefrontStatsBuffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, wavefrontStatsBuffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, bounceStatsSize, nullptr, GL_STREAM_READ);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glGenQueries(WAVEFRONT_STAT_BOUNCES + 1, wavefrontStatsQueries);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, wavefrontBuffers[0]);
+            glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, bounceStats, bounceStatsSize, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        // WAVEFRONT_GROUP_SIZE of the kernels
+        const int groupSize = 64;
+        Program* dispatchShader = wavefrontShaders[WAVEFRONT_DISPATCH];
+        Program* sortShader = wavefrontShaders[WAVEFRONT_SORT];
+        int numGroups = (numPaths + groupSize - 1) / groupSize;
+
+        generateShader->Use();
+        glDispatchCompute(numGroups, 1, 1);
+        glMemoryBarrier(barriers);
+
+        // Alpha tested surfaces are passed through without a bounce, paths crossing them get a few extra iterations
+        int numBounces = scene->renderOptions.maxDepth + 1;
+        if (materialDefines.find("OPT_ALPHA_TEST") != std::string::npos)
+            numBounces += 8;
+
+        // Rays to extend and the queue the next bounce fills, swapped at the start of every bounce.
+        // The generate kernel queued into the latter
+        GLuint rayQueues[2] = { wavefrontBuffers[4], wavefrontBuffers[5] };
+
+        for (int bounce = 0; bounce < numBounces; bounce++)
+        {
+            if (collectStats && bounce < WAVEFRONT_STAT_BOUNCES)
+            {
+                glQueryCounter(wavefrontStatsQueries[bounce], GL_TIMESTAMP);
+                wavefrontStatsBounces = bounce + 1;
+            }
+
+            // Rays queued by the previous bounce are extended, this one queues into the other buffer
+            std::swap(rayQueues[0], rayQueues[1]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, rayQueues[0]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, rayQueues[1]);
+
+            dispatchShader->Use();
+            glUniform1i(dispatchShader->getUniformLocation("stage"), 0);
+            glUniform1i(dispatchShader->getUniformLocation("bounce"), bounce);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(barriers);
+
+            // Camera rays are coherent already. Secondary rays are binned by origin and direction, sorted into the
+            // other queue, which becomes the one to extend. The queue they came from is free for the next bounce
+            if (scene->renderOptions.enableRaySorting && bounce > 0)
+            {
+                GPUProfileScope profile("Ray Sort");
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, wavefrontBuffers[9]);
+                glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+                glMemoryBarrier(barriers);
+
+                // Count, scan (a single group) and scatter
+                sortShader->Use();
+                for (int stage = 0; stage < 3; stage++)
+                {
+                    glUniform1i(sortShader->getUniformLocation("stage"), stage);
+                    if (stage == 1)
+                        glDispatchCompute(1, 1, 1);
+                    else
+                        glDispatchComputeIndirect(extendArgs);
+                    glMemoryBarrier(barriers);
+                }
+
+                std::swap(rayQueues[0], rayQueues[1]);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, rayQueues[0]);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, rayQueues[1]);
+            }
+
+            wavefrontShaders[WAVEFRONT_EXTEND]->Use();
+            glUniform1i(wavefrontShaders[WAVEFRONT_EXTEND]->getUniformLocation("bounce"), bounce);
+            glDispatchComputeIndirect(extendArgs);
+            glMemoryBarrier(barriers);
+
+            dispatchShader->Use();
+            glUniform1i(dispatchShader->getUniformLocation("stage"), 1);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(barriers);
+
+            Program* shadeShaders[2] = { wavefrontShaders[WAVEFRONT_SHADE_OPAQUE], wavefrontShaders[WAVEFRONT_SHADE_TRANSMISSIVE] };
+            for (int i = 0; i < 2; i++)
+            {
+                if (shadeShaders[i] == nullptr)
+                    continue;
+                shadeShaders[i]->Use();
+                glUniform1i(shadeShaders[i]->getUniformLocation("materialClass"), i);
+                glDispatchComputeIndirect(shadeArgs[i]);
             }
+            glMemoryBarrier(barriers);
+
+            dispatchShader->Use();
+            glUniform1i(dispatchShader->getUniformLocation("stage"), 2);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(barriers);
+
+            wavefrontShaders[WAVEFRONT_SHADOW]->Use();
+            glDispatchComputeIndirect(shadowArgs);
+            glMemoryBarrier(barriers);
         }
-        else
-            denoised = false;
 
-        // If scene was modified then clear out image for re-rendering
-        if (scene->dirty)
+        if (collectStats)
         {
-            tile.x = -1;
-            tile.y = numTiles.y - 1;
-            sampleCounter = 1;
-            denoised = false;
-            frameCounter = 1;
+            glQueryCounter(wavefrontStatsQueries[wavefrontStatsBounces], GL_TIMESTAMP);
+            glBindBuffer(GL_COPY_READ_BUFFER, wavefrontBuffers[0]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, wavefrontStatsBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, bounceStats, 0, bounceStatsSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            wavefrontStatsPending = true;
+        }
 
-            // Clear out the accumulated texture for rendering a new image
-            glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
-            glClear(GL_COLOR_BUFFER_BIT);
+        // Adds the samples of every pixel to accumTexture, which the tile shader would have blended into
+        glBindImageTexture(0, accumTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        accumulateShader->Use();
+        glDispatchCompute((tilePixels + groupSize - 1) / groupSize, 1, 1);
+        accumulateShader->StopUsing();
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    }
+
+    // Averages the color and albedo/normal of the pass that was just completed into the denoiser inputs and
+    // starts denoising them, if a denoise is due and none is in flight. Update() swaps in the result
+    void Renderer::RequestDenoise()
+    {
+        // Value sampleCounter takes once NextTile() starts the next pass
+        int passSampleCounter = sampleCounter + samplesInPass;
+
+        // Denoise again every denoiserFrameCnt samples. Counted in samples since several tiles can be rendered per frame
+        if (denoiser->IsBusy() || (denoised && passSampleCounter - denoisedSampleCounter < scene->renderOptions.denoiserFrameCnt))
+            return;
+
+        denoiserShader->Use();
+        glUniform1f(denoiserShader->getUniformLocation("invSampleCounter"), 1.0f / (passSampleCounter - 1));
+        denoiserShader->StopUsing();
+
+        {
+            GPUProfileScope profile("Denoise Resolve");
+            glBindFramebuffer(GL_FRAMEBUFFER, denoiserFBO);
+            glViewport(0, 0, renderResolution.x, renderResolution.y);
+
+            GLuint inputTextures[4] = { accumTexture, momentTexture, albedoTexture, normalTexture };
+            for (int i = 3; i >= 0; i--)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, inputTextures[i]);
+            }
+            quad->Draw(denoiserShader);
+
+            for (int i = 3; i >= 1; i--)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // FIXME: Figure out a way to have transparency with denoiser
+        CPUProfileScope profile("Denoise Readback");
+        GPUProfileScope gpuProfile("Denoise Readback");
+        denoiser->Request(denoiserInputTexture[0], denoiserInputTexture[1], denoiserInputTexture[2], passSampleCounter);
+    }
+
+    // The denoiser works on HDR radiance, so its result is tonemapped like the tile output before it is displayed
+    void Renderer::TonemapDenoised()
+    {
+        tonemapShader->Use();
+        glUniform1f(tonemapShader->getUniformLocation("invSampleCounter"), 1.0f);
+        tonemapShader->StopUsing();
+
+        {
+            GPUProfileScope profile("Tonemap");
+            glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, denoisedOutputTexture, 0);
+            glViewport(0, 0, renderResolution.x, renderResolution.y);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, denoisedTexture);
+            quad->Draw(tonemapShader);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+    }
+
+    // Either seeds the history with the image accumulated so far, before the camera moves away from it, or reprojects
+    // the history to the current camera and blends in the preview that was just rendered
+    void Renderer::UpdateHistory(bool seed)
+    {
+        iVec2 previewResolution = PreviewResolution();
+
+        reprojectShader->Use();
+        glUniform1i(reprojectShader->getUniformLocation("seedHistory"), seed);
+        glUniform1i(reprojectShader->getUniformLocation("historyValid"), historyLength > 0);
+        glUniform1i(reprojectShader->getUniformLocation("completedSamples"), sampleCounter - 1);
+        glUniform1i(reprojectShader->getUniformLocation("samplesPerPass"), samplesInPass);
+        glUniform2i(reprojectShader->getUniformLocation("currentTile"), tile.x, tile.y);
+        glUniform2i(reprojectShader->getUniformLocation("tileSize"), tileWidth, tileHeight);
+        glUniform2f(reprojectShader->getUniformLocation("previewScale"), (float)previewResolution.x / windowResolution.x, (float)previewResolution.y / windowResolution.y);
+        glUniform3f(reprojectShader->getUniformLocation("historyCameraPosition"), historyParams.cameraPosition.x, historyParams.cameraPosition.y, historyParams.cameraPosition.z);
+        glUniform3f(reprojectShader->getUniformLocation("historyCameraRight"), historyParams.cameraRight.x, historyParams.cameraRight.y, historyParams.cameraRight.z);
+        glUniform3f(reprojectShader->getUniformLocation("historyCameraUp"), historyParams.cameraUp.x, historyParams.cameraUp.y, historyParams.cameraUp.z);
+        glUniform3f(reprojectShader->getUniformLocation("historyCameraForward"), historyParams.cameraForward.x, historyParams.cameraForward.y, historyParams.cameraForward.z);
+        glUniform1f(reprojectShader->getUniformLocation("historyCameraFov"), historyParams.cameraFov);
+        reprojectShader->StopUsing();
+
+        {
+            GPUProfileScope profile("Reproject");
+            glBindFramebuffer(GL_FRAMEBUFFER, historyFBO[1 - historyBuffer]);
+            glViewport(0, 0, renderResolution.x, renderResolution.y);
+
+            GLuint inputTextures[3] = { historyTexture[historyBuffer], historyPositionTexture[historyBuffer], seed ? momentTexture : pathTraceTextureLowRes };
+            for (int i = 0; i < 3; i++)
+            {
+                glActiveTexture(GL_TEXTURE12 + i);
+                glBindTexture(GL_TEXTURE_2D, inputTextures[i]);
+            }
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, accumTexture);
+            quad->Draw(reprojectShader);
+
+            // ResampleLights() binds the reservoirs again before the next tile
+            for (int i = 0; i < 3; i++)
+            {
+                glActiveTexture(GL_TEXTURE12 + i);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+            glActiveTexture(GL_TEXTURE0);
         }
-        else // Update render state
+
+        // The uniform buffer holds the camera the history was just rendered with, Update() uploads a moved camera after seeding
+        historyBuffer = 1 - historyBuffer;
+        historyParams = renderParams;
+        historyLength = std::min(seed ? sampleCounter - 1 : historyLength + 1, (int)MAX_HISTORY_LENGTH);
+    }
+
+    // The history is displayed in place of the preview, until the accumulated image has caught up with it
+    bool Renderer::ShowHistory()
+    {
+        return reprojectShader != nullptr && historyLength > 0 && sampleCounter - 1 < historyLength;
+    }
+
+    void Renderer::NextTile()
+    {
+        bool skipTile;
+        do
         {
-            frameCounter++;
+            // Every sample of a tile gets its own frame number for seeding the RNG
+            frameCounter += samplesInPass;
             tile.x++;
             if (tile.x >= numTiles.x)
             {
@@ -761,55 +1945,419 @@ namespace PathTracer
                     // If we've reached here, it means all the tiles have been rendered (for a single sample) and the image can now be displayed.
                     tile.x = 0;
                     tile.y = numTiles.y - 1;
-                    sampleCounter++;
+                    sampleCounter += samplesInPass;
                     currentBuffer = 1 - currentBuffer;
+                    samplesInPass = PassSampleCount();
                 }
             }
+
+            // With adaptive sampling, tiles whose pixels have all converged are skipped. The first and last tile
+            // of a pass are always drawn since they trigger light resampling and tonemapping
+            skipTile = convergenceShader != nullptr && IsTileConverged(tile.y * numTiles.x + tile.x) &&
+                       !(tile.x == 0 && tile.y == numTiles.y - 1) && !(tile.x == numTiles.x - 1 && tile.y == 0);
+        } while (skipTile);
+    }
+
+    // Number of samples every pixel gets in a pass over all tiles. It only changes between passes
+    int Renderer::PassSampleCount()
+    {
+        // The tile shader traces one sample, see CompileShaders()
+        if (singleSample)
+            return 1;
+
+        int samples = std::max(scene->renderOptions.samplesPerPass, 1);
+
+        // Once a whole sample fits into the frame time, the scheduler adds samples per pass rather than tiles
+        if (scene->renderOptions.enableAdaptiveTiles && tileTime > 0.0f)
+        {
+            float sampleTime = tileTime * numTiles.x * numTiles.y;
+            samples = std::max(samples, std::min((int)(scene->renderOptions.targetFrameTime / sampleTime), 64));
+        }
+
+        // Do not overshoot maxSpp
+        if (scene->renderOptions.maxSpp != -1)
+            samples = std::max(1, std::min(samples, scene->renderOptions.maxSpp - (sampleCounter - 1)));
+
+        return samples;
+    }
+
+    void Renderer::UpdateTilesPerFrame()
+    {
+        if (!tileTimerPending)
+            return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(tileTimerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(tileTimerQuery, GL_QUERY_RESULT, &elapsed);
+        tileTimerPending = false;
+
+        if (timedTileSamples == 0)
+            return;
+
+        // Smooth the GPU time per tile and sample so a single slow tile (ReSTIR or tonemap passes, complex geometry) does not make the count jump around
+        float msPerTile = elapsed / (1000000.0f * timedTileSamples);
+        tileTime = tileTime == 0.0f ? msPerTile : tileTime * 0.75f + msPerTile * 0.25f;
+
+        int maxTiles = numTiles.x * numTiles.y;
+        tilesPerFrame = (int)(scene->renderOptions.targetFrameTime / std::max(tileTime * samplesInPass, 0.001f));
+        tilesPerFrame = std::max(1, std::min(tilesPerFrame, maxTiles));
+    }
+
+    // Adds rays per second and the share of rays with the same sort key as the one extended before them (how coherent
+    // the queue is) per bounce of the last measured tile to the profiler. GL has no cache counters, this is the proxy
+    void Renderer::ReportWavefrontStats()
+    {
+        if (!wavefrontStatsPending)
+            return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(wavefrontStatsQueries[wavefrontStatsBounces], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        wavefrontStatsPending = false;
+
+        GLuint stats[2 * WAVEFRONT_STAT_BOUNCES];
+        glBindBuffer(GL_COPY_READ_BUFFER, wavefrontStatsBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(stats), stats);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        GLuint64 timestamps[WAVEFRONT_STAT_BOUNCES + 1];
+        for (int i = 0; i <= wavefrontStatsBounces; i++)
+            glGetQueryObjectui64v(wavefrontStatsQueries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+        for (int i = 0; i < wavefrontStatsBounces; i++)
+        {
+            GLuint rays = stats[i];
+            GLuint keyChanges = stats[WAVEFRONT_STAT_BOUNCES + i];
+            double seconds = (timestamps[i + 1] - timestamps[i]) / 1000000000.0;
+            if (rays == 0 || seconds <= 0.0)
+                continue;
+
+            char name[64];
+            snprintf(name, sizeof(name), "Bounce %d Mrays/s", i);
+            Profiler::Get().AddCount(name, rays / seconds / 1000000.0);
+            snprintf(name, sizeof(name), "Bounce %d Coherent Rays %%", i);
+            Profiler::Get().AddCount(name, 100.0 * (1.0 - (double)keyChanges / rays));
+        }
+    }
+
+    void Renderer::UpdatePreviewScale()
+    {
+        if (!previewTimerPending)
+            return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(previewTimerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(previewTimerQuery, GL_QUERY_RESULT, &elapsed);
+        previewTimerPending = false;
+
+        if (timedPreviewPixels == 0)
+            return;
+
+        // Smoothed like the tile time, so the preview does not flicker between sizes
+        float msPerPixel = elapsed / (1000000.0f * timedPreviewPixels);
+        previewPixelTime = previewPixelTime == 0.0f ? msPerPixel : previewPixelTime * 0.75f + msPerPixel * 0.25f;
+
+        // The preview cost grows with its pixel count, i.e. with the square of the scale
+        const float minPreviewScale = 0.0625f;
+        float windowPixels = (float)windowResolution.x * windowResolution.y;
+        float scale = sqrtf(scene->renderOptions.targetFrameTime / std::max(previewPixelTime * windowPixels, 0.0001f));
+        interactionScale = std::max(minPreviewScale, std::min(scale, 1.0f));
+    }
+
+    // Picks the next refinement step after the scene stopped changing. Steps no larger than the current preview
+    // are skipped and refinement stops at the first one that is not expected to fit the frame time.
+    // Returns true if a refined preview is rendered this frame instead of a tile
+    bool Renderer::NextRefinement()
+    {
+        const float refineScales[3] = { 0.25f, 0.5f, 1.0f };
+
+        refinePreview = false;
+        if (!scene->renderOptions.enableDynamicPreview)
+            return false;
+
+        while (refineStage < 3)
+        {
+            float scale = refineScales[refineStage++];
+            if (scale <= pixelRatio)
+                continue;
+
+            float expectedTime = previewPixelTime * windowResolution.x * scale * windowResolution.y * scale;
+            if (expectedTime > scene->renderOptions.targetFrameTime)
+            {
+                refineStage = 3;
+                break;
+            }
+
+            pixelRatio = scale;
+            refinePreview = true;
+            return true;
+        }
+
+        return false;
+    }
+
+    iVec2 Renderer::PreviewResolution()
+    {
+        return iVec2(std::max((int)(windowResolution.x * pixelRatio), 1), std::max((int)(windowResolution.y * pixelRatio), 1));
+    }
+
+    void Renderer::Present()
+    {
+        GPUProfileScope profile("Present");
+        glActiveTexture(GL_TEXTURE0);
+
+        if (ShowHistory())
+        {
+            // History is kept as an average, not a sum
+            tonemapShader->Use();
+            glUniform1f(tonemapShader->getUniformLocation("invSampleCounter"), 1.0f);
+            tonemapShader->StopUsing();
+
+            glBindTexture(GL_TEXTURE_2D, historyTexture[historyBuffer]);
+            quad->Draw(tonemapShader);
+        }
+        // For the first sample or if the camera is moving, we do not have an image ready with all the tiles rendered, so we display a low res preview.
+        else if (scene->dirty || sampleCounter == 1)
+        {
+            // Only the corner the preview was rendered to is stretched over the window
+            iVec2 previewResolution = PreviewResolution();
+            tonemapShader->Use();
+            glUniform1f(tonemapShader->getUniformLocation("invSampleCounter"), 1.0f / sampleCounter);
+            glUniform2f(tonemapShader->getUniformLocation("texCoordScale"), (float)previewResolution.x / windowResolution.x, (float)previewResolution.y / windowResolution.y);
+            tonemapShader->StopUsing();
+
+            glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+            quad->Draw(tonemapShader);
+
+            tonemapShader->Use();
+            glUniform2f(tonemapShader->getUniformLocation("texCoordScale"), 1.0f, 1.0f);
+            tonemapShader->StopUsing();
+        }
+        else
+        {
+            if (scene->renderOptions.enableDenoiser && denoised)
+                glBindTexture(GL_TEXTURE_2D, denoisedOutputTexture);
+            else
+                glBindTexture(GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer]);
+
+            quad->Draw(outputShader);
+        }
+    }
+
+    float Renderer::GetProgress()
+    {
+        if (IsConverged())
+            return 100.0f;
+
+        int maxSpp = scene->renderOptions.maxSpp;
+        return maxSpp <= 0 ? 0.0f : (sampleCounter - 1) * 100.0f / maxSpp;
+    }
+
+    // Texture holding the last completed image (tonemapped, bottom row first), for asynchronous readbacks
+    GLuint Renderer::GetOutputTexture(int& w, int& h)
+    {
+        w = renderResolution.x;
+        h = renderResolution.y;
+
+        if (scene->renderOptions.enableDenoiser && denoised)
+            return denoisedOutputTexture;
+        else
+            return tileOutputTexture[1 - currentBuffer];
+    }
+
+    int Renderer::GetSampleCount()
+    {
+        return sampleCounter;
+    }
+
+    void Renderer::Update(float secondsElapsed)
+    {
+        CPUProfileScope profile("Update");
+
+        UpdateTilesPerFrame();
+        UpdatePreviewScale();
+        ReportWavefrontStats();
+
+        // Switch to shaders that were compiled in the background. Options changed with them, so the image starts over
+        if (shadersPending && pendingShaders.IsReady())
+        {
+            CPUProfileScope profile("Shader Swap");
+            shadersPending = false;
+            if (UseShaders(pendingShaders))
+                scene->dirty = true;
+        }
+
+        // Swap in the result of a denoise running in the background, if it has finished
+        {
+            CPUProfileScope profile("Denoise");
+            if (denoiser->Update(denoisedTexture))
+            {
+                denoised = true;
+                denoisedSampleCounter = denoiser->GetSampleCount();
+                TonemapDenoised();
+            }
+        }
+
+        // If maxSpp samples are done or every pixel converged then stop updates
+        // TODO: Tonemapping and denosing still need to be able to run on final image
+        if (!scene->dirty && ((scene->renderOptions.maxSpp != -1 && sampleCounter - 1 >= scene->renderOptions.maxSpp) || IsConverged()))
+            return;
+
+        // Update data for instances
+        if (scene->instancesModified)
+        {
+            CPUProfileScope profile("Upload Instances");
+
+            // Update transforms
+            glBindTexture(GL_TEXTURE_2D, transformsTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Mat4) / sizeof(Vec4)) * scene->transforms.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->transforms[0]);
+
+            // Update materials
+            glBindTexture(GL_TEXTURE_2D, materialsTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Material) / sizeof(Vec4)) * scene->materials.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->materials[0]);
+
+            // Update top level BVH
+            int index = scene->bvhTranslator.topLevelIndex;
+            int offset = sizeof(RadeonRays::BvhTranslator::Node) * index;
+            int size = sizeof(RadeonRays::BvhTranslator::Node) * (scene->bvhTranslator.nodes.size() - index);
+            glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, offset, size, &scene->bvhTranslator.nodes[index]);
+
+            // An edited material can start using a feature that was compiled out
+            if (MaterialDefines() != (shadersPending ? pendingShaders.materialDefines : materialDefines))
+                ReloadShaders();
+        }
+
+        // Recreate texture for envmaps
+        if (scene->envMapModified)
+        {
+            // Create texture for environment map
+            if (scene->envMap != nullptr)
+            {
+                CPUProfileScope profile("Upload EnvMap");
+
+                glBindTexture(GL_TEXTURE_2D, envMapTexture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, scene->envMap->width, scene->envMap->height, 0, GL_RGB, GL_FLOAT, scene->envMap->img);
+
+                glBindTexture(GL_TEXTURE_2D, envMapCDFTexture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, scene->envMap->width, scene->envMap->height, 0, GL_RED, GL_FLOAT, scene->envMap->cdf);
+            }
+        }
+
+        // Denoising is requested by RenderTile() at the end of a pass, when the HDR color and AOVs are complete
+        if (!scene->renderOptions.enableDenoiser)
+        {
+            denoised = false;
+            denoiser->Cancel();
+        }
+
+        // If scene was modified then clear out image for re-rendering
+        if (scene->dirty)
+        {
+            // What was accumulated so far becomes the history to reproject, if it is better than the current one.
+            // Moved instances or a new environment map invalidate it
+            if (reprojectShader != nullptr)
+            {
+                if (scene->instancesModified || scene->envMapModified)
+                    historyLength = 0;
+                else if (sampleCounter - 1 > historyLength)
+                    UpdateHistory(true);
+            }
+
+            tile.x = -1;
+            tile.y = numTiles.y - 1;
+            sampleCounter = 1;
+            denoised = false;
+            denoiser->Cancel();
+            frameCounter = 1;
+            samplesInPass = PassSampleCount();
+
+            // Clear out the accumulated texture (and moments) for rendering a new image
+            glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+            if (cpuRenderer != nullptr)
+                cpuRenderer->Clear();
+
+            if (convergenceShader != nullptr)
+                ResetConvergence();
+
+            // Interactive previews are sized to hold the frame time, refinement starts over once the scene stops changing
+            pixelRatio = scene->renderOptions.enableDynamicPreview ? interactionScale : 0.25f;
+            refineStage = 0;
+            refinePreview = false;
         }
+        else if (!NextRefinement() && (cpuRenderer == nullptr || !cpuRenderer->IsBusy())) // Update render state, a CPU tile in flight keeps its place
+            NextTile();
 
         // Update uniforms
+        UpdateRenderParams();
+    }
 
-        GLuint shaderObject;
-        pathTraceShader->Use();
-        shaderObject = pathTraceShader->getObject();
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.position"), scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.right"), scene->camera->right.x, scene->camera->right.y, scene->camera->right.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.up"), scene->camera->up.x, scene->camera->up.y, scene->camera->up.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.forward"), scene->camera->forward.x, scene->camera->forward.y, scene->camera->forward.z);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.fov"), scene->camera->fov);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
-        glUniform1i(glGetUniformLocation(shaderObject, "enableEnvMap"), scene->envMap == nullptr ? false : scene->renderOptions.enableEnvMap);
-        glUniform1f(glGetUniformLocation(shaderObject, "envMapIntensity"), scene->renderOptions.envMapIntensity);
-        glUniform1f(glGetUniformLocation(shaderObject, "envMapRot"), scene->renderOptions.envMapRot / 360.0f);
-        glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->renderOptions.maxDepth);
-        glUniform2f(glGetUniformLocation(shaderObject, "tileOffset"), (float)tile.x * invNumTiles.x, (float)tile.y * invNumTiles.y);
-        glUniform1i(glGetUniformLocation(shaderObject, "frameNum"), frameCounter);   
-        pathTraceShader->StopUsing();
+    RenderParams GetRenderParams(Scene* scene, const iVec2& resolution)
+    {
+        RenderParams params = {};
+
+        params.cameraUp = scene->camera->up;
+        params.cameraRight = scene->camera->right;
+        params.cameraForward = scene->camera->forward;
+        params.cameraPosition = scene->camera->position;
+        params.cameraFov = scene->camera->fov;
+        params.cameraFocalDist = scene->camera->focalDist;
+        params.cameraAperture = scene->camera->aperture;
+        params.resolution = Vec2(float(resolution.x), float(resolution.y));
+        params.invNumTiles = Vec2(1.0f, 1.0f);
+        if (scene->envMap != nullptr)
+        {
+            params.envMapRes = Vec2((float)scene->envMap->width, (float)scene->envMap->height);
+            params.envMapTotalSum = scene->envMap->totalSum;
+        }
+        params.envMapIntensity = scene->renderOptions.envMapIntensity;
+        params.envMapRot = scene->renderOptions.envMapRot / 360.0f;
+        params.envMapSelectPdf = scene->EnvMapSelectPdf();
+        params.numOfLights = scene->lights.size();
+        params.topBVHIndex = scene->bvhTranslator.topLevelIndex;
+
+        // Numeric options are uniforms, so changing them only restarts the image
+        const RenderOptions& options = scene->renderOptions;
+        params.maxDepth = options.maxDepth;
+        params.previewMaxDepth = options.maxDepth;
+        params.rrDepth = options.RRDepth;
+        params.restirCandidates = std::max(options.restirCandidates, 1);
+        params.restirSpatialSamples = std::max(options.restirSpatialSamples, 0);
+        params.enableBackground = options.enableBackground;
+        params.transparentBackground = options.transparentBackground;
+        params.enableTonemap = options.enableTonemap;
+        params.enableAces = options.enableAces;
+        params.simpleAcesFit = options.simpleAcesFit;
+        params.backgroundCol = options.backgroundCol;
+        return params;
+    }
 
-        pathTraceShaderLowRes->Use();
-        shaderObject = pathTraceShaderLowRes->getObject();
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.position"), scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.right"), scene->camera->right.x, scene->camera->right.y, scene->camera->right.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.up"), scene->camera->up.x, scene->camera->up.y, scene->camera->up.z);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.forward"), scene->camera->forward.x, scene->camera->forward.y, scene->camera->forward.z);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.fov"), scene->camera->fov);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
-        glUniform1i(glGetUniformLocation(shaderObject, "enableEnvMap"), scene->envMap == nullptr ? false : scene->renderOptions.enableEnvMap);
-        glUniform1f(glGetUniformLocation(shaderObject, "envMapIntensity"), scene->renderOptions.envMapIntensity);
-        glUniform1f(glGetUniformLocation(shaderObject, "envMapRot"), scene->renderOptions.envMapRot / 360.0f);
-        glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->dirty ? 2 : scene->renderOptions.maxDepth);
-        glUniform3f(glGetUniformLocation(shaderObject, "camera.position"), scene->camera->position.x, scene->camera->position.y, scene->camera->position.z);
-        pathTraceShaderLowRes->StopUsing();
+    void Renderer::UpdateRenderParams()
+    {
+        // The preview traces two bounces while it is shown
+        RenderParams params = GetRenderParams(scene, renderResolution);
+        params.invNumTiles = invNumTiles;
+        if (scene->dirty || refinePreview)
+            params.previewMaxDepth = 2;
+
+        // Nothing to upload while the camera and options are unchanged
+        if (memcmp(&params, &renderParams, sizeof(RenderParams)) == 0)
+            return;
 
-        tonemapShader->Use();
-        shaderObject = tonemapShader->getObject();
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), 1.0f / (sampleCounter));
-        glUniform1i(glGetUniformLocation(shaderObject, "enableTonemap"), scene->renderOptions.enableTonemap);
-        glUniform1i(glGetUniformLocation(shaderObject, "enableAces"), scene->renderOptions.enableAces);
-        glUniform1i(glGetUniformLocation(shaderObject, "simpleAcesFit"), scene->renderOptions.simpleAcesFit);
-        glUniform3f(glGetUniformLocation(shaderObject, "backgroundCol"), scene->renderOptions.backgroundCol.x, scene->renderOptions.backgroundCol.y, scene->renderOptions.backgroundCol.z);
-        tonemapShader->StopUsing();
+        CPUProfileScope profile("Upload Params");
+        renderParams = params;
+        glBindBuffer(GL_UNIFORM_BUFFER, renderParamsUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(RenderParams), &renderParams);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 }
\ No newline at end of file
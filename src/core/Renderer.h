@@ -10,8 +10,6 @@
 
 namespace PathTracer
 {
-    Program* LoadShaders(const Shader::ShaderSource& vertShaderObj, const Shader::ShaderSource& fragShaderObj);
-
     struct RenderOptions
     {
         RenderOptions()
@@ -28,7 +26,24 @@ namespace PathTracer
             textureHeight = 2048;
             denoiserFrameCnt = 20;
             enableRR = true;
+            enableLightPowerSampling = false;
+            enableReSTIR = false;
+            restirCandidates = 8;
+            restirSpatialSamples = 4;
+            enableAdaptiveTiles = false;
+            enableDynamicPreview = false;
+            enableReprojection = false;
+            targetFrameTime = 16.0f;
+            samplesPerPass = 1;
+            enableAdaptiveSampling = false;
+            adaptiveThreshold = 0.02f;
+            adaptiveMinSpp = 32;
             enableDenoiser = false;
+            enableWavefront = false;
+            enableRaySorting = false;
+            enableShortStack = false;
+            enableCPURenderer = false;
+            cpuThreads = 0;
             enableTonemap = true;
             enableAces = false;
             openglNormalMap = true;
@@ -51,8 +66,23 @@ namespace PathTracer
         int textureWidth;
         int textureHeight;
         int denoiserFrameCnt;
+        int restirCandidates;
+        int restirSpatialSamples;
+        int samplesPerPass;
+        int adaptiveMinSpp;
+        int cpuThreads;
         bool enableRR;
+        bool enableLightPowerSampling;
+        bool enableReSTIR;
+        bool enableAdaptiveTiles;
+        bool enableDynamicPreview;
+        bool enableReprojection;
+        bool enableAdaptiveSampling;
         bool enableDenoiser;
+        bool enableWavefront;
+        bool enableRaySorting;
+        bool enableShortStack;
+        bool enableCPURenderer;
         bool enableTonemap;
         bool enableAces;
         bool simpleAcesFit;
@@ -63,9 +93,56 @@ namespace PathTracer
         bool independentRenderSize;
         float envMapIntensity;
         float envMapRot;
+        float targetFrameTime;
+        float adaptiveThreshold;
     };
 
+    // Mirrors the std140 layout of the RenderParams uniform block in shaders/common/globals.glsl
+    struct RenderParams
+    {
+        Vec3 cameraUp;
+        float pad0;
+        Vec3 cameraRight;
+        float pad1;
+        Vec3 cameraForward;
+        float pad2;
+        Vec3 cameraPosition;
+        float cameraFov;
+        float cameraFocalDist;
+        float cameraAperture;
+        float pad3[2];
+        Vec2 resolution;
+        Vec2 invNumTiles;
+        Vec2 envMapRes;
+        float envMapTotalSum;
+        float envMapIntensity;
+        float envMapRot;
+        float envMapSelectPdf;
+        int numOfLights;
+        int topBVHIndex;
+        int maxDepth;
+        int previewMaxDepth;
+        int rrDepth;
+        int restirCandidates;
+        int restirSpatialSamples;
+        int enableBackground;
+        int transparentBackground;
+        int enableTonemap;
+        int enableAces;
+        int simpleAcesFit;
+        float pad4[2];
+        Vec3 backgroundCol;
+        float pad5;
+    };
+    static_assert(sizeof(RenderParams) == 192, "RenderParams must match the std140 layout of the uniform block");
+
     class Scene;
+    class Denoiser;
+    class CpuRenderer;
+
+    // Camera, environment map and option values of the uniform block for the scene as it is now. The renderer adds
+    // its tile count and preview depth, the CPU path tracer can use them as they are
+    RenderParams GetRenderParams(Scene* scene, const iVec2& resolution);
 
     class Renderer
     {
@@ -85,15 +162,24 @@ namespace PathTracer
         GLuint materialsTexture;
         GLuint transformsTexture;
         GLuint lightsTexture;
+        GLuint lightDistTexture;
         GLuint textureMapsArrayTexture;
         GLuint envMapTexture;
         GLuint envMapCDFTexture;
 
+        // Uniform buffer for parameters shared by all path tracing programs. Only re-uploaded when they change
+        GLuint renderParamsUBO;
+        RenderParams renderParams;
+
         // FBOs
-        GLuint pathTraceFBO;
         GLuint pathTraceFBOLowRes;
         GLuint accumFBO;
         GLuint outputFBO;
+        GLuint restirInitialFBO;
+        GLuint restirFBO[2];
+        GLuint convergenceFBO;
+        GLuint denoiserFBO;
+        GLuint historyFBO[2];
 
         // Shaders
         std::string shadersDir;
@@ -101,13 +187,123 @@ namespace PathTracer
         Program* pathTraceShaderLowRes;
         Program* outputShader;
         Program* tonemapShader;
+        Program* restirInitialShader;
+        Program* restirSpatialShader;
+        Program* convergenceShader;
+        Program* denoiserShader;
+        Program* reprojectShader;
+
+        // Kernels of the wavefront path tracer, used instead of the tile shader while they are compiled
+        enum WavefrontKernel
+        {
+            WAVEFRONT_GENERATE,
+            WAVEFRONT_EXTEND,
+            WAVEFRONT_SHADE_OPAQUE,
+            WAVEFRONT_SHADE_TRANSMISSIVE,
+            WAVEFRONT_SHADOW,
+            WAVEFRONT_ACCUMULATE,
+            WAVEFRONT_DISPATCH,
+            WAVEFRONT_SORT,
+            WAVEFRONT_KERNELS
+        };
+        Program* wavefrontShaders[WAVEFRONT_KERNELS];
+
+        // Defines for the material features the shaders were compiled with
+        std::string materialDefines;
+
+        // The tile shader was compiled without the sample loop, passes are one sample then
+        bool singleSample;
+
+        // Programs of one shader configuration, feature programs are nullptr while the feature is off.
+        // ReloadShaders() compiles a new set in the background while the current programs keep rendering,
+        // Update() switches to it once the driver has linked it
+        struct ShaderSet
+        {
+            ShaderSet();
+            std::vector<Program*> Programs();
+            bool IsReady();
+            void Delete();
+
+            Program* pathTraceShader;
+            Program* pathTraceShaderLowRes;
+            Program* outputShader;
+            Program* tonemapShader;
+            Program* restirInitialShader;
+            Program* restirSpatialShader;
+            Program* convergenceShader;
+            Program* denoiserShader;
+            Program* reprojectShader;
+            Program* wavefrontShaders[WAVEFRONT_KERNELS];
+            std::string materialDefines;
+            bool singleSample;
+
+            // Programs compiled from source (not ProgramCache), stored in the cache once they are linked.
+            // Compute programs have an empty vertex shader source
+            Shader::ShaderSource vertexShaderSrc;
+            std::vector<Program*> compiledPrograms;
+            std::vector<Shader::ShaderSource> compiledVertexShaderSrcs;
+            std::vector<Shader::ShaderSource> compiledShaderSrcs;
+        };
+        ShaderSet pendingShaders;
+        bool shadersPending;
 
         // Render textures
         GLuint pathTraceTextureLowRes;
-        GLuint pathTraceTexture;
         GLuint accumTexture;
         GLuint tileOutputTexture[2];
         GLuint denoisedTexture;
+        GLuint denoisedOutputTexture;
+
+        // Light reservoirs for ReSTIR. Initial (candidates + temporal) and final (spatial) reservoirs,
+        // the latter ping-ponged so the next sample can reuse them temporally
+        GLuint restirInitialSampleTexture;
+        GLuint restirInitialWeightTexture;
+        GLuint restirGBufferTexture;
+        GLuint restirSampleTexture[2];
+        GLuint restirWeightTexture[2];
+
+        // Adaptive sampling. Per pixel luminance moments and sample counts are accumulated next to accumTexture,
+        // pixels below the error threshold are flagged in convergenceTexture and skipped by the tile shader
+        GLuint momentTexture;
+        GLuint convergenceTexture;
+        std::vector<GLuint> tileQueries;
+        std::vector<char> tileConverged;
+        std::vector<char> tileQueryPending;
+        int convergedTiles;
+
+        // Denoiser inputs. First hit albedo and normal are accumulated next to accumTexture and
+        // averaged together with the HDR color into denoiserInputTexture (color, albedo, normal) once per pass
+        GLuint albedoTexture;
+        GLuint normalTexture;
+        GLuint denoiserInputTexture[3];
+
+        // Temporal reprojection while the camera moves. HDR history and first hit positions (with the history length per pixel),
+        // ping-ponged between frames. It is only ever displayed, the accumulated image and saved frames never use it
+        static const int MAX_HISTORY_LENGTH = 32;
+        GLuint historyTexture[2];
+        GLuint historyPositionTexture[2];
+        int historyBuffer;
+        int historyLength;
+        int previewFrameCounter;
+        RenderParams historyParams;
+
+        // Paths, hit records, shadow rays, queues and sort keys of the wavefront path tracer, at the shader storage
+        // bindings of shaders/common/wavefront.glsl. Sized for the paths of one tile pass, grown when a pass has more
+        GLuint wavefrontBuffers[10];
+        int wavefrontCapacity;
+
+        // While profiling, ray counts, coherence and GPU time per bounce of one tile are copied to wavefrontStatsBuffer
+        // and reported once the GPU is done with them, like the tile timer. Sizes match wavefront.glsl
+        static const int WAVEFRONT_STAT_BOUNCES = 16;
+        static const int WAVEFRONT_KEYS = 512;
+        GLuint wavefrontStatsBuffer;
+        GLuint wavefrontStatsQueries[WAVEFRONT_STAT_BOUNCES + 1];
+        int wavefrontStatsBounces;
+        bool wavefrontStatsPending;
+
+        // Traces tiles on the CPU instead of the GPU while enableCPURenderer is set. Its sums are uploaded to
+        // accumTexture (and the denoiser inputs), previews are still rendered by pathTraceShaderLowRes
+        CpuRenderer* cpuRenderer;
 
         // Render resolution and window resolution
         iVec2 renderResolution;
@@ -120,14 +316,34 @@ namespace PathTracer
         int tileWidth;
         int tileHeight;
         int currentBuffer;
+        int restirBuffer;
         int frameCounter;
         int sampleCounter;
+        int samplesInPass;
         float pixelRatio;
 
+        // Adaptive tile scheduling. GPU time per tile and sample is measured with a timer query
+        GLuint tileTimerQuery;
+        bool tileTimerPending;
+        int timedTileSamples;
+        float tileTime;
+        int tilesPerFrame;
+
+        // Dynamic preview resolution. GPU time per preview pixel is measured the same way and the preview scale
+        // (pixelRatio) is chosen so it fits targetFrameTime. Once the scene stops changing, the preview is refined
+        // through 1/4, 1/2 and full resolution, as far as the frame time allows, before tiles are accumulated
+        GLuint previewTimerQuery;
+        bool previewTimerPending;
+        int timedPreviewPixels;
+        float previewPixelTime;
+        float interactionScale;
+        int refineStage;
+        bool refinePreview;
+
         // Denoiser output
-        Vec3* denoiserInputFramePtr;
-        Vec3* frameOutputPtr;
+        Denoiser* denoiser;
         bool denoised;
+        int denoisedSampleCounter;
 
         bool initialized;
 
@@ -142,11 +358,54 @@ namespace PathTracer
         void Update(float secondsElapsed);
         float GetProgress();
         int GetSampleCount();
-        void GetOutputBuffer(unsigned char**, int& w, int& h);
+        GLuint GetOutputTexture(int& w, int& h);
+
+        // Waits for the CPU tile in flight. Geometry, instances and the environment map must not change while one is,
+        // since the tile reads them in place
+        void WaitForCPUTile();
 
     private:
         void InitGPUDataBuffers();
         void InitFBOs();
         void InitShaders();
+        void CompileShaders(ShaderSet& shaders);
+        Program* CompileProgram(ShaderSet& shaders, const Shader::ShaderSource& fragShaderSrc);
+        Program* CompileComputeProgram(ShaderSet& shaders, const Shader::ShaderSource& computeShaderSrc);
+        bool UseShaders(ShaderSet& shaders);
+        void UpdateFeatureFBOs();
+        void InitPathTraceUniforms(Program* shader);
+        std::string MaterialDefines();
+        void UpdateRenderParams();
+        void InitReSTIRFBOs();
+        void DeleteReSTIRFBOs();
+        void ResampleLights();
+        void InitAdaptiveFBOs();
+        void DeleteAdaptiveFBOs();
+        void ResetConvergence();
+        void InitDenoiserFBOs();
+        void DeleteDenoiserFBOs();
+        void UpdateAccumDrawBuffers();
+        void RequestDenoise();
+        void TonemapDenoised();
+        void InitReprojectionFBOs();
+        void DeleteReprojectionFBOs();
+        void InitWavefrontBuffers(int capacity);
+        void DeleteWavefrontBuffers();
+        void UpdateWavefrontCapacity();
+        void ReportWavefrontStats();
+        void UpdateHistory(bool seed);
+        bool ShowHistory();
+        bool IsTileConverged(int index);
+        bool IsConverged();
+        void RenderTile();
+        void RenderTileWavefront();
+        void RenderTileCPU();
+        void FinishSample();
+        void NextTile();
+        void UpdateTilesPerFrame();
+        void UpdatePreviewScale();
+        bool NextRefinement();
+        iVec2 PreviewResolution();
+        int PassSampleCount();
     };
 }
\ No newline at end of file
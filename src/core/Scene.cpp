@@ -2,12 +2,16 @@
 
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "stb_image_resize.h"
 #include "stb_image.h"
 #include "Scene.h"
+#include "BvhTraversal.h"
 #include "Camera.h"
+#include "Profiler.h"
+#include "TaskSystem.h"
 
 namespace PathTracer
 {
@@ -60,6 +64,48 @@ namespace PathTracer
         return id;
     }
 
+    std::vector<int> Scene::AddMeshes(const std::vector<std::string>& filenames)
+    {
+        // Files that are new to the scene, in the order their ids are handed out
+        std::vector<std::string> newFiles;
+        for (const std::string& filename : filenames)
+        {
+            bool loaded = std::find(newFiles.begin(), newFiles.end(), filename) != newFiles.end();
+            for (int i = 0; i < meshes.size() && !loaded; i++)
+                loaded = meshes[i]->name == filename;
+            if (!loaded)
+                newFiles.push_back(filename);
+        }
+
+        CPUProfileScope profile("Load Meshes");
+        std::vector<Mesh*> newMeshes(newFiles.size());
+        TaskSystem::Get().ParallelFor(0, newFiles.size(), 1, [&](int first, int last)
+        {
+            for (int i = first; i < last; i++)
+            {
+                printf("Loading model %s\n", newFiles[i].c_str());
+                newMeshes[i] = new Mesh;
+                if (!newMeshes[i]->LoadFromFile(newFiles[i]))
+                {
+                    printf("Unable to load model %s\n", newFiles[i].c_str());
+                    delete newMeshes[i];
+                    newMeshes[i] = nullptr;
+                }
+            }
+        });
+
+        for (Mesh* mesh : newMeshes)
+            if (mesh)
+                meshes.push_back(mesh);
+
+        std::vector<int> ids(filenames.size(), -1);
+        for (int i = 0; i < filenames.size(); i++)
+            for (int j = 0; j < meshes.size() && ids[i] == -1; j++)
+                if (meshes[j]->name == filenames[i])
+                    ids[i] = j;
+        return ids;
+    }
+
     int Scene::AddTexture(const std::string& filename)
     {
         int id = -1;
@@ -125,54 +171,135 @@ namespace PathTracer
 
     void Scene::createTLAS()
     {
-        // Loop through all the mesh Instances and build a Top Level BVH
-        std::vector<RadeonRays::bbox> bounds;
-        bounds.resize(meshInstances.size());
-
+        // Loop through all the mesh Instances and build a Top Level BVH from their bounds in world space
+        std::vector<RadeonRays::bbox> meshBounds(meshInstances.size());
+        std::vector<Mat4> instanceTransforms(meshInstances.size());
         for (int i = 0; i < meshInstances.size(); i++)
         {
-            RadeonRays::bbox bbox = meshes[meshInstances[i].meshID]->bvh->Bounds();
-            Mat4 matrix = meshInstances[i].transform;
+            meshBounds[i] = meshes[meshInstances[i].meshID]->bvh->Bounds();
+            instanceTransforms[i] = meshInstances[i].transform;
+        }
+
+        std::vector<RadeonRays::bbox> bounds(meshInstances.size());
+        RadeonRays::transform_bounds(meshBounds.data(), instanceTransforms.data(), (int)bounds.size(), bounds.data());
 
-            Vec3 minBound = bbox.pmin;
-            Vec3 maxBound = bbox.pmax;
+        sceneBvh->Build(&bounds[0], bounds.size());
+        sceneBounds = sceneBvh->Bounds();
+    }
 
-            Vec3 right       = Vec3(matrix[0][0], matrix[0][1], matrix[0][2]);
-            Vec3 up          = Vec3(matrix[1][0], matrix[1][1], matrix[1][2]);
-            Vec3 forward     = Vec3(matrix[2][0], matrix[2][1], matrix[2][2]);
-            Vec3 translation = Vec3(matrix[3][0], matrix[3][1], matrix[3][2]);
+    void Scene::createBLAS()
+    {
+        // Loop through all meshes and build BVHs, largest first so a big mesh doesn't start last and hold up the rest
+        std::vector<int> order(meshes.size());
+        for (int i = 0; i < meshes.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+        {
+            return meshes[a]->vertexXYZU.size() > meshes[b]->vertexXYZU.size();
+        });
 
-            Vec3 xa = right * minBound.x;
-            Vec3 xb = right * maxBound.x;
+        TaskGroup group;
+        for (int i : order)
+        {
+            group.Run([this, i]()
+            {
+                printf("Building BVH for %s\n", meshes[i]->name.c_str());
+                meshes[i]->BuildBVH();
+            });
+        }
+        group.Wait();
+    }
 
-            Vec3 ya = up * minBound.y;
-            Vec3 yb = up * maxBound.y;
+    // Builds an alias table (Vose's method) so the shader can pick a light in proportion to its power with a single lookup
+    // https://pbr-book.org/4ed/Sampling_Algorithms/The_Alias_Method
+    void Scene::buildLightDistribution()
+    {
+        int numLights = lights.size();
+        lightDistribution.resize(numLights);
+        lightsPower = 0.0f;
 
-            Vec3 za = forward * minBound.z;
-            Vec3 zb = forward * maxBound.z;
+        if (numLights == 0)
+            return;
 
-            minBound = Vec3::Min(xa, xb) + Vec3::Min(ya, yb) + Vec3::Min(za, zb) + translation;
-            maxBound = Vec3::Max(xa, xb) + Vec3::Max(ya, yb) + Vec3::Max(za, zb) + translation;
+        // Lights are treated as diffuse emitters, distant lights cover a disk the size of the scene
+        float sceneRadius = Vec3::Length(sceneBounds.extents()) * 0.5f;
+        std::vector<float> power(numLights);
+        for (int i = 0; i < numLights; i++)
+        {
+            const Light& light = lights[i];
+            float lum = Luminance(light.emission.x, light.emission.y, light.emission.z);
 
-            RadeonRays::bbox bound;
-            bound.pmin = minBound;
-            bound.pmax = maxBound;
+            if ((int)light.type == LightType::DistantLight)
+                power[i] = lum * PI * sceneRadius * sceneRadius;
+            else
+                power[i] = lum * PI * light.area;
 
-            bounds[i] = bound;
+            lightsPower += power[i];
         }
-        sceneBvh->Build(&bounds[0], bounds.size());
-        sceneBounds = sceneBvh->Bounds();
-    }
 
-    void Scene::createBLAS()
-    {
-        // Loop through all meshes and build BVHs
-#pragma omp parallel for
-        for (int i = 0; i < meshes.size(); i++)
+        // Fall back to uniform selection if there is nothing to weigh the lights by
+        if (lightsPower <= 0.0f)
+            std::fill(power.begin(), power.end(), 1.0f);
+
+        float powerSum = lightsPower > 0.0f ? lightsPower : (float)numLights;
+
+        // Split lights into under-full and over-full bins, then let every under-full bin borrow from an over-full one
+        std::vector<float> scaled(numLights);
+        std::vector<int> small, large;
+        for (int i = 0; i < numLights; i++)
         {
-            printf("Building BVH for %s\n", meshes[i]->name.c_str());
-            meshes[i]->BuildBVH();
+            lightDistribution[i].z = power[i] / powerSum;
+            scaled[i] = lightDistribution[i].z * numLights;
+            if (scaled[i] < 1.0f)
+                small.push_back(i);
+            else
+                large.push_back(i);
         }
+
+        while (!small.empty() && !large.empty())
+        {
+            int s = small.back(); small.pop_back();
+            int l = large.back(); large.pop_back();
+
+            lightDistribution[s].x = scaled[s];
+            lightDistribution[s].y = (float)l;
+
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+            if (scaled[l] < 1.0f)
+                small.push_back(l);
+            else
+                large.push_back(l);
+        }
+
+        // Whatever is left is full up to rounding error
+        for (int i : large)
+        {
+            lightDistribution[i].x = 1.0f;
+            lightDistribution[i].y = (float)i;
+        }
+        for (int i : small)
+        {
+            lightDistribution[i].x = 1.0f;
+            lightDistribution[i].y = (float)i;
+        }
+    }
+
+    // Probability of sampling the environment map instead of an analytic light, proportional to their power
+    float Scene::EnvMapSelectPdf()
+    {
+        if (!envMap || !renderOptions.enableEnvMap)
+            return 0.0f;
+
+        if (lights.empty())
+            return 1.0f;
+
+        float sceneRadius = Vec3::Length(sceneBounds.extents()) * 0.5f;
+        float envMapPower = envMap->avgLuminance * renderOptions.envMapIntensity * PI * sceneRadius * sceneRadius;
+
+        if (envMapPower + lightsPower <= 0.0f)
+            return 0.5f;
+
+        return envMapPower / (envMapPower + lightsPower);
     }
 
     void Scene::RebuildInstances()
@@ -185,7 +312,10 @@ namespace PathTracer
 
         //Copy transforms
         for (int i = 0; i < meshInstances.size(); i++)
+        {
             transforms[i] = meshInstances[i].transform;
+            inverseTransforms[i] = Mat4::Inverse(transforms[i]);
+        }
 
         instancesModified = true;
         dirty = true;
@@ -193,75 +323,106 @@ namespace PathTracer
 
     // ProcessScene accomplishes the following:
     // 1. create accelarations structures(BVH) for path-tracing
-    // 2. load geometric information: vertex position/uv coordinates/mesh transforms
-    // 3. load appearance information: textures
-    // 4. add a camera if there is not one
+    // 2. build the light power distribution for light selection
+    // 3. load geometric information: vertex position/uv coordinates/mesh transforms
+    // 4. load appearance information: textures
+    // 5. add a camera if there is not one
     void Scene::ProcessScene()
     {
         // step 1: create bottom/top level bvhs and flatten them 
         printf("Create Bottom-level Accelaration Structure\n");
-        createBLAS();                                           // Bottom means mesh-level BVH
+        {
+            CPUProfileScope profile("Build BLAS");
+            createBLAS();                                           // Bottom means mesh-level BVH
+        }
         printf("Create Top-level Accelaration Structure\n");
-        createTLAS();                                           // Top means scene-level BVH
+        {
+            CPUProfileScope profile("Build TLAS");
+            createTLAS();                                           // Top means scene-level BVH
+        }
         printf("Flattening BVH\n");
-        bvhTranslator.Process(sceneBvh, meshes, meshInstances); // flatten BVH
+        {
+            CPUProfileScope profile("Flatten BVH");
+            bvhTranslator.Process(sceneBvh, meshes, meshInstances); // flatten BVH
+        }
 
-        // step 2: load vertex indices/normals/UVs as scene parameters
-        int vertexCnt = 0;
-        printf("Load vertex indices/normals/UVs\n");
-        for (int i = 0; i < meshes.size(); i++)
+        // step 2: build the power distribution used to pick lights for next event estimation
+        printf("Building light distribution\n");
         {
-            int numTriangles = meshes[i]->bvh->GetNumIndices();
-            const int* triIndices = meshes[i]->bvh->GetIndices();
+            CPUProfileScope profile("Light Distribution");
+            buildLightDistribution();
+        }
 
-            for (int j = 0; j < numTriangles; j++)
+        // step 3: load vertex indices/normals/UVs as scene parameters
+        {
+            CPUProfileScope profile("Copy Scene Data");
+            int vertexCnt = 0;
+            printf("Load vertex indices/normals/UVs\n");
+            meshVertexOffsets.resize(meshes.size());
+            for (int i = 0; i < meshes.size(); i++)
             {
-                int index = triIndices[j];
-                int v0 = (index * 3 + 0) + vertexCnt;
-                int v1 = (index * 3 + 1) + vertexCnt;
-                int v2 = (index * 3 + 2) + vertexCnt;
-                vertIndices.push_back(iVec3(v0, v1, v2));
+                meshVertexOffsets[i] = vertexCnt;
+                int numTriangles = meshes[i]->bvh->GetNumIndices();
+                const int* triIndices = meshes[i]->bvh->GetIndices();
+
+                for (int j = 0; j < numTriangles; j++)
+                {
+                    int index = triIndices[j];
+                    int v0 = (index * 3 + 0) + vertexCnt;
+                    int v1 = (index * 3 + 1) + vertexCnt;
+                    int v2 = (index * 3 + 2) + vertexCnt;
+                    vertIndices.push_back(iVec3(v0, v1, v2));
+                }
+
+                vertexXYZU.insert(vertexXYZU.end(), meshes[i]->vertexXYZU.begin(), meshes[i]->vertexXYZU.end());
+                normalXYZV.insert(normalXYZV.end(), meshes[i]->normalXYZV.begin(), meshes[i]->normalXYZV.end());
+                vertexCnt += meshes[i]->vertexXYZU.size();
             }
 
-            vertexXYZU.insert(vertexXYZU.end(), meshes[i]->vertexXYZU.begin(), meshes[i]->vertexXYZU.end());
-            normalXYZV.insert(normalXYZV.end(), meshes[i]->normalXYZV.begin(), meshes[i]->normalXYZV.end());
-            vertexCnt += meshes[i]->vertexXYZU.size();
+            // step 4: load instance transforms as scene parameters (timed with the copy of step 3)
+            printf("Copying instance transforms\n");
+            transforms.resize(meshInstances.size());
+            inverseTransforms.resize(meshInstances.size());
+            for (int i = 0; i < meshInstances.size(); i++)
+            {
+                transforms[i] = meshInstances[i].transform;
+                inverseTransforms[i] = Mat4::Inverse(transforms[i]);
+            }
         }
 
-        // step 3: load instance transforms as scene parameters
-        printf("Copying instance transforms\n");
-        transforms.resize(meshInstances.size());
-        for (int i = 0; i < meshInstances.size(); i++)
-            transforms[i] = meshInstances[i].transform;
-
-        // step 4: load and resize textures as scene parameters
-        if (!textures.empty())
-            printf("Copying and resizing textures\n");
-
-        int requiredWidth = renderOptions.textureWidth;
-        int requiredHeight = renderOptions.textureHeight;
-        int texBytes = requiredWidth * requiredHeight * 4;
-        textureMapsArray.resize(texBytes * textures.size());
-
-#pragma omp parallel for        // use OpenMP to parallelize this loop
-        for (int i = 0; i < textures.size(); i++)
+        // step 5: load and resize textures as scene parameters
         {
-            int texWidth = textures[i]->width;
-            int texHeight = textures[i]->height;
+            CPUProfileScope profile("Resize Textures");
+            if (!textures.empty())
+                printf("Copying and resizing textures\n");
+
+            int requiredWidth = renderOptions.textureWidth;
+            int requiredHeight = renderOptions.textureHeight;
+            int texBytes = requiredWidth * requiredHeight * 4;
+            textureMapsArray.resize(texBytes * textures.size());
 
-            // Resize textures to fit 2D texture array
-            if (texWidth != requiredWidth || texHeight != requiredHeight)
+            TaskSystem::Get().ParallelFor(0, textures.size(), 1, [&](int first, int last)
             {
-                unsigned char* resizedTex = new unsigned char[texBytes];
-                stbir_resize_uint8(&textures[i]->texData[0], texWidth, texHeight, 0, resizedTex, requiredWidth, requiredHeight, 0, 4);
-                std::copy(resizedTex, resizedTex + texBytes, &textureMapsArray[i * texBytes]);
-                delete[] resizedTex;
-            }
-            else
-                std::copy(textures[i]->texData.begin(), textures[i]->texData.end(), &textureMapsArray[i * texBytes]);
+                for (int i = first; i < last; i++)
+                {
+                    int texWidth = textures[i]->width;
+                    int texHeight = textures[i]->height;
+
+                    // Resize textures to fit 2D texture array
+                    if (texWidth != requiredWidth || texHeight != requiredHeight)
+                    {
+                        unsigned char* resizedTex = new unsigned char[texBytes];
+                        stbir_resize_uint8(&textures[i]->texData[0], texWidth, texHeight, 0, resizedTex, requiredWidth, requiredHeight, 0, 4);
+                        std::copy(resizedTex, resizedTex + texBytes, &textureMapsArray[i * texBytes]);
+                        delete[] resizedTex;
+                    }
+                    else
+                        std::copy(textures[i]->texData.begin(), textures[i]->texData.end(), &textureMapsArray[i * texBytes]);
+                }
+            });
         }
 
-        // step 5: add a default camera
+        // step 6: add a default camera
         if (!camera)
         {
             RadeonRays::bbox bounds = sceneBvh->Bounds();
@@ -272,4 +433,471 @@ namespace PathTracer
 
         initialized = true;
     }
+
+    namespace
+    {
+        typedef RadeonRays::BvhTranslator::Node Node;
+
+        // Ray/triangle test against triangle tri of vertIndices
+        inline bool HitTriangle(const Scene& scene, const Ray& r, int tri, float& t, float& u, float& v)
+        {
+            const iVec3& vertIndices = scene.vertIndices[tri];
+            return IntersectTriangle(r, scene.vertexXYZU[vertIndices.x], scene.vertexXYZU[vertIndices.y],
+                                     scene.vertexXYZU[vertIndices.z], t, u, v);
+        }
+
+        // Triangle of the mesh of the instance, from the index into vertIndices
+        inline int MeshTriangle(const Scene& scene, int instance, int tri)
+        {
+            int meshID = scene.meshInstances[instance].meshID;
+            return (scene.vertIndices[tri].x - scene.meshVertexOffsets[meshID]) / 3;
+        }
+
+        Ray BatchRay(const RayBatch& rays, int i)
+        {
+            Ray r;
+            r.origin = Vec3(rays.origin[0][i], rays.origin[1][i], rays.origin[2][i]);
+            r.direction = Vec3(rays.direction[0][i], rays.direction[1][i], rays.direction[2][i]);
+            return r;
+        }
+
+#ifdef MATH_SIMD_SSE
+        // Four rays, one lane each
+        struct RayPacket
+        {
+            __m128 origin[3];
+            __m128 direction[3];
+            __m128 invDir[3];
+        };
+
+        inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+
+        inline int LaneCount(int mask)
+        {
+            return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        }
+
+        // Same operations as TransformPoint() and TransformVector(), so every lane matches the single ray path
+        RayPacket TransformPacket(const Mat4& m, const RayPacket& p)
+        {
+            RayPacket out;
+            for (int i = 0; i < 3; i++)
+            {
+                __m128 c0 = _mm_set1_ps(m.data[0][i]);
+                __m128 c1 = _mm_set1_ps(m.data[1][i]);
+                __m128 c2 = _mm_set1_ps(m.data[2][i]);
+                __m128 c3 = _mm_set1_ps(m.data[3][i]);
+                out.origin[i] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, p.origin[0]), _mm_mul_ps(c1, p.origin[1])),
+                                                      _mm_mul_ps(c2, p.origin[2])), c3);
+                out.direction[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, p.direction[0]), _mm_mul_ps(c1, p.direction[1])),
+                                              _mm_mul_ps(c2, p.direction[2]));
+            }
+            for (int i = 0; i < 3; i++)
+                out.invDir[i] = _mm_div_ps(_mm_set1_ps(1.0f), out.direction[i]);
+            return out;
+        }
+
+        // Distance every lane enters the box at, 0 from inside. Lanes that miss it or enter at or beyond their tMax
+        // get infinity, the same boxes BoxHit() rejects
+        inline __m128 PacketBoxEntry(const Node& node, const RayPacket& p, __m128 tMax)
+        {
+            __m128 t0 = _mm_set1_ps(-INFINITY);
+            __m128 t1 = _mm_set1_ps(INFINITY);
+            for (int i = 0; i < 3; i++)
+            {
+                __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bboxmax[i]), p.origin[i]), p.invDir[i]);
+                __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bboxmin[i]), p.origin[i]), p.invDir[i]);
+                t0 = _mm_max_ps(t0, _mm_min_ps(f, n));
+                t1 = _mm_min_ps(t1, _mm_max_ps(f, n));
+            }
+
+            __m128 zero = _mm_setzero_ps();
+            __m128 entry = _mm_max_ps(t0, zero);
+            __m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(t1, t0), _mm_cmpgt_ps(t1, zero)), _mm_cmplt_ps(entry, tMax));
+            return Select(hit, entry, _mm_set1_ps(INFINITY));
+        }
+
+        // IntersectTriangle() of one triangle against every lane. Returns the mask of lanes that hit it before tMax
+        inline __m128 PacketTriangle(const Vec4& v0, const Vec4& v1, const Vec4& v2, const RayPacket& p, __m128 tMax,
+                                     __m128& t, __m128& u, __m128& v)
+        {
+            __m128 e0[3], e1[3], tv[3];
+            for (int i = 0; i < 3; i++)
+            {
+                e0[i] = _mm_set1_ps(v1[i] - v0[i]);
+                e1[i] = _mm_set1_ps(v2[i] - v0[i]);
+                tv[i] = _mm_sub_ps(p.origin[i], _mm_set1_ps(v0[i]));
+            }
+
+            auto cross = [](const __m128* a, const __m128* b, __m128* out)
+            {
+                out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+                out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+                out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+            };
+            auto dot = [](const __m128* a, const __m128* b)
+            {
+                return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+            };
+
+            __m128 pv[3], qv[3];
+            cross(p.direction, e1, pv);
+            cross(tv, e0, qv);
+            __m128 det = dot(e0, pv);
+
+            u = _mm_div_ps(dot(tv, pv), det);
+            v = _mm_div_ps(dot(p.direction, qv), det);
+            t = _mm_div_ps(dot(e1, qv), det);
+
+            __m128 zero = _mm_setzero_ps();
+            __m128 w = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), u), v);
+            __m128 hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+            hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmpge_ps(w, zero)));
+            return _mm_and_ps(hit, _mm_cmplt_ps(t, tMax));
+        }
+
+        // Deferred nodes TraversePacket() keeps, deeper BVHs are left to TraverseBVH()
+        static const int kPacketStackSize = 128;
+
+        // TraverseBVH() for four rays. A node is visited when any lane enters it before its tMax and the child nearer
+        // for most lanes goes first. visitLeaf(first, count, instance, packet) gets the tris of every BLAS leaf with the
+        // rays in the space of the instance and returns true to stop. tMax may shrink while the BVH is walked.
+        // Returns false when the stack is full, the walk is abandoned then and the rays have to be traced one by one
+        template <typename LeafFunc>
+        bool TraversePacket(const Node* nodes, int root, const Mat4* inverseTransforms, const RayPacket& world,
+                            const __m128& tMax, LeafFunc visitLeaf)
+        {
+            struct StackEntry
+            {
+                __m128 entry;
+                int index;
+            };
+            StackEntry stack[kPacketStackSize];
+            int ptr = 0;
+            stack[ptr++] = { _mm_setzero_ps(), -1 };
+
+            int index = root;
+            int instance = -1;
+            bool BLAS = false;
+
+            RayPacket local = world;
+            const __m128 inf = _mm_set1_ps(INFINITY);
+
+            while (index != -1)
+            {
+                const Node& node = nodes[index];
+                int leftIndex = (int)node.LRLeaf.x;
+                int rightIndex = (int)node.LRLeaf.y;
+                int leaf = (int)node.LRLeaf.z;
+
+                if (leaf > 0) // Leaf node of BLAS
+                {
+                    if (visitLeaf(leftIndex, rightIndex, instance, local))
+                        return true;
+                }
+                else if (leaf < 0) // Leaf node of TLAS
+                {
+                    if (ptr == kPacketStackSize)
+                        return false;
+
+                    instance = -leaf - 1;
+                    local = TransformPacket(inverseTransforms[instance], world);
+
+                    stack[ptr++] = { _mm_setzero_ps(), -1 };
+                    index = leftIndex;
+                    BLAS = true;
+                    continue;
+                }
+                else
+                {
+                    __m128 entryLeft = PacketBoxEntry(nodes[leftIndex], local, tMax);
+                    __m128 entryRight = PacketBoxEntry(nodes[rightIndex], local, tMax);
+                    int hitLeft = _mm_movemask_ps(_mm_cmplt_ps(entryLeft, inf));
+                    int hitRight = _mm_movemask_ps(_mm_cmplt_ps(entryRight, inf));
+
+                    if (hitLeft && hitRight)
+                    {
+                        if (ptr == kPacketStackSize)
+                            return false;
+
+                        int both = hitLeft & hitRight;
+                        int leftNearer = LaneCount(_mm_movemask_ps(_mm_cmplt_ps(entryLeft, entryRight)) & both);
+                        int rightNearer = LaneCount(_mm_movemask_ps(_mm_cmplt_ps(entryRight, entryLeft)) & both);
+                        if (leftNearer >= rightNearer)
+                        {
+                            index = leftIndex;
+                            stack[ptr++] = { entryRight, rightIndex };
+                        }
+                        else
+                        {
+                            index = rightIndex;
+                            stack[ptr++] = { entryLeft, leftIndex };
+                        }
+                        continue;
+                    }
+                    else if (hitLeft)
+                    {
+                        index = leftIndex;
+                        continue;
+                    }
+                    else if (hitRight)
+                    {
+                        index = rightIndex;
+                        continue;
+                    }
+                }
+
+                while (true)
+                {
+                    StackEntry next = stack[--ptr];
+                    if (next.index == -1 && BLAS)
+                    {
+                        BLAS = false;
+                        local = world;
+                        continue;
+                    }
+
+                    if (next.index == -1 || _mm_movemask_ps(_mm_cmplt_ps(next.entry, tMax)))
+                    {
+                        index = next.index;
+                        break;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Loads rays first..first+3 of the batch. Lanes past the end get tMax = -1 and never hit anything
+        void LoadPacket(const RayBatch& rays, int first, RayPacket& packet, __m128& tMax)
+        {
+            float lanes[7][4];
+            for (int l = 0; l < 4; l++)
+            {
+                int i = first + l;
+                bool valid = i < rays.count;
+                for (int c = 0; c < 3; c++)
+                {
+                    lanes[c][l] = valid ? rays.origin[c][i] : 0.0f;
+                    lanes[3 + c][l] = valid ? rays.direction[c][i] : 1.0f;
+                }
+                lanes[6][l] = !valid ? -1.0f : rays.tMax ? rays.tMax[i] : INFINITY;
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                packet.origin[c] = _mm_loadu_ps(lanes[c]);
+                packet.direction[c] = _mm_loadu_ps(lanes[3 + c]);
+                packet.invDir[c] = _mm_div_ps(_mm_set1_ps(1.0f), packet.direction[c]);
+            }
+            tMax = _mm_loadu_ps(lanes[6]);
+        }
+#endif
+    }
+
+    // Rays per task of the batch queries, a multiple of the packet size
+    static const int kBatchGrain = 1024;
+
+    void Scene::IntersectBatch(const RayBatch& rays, HitBatch& hits, bool packets) const
+    {
+        const Node* nodes = bvhTranslator.nodes.data();
+        int root = bvhTranslator.topLevelIndex;
+
+        auto intersectRay = [&](int i)
+        {
+            Ray r = BatchRay(rays, i);
+            float t = rays.tMax ? rays.tMax[i] : INFINITY;
+            float u = 0.0f, v = 0.0f;
+            int hitTri = -1;
+            int hitInstance = -1;
+
+            TraverseBVH(nodes, root, inverseTransforms.data(), r, t, [&](int first, int count, int instance, int, const Ray& rTrans)
+            {
+                for (int j = 0; j < count; j++)
+                {
+                    float tHit, uHit, vHit;
+                    if (HitTriangle(*this, rTrans, first + j, tHit, uHit, vHit) && tHit < t)
+                    {
+                        t = tHit;
+                        u = uHit;
+                        v = vHit;
+                        hitTri = first + j;
+                        hitInstance = instance;
+                    }
+                }
+                return false;
+            });
+
+            bool hit = hitTri != -1;
+            hits.t[i] = hit ? t : INFINITY;
+            hits.instance[i] = hitInstance;
+            hits.primitive[i] = hit ? MeshTriangle(*this, hitInstance, hitTri) : -1;
+            hits.u[i] = u;
+            hits.v[i] = v;
+        };
+
+#ifdef MATH_SIMD_SSE
+        if (packets)
+        {
+            TaskSystem::Get().ParallelFor(0, rays.count, kBatchGrain, [&](int begin, int end)
+            {
+                for (int first = begin; first < end; first += 4)
+                {
+                    RayPacket packet;
+                    __m128 tMax;
+                    LoadPacket(rays, first, packet, tMax);
+
+                    __m128 u = _mm_setzero_ps();
+                    __m128 v = _mm_setzero_ps();
+                    int hitTri[4] = { -1, -1, -1, -1 };
+                    int hitInstance[4] = { -1, -1, -1, -1 };
+
+                    bool complete = TraversePacket(nodes, root, inverseTransforms.data(), packet, tMax,
+                        [&](int leafFirst, int count, int instance, const RayPacket& local)
+                    {
+                        for (int i = 0; i < count; i++)
+                        {
+                            const iVec3& vertIndices = this->vertIndices[leafFirst + i];
+                            __m128 tTri, uTri, vTri;
+                            __m128 hit = PacketTriangle(vertexXYZU[vertIndices.x], vertexXYZU[vertIndices.y],
+                                                        vertexXYZU[vertIndices.z], local, tMax, tTri, uTri, vTri);
+                            int mask = _mm_movemask_ps(hit);
+                            if (mask == 0)
+                                continue;
+
+                            tMax = Select(hit, tTri, tMax);
+                            u = Select(hit, uTri, u);
+                            v = Select(hit, vTri, v);
+                            for (int l = 0; l < 4; l++)
+                            {
+                                if (mask & (1 << l))
+                                {
+                                    hitTri[l] = leafFirst + i;
+                                    hitInstance[l] = instance;
+                                }
+                            }
+                        }
+                        return false;
+                    });
+
+                    if (!complete)
+                    {
+                        for (int i = first; i < first + 4 && i < rays.count; i++)
+                            intersectRay(i);
+                        continue;
+                    }
+
+                    float t[4], hitU[4], hitV[4];
+                    _mm_storeu_ps(t, tMax);
+                    _mm_storeu_ps(hitU, u);
+                    _mm_storeu_ps(hitV, v);
+                    for (int l = 0; l < 4 && first + l < rays.count; l++)
+                    {
+                        int i = first + l;
+                        bool hit = hitTri[l] != -1;
+                        hits.t[i] = hit ? t[l] : INFINITY;
+                        hits.instance[i] = hitInstance[l];
+                        hits.primitive[i] = hit ? MeshTriangle(*this, hitInstance[l], hitTri[l]) : -1;
+                        hits.u[i] = hitU[l];
+                        hits.v[i] = hitV[l];
+                    }
+                }
+            });
+            return;
+        }
+#endif
+
+        TaskSystem::Get().ParallelFor(0, rays.count, kBatchGrain, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+                intersectRay(i);
+        });
+    }
+
+    // Stops at the first triangle in front of tMax, like anyhit.glsl
+    void Scene::OccludedBatch(const RayBatch& rays, bool* occluded, bool packets) const
+    {
+        const Node* nodes = bvhTranslator.nodes.data();
+        int root = bvhTranslator.topLevelIndex;
+
+        auto occludedRay = [&](int i)
+        {
+            Ray r = BatchRay(rays, i);
+            float tMax = rays.tMax ? rays.tMax[i] : INFINITY;
+            bool hit = false;
+
+            TraverseBVH(nodes, root, inverseTransforms.data(), r, tMax, [&](int first, int count, int, int, const Ray& rTrans)
+            {
+                for (int j = 0; j < count; j++)
+                {
+                    float tHit, uHit, vHit;
+                    if (HitTriangle(*this, rTrans, first + j, tHit, uHit, vHit) && tHit < tMax)
+                    {
+                        hit = true;
+                        return true;
+                    }
+                }
+                return false;
+            });
+
+            occluded[i] = hit;
+        };
+
+#ifdef MATH_SIMD_SSE
+        if (packets)
+        {
+            TaskSystem::Get().ParallelFor(0, rays.count, kBatchGrain, [&](int begin, int end)
+            {
+                for (int first = begin; first < end; first += 4)
+                {
+                    RayPacket packet;
+                    __m128 tMax;
+                    LoadPacket(rays, first, packet, tMax);
+
+                    // Occluded lanes are retired by setting their tMax to -1, the walk ends once no lane is left
+                    int hitMask = 0;
+                    bool complete = TraversePacket(nodes, root, inverseTransforms.data(), packet, tMax,
+                        [&](int leafFirst, int count, int, const RayPacket& local)
+                    {
+                        for (int i = 0; i < count; i++)
+                        {
+                            const iVec3& vertIndices = this->vertIndices[leafFirst + i];
+                            __m128 tTri, uTri, vTri;
+                            __m128 hit = PacketTriangle(vertexXYZU[vertIndices.x], vertexXYZU[vertIndices.y],
+                                                        vertexXYZU[vertIndices.z], local, tMax, tTri, uTri, vTri);
+                            int mask = _mm_movemask_ps(hit);
+                            if (mask == 0)
+                                continue;
+
+                            hitMask |= mask;
+                            tMax = Select(hit, _mm_set1_ps(-1.0f), tMax);
+                            if (_mm_movemask_ps(_mm_cmpgt_ps(tMax, _mm_setzero_ps())) == 0)
+                                return true;
+                        }
+                        return false;
+                    });
+
+                    if (!complete)
+                    {
+                        for (int i = first; i < first + 4 && i < rays.count; i++)
+                            occludedRay(i);
+                        continue;
+                    }
+
+                    for (int l = 0; l < 4 && first + l < rays.count; l++)
+                        occluded[first + l] = (hitMask & (1 << l)) != 0;
+                }
+            });
+            return;
+        }
+#endif
+
+        TaskSystem::Get().ParallelFor(0, rays.count, kBatchGrain, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+                occludedRay(i);
+        });
+    }
 }
\ No newline at end of file
@@ -36,15 +36,37 @@ namespace PathTracer
         float type;
     };
 
+    // Rays of a batched query, one array per component. tMax may be null for rays without an end
+    struct RayBatch
+    {
+        int count;
+        const float* origin[3];
+        const float* direction[3];
+        const float* tMax;
+    };
+
+    // Closest hit of every ray of a batch. Rays that hit nothing get t = INFINITY, instance = -1 and primitive = -1
+    struct HitBatch
+    {
+        float* t;
+        int* instance;  // Index into meshInstances
+        int* primitive; // Triangle of the mesh of the instance
+        float* u;       // Barycentrics of the second and third vertex of the triangle
+        float* v;
+    };
+
     class Scene
     {
     public:
-        Scene() : camera(nullptr), envMap(nullptr), initialized(false), dirty(true) {
+        Scene() : lightsPower(0.0f), camera(nullptr), envMap(nullptr), initialized(false), dirty(true) {
             sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
         }
         ~Scene();
 
         int AddMesh(const std::string& filename);
+        // Like AddMesh() for each file, with the files that are not loaded yet read in parallel. Ids are in the order
+        // of filenames, -1 where loading failed
+        std::vector<int> AddMeshes(const std::vector<std::string>& filenames);
         int AddTexture(const std::string& filename);
         int AddMaterial(const Material& material);
         int AddMeshInstance(const MeshInstance& meshInstance);
@@ -55,6 +77,13 @@ namespace PathTracer
 
         void ProcessScene();
         void RebuildInstances();
+        float EnvMapSelectPdf();
+
+        // Ray queries against the triangles of the scene on the CPU, for tools and baking. Lights are not hit and alpha
+        // is ignored. Rays are traced four at a time with SSE unless packets is false, in chunks on the TaskSystem.
+        // Need ProcessScene()
+        void IntersectBatch(const RayBatch& rays, HitBatch& hits, bool packets = true) const;
+        void OccludedBatch(const RayBatch& rays, bool* occluded, bool packets = true) const;
 
         // Options
         RenderOptions renderOptions;
@@ -67,6 +96,8 @@ namespace PathTracer
         std::vector<Vec4> vertexXYZU; // Vertex + texture Coord (u/s)
         std::vector<Vec4> normalXYZV; // Normal + texture Coord (v/t)
         std::vector<Mat4> transforms;
+        std::vector<Mat4> inverseTransforms;
+        std::vector<int> meshVertexOffsets; // First vertex of every mesh in vertexXYZU
 
         // Materials
         std::vector<Material> materials;
@@ -76,6 +107,8 @@ namespace PathTracer
 
         // Lights
         std::vector<Light> lights;
+        std::vector<Vec3> lightDistribution; // Alias table over light power: threshold, alias index, pdf
+        float lightsPower;
 
         // Environment Map
         EnvironmentMap* envMap;
@@ -101,5 +134,6 @@ namespace PathTracer
         RadeonRays::Bvh* sceneBvh;
         void createBLAS();
         void createTLAS();
+        void buildLightDistribution();
     };
 }
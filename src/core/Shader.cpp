@@ -7,7 +7,8 @@
 
 namespace PathTracer
 {
-    Shader::Shader(const ShaderSource& shaderSrc, GLenum shaderType)
+    Shader::Shader(const ShaderSource& shaderSrc, GLenum shaderType, bool deferCheck)
+        : path(shaderSrc.path)
     {
         // Adding shader process
         // step 1: create a shader (glCreateShader)
@@ -19,6 +20,12 @@ namespace PathTracer
         const GLchar* src = (const GLchar*)shaderSrc.src.c_str();
         glShaderSource(object, 1, &src, 0);
         glCompileShader(object);
+        if (!deferCheck)
+            CheckStatus();
+    }
+
+    void Shader::CheckStatus()
+    {
         GLint success = 0;
         glGetShaderiv(object, GL_COMPILE_STATUS, &success);
         if (success == GL_FALSE)
@@ -28,7 +35,7 @@ namespace PathTracer
             glGetShaderiv(object, GL_INFO_LOG_LENGTH, &logSize);
             char* info = new char[logSize + 1];
             glGetShaderInfoLog(object, logSize, NULL, info);
-            msg += shaderSrc.path;
+            msg += path;
             msg += "\n";
             msg += info;
             delete[] info;
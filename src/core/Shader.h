@@ -20,6 +20,7 @@ namespace PathTracer
         }
 
         GLuint object;
+        std::string path;
 
     public:
         struct ShaderSource
@@ -28,7 +29,10 @@ namespace PathTracer
             std::string path;
         };
 
-        Shader(const ShaderSource& sourceObj, GLuint shaderType);
+        // With deferCheck the compile status is not queried, so drivers with parallel compilation are not waited on.
+        // It is checked by CheckStatus(), or by Program::CheckStatus() for the shaders of a program
+        Shader(const ShaderSource& sourceObj, GLuint shaderType, bool deferCheck = false);
+        void CheckStatus();
         GLuint getObject() const;
 
         static ShaderSource load(std::string path)
@@ -0,0 +1,211 @@
+
+
+#include <algorithm>
+#include <cstdio>
+#include "TaskSystem.h"
+
+namespace PathTracer
+{
+    // Index of the worker running on this thread, -1 on threads that are not part of the task system
+    static thread_local int workerIndex = -1;
+
+    TaskSystem& TaskSystem::Get()
+    {
+        static TaskSystem taskSystem;
+        return taskSystem;
+    }
+
+    TaskSystem::TaskSystem()
+        : queued(0)
+        , nextWorker(0)
+        , quit(false)
+    {
+        SetThreadCount(0);
+    }
+
+    TaskSystem::~TaskSystem()
+    {
+        StopWorkers();
+    }
+
+    void TaskSystem::SetThreadCount(int count)
+    {
+        if (count <= 0)
+            count = std::max((int)std::thread::hardware_concurrency(), 1);
+
+        if (count - 1 == (int)workers.size())
+            return;
+
+        StopWorkers();
+        quit = false;
+
+        for (int i = 0; i < count - 1; i++)
+            workers.push_back(new Worker());
+        for (int i = 0; i < (int)workers.size(); i++)
+            workers[i]->thread = std::thread(&TaskSystem::WorkerLoop, this, i);
+
+        printf("Task system with %d threads\n", count);
+    }
+
+    void TaskSystem::ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& func)
+    {
+        grain = std::max(grain, 1);
+        if (end - begin <= 0)
+            return;
+
+        if (workers.empty() || end - begin <= grain)
+        {
+            func(begin, end);
+            return;
+        }
+
+        TaskGroup group;
+        for (int first = begin; first < end; first += grain)
+        {
+            int last = std::min(first + grain, end);
+            group.Run([&func, first, last]() { func(first, last); });
+        }
+        group.Wait();
+    }
+
+    // Workers add to their own deque, other threads deal their tasks out round robin
+    void TaskSystem::Push(std::function<void()> task)
+    {
+        if (workers.empty())
+        {
+            task();
+            return;
+        }
+
+        int index = workerIndex >= 0 ? workerIndex : (int)(nextWorker++ % workers.size());
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->tasks.push_back(std::move(task));
+            queued++;
+        }
+
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+
+    // Own tasks are taken from the back, tasks of other workers are stolen from the front
+    bool TaskSystem::RunTask()
+    {
+        int start = std::max(workerIndex, 0);
+        for (int i = 0; i < (int)workers.size(); i++)
+        {
+            Worker* worker = workers[(start + i) % workers.size()];
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+                if (worker->tasks.empty())
+                    continue;
+
+                if (i == 0 && workerIndex >= 0)
+                {
+                    task = std::move(worker->tasks.back());
+                    worker->tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(worker->tasks.front());
+                    worker->tasks.pop_front();
+                }
+                queued--;
+            }
+
+            task();
+            return true;
+        }
+        return false;
+    }
+
+    void TaskSystem::Sleep(const std::atomic<int>& pending)
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&] { return pending == 0 || queued > 0; });
+    }
+
+    void TaskSystem::WakeAll()
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_all();
+    }
+
+    void TaskSystem::StopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for (int i = 0; i < (int)workers.size(); i++)
+        {
+            workers[i]->thread.join();
+            delete workers[i];
+        }
+        workers.clear();
+    }
+
+    void TaskSystem::WorkerLoop(int index)
+    {
+        workerIndex = index;
+        while (true)
+        {
+            if (RunTask())
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return quit || queued > 0; });
+            if (quit)
+                return;
+        }
+    }
+
+    // The count drops after the task is done, waking the threads in Wait() once the group is finished. A task that
+    // throws still counts as done, the first exception is kept for Wait()
+    void TaskGroup::Run(std::function<void()> task)
+    {
+        pending++;
+        TaskSystem::Get().Push([this, task]()
+        {
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+
+            if (--pending == 0)
+                TaskSystem::Get().WakeAll();
+        });
+    }
+
+    void TaskGroup::Wait()
+    {
+        Finish();
+
+        std::exception_ptr taskError;
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            std::swap(taskError, error);
+        }
+        if (taskError)
+            std::rethrow_exception(taskError);
+    }
+
+    void TaskGroup::Finish()
+    {
+        TaskSystem& taskSystem = TaskSystem::Get();
+        while (pending > 0)
+        {
+            if (!taskSystem.RunTask())
+                taskSystem.Sleep(pending);
+        }
+    }
+}
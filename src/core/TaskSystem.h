@@ -0,0 +1,99 @@
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PathTracer
+{
+    // Worker threads shared by everything that runs on the CPU in parallel: building BVHs, loading meshes, resizing
+    // textures, CPU path tracing and batched ray queries. Each worker takes tasks from the back of its own deque and
+    // steals from the front of the others once it is empty. Threads waiting for a TaskGroup or ParallelFor run queued
+    // tasks meanwhile, so tasks can start and wait for tasks of their own
+    class TaskSystem
+    {
+    public:
+        static TaskSystem& Get();
+        ~TaskSystem();
+
+        // Threads that run tasks, counting the thread that waits for them. 0 uses all cores, 1 runs every task
+        // right away on the thread that adds it. Must not be called while tasks are running
+        void SetThreadCount(int count);
+        int GetThreadCount() const { return (int)workers.size() + 1; }
+
+        // Calls func(first, last) for ranges of at most grain items covering [begin, end) and returns once all are done.
+        // The first exception func throws is rethrown after the other ranges have finished
+        void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& func);
+
+        // Runs func on a worker, an exception it throws is rethrown by get(). Futures don't run queued tasks while
+        // waiting, so tasks should wait with a TaskGroup
+        template <typename Func>
+        auto Async(Func func) -> std::future<decltype(func())>;
+
+    private:
+        friend class TaskGroup;
+
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        TaskSystem();
+
+        void Push(std::function<void()> task);
+        // Runs one queued task on the calling thread, false if there was none
+        bool RunTask();
+        // Blocks until pending is 0 or a task is queued
+        void Sleep(const std::atomic<int>& pending);
+        void WakeAll();
+        void StopWorkers();
+        void WorkerLoop(int index);
+
+        std::vector<Worker*> workers;
+        std::atomic<int> queued;
+        std::atomic<unsigned> nextWorker;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        bool quit;
+    };
+
+    // Tasks that are waited for together. Wait() runs queued tasks until all of the group are done and rethrows the
+    // first exception a task threw. The destructor only waits, errors not collected with Wait() are dropped
+    class TaskGroup
+    {
+    public:
+        TaskGroup() : pending(0) {}
+        ~TaskGroup() { Finish(); }
+
+        void Run(std::function<void()> task);
+        void Wait();
+
+    private:
+        void Finish();
+
+        std::atomic<int> pending;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+
+    template <typename Func>
+    auto TaskSystem::Async(Func func) -> std::future<decltype(func())>
+    {
+        using Result = decltype(func());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        std::future<Result> result = task->get_future();
+        Push([task]() { (*task)(); });
+        return result;
+    }
+}
@@ -8,6 +8,7 @@
 #include <map>
 #include <cstdint>
 #include "GLTFLoader.h"
+#include "Profiler.h"
 #include "tiny_gltf.h"
 
 namespace PathTracer
@@ -359,6 +360,7 @@ namespace PathTracer
 
     bool LoadGLTF(const std::string& filename, Scene* scene, RenderOptions& renderOptions, Mat4 xform, bool binary)
     {
+        CPUProfileScope profile("Load GLTF");
         tinygltf::Model gltfModel;
         tinygltf::TinyGLTF loader;
         std::string err;
@@ -52,6 +52,34 @@ namespace PathTracer
             int id;
         };
 
+        // Mesh blocks are collected so their files can be read in parallel, then instanced in the order of the file
+        struct MeshBlock
+        {
+            std::string filename;
+            std::string instanceName;
+            Mat4 transform;
+            int materialID;
+        };
+
+        std::vector<MeshBlock> meshBlocks;
+        auto addMeshBlocks = [&]()
+        {
+            std::vector<std::string> filenames;
+            for (const MeshBlock& block : meshBlocks)
+                filenames.push_back(block.filename);
+
+            std::vector<int> meshIDs = scene->AddMeshes(filenames);
+            for (int i = 0; i < meshBlocks.size(); i++)
+            {
+                if (meshIDs[i] != -1)
+                {
+                    MeshInstance instance(meshBlocks[i].instanceName, meshIDs[i], meshBlocks[i].transform, meshBlocks[i].materialID);
+                    scene->AddMeshInstance(instance);
+                }
+            }
+            meshBlocks.clear();
+        };
+
         std::map<std::string, MaterialData> materialMap;
         std::vector<std::string> albedoTex;
         std::vector<std::string> metallicRoughnessTex;
@@ -258,6 +286,16 @@ namespace PathTracer
             {
                 char envMap[200] = "none";
                 char enableRR[10] = "none";
+                char enableLightPowerSampling[10] = "none";
+                char enableReSTIR[10] = "none";
+                char enableAdaptiveTiles[10] = "none";
+                char enableDynamicPreview[10] = "none";
+                char enableReprojection[10] = "none";
+                char enableAdaptiveSampling[10] = "none";
+                char enableWavefront[10] = "none";
+                char enableRaySorting[10] = "none";
+                char enableShortStack[10] = "none";
+                char enableCPURenderer[10] = "none";
                 char enableAces[10] = "none";
                 char openglNormalMap[10] = "none";
                 char transparentBackground[10] = "none";
@@ -279,8 +317,25 @@ namespace PathTracer
                     sscanf(line, " maxspp %i", &renderOptions.maxSpp);
                     sscanf(line, " tilewidth %i", &renderOptions.tileWidth);
                     sscanf(line, " tileheight %i", &renderOptions.tileHeight);
+                    sscanf(line, " adaptivetiles %s", enableAdaptiveTiles);
+                    sscanf(line, " dynamicpreview %s", enableDynamicPreview);
+                    sscanf(line, " enablereprojection %s", enableReprojection);
+                    sscanf(line, " targetframetime %f", &renderOptions.targetFrameTime);
+                    sscanf(line, " samplesperpass %i", &renderOptions.samplesPerPass);
+                    sscanf(line, " enableadaptivesampling %s", enableAdaptiveSampling);
+                    sscanf(line, " adaptivethreshold %f", &renderOptions.adaptiveThreshold);
+                    sscanf(line, " adaptiveminspp %i", &renderOptions.adaptiveMinSpp);
+                    sscanf(line, " enablewavefront %s", enableWavefront);
+                    sscanf(line, " enableraysorting %s", enableRaySorting);
+                    sscanf(line, " enableshortstack %s", enableShortStack);
+                    sscanf(line, " enablecpurenderer %s", enableCPURenderer);
+                    sscanf(line, " cputhreads %i", &renderOptions.cpuThreads);
                     sscanf(line, " enablerr %s", enableRR);
                     sscanf(line, " rrdepth %i", &renderOptions.RRDepth);
+                    sscanf(line, " enablelightpowersampling %s", enableLightPowerSampling);
+                    sscanf(line, " enablerestir %s", enableReSTIR);
+                    sscanf(line, " restircandidates %i", &renderOptions.restirCandidates);
+                    sscanf(line, " restirspatialsamples %i", &renderOptions.restirSpatialSamples);
                     sscanf(line, " enabletonemap %s", enableTonemap);
                     sscanf(line, " enableaces %s", enableAces);
                     sscanf(line, " texarraywidth %i", &renderOptions.textureWidth);
@@ -311,6 +366,56 @@ namespace PathTracer
                 else if (strcmp(enableRR, "true") == 0)
                     renderOptions.enableRR = true;
 
+                if (strcmp(enableLightPowerSampling, "false") == 0)
+                    renderOptions.enableLightPowerSampling = false;
+                else if (strcmp(enableLightPowerSampling, "true") == 0)
+                    renderOptions.enableLightPowerSampling = true;
+
+                if (strcmp(enableReSTIR, "false") == 0)
+                    renderOptions.enableReSTIR = false;
+                else if (strcmp(enableReSTIR, "true") == 0)
+                    renderOptions.enableReSTIR = true;
+
+                if (strcmp(enableAdaptiveTiles, "false") == 0)
+                    renderOptions.enableAdaptiveTiles = false;
+                else if (strcmp(enableAdaptiveTiles, "true") == 0)
+                    renderOptions.enableAdaptiveTiles = true;
+
+                if (strcmp(enableDynamicPreview, "false") == 0)
+                    renderOptions.enableDynamicPreview = false;
+                else if (strcmp(enableDynamicPreview, "true") == 0)
+                    renderOptions.enableDynamicPreview = true;
+
+                if (strcmp(enableReprojection, "false") == 0)
+                    renderOptions.enableReprojection = false;
+                else if (strcmp(enableReprojection, "true") == 0)
+                    renderOptions.enableReprojection = true;
+
+                if (strcmp(enableAdaptiveSampling, "false") == 0)
+                    renderOptions.enableAdaptiveSampling = false;
+                else if (strcmp(enableAdaptiveSampling, "true") == 0)
+                    renderOptions.enableAdaptiveSampling = true;
+
+                if (strcmp(enableWavefront, "false") == 0)
+                    renderOptions.enableWavefront = false;
+                else if (strcmp(enableWavefront, "true") == 0)
+                    renderOptions.enableWavefront = true;
+
+                if (strcmp(enableRaySorting, "false") == 0)
+                    renderOptions.enableRaySorting = false;
+                else if (strcmp(enableRaySorting, "true") == 0)
+                    renderOptions.enableRaySorting = true;
+
+                if (strcmp(enableShortStack, "false") == 0)
+                    renderOptions.enableShortStack = false;
+                else if (strcmp(enableShortStack, "true") == 0)
+                    renderOptions.enableShortStack = true;
+
+                if (strcmp(enableCPURenderer, "false") == 0)
+                    renderOptions.enableCPURenderer = false;
+                else if (strcmp(enableCPURenderer, "true") == 0)
+                    renderOptions.enableCPURenderer = true;
+
                 if (strcmp(openglNormalMap, "false") == 0)
                     renderOptions.openglNormalMap = false;
                 else if (strcmp(openglNormalMap, "true") == 0)
@@ -392,29 +497,24 @@ namespace PathTracer
 
                 if (!filename.empty())
                 {
-                    int mesh_id = scene->AddMesh(filename);
-                    if (mesh_id != -1)
-                    {
-                        std::string instanceName;
+                    std::string instanceName;
 
-                        if (strcmp(meshName, "none") != 0)
-                            instanceName = std::string(meshName);
-                        else
-                        {
-                            std::size_t pos = filename.find_last_of("/\\");
-                            instanceName = filename.substr(pos + 1);
-                        }
+                    if (strcmp(meshName, "none") != 0)
+                        instanceName = std::string(meshName);
+                    else
+                    {
+                        std::size_t pos = filename.find_last_of("/\\");
+                        instanceName = filename.substr(pos + 1);
+                    }
 
-                        Mat4 transformMat;
+                    Mat4 transformMat;
 
-                        if (matrixProvided)
-                            transformMat = xform;
-                        else
-                            transformMat = scale * rot * translate;
+                    if (matrixProvided)
+                        transformMat = xform;
+                    else
+                        transformMat = scale * rot * translate;
 
-                        MeshInstance instance(instanceName, mesh_id, transformMat, material_id);
-                        scene->AddMeshInstance(instance);
-                    }
+                    meshBlocks.push_back({ filename, instanceName, transformMat, material_id });
                 }
             }
 
@@ -465,6 +565,9 @@ namespace PathTracer
                     else
                         transformMat = scale * rot * translate;
 
+                    // Meshes and instances before this block keep their ids
+                    addMeshBlocks();
+
                     // TODO: Add support for instancing.
                     // If the same gltf is loaded multiple times then mesh data gets duplicated
                     if (ext == "gltf")
@@ -483,6 +586,8 @@ namespace PathTracer
 
         fclose(file);
 
+        addMeshBlocks();
+
         return true;
     }
 }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "Vec3.h"
+#include "Vec3A.h"
 
 namespace PathTracer
 {
@@ -18,6 +19,7 @@ namespace PathTracer
         static Mat4 Translate(const Vec3& a);
         static Mat4 Scale(const Vec3& a);
         static Mat4 QuatToMatrix(float x, float y, float z, float w);
+        static Mat4 Inverse(const Mat4& a);
 
         float data[4][4];
     };
@@ -52,6 +54,24 @@ namespace PathTracer
     {
         Mat4 out;
 
+#if defined(MATH_SIMD_SSE) || defined(MATH_SIMD_NEON)
+        // Row i of the product is the rows of b weighted by row i of this matrix, summed in the same order as the
+        // scalar version
+        for (int i = 0; i < 4; i++)
+        {
+#if defined(MATH_SIMD_SSE)
+            __m128 row = _mm_mul_ps(_mm_set1_ps(data[i][0]), _mm_loadu_ps(b.data[0]));
+            for (int k = 1; k < 4; k++)
+                row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(data[i][k]), _mm_loadu_ps(b.data[k])));
+            _mm_storeu_ps(out.data[i], row);
+#else
+            float32x4_t row = vmulq_n_f32(vld1q_f32(b.data[0]), data[i][0]);
+            for (int k = 1; k < 4; k++)
+                row = vaddq_f32(row, vmulq_n_f32(vld1q_f32(b.data[k]), data[i][k]));
+            vst1q_f32(out.data[i], row);
+#endif
+        }
+#else
         out[0][0] = data[0][0] * b.data[0][0] + data[0][1] * b.data[1][0] + data[0][2] * b.data[2][0] + data[0][3] * b.data[3][0];
         out[0][1] = data[0][0] * b.data[0][1] + data[0][1] * b.data[1][1] + data[0][2] * b.data[2][1] + data[0][3] * b.data[3][1];
         out[0][2] = data[0][0] * b.data[0][2] + data[0][1] * b.data[1][2] + data[0][2] * b.data[2][2] + data[0][3] * b.data[3][2];
@@ -71,6 +91,7 @@ namespace PathTracer
         out[3][1] = data[3][0] * b.data[0][1] + data[3][1] * b.data[1][1] + data[3][2] * b.data[2][1] + data[3][3] * b.data[3][1];
         out[3][2] = data[3][0] * b.data[0][2] + data[3][1] * b.data[1][2] + data[3][2] * b.data[2][2] + data[3][3] * b.data[3][2];
         out[3][3] = data[3][0] * b.data[0][3] + data[3][1] * b.data[1][3] + data[3][2] * b.data[2][3] + data[3][3] * b.data[3][3];
+#endif
 
         return out;
     }
@@ -117,4 +138,38 @@ namespace PathTracer
 
         return out;
     }
+
+    // General inverse by cofactors. Returns the identity for singular matrices
+    inline Mat4 Mat4::Inverse(const Mat4& a)
+    {
+        const float* m = &a.data[0][0];
+        float inv[16];
+
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+        Mat4 out;
+        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        if (det != 0.0f)
+        {
+            for (int i = 0; i < 16; i++)
+                (&out.data[0][0])[i] = inv[i] / det;
+        }
+
+        return out;
+    }
 }
\ No newline at end of file
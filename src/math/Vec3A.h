@@ -0,0 +1,132 @@
+
+
+#pragma once
+
+#include <algorithm>
+#include "Vec3.h"
+#include "Vec4.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATH_SIMD_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MATH_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace PathTracer
+{
+    // Vec3 in one 16 byte register (SSE, NEON or plain floats), for the CPU side hot paths like growing bounding boxes.
+    // w is padding and kept at 0. Every component is computed like Vec3 does, including Min()/Max() with equal or NaN
+    // inputs, so results are bit for bit the same
+    struct alignas(16) Vec3A
+    {
+    public:
+        Vec3A();
+        Vec3A(float x, float y, float z);
+        Vec3A(const Vec3& b);
+        Vec3A(const Vec4& b);
+
+        operator Vec3() const;
+
+        Vec3A operator*(const Vec3A& b) const;
+        Vec3A operator+(const Vec3A& b) const;
+        Vec3A operator-(const Vec3A& b) const;
+        Vec3A operator*(float b) const;
+
+        float operator[](int i) const;
+        float& operator[](int i);
+
+        static Vec3A Min(const Vec3A& a, const Vec3A& b);
+        static Vec3A Max(const Vec3A& a, const Vec3A& b);
+
+#if defined(MATH_SIMD_SSE)
+        Vec3A(__m128 m) : m(m) {}
+        union
+        {
+            __m128 m;
+            struct { float x, y, z, w; };
+        };
+#elif defined(MATH_SIMD_NEON)
+        Vec3A(float32x4_t m) : m(m) {}
+        union
+        {
+            float32x4_t m;
+            struct { float x, y, z, w; };
+        };
+#else
+        float x, y, z, w;
+#endif
+    };
+
+#if defined(MATH_SIMD_SSE)
+    inline Vec3A::Vec3A() : m(_mm_setzero_ps()) {}
+    inline Vec3A::Vec3A(float x, float y, float z) : m(_mm_set_ps(0.0f, z, y, x)) {}
+    inline Vec3A::Vec3A(const Vec3& b) : m(_mm_set_ps(0.0f, b.z, b.y, b.x)) {}
+    inline Vec3A::Vec3A(const Vec4& b) : m(_mm_and_ps(_mm_loadu_ps(&b.x), _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)))) {}
+
+    inline Vec3A Vec3A::operator*(const Vec3A& b) const { return _mm_mul_ps(m, b.m); }
+    inline Vec3A Vec3A::operator+(const Vec3A& b) const { return _mm_add_ps(m, b.m); }
+    inline Vec3A Vec3A::operator-(const Vec3A& b) const { return _mm_sub_ps(m, b.m); }
+    inline Vec3A Vec3A::operator*(float b) const { return _mm_mul_ps(m, _mm_set1_ps(b)); }
+
+    // _mm_min_ps(b, a) is b < a ? b : a, which is std::min(a, b)
+    inline Vec3A Vec3A::Min(const Vec3A& a, const Vec3A& b) { return _mm_min_ps(b.m, a.m); }
+    inline Vec3A Vec3A::Max(const Vec3A& a, const Vec3A& b) { return _mm_max_ps(b.m, a.m); }
+#elif defined(MATH_SIMD_NEON)
+    inline Vec3A::Vec3A() : m(vdupq_n_f32(0.0f)) {}
+
+    inline Vec3A::Vec3A(float x, float y, float z)
+    {
+        float v[4] = { x, y, z, 0.0f };
+        m = vld1q_f32(v);
+    }
+
+    inline Vec3A::Vec3A(const Vec3& b) : Vec3A(b.x, b.y, b.z) {}
+    inline Vec3A::Vec3A(const Vec4& b) : Vec3A(b.x, b.y, b.z) {}
+
+    inline Vec3A Vec3A::operator*(const Vec3A& b) const { return vmulq_f32(m, b.m); }
+    inline Vec3A Vec3A::operator+(const Vec3A& b) const { return vaddq_f32(m, b.m); }
+    inline Vec3A Vec3A::operator-(const Vec3A& b) const { return vsubq_f32(m, b.m); }
+    inline Vec3A Vec3A::operator*(float b) const { return vmulq_n_f32(m, b); }
+
+    // vminq_f32 orders -0 before +0 and returns NaN, compare and select to match std::min and std::max instead
+    inline Vec3A Vec3A::Min(const Vec3A& a, const Vec3A& b) { return vbslq_f32(vcltq_f32(b.m, a.m), b.m, a.m); }
+    inline Vec3A Vec3A::Max(const Vec3A& a, const Vec3A& b) { return vbslq_f32(vcltq_f32(a.m, b.m), b.m, a.m); }
+#else
+    inline Vec3A::Vec3A() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+    inline Vec3A::Vec3A(float x, float y, float z) : x(x), y(y), z(z), w(0.0f) {}
+    inline Vec3A::Vec3A(const Vec3& b) : x(b.x), y(b.y), z(b.z), w(0.0f) {}
+    inline Vec3A::Vec3A(const Vec4& b) : x(b.x), y(b.y), z(b.z), w(0.0f) {}
+
+    inline Vec3A Vec3A::operator*(const Vec3A& b) const { return Vec3A(x * b.x, y * b.y, z * b.z); }
+    inline Vec3A Vec3A::operator+(const Vec3A& b) const { return Vec3A(x + b.x, y + b.y, z + b.z); }
+    inline Vec3A Vec3A::operator-(const Vec3A& b) const { return Vec3A(x - b.x, y - b.y, z - b.z); }
+    inline Vec3A Vec3A::operator*(float b) const { return Vec3A(x * b, y * b, z * b); }
+
+    inline Vec3A Vec3A::Min(const Vec3A& a, const Vec3A& b)
+    {
+        return Vec3A(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+    }
+
+    inline Vec3A Vec3A::Max(const Vec3A& a, const Vec3A& b)
+    {
+        return Vec3A(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+    }
+#endif
+
+    inline Vec3A::operator Vec3() const
+    {
+        return Vec3(x, y, z);
+    }
+
+    inline float Vec3A::operator[](int i) const
+    {
+        return (&x)[i];
+    }
+
+    inline float& Vec3A::operator[](int i)
+    {
+        return (&x)[i];
+    }
+}
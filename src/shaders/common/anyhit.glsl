@@ -41,11 +41,10 @@ bool AnyHit(Ray r, float maxDist)
 #endif
 
     // Intersect BVH and tris
-    int stack[64];
-    int ptr = 0;
-    stack[ptr++] = -1;
+    ResetStack();
 
     int index = topBVHIndex;
+    int tlasLeaf = -1;
     float leftHit = 0.0;
     float rightHit = 0.0;
 
@@ -133,8 +132,9 @@ bool AnyHit(Ray r, float maxDist)
             rTrans.origin    = vec3(inverse(transform) * vec4(r.origin, 1.0));
             rTrans.direction = vec3(inverse(transform) * vec4(r.direction, 0.0));
 
-            // Add a marker. We'll return to this spot after we've traversed the entire BLAS
-            stack[ptr++] = -1;
+            // The BLAS gets the stack above the TLAS entries. We'll return to this leaf after we've traversed the entire BLAS
+            EnterBLAS();
+            tlasLeaf = index;
 
             index = leftIndex;
             BLAS = true;
@@ -162,7 +162,7 @@ bool AnyHit(Ray r, float maxDist)
                     deferred = rightIndex;
                 }
 
-                stack[ptr++] = deferred;
+                PushNode(deferred, BLAS);
                 continue;
             }
             else if (leftHit > 0.)
@@ -176,17 +176,17 @@ bool AnyHit(Ray r, float maxDist)
                 continue;
             }
         }
-        index = stack[--ptr];
+        index = NextNode(index, BLAS, rTrans);
 
         // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
         if (BLAS && index == -1)
         {
             BLAS = false;
 
-            index = stack[--ptr];
-
             rTrans.origin = r.origin;
             rTrans.direction = r.direction;
+
+            index = NextNode(tlasLeaf, false, rTrans);
         }
     }
 
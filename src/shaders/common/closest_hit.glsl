@@ -34,6 +34,9 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
                 t = d;
                 float cosTheta = dot(-r.direction, normal);
                 lightSample.pdf = (t * t) / (area * cosTheta);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+                lightSample.pdf *= LightSelectPdf(i);
+#endif
                 lightSample.emission = emission;
                 state.isEmitter = true;
             }
@@ -51,6 +54,9 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
                 float cosTheta = dot(-r.direction, normalize(hitPt - position));
                 // TODO: Fix this. Currently assumes the light will be hit only from the outside
                 lightSample.pdf = (t * t) / (area * cosTheta * 0.5);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+                lightSample.pdf *= LightSelectPdf(i);
+#endif
                 lightSample.emission = emission;
                 state.isEmitter = true;
             }
@@ -59,11 +65,10 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
 #endif
 
     // Intersect BVH and tris
-    int stack[64];
-    int ptr = 0;
-    stack[ptr++] = -1;
+    ResetStack();
 
     int index = topBVHIndex;
+    int tlasLeaf = -1;
     float leftHit = 0.0;
     float rightHit = 0.0;
 
@@ -136,8 +141,9 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
             rTrans.origin    = vec3(inverse(transMat) * vec4(r.origin, 1.0));
             rTrans.direction = vec3(inverse(transMat) * vec4(r.direction, 0.0));
 
-            // Add a marker. We'll return to this spot after we've traversed the entire BLAS
-            stack[ptr++] = -1;
+            // The BLAS gets the stack above the TLAS entries. We'll return to this leaf after we've traversed the entire BLAS
+            EnterBLAS();
+            tlasLeaf = index;
             index = leftIndex;
             BLAS = true;
             currMatID = rightIndex;
@@ -162,7 +168,7 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
                     deferred = rightIndex;
                 }
 
-                stack[ptr++] = deferred;
+                PushNode(deferred, BLAS);
                 continue;
             }
             else if (leftHit > 0.)
@@ -176,17 +182,17 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSample)
                 continue;
             }
         }
-        index = stack[--ptr];
+        index = NextNode(index, BLAS, rTrans);
 
         // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
         if (BLAS && index == -1)
         {
             BLAS = false;
 
-            index = stack[--ptr];
-
             rTrans.origin = r.origin;
             rTrans.direction = r.direction;
+
+            index = NextNode(tlasLeaf, false, rTrans);
         }
     }
 
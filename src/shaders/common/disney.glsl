@@ -50,17 +50,25 @@ vec3 EvalDisneyDiffuse(Material mat, vec3 Csheen, vec3 V, vec3 L, vec3 H, out fl
     float Fretro = Rr * (FL + FV + FL * FV * (Rr - 1.0));
     float Fd = (1.0 - 0.5 * FL) * (1.0 - 0.5 * FV);
 
+    float diffuse = Fd + Fretro;
+
     // Fake subsurface
+#ifdef OPT_SUBSURFACE
     float Fss90 = 0.5 * Rr;
     float Fss = mix(1.0, Fss90, FL) * mix(1.0, Fss90, FV);
     float ss = 1.25 * (Fss * (1.0 / (L.z + V.z) - 0.5) + 0.5);
+    diffuse = mix(diffuse, ss, mat.subsurface);
+#endif
 
     // Sheen
+    vec3 Fsheen = vec3(0.0);
+#ifdef OPT_SHEEN
     float FH = SchlickWeight(LDotH);
-    vec3 Fsheen = FH * mat.sheen * Csheen;
+    Fsheen = FH * mat.sheen * Csheen;
+#endif
 
     pdf = L.z * INV_PI;
-    return INV_PI * mat.baseColor * mix(Fd + Fretro, ss, mat.subsurface) + Fsheen;
+    return INV_PI * mat.baseColor * diffuse + Fsheen;
 }
 
 vec3 EvalMicrofacetReflection(Material mat, vec3 V, vec3 L, vec3 H, vec3 F, out float pdf)
@@ -171,7 +179,12 @@ vec3 DisneySample(State state, vec3 V, vec3 N, out vec3 L, out float pdf)
     {
         L = CosineSampleHemisphere(r1, r2);
     }
+    // The last lobe that is compiled in takes whatever rounding leaves above the CDF
+#if defined(OPT_SPECTRANS) || defined(OPT_CLEARCOAT)
     else if (r3 < cdf[2]) // Dielectric + Metallic reflection
+#else
+    else // Dielectric + Metallic reflection
+#endif
     {
         vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
 
@@ -180,7 +193,12 @@ vec3 DisneySample(State state, vec3 V, vec3 N, out vec3 L, out float pdf)
 
         L = normalize(reflect(-V, H));
     }
+#ifdef OPT_SPECTRANS
+#ifdef OPT_CLEARCOAT
     else if (r3 < cdf[3]) // Glass
+#else
+    else // Glass
+#endif
     {
         vec3 H = SampleGGXVNDF(V, state.mat.ax, state.mat.ay, r1, r2);
         float F = DielectricFresnel(abs(dot(V, H)), state.eta);
@@ -201,6 +219,8 @@ vec3 DisneySample(State state, vec3 V, vec3 N, out vec3 L, out float pdf)
             L = normalize(refract(-V, H, state.eta));
         }
     }
+#endif
+#ifdef OPT_CLEARCOAT
     else // Clearcoat
     {
         vec3 H = SampleGTR1(state.mat.clearcoatRoughness, r1, r2);
@@ -210,6 +230,7 @@ vec3 DisneySample(State state, vec3 V, vec3 N, out vec3 L, out float pdf)
 
         L = normalize(reflect(-V, H));
     }
+#endif
 
     L = ToWorld(T, B, N, L);
     V = ToWorld(T, B, N, V);
@@ -299,6 +320,7 @@ vec3 DisneyEval(State state, vec3 V, vec3 N, vec3 L, out float pdf)
     }
 
     // Glass/Specular BSDF
+#ifdef OPT_SPECTRANS
     if (glassPr > 0.0)
     {
         // Dielectric fresnel (achromatic)
@@ -315,13 +337,16 @@ vec3 DisneyEval(State state, vec3 V, vec3 N, vec3 L, out float pdf)
             pdf += tmpPdf * glassPr * (1.0 - F);
         }
     }
+#endif
 
     // Clearcoat
+#ifdef OPT_CLEARCOAT
     if (clearCtPr > 0.0 && reflect)
     {
         f += EvalClearcoat(state.mat, V, L, H, tmpPdf) * 0.25 * state.mat.clearcoat;
         pdf += tmpPdf * clearCtPr;
     }
+#endif
 
     return f * abs(L.z);
 }
\ No newline at end of file
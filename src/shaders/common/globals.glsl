@@ -114,7 +114,32 @@ struct LightSampleRec
     float pdf;
 };
 
-uniform Camera camera;
+// Scene and camera parameters and render options shared by the path tracing and tonemapping programs.
+// Filled from RenderParams in Renderer.h, which has to match this std140 layout
+layout(std140) uniform RenderParams
+{
+    Camera camera;
+    vec2 resolution;
+    vec2 invNumTiles;
+    vec2 envMapRes;
+    float envMapTotalSum;
+    float envMapIntensity;
+    float envMapRot;
+    float envMapSelectPdf;
+    int numOfLights;
+    int topBVHIndex;
+    int maxDepth;
+    int previewMaxDepth;
+    int rrDepth;
+    int restirCandidates;
+    int restirSpatialSamples;
+    bool enableBackground;
+    bool transparentBackground;
+    bool enableTonemap;
+    bool enableAces;
+    bool simpleAcesFit;
+    vec3 backgroundCol;
+};
 
 //RNG from code by Moroz Mykhailo (https://www.shadertoy.com/view/wltcRS)
 
@@ -57,4 +57,125 @@ float AABBIntersect(vec3 minCorner, vec3 maxCorner, Ray r)
     float t0 = max(tmin.x, max(tmin.y, tmin.z));
 
     return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
-}
\ No newline at end of file
+}
+
+// Traversal stack of ClosestHit() and AnyHit()
+#ifdef OPT_SHORT_STACK
+
+// Only the last SHORT_STACK_SIZE deferred nodes are kept, pushing onto a full stack drops the oldest one. Once a level
+// (the TLAS or the current BLAS) has dropped nodes and its part of the stack runs empty, traversal continues by
+// climbing the parent links instead (NextNode). Saves registers on GPUs where the full stack limits occupancy
+#define SHORT_STACK_SIZE 8
+
+int shortStack[SHORT_STACK_SIZE];
+int stackTop;    // Ring index of the next push
+int stackSize;
+int blasBase;    // Entries below it belong to the TLAS
+bool tlasDropped;
+bool blasDropped;
+
+void ResetStack()
+{
+    stackTop = 0;
+    stackSize = 0;
+    blasBase = 0;
+    tlasDropped = false;
+    blasDropped = false;
+}
+
+void EnterBLAS()
+{
+    blasBase = stackSize;
+    blasDropped = false;
+}
+
+void PushNode(int index, bool BLAS)
+{
+    if (stackSize == SHORT_STACK_SIZE)
+    {
+        // The oldest entry belongs to the TLAS unless the BLAS has filled the whole stack
+        if (BLAS && blasBase == 0)
+            blasDropped = true;
+        else
+        {
+            tlasDropped = true;
+            if (BLAS)
+                blasBase--;
+        }
+    }
+    else
+        stackSize++;
+
+    shortStack[stackTop % SHORT_STACK_SIZE] = index;
+    stackTop++;
+}
+
+// Node to visit once the subtree at index is done, -1 when the level is done. Rays are in the space of the level
+int NextNode(int index, bool BLAS, Ray r)
+{
+    if (stackSize > (BLAS ? blasBase : 0))
+    {
+        stackTop--;
+        stackSize--;
+        return shortStack[stackTop % SHORT_STACK_SIZE];
+    }
+
+    if (!(BLAS ? blasDropped : tlasDropped))
+        return -1;
+
+    // The next node is the far child of the closest ancestor that was entered through its near child with both children
+    // hit. Repeating the traversal's own box tests there gives the same decisions it made on the way down
+    int child = index;
+    while (true)
+    {
+        int parent = int(texelFetch(BVHTexture, child * 3 + 0).w);
+        if (parent == -1)
+            return -1;
+
+        ivec3 LRLeaf = ivec3(texelFetch(BVHTexture, parent * 3 + 2).xyz);
+        float leftHit  = AABBIntersect(texelFetch(BVHTexture, LRLeaf.x * 3 + 0).xyz, texelFetch(BVHTexture, LRLeaf.x * 3 + 1).xyz, r);
+        float rightHit = AABBIntersect(texelFetch(BVHTexture, LRLeaf.y * 3 + 0).xyz, texelFetch(BVHTexture, LRLeaf.y * 3 + 1).xyz, r);
+
+        if (leftHit > 0.0 && rightHit > 0.0)
+        {
+            int near = leftHit > rightHit ? LRLeaf.y : LRLeaf.x;
+            if (child == near)
+                return near == LRLeaf.x ? LRLeaf.y : LRLeaf.x;
+        }
+
+        child = parent;
+    }
+
+    return -1;
+}
+
+#else
+
+// Full stack, a -1 marker separates the BLAS entries from the TLAS ones and ends the traversal at the bottom
+int stack[64];
+int ptr;
+
+void ResetStack()
+{
+    ptr = 0;
+    stack[ptr++] = -1;
+}
+
+void EnterBLAS()
+{
+    // Add a marker. We'll return to this spot after we've traversed the entire BLAS
+    stack[ptr++] = -1;
+}
+
+void PushNode(int index, bool BLAS)
+{
+    stack[ptr++] = index;
+}
+
+// Node to visit once the subtree at index is done, -1 when the level is done
+int NextNode(int index, bool BLAS, Ray r)
+{
+    return stack[--ptr];
+}
+
+#endif
@@ -13,22 +13,46 @@ void GetMaterial(inout State state, in Ray r)
     vec4 param7 = texelFetch(materialsTexture, ivec2(index + 6, 0), 0);
     vec4 param8 = texelFetch(materialsTexture, ivec2(index + 7, 0), 0);
 
+    // Lobes that no material of the scene uses are compiled out (see Renderer::MaterialDefines),
+    // their parameters are constant zero so everything depending on them folds away
     mat.baseColor          = param1.rgb;
+#ifdef OPT_ANISOTROPIC
     mat.anisotropic        = param1.w;
+#else
+    mat.anisotropic        = 0.0;
+#endif
 
     mat.emission           = param2.rgb;
 
     mat.metallic           = param3.x;
     mat.roughness          = max(param3.y, 0.001);
+#ifdef OPT_SUBSURFACE
     mat.subsurface         = param3.z;
+#else
+    mat.subsurface         = 0.0;
+#endif
     mat.specularTint       = param3.w;
 
+#ifdef OPT_SHEEN
     mat.sheen              = param4.x;
     mat.sheenTint          = param4.y;
+#else
+    mat.sheen              = 0.0;
+    mat.sheenTint          = 0.0;
+#endif
+#ifdef OPT_CLEARCOAT
     mat.clearcoat          = param4.z;
     mat.clearcoatRoughness = mix(0.1, 0.001, param4.w); // Remapping from gloss to roughness
+#else
+    mat.clearcoat          = 0.0;
+    mat.clearcoatRoughness = 0.1;
+#endif
 
+#ifdef OPT_SPECTRANS
     mat.specTrans          = param5.x;
+#else
+    mat.specTrans          = 0.0;
+#endif
     mat.ior                = param5.y;
     mat.medium.type        = int(param5.z);
     mat.medium.density     = param5.w;
@@ -43,22 +67,27 @@ void GetMaterial(inout State state, in Ray r)
     mat.alphaCutoff        = param8.z;
 
     // Base Color Map
+#ifdef OPT_BASECOLORMAP
     if (texIDs.x >= 0)
     {
         vec4 col = texture(textureMapsArrayTexture, vec3(state.texCoord, texIDs.x));
         mat.baseColor.rgb *= pow(col.rgb, vec3(2.2));
         mat.opacity *= col.a;
     }
+#endif
 
     // Metallic Roughness Map
+#ifdef OPT_METALLICROUGHNESSMAP
     if (texIDs.y >= 0)
     {
         vec2 matRgh = texture(textureMapsArrayTexture, vec3(state.texCoord, texIDs.y)).bg;
         mat.metallic = matRgh.x;
         mat.roughness = max(matRgh.y * matRgh.y, 0.001);
     }
+#endif
 
     // Normal Map
+#ifdef OPT_NORMALMAP
     if (texIDs.z >= 0)
     {
         vec3 texNormal = texture(textureMapsArrayTexture, vec3(state.texCoord, texIDs.z)).rgb;
@@ -72,11 +101,13 @@ void GetMaterial(inout State state, in Ray r)
         state.normal = normalize(state.tangent * texNormal.x + state.bitangent * texNormal.y + state.normal * texNormal.z);
         state.ffnormal = dot(origNormal, r.direction) <= 0.0 ? state.normal : -state.normal;
     }
-
+#endif
 
     // Emission Map
+#ifdef OPT_EMISSIONMAP
     if (texIDs.w >= 0)
         mat.emission = pow(texture(textureMapsArrayTexture, vec3(state.texCoord, texIDs.w)).rgb, vec3(2.2));
+#endif
 
     float aspect = sqrt(1.0 - mat.anisotropic * 0.9);
     mat.ax = max(0.001, mat.roughness / aspect);
@@ -127,7 +158,7 @@ vec3 EvalTransmittance(Ray r)
 }
 #endif
 
-vec3 DirectLight(in Ray r, in State state, bool isSurface)
+vec3 DirectLight(in Ray r, in State state, bool isSurface, bool resampleLights)
 {
     vec3 Ld = vec3(0.0);
     vec3 Li = vec3(0.0);
@@ -135,13 +166,26 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 
     ScatterSampleRec scatterSample;
 
+    // Uniform selection samples the environment and one analytic light every time.
+    // With power sampling only one of them is sampled and the choice is folded into the light pdf
+    bool sampleEnvMap = true;
+    bool sampleLights = true;
+#ifdef OPT_LIGHT_POWER_SAMPLING
+    sampleEnvMap = rand() < envMapSelectPdf;
+    sampleLights = !sampleEnvMap;
+#endif
+
     // Environment Light
 #ifdef OPT_ENVMAP
+    if (sampleEnvMap)
     {
         vec3 color;
         vec4 dirPdf = SampleEnvMap(Li);
         vec3 lightDir = dirPdf.xyz;
         float lightPdf = dirPdf.w;
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        lightPdf *= envMapSelectPdf;
+#endif
 
         Ray shadowRay = Ray(scatterPos, lightDir);
 
@@ -184,13 +228,30 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 #endif
 
     // Analytic Lights
+#ifdef OPT_RESTIR
+    // Primary hits take the light sample resampled for their pixel. Its estimate is not MIS weighted,
+    // so PathTrace ignores analytic lights hit by the following BSDF sample
+    if (sampleLights && resampleLights)
+    {
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        Ld += ResampledDirectLight(r, state) / (1.0 - envMapSelectPdf);
+#else
+        Ld += ResampledDirectLight(r, state);
+#endif
+        sampleLights = false;
+    }
+#endif
+
 #ifdef OPT_LIGHTS
+    if (sampleLights)
     {
         LightSampleRec lightSample;
         Light light;
 
         //Pick a light to sample
-        int index = int(rand() * float(numOfLights)) * 5;
+        int lightIndex = SampleLightIndex();
+        float lightSelectPdf = LightSelectPdf(lightIndex);
+        int index = lightIndex * 5;
 
         // Fetch light Data
         vec3 position = texelFetch(lightsTexture, ivec2(index + 0, 0), 0).xyz;
@@ -204,7 +265,13 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
 
         light = Light(position, emission, u, v, radius, area, type);
         SampleOneLight(light, scatterPos, lightSample);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        // Selection probability is part of the light pdf so MIS matches the pdf ClosestHit reports for BSDF hits
         Li = lightSample.emission;
+        lightSample.pdf *= lightSelectPdf;
+#else
+        Li = lightSample.emission / lightSelectPdf;
+#endif
 
         if (dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
         {
@@ -252,6 +319,12 @@ vec3 DirectLight(in Ray r, in State state, bool isSurface)
     return Ld;
 }
 
+#ifdef OPT_DENOISER
+// Albedo and normal of the first surface hit, the auxiliary images of the denoiser
+vec3 aovAlbedo;
+vec3 aovNormal;
+#endif
+
 vec4 PathTrace(Ray r)
 {
     vec3 radiance = vec3(0.0);
@@ -268,21 +341,31 @@ vec4 PathTrace(Ray r)
     bool mediumSampled = false;
     bool surfaceScatter = false;
 
+    // For reservoir resampled direct lighting at the primary hit
+    bool primaryHit = true;
+    bool lightsResampled = false;
+
+#ifdef OPT_DENOISER
+    aovAlbedo = vec3(0.0);
+    aovNormal = vec3(0.0);
+#endif
+
     for (state.depth = 0;; state.depth++)
     {
         bool hit = ClosestHit(r, state, lightSample);
 
         if (!hit)
         {
-#if defined(OPT_BACKGROUND) || defined(OPT_TRANSPARENT_BACKGROUND)
-            if (state.depth == 0)
+            if (state.depth == 0 && (enableBackground || transparentBackground))
                 alpha = 0.0;
-#endif
             {
 
 
 #ifdef OPT_ENVMAP
                 vec4 envMapColPdf = EvalEnvMap(r);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+                envMapColPdf.w *= envMapSelectPdf;
+#endif
 
                 float misWeight = 1.0;
 
@@ -324,6 +407,11 @@ vec4 PathTrace(Ray r)
                 misWeight = 1.0f;
 #endif
 
+#ifdef OPT_RESTIR
+            if (lightsResampled)
+                misWeight = 0.0;
+#endif
+
             radiance += misWeight * lightSample.emission * throughput;
 
             break;
@@ -365,7 +453,8 @@ vec4 PathTrace(Ray r)
                     state.fhp = r.origin;
 
                     // Transmittance Evaluation
-                    radiance += DirectLight(r, state, false) * throughput;
+                    radiance += DirectLight(r, state, false, false) * throughput;
+                    lightsResampled = false;
 
                     // Pick a new direction based on the phase function
                     vec3 scatterDir = SampleHG(-r.direction, state.medium.anisotropy, rand(), rand());
@@ -393,8 +482,17 @@ vec4 PathTrace(Ray r)
             {
                 surfaceScatter = true;
 
+#ifdef OPT_DENOISER
+                if (primaryHit)
+                {
+                    aovAlbedo = state.mat.baseColor;
+                    aovNormal = state.ffnormal;
+                }
+#endif
+
                 // Next event estimation
-                radiance += DirectLight(r, state, true) * throughput;
+                radiance += DirectLight(r, state, true, primaryHit) * throughput;
+                lightsResampled = primaryHit;
 
                 // Sample BSDF for color and outgoing direction
                 scatterSample.f = DisneySample(state, -r.direction, state.ffnormal, scatterSample.L, scatterSample.pdf);
@@ -425,9 +523,11 @@ vec4 PathTrace(Ray r)
         }
 #endif
 
+        primaryHit = false;
+
 #ifdef OPT_RR
         // Russian roulette
-        if (state.depth >= OPT_RR_DEPTH)
+        if (state.depth >= rrDepth)
         {
             float q = min(max(throughput.x, max(throughput.y, throughput.z)) + 0.001, 0.95);
             if (rand() > q)
@@ -438,5 +538,11 @@ vec4 PathTrace(Ray r)
 
     }
 
+#ifdef OPT_DENOISER
+    // Background, lights and media seen directly have no surface. Their albedo is the clamped radiance
+    if (aovNormal == vec3(0.0))
+        aovAlbedo = clamp(radiance, 0.0, 1.0);
+#endif
+
     return vec4(radiance, alpha);
 }
\ No newline at end of file
@@ -0,0 +1,259 @@
+// Reservoir-based spatiotemporal importance resampling (ReSTIR) of analytic lights at primary hits
+// https://research.nvidia.com/publication/2020-07_Spatiotemporal-reservoir-resampling-real-time-ray-tracing-dynamic-direct
+//
+// Samples are stored as a point on the light (a direction for distant lights) and resampled
+// with respect to area on the light, so they stay valid when re-evaluated at a neighbouring pixel.
+// The environment map is not part of the reservoirs and keeps using regular NEE with MIS.
+
+#ifdef OPT_RESTIR
+
+// Caps the history carried over from previous samples, relative to the number of fresh candidates
+#define RESTIR_HISTORY_LIMIT 20.0
+#define RESTIR_SPATIAL_RADIUS 30.0
+#define RESTIR_MAX_SPATIAL_SAMPLES 8
+
+struct Reservoir
+{
+    vec3 lightPos;
+    int lightIndex;
+    float wSum;
+    float M;
+    float W;
+};
+
+// Full resolution pixel the reservoir of the current fragment lives at
+ivec2 restirPixel;
+
+#if defined(OPT_MEDIUM)
+vec3 EvalTransmittance(Ray r);
+#endif
+void GetMaterial(inout State state, in Ray r);
+
+Light FetchLight(int lightIndex)
+{
+    int index = lightIndex * 5;
+    vec3 position = texelFetch(lightsTexture, ivec2(index + 0, 0), 0).xyz;
+    vec3 emission = texelFetch(lightsTexture, ivec2(index + 1, 0), 0).xyz;
+    vec3 u        = texelFetch(lightsTexture, ivec2(index + 2, 0), 0).xyz;
+    vec3 v        = texelFetch(lightsTexture, ivec2(index + 3, 0), 0).xyz;
+    vec3 params   = texelFetch(lightsTexture, ivec2(index + 4, 0), 0).xyz;
+    return Light(position, emission, u, v, params.x, params.y, params.z);
+}
+
+// Camera ray seeded only by pixel and sample so every ReSTIR pass and the tile pass agree on the primary hit
+Ray ResampledCameraRay(ivec2 pixelCoord, int sampleIndex)
+{
+    InitRNG(vec2(pixelCoord), 2 * sampleIndex);
+
+    float r1 = 2.0 * rand();
+    float r2 = 2.0 * rand();
+
+    vec2 jitter;
+    jitter.x = r1 < 1.0 ? sqrt(r1) - 1.0 : 1.0 - sqrt(2.0 - r1);
+    jitter.y = r2 < 1.0 ? sqrt(r2) - 1.0 : 1.0 - sqrt(2.0 - r2);
+
+    jitter /= (resolution * 0.5);
+    vec2 d = ((vec2(pixelCoord) + 0.5) / resolution * 2.0 - 1.0) + jitter;
+
+    float scale = tan(camera.fov * 0.5);
+    d.y *= resolution.y / resolution.x * scale;
+    d.x *= scale;
+    vec3 rayDir = normalize(d.x * camera.right + d.y * camera.up + camera.forward);
+
+    vec3 focalPoint = camera.focalDist * rayDir;
+    float cam_r1 = rand() * TWO_PI;
+    float cam_r2 = rand() * camera.aperture;
+    vec3 randomAperturePos = (cos(cam_r1) * camera.right + sin(cam_r1) * camera.up) * sqrt(cam_r2);
+    vec3 finalRayDir = normalize(focalPoint - randomAperturePos);
+
+    return Ray(camera.position + randomAperturePos, finalRayDir);
+}
+
+Ray ResampledCameraRay(ivec2 pixelCoord)
+{
+    return ResampledCameraRay(pixelCoord, sampleNum);
+}
+
+Reservoir EmptyReservoir()
+{
+    return Reservoir(vec3(0.0), -1, 0.0, 0.0, 0.0);
+}
+
+Reservoir LoadReservoir(ivec2 pixelCoord)
+{
+    vec4 lightSample = texelFetch(restirSampleTexture, pixelCoord, 0);
+    vec4 weights = texelFetch(restirWeightTexture, pixelCoord, 0);
+    return Reservoir(lightSample.xyz, int(lightSample.w), weights.x, weights.y, weights.z);
+}
+
+// Unshadowed contribution of a light sample at the shading point, with respect to area on the light
+vec3 LightSampleContribution(in State state, in Ray r, int lightIndex, vec3 lightPos, out vec3 lightDir, out float lightDist)
+{
+    Light light = FetchLight(lightIndex);
+    vec3 scatterPos = state.fhp + state.normal * EPS;
+    float G = 1.0;
+
+    if (int(light.type) == DISTANT_LIGHT)
+    {
+        lightDir = lightPos;
+        lightDist = INF;
+    }
+    else
+    {
+        lightDir = lightPos - scatterPos;
+        lightDist = length(lightDir);
+        lightDir /= lightDist;
+
+        vec3 lightNormal = int(light.type) == QUAD_LIGHT ? normalize(cross(light.u, light.v)) : normalize(lightPos - light.position);
+        float cosTheta = dot(-lightDir, lightNormal);
+
+        // Back side of a single sided quad or the far side of a sphere
+        if (cosTheta <= 0.0)
+            return vec3(0.0);
+
+        G = cosTheta / (lightDist * lightDist);
+    }
+
+    float bsdfPdf;
+    vec3 f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, bsdfPdf);
+    return f * light.emission * G;
+}
+
+float TargetPdf(in State state, in Ray r, int lightIndex, vec3 lightPos)
+{
+    if (lightIndex < 0)
+        return 0.0;
+
+    vec3 lightDir;
+    float lightDist;
+    return Luminance(LightSampleContribution(state, r, lightIndex, lightPos, lightDir, lightDist));
+}
+
+void UpdateReservoir(inout Reservoir res, vec3 lightPos, int lightIndex, float w, float M)
+{
+    res.wSum += w;
+    res.M += M;
+    if (w > 0.0 && rand() * res.wSum < w)
+    {
+        res.lightPos = lightPos;
+        res.lightIndex = lightIndex;
+    }
+}
+
+void CombineReservoir(inout Reservoir res, in Reservoir other, in State state, in Ray r)
+{
+    float targetPdf = TargetPdf(state, r, other.lightIndex, other.lightPos);
+    UpdateReservoir(res, other.lightPos, other.lightIndex, targetPdf * other.W * other.M, other.M);
+}
+
+void FinalizeReservoir(inout Reservoir res, in State state, in Ray r)
+{
+    float targetPdf = TargetPdf(state, r, res.lightIndex, res.lightPos);
+    res.W = targetPdf > 0.0 ? res.wSum / (res.M * targetPdf) : 0.0;
+}
+
+bool LightSampleVisible(in State state, vec3 lightDir, float lightDist)
+{
+    Ray shadowRay = Ray(state.fhp + state.normal * EPS, lightDir);
+#if defined(OPT_MEDIUM)
+    return EvalTransmittance(shadowRay) != vec3(0.0);
+#else
+    return !AnyHit(shadowRay, lightDist - EPS);
+#endif
+}
+
+// True if the primary hit of a pixel in the given sample sees the light sample unoccluded and with a non-zero
+// target pdf, i.e. a reservoir there could hold it. Reused reservoirs only count towards the normalization of
+// the chosen sample when this holds. Traces the hit again and reseeds the RNG
+bool SampleReachesPixel(ivec2 pixelCoord, int sampleIndex, int lightIndex, vec3 lightPos)
+{
+    Ray r = ResampledCameraRay(pixelCoord, sampleIndex);
+
+    State state;
+    LightSampleRec lightSample;
+    if (!ClosestHit(r, state, lightSample) || state.isEmitter)
+        return false;
+
+    GetMaterial(state, r);
+
+    vec3 lightDir;
+    float lightDist;
+    if (Luminance(LightSampleContribution(state, r, lightIndex, lightPos, lightDir, lightDist)) <= 0.0)
+        return false;
+
+    return LightSampleVisible(state, lightDir, lightDist);
+}
+
+// Resampled importance sampling over restirCandidates light samples drawn from the light distribution
+Reservoir SampleLightCandidates(in State state, in Ray r)
+{
+    Reservoir res = EmptyReservoir();
+    vec3 scatterPos = state.fhp + state.normal * EPS;
+
+    for (int i = 0; i < restirCandidates; i++)
+    {
+        int lightIndex = SampleLightIndex();
+        Light light = FetchLight(lightIndex);
+        int type = int(light.type);
+
+        LightSampleRec lightSample;
+        SampleOneLight(light, scatterPos, lightSample);
+
+        // Source pdf in area measure. Sphere lights are only sampled on the hemisphere facing the shading point
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        float sourcePdf = texelFetch(lightDistTexture, ivec2(lightIndex, 0), 0).z;
+#else
+        float sourcePdf = 1.0 / float(numOfLights);
+#endif
+        vec3 lightPos = lightSample.direction;
+        if (type != DISTANT_LIGHT)
+        {
+            lightPos = scatterPos + lightSample.direction * lightSample.dist;
+            sourcePdf /= type == SPHERE_LIGHT ? light.area * 0.5 : light.area;
+        }
+
+        float targetPdf = TargetPdf(state, r, lightIndex, lightPos);
+        UpdateReservoir(res, lightPos, lightIndex, targetPdf / sourcePdf, 1.0);
+    }
+
+    FinalizeReservoir(res, state, r);
+
+    // Occluded samples are not worth sharing with neighbours
+    if (res.W > 0.0)
+    {
+        vec3 lightDir;
+        float lightDist;
+        LightSampleContribution(state, r, res.lightIndex, res.lightPos, lightDir, lightDist);
+        if (!LightSampleVisible(state, lightDir, lightDist))
+            res.W = 0.0;
+    }
+
+    return res;
+}
+
+// Direct lighting from analytic lights at the primary hit using the reservoir resampled for this pixel
+vec3 ResampledDirectLight(in Ray r, in State state)
+{
+    Reservoir res = LoadReservoir(restirPixel);
+
+    if (res.lightIndex < 0 || res.W <= 0.0)
+        return vec3(0.0);
+
+    vec3 lightDir;
+    float lightDist;
+    vec3 Ld = LightSampleContribution(state, r, res.lightIndex, res.lightPos, lightDir, lightDist);
+
+    if (Ld == vec3(0.0))
+        return Ld;
+
+#if defined(OPT_MEDIUM)
+    Ld *= EvalTransmittance(Ray(state.fhp + state.normal * EPS, lightDir));
+#else
+    if (!LightSampleVisible(state, lightDir, lightDist))
+        return vec3(0.0);
+#endif
+
+    return Ld * res.W;
+}
+
+#endif
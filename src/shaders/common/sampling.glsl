@@ -183,7 +183,7 @@ void SampleSphereLight(in Light light, in vec3 scatterPos, inout LightSampleRec
 
     lightSample.direction /= lightSample.dist;
     lightSample.normal = normalize(lightSurfacePos - light.position);
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.pdf = distSq / (light.area * 0.5 * abs(dot(lightSample.normal, lightSample.direction)));
 }
 
@@ -198,7 +198,7 @@ void SampleRectLight(in Light light, in vec3 scatterPos, inout LightSampleRec li
     float distSq = lightSample.dist * lightSample.dist;
     lightSample.direction /= lightSample.dist;
     lightSample.normal = normalize(cross(light.u, light.v));
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.pdf = distSq / (light.area * abs(dot(lightSample.normal, lightSample.direction)));
 }
 
@@ -206,11 +206,34 @@ void SampleDistantLight(in Light light, in vec3 scatterPos, inout LightSampleRec
 {
     lightSample.direction = normalize(light.position - vec3(0.0));
     lightSample.normal = normalize(scatterPos - light.position);
-    lightSample.emission = light.emission * float(numOfLights);
+    lightSample.emission = light.emission;
     lightSample.dist = INF;
     lightSample.pdf = 1.0;
 }
 
+// Probability of picking a given analytic light for next event estimation
+float LightSelectPdf(int lightIndex)
+{
+#ifdef OPT_LIGHT_POWER_SAMPLING
+    return texelFetch(lightDistTexture, ivec2(lightIndex, 0), 0).z * (1.0 - envMapSelectPdf);
+#else
+    return 1.0 / float(numOfLights);
+#endif
+}
+
+int SampleLightIndex()
+{
+#ifdef OPT_LIGHT_POWER_SAMPLING
+    // Alias table lookup: pick a bin uniformly, then keep it or jump to its alias
+    float u = rand() * float(numOfLights);
+    int index = min(int(u), numOfLights - 1);
+    vec2 thresholdAlias = texelFetch(lightDistTexture, ivec2(index, 0), 0).xy;
+    return fract(u) < thresholdAlias.x ? index : int(thresholdAlias.y);
+#else
+    return int(rand() * float(numOfLights));
+#endif
+}
+
 void SampleOneLight(in Light light, in vec3 scatterPos, inout LightSampleRec lightSample)
 {
     int type = int(light.type);
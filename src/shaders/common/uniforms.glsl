@@ -1,8 +1,7 @@
+// Scene and camera parameters and render options shared by all programs are in the RenderParams block (globals.glsl)
 uniform bool isCameraMoving;
 uniform vec3 randomVector;
-uniform vec2 resolution;
 uniform vec2 tileOffset;
-uniform vec2 invNumTiles;
 
 uniform sampler2D accumTexture;
 uniform samplerBuffer BVHTexture;
@@ -12,16 +11,17 @@ uniform samplerBuffer normalsTexture;
 uniform sampler2D materialsTexture;
 uniform sampler2D transformsTexture;
 uniform sampler2D lightsTexture;
+uniform sampler2D lightDistTexture;
 uniform sampler2DArray textureMapsArrayTexture;
+uniform sampler2D restirSampleTexture;
+uniform sampler2D restirWeightTexture;
+uniform sampler2D restirGBufferTexture;
+uniform sampler2D convergenceTexture;
 
 uniform sampler2D envMapTexture;
 uniform sampler2D envMapCDFTexture;
 
-uniform vec2 envMapRes;
-uniform float envMapTotalSum;
-uniform float envMapIntensity;
-uniform float envMapRot;
-uniform int numOfLights;
-uniform int maxDepth;
-uniform int topBVHIndex;
-uniform int frameNum;
\ No newline at end of file
+uniform int frameNum;
+uniform int samplesPerPass;
+uniform int sampleNum;
+uniform bool restirTemporal;
\ No newline at end of file
@@ -0,0 +1,101 @@
+// Buffers of the wavefront path tracer (Renderer::RenderTileWavefront). Instead of tracing every path to the end in
+// one invocation, paths are kept in buffers and advanced a bounce at a time by separate kernels: extend (closest hit),
+// shade (one kernel per material class) and shadow (next event estimation visibility). Each kernel only runs over
+// the paths queued for it, so invocations of a group do the same work
+
+#define WAVEFRONT_GROUP_SIZE 64
+
+// Material classes of the shade kernels. Transmissive materials are shaded by a variant with the glass lobe
+#define WAVEFRONT_OPAQUE 0
+#define WAVEFRONT_TRANSMISSIVE 1
+
+// Coherence binning of secondary rays (wavefront_sort.glsl). Keys are the direction octant and the cell of the origin
+// in a WAVEFRONT_GRID^3 grid over the scene bounds
+#define WAVEFRONT_GRID 4
+#define WAVEFRONT_KEYS (WAVEFRONT_GRID * WAVEFRONT_GRID * WAVEFRONT_GRID * 8)
+
+// Bounces with statistics, deeper ones are not counted
+#define WAVEFRONT_STAT_BOUNCES 16
+
+struct WavefrontPath
+{
+    vec4 origin;     // w: pdf of the BSDF sample that made the ray, for MIS with the light it hits
+    vec4 direction;  // w: alpha
+    vec4 throughput;
+    vec4 radiance;
+    uvec4 seed;      // RNG state
+    ivec4 pixel;     // xy: pixel, z: depth, w: number of queued shadow rays
+};
+
+// Surface hit of the extend kernel, everything the shade kernels need to rebuild State
+struct WavefrontHit
+{
+    vec4 normal;     // w: hit distance
+    vec4 tangent;    // w: texture coordinate u
+    vec4 bitangent;  // w: texture coordinate v
+    ivec4 matID;
+};
+
+struct WavefrontShadowRay
+{
+    vec4 origin;     // w: distance to the light
+    vec4 direction;
+    vec4 contribution;
+};
+
+// Queue lengths and the indirect dispatch arguments computed from them (wavefront_dispatch.glsl)
+layout(std430, binding = 0) buffer WavefrontCounters
+{
+    uint rayCount;
+    uint nextRayCount;
+    uint hitCount[2];
+    uint shadowCount;
+    uint counterPad[3];
+    uvec4 extendArgs;
+    uvec4 shadeArgs[2];
+    uvec4 shadowArgs;
+
+    // Rays extended per bounce and how often the key changes between consecutive ones, only counted with collectStats
+    uint bounceRays[WAVEFRONT_STAT_BOUNCES];
+    uint bounceKeyChanges[WAVEFRONT_STAT_BOUNCES];
+};
+
+layout(std430, binding = 1) buffer WavefrontPaths { WavefrontPath paths[]; };
+layout(std430, binding = 2) buffer WavefrontHits { WavefrontHit hits[]; };
+
+// Two shadow rays per path (environment map and analytic light), see WavefrontPath.pixel.w
+layout(std430, binding = 3) buffer WavefrontShadowRays { WavefrontShadowRay shadowRays[]; };
+
+// Path indices. Rays to extend this bounce and the next, ping-ponged by the renderer, surface hits of either
+// material class (transmissive ones start at pathCapacity) and paths with shadow rays
+layout(std430, binding = 4) buffer WavefrontRayQueue { uint rayQueue[]; };
+layout(std430, binding = 5) buffer WavefrontNextRayQueue { uint nextRayQueue[]; };
+layout(std430, binding = 6) buffer WavefrontHitQueue { uint hitQueue[]; };
+layout(std430, binding = 7) buffer WavefrontShadowQueue { uint shadowQueue[]; };
+
+// Key of every queued ray and the rays per key (then their offsets in the sorted queue) while sorting
+layout(std430, binding = 8) buffer WavefrontRayKeys { uint rayKeys[]; };
+layout(std430, binding = 9) buffer WavefrontKeyBins { uint keyBins[]; };
+
+uniform int pathCapacity;
+uniform int bounce;
+uniform bool collectStats;
+
+Ray PathRay(WavefrontPath path)
+{
+    return Ray(path.origin.xyz, path.direction.xyz);
+}
+
+// Rays with the same key start close to each other in the same direction, so they mostly visit the same BVH nodes
+uint RayKey(WavefrontPath path, vec3 sceneMin, vec3 sceneMax)
+{
+    vec3 cellCoords = (path.origin.xyz - sceneMin) / max(sceneMax - sceneMin, vec3(1e-6)) * float(WAVEFRONT_GRID);
+    uvec3 cell = uvec3(clamp(cellCoords, vec3(0.0), vec3(WAVEFRONT_GRID - 1)));
+    uint octant = (path.direction.x < 0.0 ? 1u : 0u) | (path.direction.y < 0.0 ? 2u : 0u) | (path.direction.z < 0.0 ? 4u : 0u);
+    return ((cell.z * uint(WAVEFRONT_GRID) + cell.y) * uint(WAVEFRONT_GRID) + cell.x) * 8u + octant;
+}
+
+void QueueRay(uint pathIndex)
+{
+    nextRayQueue[atomicAdd(nextRayCount, 1u)] = pathIndex;
+}
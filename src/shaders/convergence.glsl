@@ -0,0 +1,26 @@
+#version 330
+
+out vec4 outCol;
+in vec2 TexCoords;
+
+uniform sampler2D momentTexture;
+uniform float adaptiveThreshold;
+uniform int adaptiveMinSpp;
+
+// Pixels whose mean is dimmer than this are judged against it, so noise in near black regions does not keep them rendering
+#define MIN_RELATIVE_LUMINANCE 0.01
+
+// Flags a pixel as converged once the standard error of its mean luminance, relative to the mean,
+// drops below adaptiveThreshold. Moments are accumulated by the tile shader (sum, sum of squares, count)
+void main()
+{
+    vec4 moments = texelFetch(momentTexture, ivec2(gl_FragCoord.xy), 0);
+    float n = max(moments.z, 1.0);
+
+    float mean = moments.x / n;
+    float variance = max(moments.y / n - mean * mean, 0.0) * n / max(n - 1.0, 1.0);
+    float relativeError = sqrt(variance / n) / max(mean, MIN_RELATIVE_LUMINANCE);
+
+    bool converged = moments.z >= float(adaptiveMinSpp) && relativeError < adaptiveThreshold;
+    outCol = vec4(converged ? 1.0 : 0.0);
+}
@@ -0,0 +1,30 @@
+#version 330
+
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 albedo;
+layout(location = 2) out vec4 normal;
+in vec2 TexCoords;
+
+uniform sampler2D accumTexture;
+uniform sampler2D albedoTexture;
+uniform sampler2D normalTexture;
+uniform float invSampleCounter;
+
+#ifdef OPT_ADAPTIVE
+uniform sampler2D momentTexture;
+#endif
+
+// Averages the accumulated HDR color and first hit albedo and normal into the denoiser inputs.
+// Unlike the tonemap pass, color is left linear so the denoiser works on radiance
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float invSamples = invSampleCounter;
+#ifdef OPT_ADAPTIVE
+    invSamples = 1.0 / max(texelFetch(momentTexture, pixel, 0).z, 1.0);
+#endif
+
+    color = vec4(texelFetch(accumTexture, pixel, 0).rgb * invSamples, 1.0);
+    albedo = vec4(texelFetch(albedoTexture, pixel, 0).rgb * invSamples, 1.0);
+    normal = vec4(texelFetch(normalTexture, pixel, 0).xyz * invSamples, 1.0);
+}
@@ -5,6 +5,10 @@ in vec2 TexCoords;
 
 #include common/uniforms.glsl
 #include common/globals.glsl
+
+// The preview traces fewer bounces while the camera or scene is changing
+#define maxDepth previewMaxDepth
+
 #include common/intersection.glsl
 #include common/sampling.glsl
 #include common/envmap.glsl
@@ -16,7 +20,7 @@ in vec2 TexCoords;
 
 void main(void)
 {
-    InitRNG(gl_FragCoord.xy, 1);
+    InitRNG(gl_FragCoord.xy, frameNum);
 
     float r1 = 2.0 * rand();
     float r2 = 2.0 * rand();
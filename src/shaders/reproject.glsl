@@ -0,0 +1,137 @@
+#version 330
+
+layout(location = 0) out vec4 history;
+layout(location = 1) out vec4 position;
+in vec2 TexCoords;
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/closest_hit.glsl
+
+// History of the previous frame. HDR color and first hit positions, or directions where the camera ray missed.
+// The w of the latter is the number of samples in the history, negated for misses
+uniform sampler2D historyTexture;
+uniform sampler2D historyPositionTexture;
+uniform bool historyValid;
+uniform float maxHistoryLength;
+
+// Noisy preview of this frame, rendered into the bottom left previewScale part of previewTexture
+uniform sampler2D previewTexture;
+uniform vec2 previewScale;
+
+// Seeding takes the accumulated image instead, so history starts out as converged as the image before the move.
+// Pixels whose tile was already drawn in the pass in progress have samplesPerPass more samples than completedSamples
+uniform bool seedHistory;
+uniform int completedSamples;
+uniform ivec2 currentTile;
+uniform ivec2 tileSize;
+
+#ifdef OPT_ADAPTIVE
+uniform sampler2D momentTexture;
+#endif
+
+// Camera the history was rendered with
+uniform vec3 historyCameraPosition;
+uniform vec3 historyCameraRight;
+uniform vec3 historyCameraUp;
+uniform vec3 historyCameraForward;
+uniform float historyCameraFov;
+
+// First hits further apart than this, relative to their distance from the camera, are treated as disocclusions
+#define POSITION_TOLERANCE 0.02
+
+// Camera ray through the center of a pixel, without jitter or depth of field so first hits are stable
+Ray CenterCameraRay(vec2 uv)
+{
+    vec2 d = uv * 2.0 - 1.0;
+    float scale = tan(camera.fov * 0.5);
+    d.y *= resolution.y / resolution.x * scale;
+    d.x *= scale;
+    return Ray(camera.position, normalize(d.x * camera.right + d.y * camera.up + camera.forward));
+}
+
+// Inverse of CenterCameraRay for the history camera. Returns coordinates outside [0, 1] if dir is not in its view
+vec2 HistoryCoords(vec3 dir)
+{
+    float z = dot(dir, historyCameraForward);
+    if (z <= 0.0)
+        return vec2(-1.0);
+
+    float scale = tan(historyCameraFov * 0.5);
+    vec2 d = vec2(dot(dir, historyCameraRight), dot(dir, historyCameraUp)) / z;
+    d.x /= scale;
+    d.y /= resolution.y / resolution.x * scale;
+    return d * 0.5 + 0.5;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    Ray r = CenterCameraRay(TexCoords);
+    State state;
+    LightSampleRec lightSample;
+    bool hit = ClosestHit(r, state, lightSample);
+    vec3 firstHit = hit ? state.fhp : r.direction;
+
+    if (seedHistory)
+    {
+        ivec2 tileIndex = pixel / tileSize;
+        bool tileDrawn = tileIndex.y > currentTile.y || (tileIndex.y == currentTile.y && tileIndex.x <= currentTile.x);
+        float n = float(completedSamples + (tileDrawn ? samplesPerPass : 0));
+#ifdef OPT_ADAPTIVE
+        n = texelFetch(momentTexture, pixel, 0).z;
+#endif
+        history = texelFetch(accumTexture, pixel, 0) / max(n, 1.0);
+        position = vec4(firstHit, hit ? min(n, maxHistoryLength) : -min(n, maxHistoryLength));
+        return;
+    }
+
+    // Motion vector from the first hit, or the direction for the background
+    vec2 historyCoords = HistoryCoords(hit ? state.fhp - historyCameraPosition : r.direction);
+    vec4 previous = vec4(0.0);
+    float previousLength = 0.0;
+
+    if (historyValid && all(greaterThanEqual(historyCoords, vec2(0.0))) && all(lessThan(historyCoords, vec2(1.0))))
+    {
+        ivec2 historyPixel = ivec2(historyCoords * resolution);
+        vec4 historyPosition = texelFetch(historyPositionTexture, historyPixel, 0);
+
+        // Reject history that saw a different surface, or background where there is geometry now
+        bool sameSurface = hit ? historyPosition.w > 0.0 && distance(historyPosition.xyz, state.fhp) < POSITION_TOLERANCE * state.hitDist
+                               : historyPosition.w < 0.0;
+        if (sameSurface)
+        {
+            previous = texelFetch(historyTexture, historyPixel, 0);
+            previousLength = abs(historyPosition.w);
+        }
+    }
+
+    // The new sample and the color range of its neighbourhood in the preview
+    ivec2 previewSize = max(ivec2(vec2(textureSize(previewTexture, 0)) * previewScale), ivec2(1));
+    ivec2 previewPixel = min(ivec2(TexCoords * vec2(previewSize)), previewSize - 1);
+    vec4 current = texelFetch(previewTexture, previewPixel, 0);
+
+    vec3 minCol = current.rgb;
+    vec3 maxCol = current.rgb;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            vec3 col = texelFetch(previewTexture, clamp(previewPixel + ivec2(x, y), ivec2(0), previewSize - 1), 0).rgb;
+            minCol = min(minCol, col);
+            maxCol = max(maxCol, col);
+        }
+    }
+
+    // Clamp history into the range, widened by its extent since a single sample per pixel is very noisy,
+    // so lighting that changed with the view does not linger
+    vec3 extent = (maxCol - minCol) * 0.5;
+    vec4 clamped = vec4(clamp(previous.rgb, minCol - extent, maxCol + extent), previous.a);
+
+    float n = min(previousLength + 1.0, maxHistoryLength);
+    history = mix(clamped, current, 1.0 / n);
+    position = vec4(firstHit, hit ? n : -n);
+}
@@ -0,0 +1,77 @@
+#version 330
+
+layout(location = 0) out vec4 reservoirSample;
+layout(location = 1) out vec4 reservoirWeight;
+layout(location = 2) out vec4 gBuffer;
+in vec2 TexCoords;
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/envmap.glsl
+#include common/anyhit.glsl
+#include common/closest_hit.glsl
+#include common/disney.glsl
+#include common/lambert.glsl
+#include common/restir.glsl
+#include common/pathtrace.glsl
+
+// Generates light candidates for the primary hit of every pixel and merges them with the
+// reservoir of the previous sample (bound as restirSampleTexture/restirWeightTexture)
+void main(void)
+{
+    restirPixel = ivec2(gl_FragCoord.xy);
+    Ray r = ResampledCameraRay(restirPixel);
+
+    State state;
+    LightSampleRec lightSample;
+    Reservoir res = EmptyReservoir();
+    gBuffer = vec4(0.0, 0.0, 0.0, -1.0);
+
+    if (ClosestHit(r, state, lightSample) && !state.isEmitter)
+    {
+        GetMaterial(state, r);
+
+        res = SampleLightCandidates(state, r);
+
+        // Temporal reuse. Reservoirs are only kept while the camera is still, so the previous
+        // sample saw (almost) the same surface through this pixel. Its ray was jittered differently
+        // though, so as in the spatial pass its M only counts if its primary hit could have produced
+        // the chosen sample, which is shadow tested again here
+        if (restirTemporal)
+        {
+            Reservoir prev = LoadReservoir(restirPixel);
+            prev.M = min(prev.M, RESTIR_HISTORY_LIMIT * float(restirCandidates));
+
+            Reservoir combined = EmptyReservoir();
+            CombineReservoir(combined, res, state, r);
+            CombineReservoir(combined, prev, state, r);
+
+            combined.W = 0.0;
+            float targetPdf = TargetPdf(state, r, combined.lightIndex, combined.lightPos);
+            if (targetPdf > 0.0)
+            {
+                vec3 lightDir;
+                float lightDist;
+                LightSampleContribution(state, r, combined.lightIndex, combined.lightPos, lightDir, lightDist);
+
+                if (LightSampleVisible(state, lightDir, lightDist))
+                {
+                    float Z = res.M;
+                    if (SampleReachesPixel(restirPixel, sampleNum - 1, combined.lightIndex, combined.lightPos))
+                        Z += prev.M;
+
+                    combined.W = combined.wSum / (Z * targetPdf);
+                }
+            }
+
+            res = combined;
+        }
+
+        gBuffer = vec4(state.ffnormal, state.hitDist);
+    }
+
+    reservoirSample = vec4(res.lightPos, float(res.lightIndex));
+    reservoirWeight = vec4(res.wSum, res.M, res.W, 0.0);
+}
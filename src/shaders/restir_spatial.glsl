@@ -0,0 +1,95 @@
+#version 330
+
+layout(location = 0) out vec4 reservoirSample;
+layout(location = 1) out vec4 reservoirWeight;
+in vec2 TexCoords;
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/envmap.glsl
+#include common/anyhit.glsl
+#include common/closest_hit.glsl
+#include common/disney.glsl
+#include common/lambert.glsl
+#include common/restir.glsl
+#include common/pathtrace.glsl
+
+// Merges the reservoir of each pixel with restirSpatialSamples random neighbours that see a similar surface.
+// The chosen sample is shadow tested from this pixel, and the normalization only counts the samples (M) of
+// reservoirs whose primary hit could have produced it (SampleReachesPixel). Otherwise neighbours across a
+// shadow boundary add samples that can never land here and darken the estimate. This costs a primary ray
+// and a shadow ray per neighbour on top of the shadow ray for the chosen sample
+void main(void)
+{
+    restirPixel = ivec2(gl_FragCoord.xy);
+    Ray r = ResampledCameraRay(restirPixel);
+
+    Reservoir res = LoadReservoir(restirPixel);
+    vec4 center = texelFetch(restirGBufferTexture, restirPixel, 0);
+
+    State state;
+    LightSampleRec lightSample;
+
+    if (center.w > 0.0 && ClosestHit(r, state, lightSample) && !state.isEmitter)
+    {
+        GetMaterial(state, r);
+        InitRNG(vec2(restirPixel), 2 * sampleNum + 1);
+
+        Reservoir combined = EmptyReservoir();
+        CombineReservoir(combined, res, state, r);
+
+        ivec2 neighbourPixels[RESTIR_MAX_SPATIAL_SAMPLES];
+        float neighbourM[RESTIR_MAX_SPATIAL_SAMPLES];
+        int numNeighbours = 0;
+
+        ivec2 maxPixel = ivec2(resolution) - 1;
+        for (int i = 0; i < min(restirSpatialSamples, RESTIR_MAX_SPATIAL_SAMPLES); i++)
+        {
+            vec2 offset = (vec2(rand(), rand()) * 2.0 - 1.0) * RESTIR_SPATIAL_RADIUS;
+            ivec2 neighbourPixel = clamp(restirPixel + ivec2(offset), ivec2(0), maxPixel);
+            if (neighbourPixel == restirPixel)
+                continue;
+
+            // Skip neighbours whose geometry differs too much from this pixel
+            vec4 neighbour = texelFetch(restirGBufferTexture, neighbourPixel, 0);
+            if (neighbour.w <= 0.0 || dot(neighbour.xyz, center.xyz) < 0.9 || abs(neighbour.w - center.w) > 0.1 * center.w)
+                continue;
+
+            Reservoir neighbourRes = LoadReservoir(neighbourPixel);
+            CombineReservoir(combined, neighbourRes, state, r);
+
+            neighbourPixels[numNeighbours] = neighbourPixel;
+            neighbourM[numNeighbours] = neighbourRes.M;
+            numNeighbours++;
+        }
+
+        combined.W = 0.0;
+        float targetPdf = TargetPdf(state, r, combined.lightIndex, combined.lightPos);
+        if (targetPdf > 0.0)
+        {
+            vec3 lightDir;
+            float lightDist;
+            LightSampleContribution(state, r, combined.lightIndex, combined.lightPos, lightDir, lightDist);
+
+            if (LightSampleVisible(state, lightDir, lightDist))
+            {
+                float Z = res.M;
+                for (int i = 0; i < numNeighbours; i++)
+                {
+                    if (SampleReachesPixel(neighbourPixels[i], sampleNum, combined.lightIndex, combined.lightPos))
+                        Z += neighbourM[i];
+                }
+
+                if (Z > 0.0)
+                    combined.W = combined.wSum / (Z * targetPdf);
+            }
+        }
+
+        res = combined;
+    }
+
+    reservoirSample = vec4(res.lightPos, float(res.lightIndex));
+    reservoirWeight = vec4(res.wSum, res.M, res.W, 0.0);
+}
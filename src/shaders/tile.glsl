@@ -1,6 +1,13 @@
 #version 330
 
-out vec4 color;
+layout(location = 0) out vec4 color;
+#ifdef OPT_ADAPTIVE
+layout(location = 1) out vec4 moment;
+#endif
+#ifdef OPT_DENOISER
+layout(location = 2) out vec4 albedo;
+layout(location = 3) out vec4 normal;
+#endif
 in vec2 TexCoords;
 
 #include common/uniforms.glsl
@@ -12,40 +19,93 @@ in vec2 TexCoords;
 #include common/closest_hit.glsl
 #include common/disney.glsl
 #include common/lambert.glsl
+#include common/restir.glsl
 #include common/pathtrace.glsl
 
 void main(void)
 {
     vec2 coordsTile = mix(tileOffset, tileOffset + invNumTiles, TexCoords);
 
-    InitRNG(gl_FragCoord.xy, frameNum);
+#ifdef OPT_ADAPTIVE
+    // Pixels flagged as converged after the previous pass keep their accumulated samples
+    if (texelFetch(convergenceTexture, ivec2(gl_FragCoord.xy), 0).r > 0.5)
+        discard;
 
-    float r1 = 2.0 * rand();
-    float r2 = 2.0 * rand();
+    vec2 lumMoments = vec2(0.0);
+#endif
 
-    vec2 jitter;
-    jitter.x = r1 < 1.0 ? sqrt(r1) - 1.0 : 1.0 - sqrt(2.0 - r1);
-    jitter.y = r2 < 1.0 ? sqrt(r2) - 1.0 : 1.0 - sqrt(2.0 - r2);
+#ifdef OPT_DENOISER
+    vec3 albedoSum = vec3(0.0);
+    vec3 normalSum = vec3(0.0);
+#endif
 
-    jitter /= (resolution * 0.5);
-    vec2 d = (coordsTile * 2.0 - 1.0) + jitter;
+    vec4 pixelColor = vec4(0.0);
 
-    float scale = tan(camera.fov * 0.5);
-    d.y *= resolution.y / resolution.x * scale;
-    d.x *= scale;
-    vec3 rayDir = normalize(d.x * camera.right + d.y * camera.up + camera.forward);
+    // Decorrelated samples per draw. Each one is seeded with its own frame number from the range reserved for this tile.
+    // A single sample is traced without the loop, drivers may keep it around PathTrace() even for one iteration
+#ifdef OPT_SINGLE_SAMPLE
+    const int i = 0;
+#else
+    for (int i = 0; i < samplesPerPass; i++)
+#endif
+    {
+#ifdef OPT_RESTIR
+        // The camera ray has to match the one the reservoirs were resampled for
+        restirPixel = ivec2(coordsTile * resolution);
+        Ray ray = ResampledCameraRay(restirPixel);
+        InitRNG(gl_FragCoord.xy, frameNum + i);
+#else
+        InitRNG(gl_FragCoord.xy, frameNum + i);
 
-    vec3 focalPoint = camera.focalDist * rayDir;
-    float cam_r1 = rand() * TWO_PI;
-    float cam_r2 = rand() * camera.aperture;
-    vec3 randomAperturePos = (cos(cam_r1) * camera.right + sin(cam_r1) * camera.up) * sqrt(cam_r2);
-    vec3 finalRayDir = normalize(focalPoint - randomAperturePos);
+        float r1 = 2.0 * rand();
+        float r2 = 2.0 * rand();
 
-    Ray ray = Ray(camera.position + randomAperturePos, finalRayDir);
+        vec2 jitter;
+        jitter.x = r1 < 1.0 ? sqrt(r1) - 1.0 : 1.0 - sqrt(2.0 - r1);
+        jitter.y = r2 < 1.0 ? sqrt(r2) - 1.0 : 1.0 - sqrt(2.0 - r2);
 
-    vec4 accumColor = texture(accumTexture, coordsTile);
+        jitter /= (resolution * 0.5);
+        vec2 d = (coordsTile * 2.0 - 1.0) + jitter;
 
-    vec4 pixelColor = PathTrace(ray);
+        float scale = tan(camera.fov * 0.5);
+        d.y *= resolution.y / resolution.x * scale;
+        d.x *= scale;
+        vec3 rayDir = normalize(d.x * camera.right + d.y * camera.up + camera.forward);
 
-    color = pixelColor + accumColor;
+        vec3 focalPoint = camera.focalDist * rayDir;
+        float cam_r1 = rand() * TWO_PI;
+        float cam_r2 = rand() * camera.aperture;
+        vec3 randomAperturePos = (cos(cam_r1) * camera.right + sin(cam_r1) * camera.up) * sqrt(cam_r2);
+        vec3 finalRayDir = normalize(focalPoint - randomAperturePos);
+
+        Ray ray = Ray(camera.position + randomAperturePos, finalRayDir);
+#endif
+
+        vec4 sampleColor = PathTrace(ray);
+        pixelColor += sampleColor;
+
+#ifdef OPT_ADAPTIVE
+        float lum = Luminance(sampleColor.rgb);
+        lumMoments += vec2(lum, lum * lum);
+#endif
+
+#ifdef OPT_DENOISER
+        albedoSum += aovAlbedo;
+        normalSum += aovNormal;
+#endif
+    }
+
+    // Added to accumTexture by additive blending
+    color = pixelColor;
+
+#ifdef OPT_ADAPTIVE
+    // Luminance moments and sample count, added to momentTexture the same way
+    moment = vec4(lumMoments, float(samplesPerPass), 0.0);
+#endif
+
+#ifdef OPT_DENOISER
+    // First hit albedo and normal for the denoiser, added to albedoTexture and normalTexture the same way
+    albedo = vec4(albedoSum, 0.0);
+    normal = vec4(normalSum, 0.0);
+#endif
 }
\ No newline at end of file
@@ -3,12 +3,18 @@
 out vec4 outCol;
 in vec2 TexCoords;
 
+// Tonemapping and background options are in the RenderParams block (globals.glsl)
 uniform sampler2D pathTraceTexture;
 uniform float invSampleCounter;
-uniform bool enableTonemap;
-uniform bool enableAces;
-uniform bool simpleAcesFit;
-uniform vec3 backgroundCol;
+
+// The preview only covers part of its texture when its resolution is scaled down
+uniform vec2 texCoordScale = vec2(1.0);
+
+#ifdef OPT_ADAPTIVE
+// Converged pixels stop accumulating, so the tile output is divided by each pixel's own sample count
+uniform sampler2D momentTexture;
+uniform bool pixelSampleCounts;
+#endif
 
 #include common/globals.glsl
 
@@ -72,7 +78,11 @@ vec3 Tonemap(in vec3 c, float limit)
 
 void main()
 {
-    vec4 col = texture(pathTraceTexture, TexCoords) * invSampleCounter;
+    vec4 col = texture(pathTraceTexture, TexCoords * texCoordScale) * invSampleCounter;
+#ifdef OPT_ADAPTIVE
+    if (pixelSampleCounts)
+        col = texture(pathTraceTexture, TexCoords) / max(texelFetch(momentTexture, ivec2(gl_FragCoord.xy), 0).z, 1.0);
+#endif
     vec3 color = col.rgb;
     float alpha = col.a;
 
@@ -94,16 +104,16 @@ void main()
     float outAlpha = 1.0;
     vec3 bgCol = backgroundCol;
 
-#ifdef OPT_TRANSPARENT_BACKGROUND
-    outAlpha = alpha;
-    float checkerSize = 10.0;
-    float res = max(sign(mod(floor(gl_FragCoord.x / checkerSize) + floor(gl_FragCoord.y / checkerSize), 2.0)), 0.0);
-    bgCol = mix(vec3(0.1), vec3(0.2), res);
-#endif
+    if (transparentBackground)
+    {
+        outAlpha = alpha;
+        float checkerSize = 10.0;
+        float res = max(sign(mod(floor(gl_FragCoord.x / checkerSize) + floor(gl_FragCoord.y / checkerSize), 2.0)), 0.0);
+        bgCol = mix(vec3(0.1), vec3(0.2), res);
+    }
 
-#if defined(OPT_BACKGROUND) || defined(OPT_TRANSPARENT_BACKGROUND)
-    outCol = vec4(mix(bgCol, color, alpha), outAlpha);
-#else
-    outCol = vec4(color, 1.0);
-#endif
+    if (enableBackground || transparentBackground)
+        outCol = vec4(mix(bgCol, color, alpha), outAlpha);
+    else
+        outCol = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 430
+
+#include common/globals.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// accumTexture, which the tile shader adds to by blending
+layout(rgba32f, binding = 0) uniform image2D accumImage;
+
+uniform ivec2 tileSize;
+uniform int numSamples;
+
+// Adds the finished paths of every sample of the pass to their pixel
+void main(void)
+{
+    int pixelIndex = int(gl_GlobalInvocationID.x);
+    int tilePixels = tileSize.x * tileSize.y;
+    if (pixelIndex >= tilePixels)
+        return;
+
+    vec4 color = vec4(0.0);
+    for (int i = 0; i < numSamples; i++)
+    {
+        WavefrontPath path = paths[i * tilePixels + pixelIndex];
+        color += vec4(path.radiance.rgb, path.direction.w);
+    }
+
+    ivec2 pixelCoords = paths[pixelIndex].pixel.xy;
+    imageStore(accumImage, pixelCoords, imageLoad(accumImage, pixelCoords) + color);
+}
@@ -0,0 +1,43 @@
+#version 430
+
+#include common/globals.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = 1) in;
+
+// Bounce stage the next dispatch is for
+#define DISPATCH_EXTEND 0
+#define DISPATCH_SHADE 1
+#define DISPATCH_SHADOW 2
+
+uniform int stage;
+
+uint NumGroups(uint count)
+{
+    return (count + uint(WAVEFRONT_GROUP_SIZE) - 1u) / uint(WAVEFRONT_GROUP_SIZE);
+}
+
+// Turns queue lengths into indirect dispatch arguments, so the CPU never reads them back
+void main()
+{
+    if (stage == DISPATCH_EXTEND)
+    {
+        // Rays queued by the previous bounce (or the generate kernel) are extended, the queues they feed start empty
+        rayCount = nextRayCount;
+        nextRayCount = 0u;
+        hitCount[WAVEFRONT_OPAQUE] = 0u;
+        hitCount[WAVEFRONT_TRANSMISSIVE] = 0u;
+        shadowCount = 0u;
+        extendArgs = uvec4(NumGroups(rayCount), 1u, 1u, 0u);
+
+        if (collectStats && bounce < WAVEFRONT_STAT_BOUNCES)
+            bounceRays[bounce] += rayCount;
+    }
+    else if (stage == DISPATCH_SHADE)
+    {
+        shadeArgs[WAVEFRONT_OPAQUE] = uvec4(NumGroups(hitCount[WAVEFRONT_OPAQUE]), 1u, 1u, 0u);
+        shadeArgs[WAVEFRONT_TRANSMISSIVE] = uvec4(NumGroups(hitCount[WAVEFRONT_TRANSMISSIVE]), 1u, 1u, 0u);
+    }
+    else
+        shadowArgs = uvec4(NumGroups(shadowCount), 1u, 1u, 0u);
+}
@@ -0,0 +1,87 @@
+#version 430
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/envmap.glsl
+#include common/closest_hit.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// Finds the closest hit of every queued ray. Misses and lights are shaded right away since they end the path,
+// surface hits are queued for the shade kernel of their material class
+void main(void)
+{
+    uint queueIndex = gl_GlobalInvocationID.x;
+    if (queueIndex >= rayCount)
+        return;
+
+    uint pathIndex = rayQueue[queueIndex];
+    WavefrontPath path = paths[pathIndex];
+    Ray r = PathRay(path);
+    int depth = path.pixel.z;
+
+    // Coherence of the queue as it is traversed. Keys change rarely once the rays are sorted
+    if (collectStats && bounce < WAVEFRONT_STAT_BOUNCES && queueIndex > 0u)
+    {
+        vec3 sceneMin = texelFetch(BVHTexture, topBVHIndex * 3 + 0).xyz;
+        vec3 sceneMax = texelFetch(BVHTexture, topBVHIndex * 3 + 1).xyz;
+        if (RayKey(path, sceneMin, sceneMax) != RayKey(paths[rayQueue[queueIndex - 1u]], sceneMin, sceneMax))
+            atomicAdd(bounceKeyChanges[bounce], 1u);
+    }
+
+    State state;
+    state.isEmitter = false;
+    LightSampleRec lightSample;
+    bool hit = ClosestHit(r, state, lightSample);
+
+    if (!hit)
+    {
+        if (depth == 0 && (enableBackground || transparentBackground))
+            paths[pathIndex].direction.w = 0.0;
+
+#ifdef OPT_ENVMAP
+        vec4 envMapColPdf = EvalEnvMap(r);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        envMapColPdf.w *= envMapSelectPdf;
+#endif
+
+        // Gather radiance from envmap and use the pdf of the BSDF sample for MIS
+        float misWeight = 1.0;
+        if (depth > 0)
+            misWeight = PowerHeuristic(path.origin.w, envMapColPdf.w);
+
+        if (misWeight > 0)
+            paths[pathIndex].radiance.rgb += misWeight * envMapColPdf.rgb * path.throughput.rgb * envMapIntensity;
+#endif
+        return;
+    }
+
+#ifdef OPT_LIGHTS
+    if (state.isEmitter)
+    {
+        float misWeight = 1.0;
+        if (depth > 0)
+            misWeight = PowerHeuristic(path.origin.w, lightSample.pdf);
+
+        paths[pathIndex].radiance.rgb += misWeight * lightSample.emission * path.throughput.rgb;
+        return;
+    }
+#endif
+
+    WavefrontHit surface;
+    surface.normal = vec4(state.normal, state.hitDist);
+    surface.tangent = vec4(state.tangent, state.texCoord.x);
+    surface.bitangent = vec4(state.bitangent, state.texCoord.y);
+    surface.matID = ivec4(state.matID, 0, 0, 0);
+    hits[pathIndex] = surface;
+
+    int materialClass = WAVEFRONT_OPAQUE;
+#ifdef OPT_SPECTRANS
+    if (texelFetch(materialsTexture, ivec2(state.matID * 8 + 4, 0), 0).x > 0.0)
+        materialClass = WAVEFRONT_TRANSMISSIVE;
+#endif
+    hitQueue[materialClass * pathCapacity + int(atomicAdd(hitCount[materialClass], 1u))] = pathIndex;
+}
@@ -0,0 +1,64 @@
+#version 430
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// Pixels of the tile (clipped to the image) and the number of paths, tileSize.x * tileSize.y per sample of the pass.
+// Paths are sample major, so the samples of a pixel are one tile apart
+uniform ivec2 tileOrigin;
+uniform ivec2 tileSize;
+uniform int numPaths;
+
+void main(void)
+{
+    int pathIndex = int(gl_GlobalInvocationID.x);
+    if (pathIndex >= numPaths)
+        return;
+
+    int tilePixels = tileSize.x * tileSize.y;
+    int sampleIndex = pathIndex / tilePixels;
+    int pixelIndex = pathIndex - sampleIndex * tilePixels;
+    ivec2 pixelCoords = tileOrigin + ivec2(pixelIndex % tileSize.x, pixelIndex / tileSize.x);
+
+    // Same seed and camera ray as the tile shader
+    vec2 fragCoord = vec2(pixelCoords) + 0.5;
+    InitRNG(fragCoord, frameNum + sampleIndex);
+
+    float r1 = 2.0 * rand();
+    float r2 = 2.0 * rand();
+
+    vec2 jitter;
+    jitter.x = r1 < 1.0 ? sqrt(r1) - 1.0 : 1.0 - sqrt(2.0 - r1);
+    jitter.y = r2 < 1.0 ? sqrt(r2) - 1.0 : 1.0 - sqrt(2.0 - r2);
+
+    jitter /= (resolution * 0.5);
+    vec2 d = (fragCoord / resolution * 2.0 - 1.0) + jitter;
+
+    float scale = tan(camera.fov * 0.5);
+    d.y *= resolution.y / resolution.x * scale;
+    d.x *= scale;
+    vec3 rayDir = normalize(d.x * camera.right + d.y * camera.up + camera.forward);
+
+    vec3 focalPoint = camera.focalDist * rayDir;
+    float cam_r1 = rand() * TWO_PI;
+    float cam_r2 = rand() * camera.aperture;
+    vec3 randomAperturePos = (cos(cam_r1) * camera.right + sin(cam_r1) * camera.up) * sqrt(cam_r2);
+    vec3 finalRayDir = normalize(focalPoint - randomAperturePos);
+
+    WavefrontPath path;
+    path.origin = vec4(camera.position + randomAperturePos, 0.0);
+    path.direction = vec4(finalRayDir, 1.0);
+    path.throughput = vec4(1.0);
+    path.radiance = vec4(0.0);
+    path.seed = seed;
+    path.pixel = ivec4(pixelCoords, 0, 0);
+    paths[pathIndex] = path;
+
+    // Every path is extended, so the queue is filled in order
+    nextRayQueue[pathIndex] = uint(pathIndex);
+    if (pathIndex == 0)
+        nextRayCount = uint(numPaths);
+}
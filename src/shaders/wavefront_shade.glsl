@@ -0,0 +1,205 @@
+#version 430
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/envmap.glsl
+#include common/anyhit.glsl
+#include common/closest_hit.glsl
+#include common/disney.glsl
+#include common/lambert.glsl
+#include common/pathtrace.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// WAVEFRONT_OPAQUE or WAVEFRONT_TRANSMISSIVE, the hit queue this variant shades
+uniform int materialClass;
+
+int numShadowRays;
+
+void QueueShadowRay(uint pathIndex, vec3 origin, vec3 direction, float maxDist, vec3 contribution)
+{
+    WavefrontShadowRay shadowRay;
+    shadowRay.origin = vec4(origin, maxDist);
+    shadowRay.direction = vec4(direction, 0.0);
+    shadowRay.contribution = vec4(contribution, 0.0);
+    shadowRays[pathIndex * 2u + uint(numShadowRays)] = shadowRay;
+    numShadowRays++;
+}
+
+// DirectLight() without the visibility test. Light samples that would contribute are queued as shadow rays
+// with their contribution, which the shadow kernel adds if nothing blocks them
+void QueueDirectLight(uint pathIndex, in Ray r, in State state, vec3 throughput)
+{
+    vec3 Li = vec3(0.0);
+    vec3 scatterPos = state.fhp + state.normal * EPS;
+
+    ScatterSampleRec scatterSample;
+
+    bool sampleEnvMap = true;
+    bool sampleLights = true;
+#ifdef OPT_LIGHT_POWER_SAMPLING
+    sampleEnvMap = rand() < envMapSelectPdf;
+    sampleLights = !sampleEnvMap;
+#endif
+
+    // Environment Light
+#ifdef OPT_ENVMAP
+    if (sampleEnvMap)
+    {
+        vec4 dirPdf = SampleEnvMap(Li);
+        vec3 lightDir = dirPdf.xyz;
+        float lightPdf = dirPdf.w;
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        lightPdf *= envMapSelectPdf;
+#endif
+
+        scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, scatterSample.pdf);
+
+        if (scatterSample.pdf > 0.0)
+        {
+            float misWeight = PowerHeuristic(lightPdf, scatterSample.pdf);
+            if (misWeight > 0.0)
+                QueueShadowRay(pathIndex, scatterPos, lightDir, INF - EPS, misWeight * Li * scatterSample.f * envMapIntensity / lightPdf * throughput);
+        }
+    }
+#endif
+
+    // Analytic Lights
+#ifdef OPT_LIGHTS
+    if (sampleLights)
+    {
+        LightSampleRec lightSample;
+        Light light;
+
+        //Pick a light to sample
+        int lightIndex = SampleLightIndex();
+        float lightSelectPdf = LightSelectPdf(lightIndex);
+        int index = lightIndex * 5;
+
+        // Fetch light Data
+        vec3 position = texelFetch(lightsTexture, ivec2(index + 0, 0), 0).xyz;
+        vec3 emission = texelFetch(lightsTexture, ivec2(index + 1, 0), 0).xyz;
+        vec3 u        = texelFetch(lightsTexture, ivec2(index + 2, 0), 0).xyz; // u vector for rect
+        vec3 v        = texelFetch(lightsTexture, ivec2(index + 3, 0), 0).xyz; // v vector for rect
+        vec3 params   = texelFetch(lightsTexture, ivec2(index + 4, 0), 0).xyz;
+        float radius  = params.x;
+        float area    = params.y;
+        float type    = params.z; // 0->Rect, 1->Sphere, 2->Distant
+
+        light = Light(position, emission, u, v, radius, area, type);
+        SampleOneLight(light, scatterPos, lightSample);
+#ifdef OPT_LIGHT_POWER_SAMPLING
+        Li = lightSample.emission;
+        lightSample.pdf *= lightSelectPdf;
+#else
+        Li = lightSample.emission / lightSelectPdf;
+#endif
+
+        if (dot(lightSample.direction, lightSample.normal) < 0.0) // Required for quad lights with single sided emission
+        {
+            scatterSample.f = DisneyEval(state, -r.direction, state.ffnormal, lightSample.direction, scatterSample.pdf);
+
+            float misWeight = 1.0;
+            if(light.area > 0.0) // No MIS for distant light
+                misWeight = PowerHeuristic(lightSample.pdf, scatterSample.pdf);
+
+            if (scatterSample.pdf > 0.0)
+                QueueShadowRay(pathIndex, scatterPos, lightSample.direction, lightSample.dist - EPS, misWeight * Li * scatterSample.f / lightSample.pdf * throughput);
+        }
+    }
+#endif
+}
+
+// One bounce of PathTrace() for the surface hits of a material class: emission, next event estimation,
+// BSDF sampling and russian roulette. Surviving paths are queued for the next extend
+void main(void)
+{
+    uint queueIndex = gl_GlobalInvocationID.x;
+    if (queueIndex >= hitCount[materialClass])
+        return;
+
+    uint pathIndex = hitQueue[materialClass * pathCapacity + int(queueIndex)];
+    WavefrontPath path = paths[pathIndex];
+    WavefrontHit surface = hits[pathIndex];
+    Ray r = PathRay(path);
+    seed = path.seed;
+
+    State state;
+    state.depth = path.pixel.z;
+    state.hitDist = surface.normal.w;
+    state.fhp = r.origin + r.direction * state.hitDist;
+    state.normal = surface.normal.xyz;
+    state.ffnormal = dot(state.normal, r.direction) <= 0.0 ? state.normal : -state.normal;
+    state.tangent = surface.tangent.xyz;
+    state.bitangent = surface.bitangent.xyz;
+    state.texCoord = vec2(surface.tangent.w, surface.bitangent.w);
+    state.isEmitter = false;
+    state.matID = surface.matID.x;
+
+    GetMaterial(state, r);
+
+    vec3 throughput = path.throughput.rgb;
+
+    // Gather radiance from emissive objects. Emission from meshes is not importance sampled
+    path.radiance.rgb += state.mat.emission * throughput;
+
+    numShadowRays = 0;
+    bool alive = state.depth < maxDepth;
+
+    if (alive)
+    {
+        ScatterSampleRec scatterSample;
+        scatterSample.pdf = path.origin.w;
+
+#ifdef OPT_ALPHA_TEST
+        // Ignore intersection and continue ray based on alpha test
+        if ((state.mat.alphaMode == ALPHA_MODE_MASK && state.mat.opacity < state.mat.alphaCutoff) ||
+            (state.mat.alphaMode == ALPHA_MODE_BLEND && rand() > state.mat.opacity))
+        {
+            scatterSample.L = r.direction;
+            state.depth--;
+        }
+        else
+#endif
+        {
+            // Next event estimation
+            QueueDirectLight(pathIndex, r, state, throughput);
+
+            // Sample BSDF for color and outgoing direction
+            scatterSample.f = DisneySample(state, -r.direction, state.ffnormal, scatterSample.L, scatterSample.pdf);
+            if (scatterSample.pdf > 0.0)
+                throughput *= scatterSample.f / scatterSample.pdf;
+            else
+                alive = false;
+        }
+
+        // Move ray origin to hit point and set direction for next bounce
+        path.origin = vec4(state.fhp + scatterSample.L * EPS, scatterSample.pdf);
+        path.direction.xyz = scatterSample.L;
+
+#ifdef OPT_RR
+        // Russian roulette
+        if (alive && state.depth >= rrDepth)
+        {
+            float q = min(max(throughput.x, max(throughput.y, throughput.z)) + 0.001, 0.95);
+            if (rand() > q)
+                alive = false;
+            throughput /= q;
+        }
+#endif
+    }
+
+    path.throughput.rgb = throughput;
+    path.seed = seed;
+    path.pixel.z = state.depth + 1;
+    path.pixel.w = numShadowRays;
+    paths[pathIndex] = path;
+
+    if (numShadowRays > 0)
+        shadowQueue[atomicAdd(shadowCount, 1u)] = pathIndex;
+    if (alive)
+        QueueRay(pathIndex);
+}
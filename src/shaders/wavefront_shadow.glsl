@@ -0,0 +1,34 @@
+#version 430
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/intersection.glsl
+#include common/sampling.glsl
+#include common/anyhit.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// Traces the shadow rays the shade kernels queued and adds the contribution of the unoccluded ones
+void main(void)
+{
+    uint queueIndex = gl_GlobalInvocationID.x;
+    if (queueIndex >= shadowCount)
+        return;
+
+    uint pathIndex = shadowQueue[queueIndex];
+
+    // Only alpha blended surfaces draw random numbers here. They get their own sequence, the path continues with its seed
+    seed = paths[pathIndex].seed ^ uvec4(0x5bd1e995u);
+
+    vec3 radiance = vec3(0.0);
+    int numShadowRays = paths[pathIndex].pixel.w;
+    for (int i = 0; i < numShadowRays; i++)
+    {
+        WavefrontShadowRay shadowRay = shadowRays[pathIndex * 2u + uint(i)];
+        if (!AnyHit(Ray(shadowRay.origin.xyz, shadowRay.direction.xyz), shadowRay.origin.w))
+            radiance += shadowRay.contribution.rgb;
+    }
+
+    paths[pathIndex].radiance.rgb += radiance;
+}
@@ -0,0 +1,75 @@
+#version 430
+
+#include common/uniforms.glsl
+#include common/globals.glsl
+#include common/wavefront.glsl
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// Counting sort of the ray queue by RayKey(), in three passes
+#define SORT_COUNT 0
+#define SORT_SCAN 1
+#define SORT_SCATTER 2
+
+uniform int stage;
+
+shared uint groupSums[WAVEFRONT_GROUP_SIZE];
+
+void main(void)
+{
+    uint queueIndex = gl_GlobalInvocationID.x;
+
+    if (stage == SORT_COUNT)
+    {
+        // keyBins was cleared by the renderer
+        if (queueIndex >= rayCount)
+            return;
+
+        vec3 sceneMin = texelFetch(BVHTexture, topBVHIndex * 3 + 0).xyz;
+        vec3 sceneMax = texelFetch(BVHTexture, topBVHIndex * 3 + 1).xyz;
+        uint key = RayKey(paths[rayQueue[queueIndex]], sceneMin, sceneMax);
+        rayKeys[queueIndex] = key;
+        atomicAdd(keyBins[key], 1u);
+    }
+    else if (stage == SORT_SCAN)
+    {
+        // A single group turns the counts into offsets. Every invocation sums a run of bins, the runs are
+        // prefixed serially and each invocation then writes the offsets of its run
+        const uint binsPerInvocation = uint(WAVEFRONT_KEYS / WAVEFRONT_GROUP_SIZE);
+        uint first = gl_LocalInvocationID.x * binsPerInvocation;
+
+        uint sum = 0u;
+        for (uint i = 0u; i < binsPerInvocation; i++)
+            sum += keyBins[first + i];
+        groupSums[gl_LocalInvocationID.x] = sum;
+        barrier();
+
+        if (gl_LocalInvocationID.x == 0u)
+        {
+            uint offset = 0u;
+            for (uint i = 0u; i < uint(WAVEFRONT_GROUP_SIZE); i++)
+            {
+                uint count = groupSums[i];
+                groupSums[i] = offset;
+                offset += count;
+            }
+        }
+        barrier();
+
+        uint offset = groupSums[gl_LocalInvocationID.x];
+        for (uint i = 0u; i < binsPerInvocation; i++)
+        {
+            uint count = keyBins[first + i];
+            keyBins[first + i] = offset;
+            offset += count;
+        }
+    }
+    else
+    {
+        // Rays of a key end up next to each other, in no particular order
+        if (queueIndex >= rayCount)
+            return;
+
+        nextRayQueue[atomicAdd(keyBins[rayKeys[queueIndex]], 1u)] = rayQueue[queueIndex];
+    }
+}
@@ -14,19 +14,19 @@ namespace RadeonRays
 	}
 
 	// Grow the bounding box by a point
-	void bbox::grow(Vec3 const& p)
+	void bbox::grow(Vec3A const& p)
 	{
-		pmin = Vec3::Min(pmin, p);
-		pmax = Vec3::Max(pmax, p);
+		pmin = Vec3A::Min(pmin, p);
+		pmax = Vec3A::Max(pmax, p);
 	}
 	// Grow the bounding box by a box
 	void bbox::grow(bbox const& b)
 	{
-		pmin = Vec3::Min(pmin, b.pmin);
-		pmax = Vec3::Max(pmax, b.pmax);
+		pmin = Vec3A::Min(pmin, b.pmin);
+		pmax = Vec3A::Max(pmax, b.pmax);
 	}
 
-	bool bbox::contains(Vec3 const& p) const
+	bool bbox::contains(Vec3A const& p) const
 	{
 		Vec3 radius = extents() * 0.5f;
 		return std::abs(center().x - p.x) <= radius.x &&
@@ -37,20 +37,20 @@ namespace RadeonRays
 	bbox bboxunion(bbox const& box1, bbox const& box2)
 	{
 		bbox res;
-		res.pmin = Vec3::Min(box1.pmin, box2.pmin);
-		res.pmax = Vec3::Max(box1.pmax, box2.pmax);
+		res.pmin = Vec3A::Min(box1.pmin, box2.pmin);
+		res.pmax = Vec3A::Max(box1.pmax, box2.pmax);
 		return res;
 	}
 
 	bbox intersection(bbox const& box1, bbox const& box2)
 	{
-		return bbox(Vec3::Max(box1.pmin, box2.pmin), Vec3::Min(box1.pmax, box2.pmax));
+		return bbox(Vec3A::Max(box1.pmin, box2.pmin), Vec3A::Min(box1.pmax, box2.pmax));
 	}
 
 	void intersection(bbox const& box1, bbox const& box2, bbox& box)
 	{
-		box.pmin = Vec3::Max(box1.pmin, box2.pmin);
-		box.pmax = Vec3::Min(box1.pmax, box2.pmax);
+		box.pmin = Vec3A::Max(box1.pmin, box2.pmin);
+		box.pmax = Vec3A::Min(box1.pmax, box2.pmax);
 	}
 
 	#define BBOX_INTERSECTION_EPS 0.f
@@ -72,5 +72,48 @@ namespace RadeonRays
 		return box1.contains(box2.pmin) && box1.contains(box2.pmax);
 	}
 
+	void triangle_bounds(Vec4 const* vertices, int numtris, bbox* out)
+	{
+		for (int i = 0; i < numtris; ++i)
+		{
+			bbox b;
+			b.grow(Vec3A(vertices[i * 3 + 0]));
+			b.grow(Vec3A(vertices[i * 3 + 1]));
+			b.grow(Vec3A(vertices[i * 3 + 2]));
+			out[i] = b;
+		}
+	}
+
+	void transform_bounds(bbox const* boxes, Mat4 const* transforms, int count, bbox* out)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			Mat4 const& m = transforms[i];
+			Vec3A right(m.data[0][0], m.data[0][1], m.data[0][2]);
+			Vec3A up(m.data[1][0], m.data[1][1], m.data[1][2]);
+			Vec3A forward(m.data[2][0], m.data[2][1], m.data[2][2]);
+			Vec3A translation(m.data[3][0], m.data[3][1], m.data[3][2]);
+
+			// Each column scaled by the extremes of its axis, the smaller ends add up to the new min
+			Vec3A xa = right * boxes[i].pmin.x;
+			Vec3A xb = right * boxes[i].pmax.x;
+			Vec3A ya = up * boxes[i].pmin.y;
+			Vec3A yb = up * boxes[i].pmax.y;
+			Vec3A za = forward * boxes[i].pmin.z;
+			Vec3A zb = forward * boxes[i].pmax.z;
+
+			out[i].pmin = Vec3A::Min(xa, xb) + Vec3A::Min(ya, yb) + Vec3A::Min(za, zb) + translation;
+			out[i].pmax = Vec3A::Max(xa, xb) + Vec3A::Max(ya, yb) + Vec3A::Max(za, zb) + translation;
+		}
+	}
+
+	bbox bboxunion(bbox const* boxes, int count)
+	{
+		bbox res;
+		for (int i = 0; i < count; ++i)
+			res.grow(boxes[i]);
+		return res;
+	}
+
 	
 }
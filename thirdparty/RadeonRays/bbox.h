@@ -11,6 +11,7 @@
 #include "Mat4.h"
 #include "Vec2.h"
 #include "Vec3.h"
+#include "Vec3A.h"
 #include "Vec4.h"
 
 using namespace PathTracer;
@@ -21,31 +22,31 @@ namespace RadeonRays
     {
     public:
         bbox()
-            : pmin(Vec3(std::numeric_limits<float>::max(),
-                        std::numeric_limits<float>::max(),
-                        std::numeric_limits<float>::max()))
-            , pmax(Vec3(-std::numeric_limits<float>::max(),
-                        -std::numeric_limits<float>::max(),
-                        -std::numeric_limits<float>::max()))
+            : pmin(Vec3A(std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max()))
+            , pmax(Vec3A(-std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max()))
         {
         }
 
-        bbox(Vec3 const& p)
+        bbox(Vec3A const& p)
             : pmin(p)
             , pmax(p)
         {
         }
 
-        bbox(Vec3 const& p1, Vec3 const& p2)
-            : pmin(Vec3::Min(p1, p2))
-            , pmax(Vec3::Max(p1, p2))
+        bbox(Vec3A const& p1, Vec3A const& p2)
+            : pmin(Vec3A::Min(p1, p2))
+            , pmax(Vec3A::Max(p1, p2))
         {
         }
 
 		Vec3 center()  const;
 		Vec3 extents() const;
 
-        bool contains(Vec3 const& p) const;
+        bool contains(Vec3A const& p) const;
 
 		inline int maxdim() const
 		{
@@ -64,15 +65,16 @@ namespace RadeonRays
 		float surface_area() const;
 
         // TODO: this is non-portable, optimization trial for fast intersection test
-        Vec3 const& operator [] (int i) const { return *(&pmin + i); }
+        Vec3A const& operator [] (int i) const { return *(&pmin + i); }
 
         // Grow the bounding box by a point
-		void grow(Vec3 const& p);
+		void grow(Vec3A const& p);
         // Grow the bounding box by a box
 		void grow(bbox const& b);
 
-        Vec3 pmin;
-        Vec3 pmax;
+        // Corners are kept in SIMD registers (Vec3A), growing a box is a min and a max per corner
+        Vec3A pmin;
+        Vec3A pmax;
     };
 
 	bbox bboxunion(bbox const& box1, bbox const& box2);
@@ -80,6 +82,14 @@ namespace RadeonRays
 	void intersection(bbox const& box1, bbox const& box2, bbox& box);
 	bool intersects(bbox const& box1, bbox const& box2);
 	bool contains(bbox const& box1, bbox const& box2);
+
+	// Batch helpers, each output box is the same as the one built by grow() or bboxunion() from the scalar inputs
+	// Box of every triangle, given by three consecutive vertices (w is ignored)
+	void triangle_bounds(Vec4 const* vertices, int numtris, bbox* out);
+	// Box around every transformed box, from the columns of the matrix (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+	void transform_bounds(bbox const* boxes, Mat4 const* transforms, int count, bbox* out);
+	// Union of all boxes
+	bbox bboxunion(bbox const* boxes, int count);
 }
 
 #endif
\ No newline at end of file
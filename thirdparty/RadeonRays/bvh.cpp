@@ -20,11 +20,8 @@ namespace RadeonRays
 
     void Bvh::Build(bbox const* bounds, int numbounds)
     {
-        for (int i = 0; i < numbounds; ++i)
-        {
-            // Calc bbox
-            m_bounds.grow(bounds[i]);
-        }
+        // Calc bbox
+        m_bounds.grow(bboxunion(bounds, numbounds));
 
         BuildImpl(bounds, numbounds);
     }
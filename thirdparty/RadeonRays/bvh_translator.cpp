@@ -9,12 +9,15 @@
 
 namespace RadeonRays
 {
-    int BvhTranslator::ProcessBLASNodes(const Bvh::Node* node)
+    int BvhTranslator::ProcessBLASNodes(const Bvh::Node* node, int parent)
     {
         RadeonRays::bbox bbox = node->bounds;
 
         nodes[curNode].bboxmin = bbox.pmin;
         nodes[curNode].bboxmax = bbox.pmax;
+        nodes[curNode].parent = parent;
+        nodes[curNode].pad0 = 0;
+        nodes[curNode].pad1 = 0;
         nodes[curNode].LRLeaf.z = 0;
 
         int index = curNode;
@@ -28,19 +31,22 @@ namespace RadeonRays
         else
         {
             curNode++;
-            nodes[index].LRLeaf.x = ProcessBLASNodes(node->lc);
+            nodes[index].LRLeaf.x = ProcessBLASNodes(node->lc, index);
             curNode++;
-            nodes[index].LRLeaf.y = ProcessBLASNodes(node->rc);
+            nodes[index].LRLeaf.y = ProcessBLASNodes(node->rc, index);
         }
         return index;
     }
 
-    int BvhTranslator::ProcessTLASNodes(const Bvh::Node* node)
+    int BvhTranslator::ProcessTLASNodes(const Bvh::Node* node, int parent)
     {
         RadeonRays::bbox bbox = node->bounds;
 
         nodes[curNode].bboxmin = bbox.pmin;
         nodes[curNode].bboxmax = bbox.pmax;
+        nodes[curNode].parent = parent;
+        nodes[curNode].pad0 = 0;
+        nodes[curNode].pad1 = 0;
         nodes[curNode].LRLeaf.z = 0;
 
         int index = curNode;
@@ -58,9 +64,9 @@ namespace RadeonRays
         else
         {
             curNode++;
-            nodes[index].LRLeaf.x = ProcessTLASNodes(node->lc);
+            nodes[index].LRLeaf.x = ProcessTLASNodes(node->lc, index);
             curNode++;
-            nodes[index].LRLeaf.y = ProcessTLASNodes(node->rc);
+            nodes[index].LRLeaf.y = ProcessTLASNodes(node->rc, index);
         }
         return index;
     }
@@ -88,7 +94,7 @@ namespace RadeonRays
             bvhRootStartIndices.push_back(bvhRootIndex);
             bvhRootIndex += mesh->bvh->m_nodecnt;
 
-            ProcessBLASNodes(mesh->bvh->m_root);
+            ProcessBLASNodes(mesh->bvh->m_root, -1);
             curTriIndex += mesh->bvh->GetNumIndices();
         }
     }
@@ -96,7 +102,7 @@ namespace RadeonRays
     void BvhTranslator::ProcessTLAS()
     {
         curNode = topLevelIndex;
-        ProcessTLASNodes(topLevelBvh->m_root);
+        ProcessTLASNodes(topLevelBvh->m_root, -1);
     }
 
     void BvhTranslator::UpdateTLAS(const Bvh* topLevelBvh, const std::vector<PathTracer::MeshInstance>& sceneInstances)
@@ -104,7 +110,7 @@ namespace RadeonRays
         this->topLevelBvh = topLevelBvh;
         meshInstances = sceneInstances;
         curNode = topLevelIndex;
-        ProcessTLASNodes(topLevelBvh->m_root);
+        ProcessTLASNodes(topLevelBvh->m_root, -1);
     }
 
     void BvhTranslator::Process(const Bvh* topLevelBvh, 
@@ -22,11 +22,16 @@ namespace RadeonRays
         // Constructor
         BvhTranslator() = default;
 
+        // Three RGBA texels on the GPU. The parent link (-1 at the root of the TLAS and of every BLAS) lets
+        // traversal continue without the deferred nodes its short stack dropped
         struct Node
         {
             Vec3 bboxmin;
+            float parent;
             Vec3 bboxmax;
+            float pad0;
             Vec3 LRLeaf;
+            float pad1;
         };
 
         void ProcessBLAS();
@@ -41,8 +46,8 @@ namespace RadeonRays
         int curNode = 0;
         int curTriIndex = 0;
         std::vector<int> bvhRootStartIndices;
-        int ProcessBLASNodes(const Bvh::Node* root);
-        int ProcessTLASNodes(const Bvh::Node* root);
+        int ProcessBLASNodes(const Bvh::Node* root, int parent);
+        int ProcessTLASNodes(const Bvh::Node* root, int parent);
         std::vector<PathTracer::MeshInstance> meshInstances;
         std::vector<PathTracer::Mesh*> meshes;
         const Bvh* topLevelBvh;